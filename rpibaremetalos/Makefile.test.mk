@@ -10,22 +10,30 @@ TEST_BUILD_ROOT := test/build
 OBJ_DIR := test/build
 TEST_OBJ_DIR := test/build
 
-CPP_TEST_SRC_DIRS := test/src test/src/filesystem test/src/filesystem/fat32_filesystem test/src/utility
+CPP_TEST_SRC_DIRS := test/src test/src/devices test/src/filesystem test/src/filesystem/fat32_filesystem test/src/utility
 
 C_SRC   :=  
 CPP_SRC :=  src/c/platform/platform_sw_rngs.cpp \
 			src/c/services/os_entity_registry.cpp \
 			src/c/services/murmur_hash.cpp \
 			src/c/services/uuid.cpp \
+			src/c/devices/block_io.cpp \
+			src/c/devices/block_io_service.cpp \
+			src/c/devices/cached_block_io.cpp \
+			src/c/devices/ram_disk.cpp \
 			src/c/filesystem/filesystem_errors.cpp \
 			src/c/filesystem/master_boot_record.cpp \
 			src/c/filesystem/filesystem_path.cpp \
 			src/c/filesystem/file_map.cpp \
 			src/c/filesystem/fat32_blockio_adapter.cpp \
+			src/c/filesystem/fat32_fat_cache.cpp \
+			src/c/filesystem/fat32_free_cluster_bitmap.cpp \
+			src/c/filesystem/fat32_extent_map.cpp \
 			src/c/filesystem/fat32_filenames.cpp \
 			src/c/filesystem/fat32_directory_cluster.cpp \
 			src/c/filesystem/fat32_directory.cpp \
 			src/c/filesystem/fat32_file.cpp \
+			src/c/filesystem/fat32_file_mapping.cpp \
 			src/c/filesystem/fat32_filesystem.cpp
 
 CPP_TEST_SRC := $(foreach sdir,$(CPP_TEST_SRC_DIRS),$(wildcard $(sdir)/*.cpp))
@@ -19,6 +19,8 @@ extern "C"
 }
 
 #define INVALIDATE_CACHE_LINE(address) asm volatile("dc cvau, %0" : : "r"(address) : "memory")
+#define CLEAN_AND_INVALIDATE_DATA_CACHE_LINE(address) asm volatile("dc civac, %0" : : "r"(address) : "memory")
+#define DATA_SYNCHRONIZATION_BARRIER asm volatile("dsb sy" ::: "memory")
 #define INSTRUCTION_CACHE_BARRIER asm volatile("isb sy")
 #define SEND_EVENT asm volatile("sev")
 #define WAIT_FOR_EVENT asm volatile("wfe")
@@ -10,4 +10,6 @@ constexpr uint32_t MAX_CLI_COMMAND_TOKEN_LENGTH = 16;
 
 constexpr uint32_t MAX_CLI_COMMAND_LENGTH = 1024;
 
-constexpr uint32_t MAX_CLI_FILESYSTEMS_TO_LIST = 32;
\ No newline at end of file
+constexpr uint32_t MAX_CLI_FILESYSTEMS_TO_LIST = 32;
+
+constexpr uint32_t MAX_CLI_BLOCK_DEVICES_TO_LIST = 16;
\ No newline at end of file
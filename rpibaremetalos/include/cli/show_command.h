@@ -22,13 +22,27 @@ namespace cli::commands
                           CLISessionContext &context) const override;
     };
 
-    class CLIShowCommand : public CLIParentCommand<1>
+    class CLIShowBlockIOCommand : public CLICommandExecutor
+    {
+    public:
+        static const CLIShowBlockIOCommand instance;
+
+        CLIShowBlockIOCommand()
+            : CLICommandExecutor("blockio")
+        {
+        }
+
+        void ProcessToken(CommandParser &parser,
+                          CLISessionContext &context) const override;
+    };
+
+    class CLIShowCommand : public CLIParentCommand<2>
     {
     public:
         static const CLIShowCommand instance;
 
         CLIShowCommand()
-            : CLIParentCommand("show", {CLIShowDiagnosticsCommand::instance})
+            : CLIParentCommand("show", {CLIShowDiagnosticsCommand::instance, CLIShowBlockIOCommand::instance})
         {
         }
     };
@@ -7,7 +7,11 @@
 #include <stdint.h>
 #include <utility>
 
+#include "os_config.h"
 #include "os_entity.h"
+#include "synchronization.h"
+
+#include "devices/block_io_statistics.h"
 
 #include "result.h"
 
@@ -16,6 +20,20 @@ typedef enum class BlockIOResultCodes
     SUCCESS = 0,
     FAILURE,
 
+    //
+    //  Result codes for the asynchronous request queue
+    //
+
+    REQUEST_QUEUE_FULL,
+    REQUEST_ALREADY_QUEUED,
+
+    //
+    //  Result codes for RAM Disks
+    //
+
+    RAM_DISK_BLOCK_OUT_OF_RANGE,
+    RAM_DISK_UNABLE_TO_ALLOCATE_MEMORY,
+
     //
     //  Result codes for External Mass Media Controller
     //
@@ -44,6 +62,8 @@ typedef enum class BlockIOResultCodes
     EMMC_TIMEOUT_FOR_CARD_RESET,
     EMMC_TIMEOUT_WHILE_PROBING_FOR_SDHC_CARD,
     EMMC_TIMEOUT_FOR_ISSUE_COMMAND,
+    EMMC_DATA_LINE_FAILED_TO_RESET_CORRECTLY,
+    EMMC_ERASE_FAILED,
 
     __LAST_BLOCK_IO_ERROR__
 } BlockIOResultCodes;
@@ -55,6 +75,151 @@ inline bool Failed( BlockIOResultCodes  code )
 
 constexpr uint32_t MAX_BLOCK_IO_BLOCK_SIZE = 2048;
 
+class BlockIODevice;
+class BlockIORequest;
+
+
+typedef enum class BlockIODirection : uint32_t
+{
+    READ = 0,
+    WRITE
+} BlockIODirection;
+
+/** @brief IO priority classes.  Requests are dispatched in strict priority order, with aging so a steady stream of
+ *         higher priority requests cannot starve the lower classes.
+ */
+
+typedef enum class BlockIOPriority : uint32_t
+{
+    METADATA = 0, //  FAT sectors and directory clusters
+    INTERACTIVE,  //  Foreground file data
+    BACKGROUND    //  Read-ahead and write-back
+} BlockIOPriority;
+
+constexpr uint32_t NUMBER_OF_BLOCK_IO_PRIORITIES = 3;
+
+typedef enum class BlockIORequestState : uint32_t
+{
+    IDLE = 0,
+    QUEUED,
+    IN_FLIGHT,
+    COMPLETE
+} BlockIORequestState;
+
+/** @brief One memory region of a vectored (scatter-gather) transfer.  The segments of a transfer map onto consecutive
+ *         blocks on the device, in order.
+ */
+
+typedef struct BlockIOSegment
+{
+    uint8_t *buffer_;
+    uint32_t block_count_;
+} BlockIOSegment;
+
+/** @brief Completion callback for an asynchronous block IO request.  The callback is invoked in the context
+ *         of the task executing the request, so it should be short and must not block.
+ */
+
+typedef void (*BlockIOCompletionCallback)(BlockIORequest &request, void *context);
+
+/** @brief Descriptor for an asynchronous block IO request.
+ *
+ *  The request is owned by the caller and must remain in scope (along with the buffer) until the request is complete.
+ *  Completion can be detected by polling IsComplete(), by waiting on the request with BlockIODevice::WaitForRequest()
+ *  or through the optional completion callback.
+ */
+
+class BlockIORequest
+{
+public:
+    BlockIORequest() = delete;
+
+    BlockIORequest(BlockIODirection direction,
+                   uint8_t *buffer,
+                   uint32_t block_number,
+                   uint32_t block_count,
+                   BlockIOCompletionCallback callback = nullptr,
+                   void *callback_context = nullptr,
+                   BlockIOPriority priority = BlockIOPriority::INTERACTIVE)
+        : direction_(direction),
+          buffer_(buffer),
+          block_number_(block_number),
+          block_count_(block_count),
+          callback_(callback),
+          callback_context_(callback_context),
+          priority_(priority)
+    {
+    }
+
+    BlockIORequest(const BlockIORequest &) = delete;
+    BlockIORequest(BlockIORequest &&) = delete;
+
+    BlockIORequest &operator=(const BlockIORequest &) = delete;
+    BlockIORequest &operator=(BlockIORequest &&) = delete;
+
+    BlockIODirection Direction() const
+    {
+        return direction_;
+    }
+
+    uint8_t *Buffer() const
+    {
+        return buffer_;
+    }
+
+    uint32_t BlockNumber() const
+    {
+        return block_number_;
+    }
+
+    uint32_t BlockCount() const
+    {
+        return block_count_;
+    }
+
+    BlockIOPriority Priority() const
+    {
+        return priority_;
+    }
+
+    BlockIORequestState State() const
+    {
+        return state_;
+    }
+
+    bool IsComplete() const
+    {
+        return state_ == BlockIORequestState::COMPLETE;
+    }
+
+    BlockIOResultCodes ResultCode() const
+    {
+        return result_code_;
+    }
+
+    uint32_t BlocksTransferred() const
+    {
+        return blocks_transferred_;
+    }
+
+private:
+    friend class BlockIODevice;
+
+    const BlockIODirection direction_;
+    uint8_t *const buffer_;
+    const uint32_t block_number_;
+    const uint32_t block_count_;
+
+    const BlockIOCompletionCallback callback_;
+    void *const callback_context_;
+
+    const BlockIOPriority priority_;
+
+    volatile BlockIORequestState state_ = BlockIORequestState::IDLE;
+    BlockIOResultCodes result_code_ = BlockIOResultCodes::SUCCESS;
+    uint32_t blocks_transferred_ = 0;
+};
+
 class BlockIODevice : public OSEntity
 {
 public:
@@ -125,6 +290,97 @@ public:
 
     virtual ValueResult<BlockIOResultCodes, uint32_t> WriteBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_write) = 0;
 
+    /** @brief Reads one or more blocks on behalf of an IO priority class.  Devices which do not schedule IO ignore the priority.
+     *
+     *     @param[in] priority Priority class of the read
+     *     @param[in] buffer Pointer to an existing empty buffer
+     *     @param[in] block_number Block number from which reading will begin
+     *     @param[in] blocks_to_read Number of blocks to read
+     *
+     *     @return ValueResult \n
+     *             Success: number of blocks read \n
+     *             Failure: failure result code
+     */
+
+    virtual ValueResult<BlockIOResultCodes, uint32_t> ReadFromBlockWithPriority(BlockIOPriority priority, uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_read)
+    {
+        return ReadFromBlock(buffer, block_number, blocks_to_read);
+    }
+
+    /** @brief Writes one or more blocks on behalf of an IO priority class.  Devices which do not schedule IO ignore the priority.
+     *
+     *     @param[in] priority Priority class of the write
+     *     @param[in] buffer Pointer to an existing buffer containing data to write to the device
+     *     @param[in] block_number Block number from which writing will begin
+     *     @param[in] blocks_to_write Number of blocks to write
+     *
+     *     @return ValueResult \n
+     *             Success: number of blocks written \n
+     *             Failure: failure result code
+     */
+
+    virtual ValueResult<BlockIOResultCodes, uint32_t> WriteBlockWithPriority(BlockIOPriority priority, uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_write)
+    {
+        return WriteBlock(buffer, block_number, blocks_to_write);
+    }
+
+    /** @brief Reads a run of consecutive blocks into a list of memory segments with a single device command where the
+     *         device supports it.  The first segment receives the first blocks of the run, the next segment the following
+     *         blocks and so on.  The default implementation reads into a bounce buffer and scatters the data.
+     *
+     *     @param[in] priority Priority class of the read
+     *     @param[in] segments Array of segments to fill
+     *     @param[in] number_of_segments Number of segments in the array
+     *     @param[in] block_number Block number from which reading will begin
+     *
+     *     @return ValueResult \n
+     *             Success: number of blocks read \n
+     *             Failure: failure result code
+     */
+
+    virtual ValueResult<BlockIOResultCodes, uint32_t> ReadBlocksV(BlockIOPriority priority, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number);
+
+    /** @brief Writes a list of memory segments to a run of consecutive blocks with a single device command where the
+     *         device supports it.  The default implementation gathers the segments into a bounce buffer.
+     *
+     *     @param[in] priority Priority class of the write
+     *     @param[in] segments Array of segments to write
+     *     @param[in] number_of_segments Number of segments in the array
+     *     @param[in] block_number Block number from which writing will begin
+     *
+     *     @return ValueResult \n
+     *             Success: number of blocks written \n
+     *             Failure: failure result code
+     */
+
+    virtual ValueResult<BlockIOResultCodes, uint32_t> WriteBlocksV(BlockIOPriority priority, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number);
+
+    /** @brief Writes any data held by the device in volatile buffers out to the media.  Devices which write
+     *         directly to the media have nothing to flush.
+     *
+     *     @return Block IO operation result code
+     */
+
+    virtual BlockIOResultCodes Flush()
+    {
+        return BlockIOResultCodes::SUCCESS;
+    }
+
+    /** @brief Tells the device the contents of a run of blocks are no longer needed, so the media can erase them
+     *         ahead of the next write.  Discard is a hint, devices without an erase operation simply ignore it.
+     *         The contents of discarded blocks are undefined until they are written again.
+     *
+     *     @param[in] block_number First block to discard
+     *     @param[in] number_of_blocks Number of blocks to discard
+     *
+     *     @return Block IO operation result code
+     */
+
+    virtual BlockIOResultCodes Discard(uint32_t block_number, uint32_t number_of_blocks)
+    {
+        return BlockIOResultCodes::SUCCESS;
+    }
+
     /** @brief Returns a text desription for a result code
      *
      *     @param[in] code result code
@@ -133,4 +389,113 @@ public:
      */
 
     const char *GetMessageForResultCode(BlockIOResultCodes code);
+
+    //
+    //  Asynchronous request interface.  Requests are queued on the device and executed in order when the queue is processed.
+    //      Several requests may be in flight at once, up to the depth of the device's request queue.
+    //
+
+    /** @brief Queues a request for execution.  The request and its buffer must remain valid until the request completes.
+     *
+     *     @param[in] request Request to queue
+     *
+     *     @return SUCCESS if the request was queued, REQUEST_QUEUE_FULL if the device queue is full or
+     *             REQUEST_ALREADY_QUEUED if the request is already queued or in flight
+     */
+
+    BlockIOResultCodes SubmitRequest(BlockIORequest &request);
+
+    /** @brief Executes all requests currently in the device queue.  Requests are sorted by priority class and then by block
+     *         number, and contiguous or nearly contiguous requests in the same class and direction are merged into a single
+     *         multi-block transfer.  Requests
+     *         touching blocks written by an earlier request are held back for a later pass, so ordering is preserved.
+     *
+     *     @return Number of requests completed
+     */
+
+    uint32_t ProcessRequests();
+
+    /** @brief Waits for a request to complete.  Queued requests are processed on the calling task until the request completes,
+     *         if another task is processing the queue the calling task yields until that task completes the request.
+     *
+     *     @param[in] request Request to wait on
+     *
+     *     @return Result code for the request
+     */
+
+    BlockIOResultCodes WaitForRequest(BlockIORequest &request);
+
+    /** @brief Returns the number of requests waiting in the device queue
+     *
+     *     @return Number of queued requests
+     */
+
+    uint32_t QueuedRequests() const
+    {
+        return queued_request_count_;
+    }
+
+    /** @brief Returns the IO counters and latency histograms for the device
+     *
+     *     @return Device statistics
+     */
+
+    const BlockIOStatistics &Statistics() const
+    {
+        return statistics_;
+    }
+
+    void ResetStatistics()
+    {
+        statistics_.Reset();
+    }
+
+    /** @brief Returns the counters of a block cache
+     *
+     *     @return Cache statistics, or nullptr if the device is not a cache
+     */
+
+    virtual const BlockIOCacheStatistics *CacheStatistics() const
+    {
+        return nullptr;
+    }
+
+    /** @brief Returns the device a layered device, like a cache or service queue, passes its IO on to
+     *
+     *     @return Underlying device, or nullptr for devices which drive the media themselves
+     */
+
+    virtual BlockIODevice *UnderlyingDevice()
+    {
+        return nullptr;
+    }
+
+protected:
+    BlockIOStatistics statistics_;
+
+    /** @brief Executes a single request on the device.  The default implementation issues a synchronous read or write,
+     *         devices may override this to use a more efficient path.
+     *
+     *     @param[in] request Request to execute
+     *
+     *     @return ValueResult \n
+     *             Success: number of blocks transferred \n
+     *             Failure: failure result code
+     */
+
+    virtual ValueResult<BlockIOResultCodes, uint32_t> ExecuteRequest(BlockIORequest &request);
+
+    void CompleteRequest(BlockIORequest &request, BlockIOResultCodes result_code, uint32_t blocks_transferred);
+
+private:
+    SpinLock request_queue_lock_;
+
+    BlockIORequest *request_queue_[MAX_QUEUED_BLOCK_IO_REQUESTS];
+    uint32_t request_queue_head_ = 0;
+    volatile uint32_t queued_request_count_ = 0;
+    bool processing_requests_ = false;
+
+    uint32_t DequeueBatch(BlockIORequest **batch);
+    void ExecuteBatch(BlockIORequest **batch, uint32_t batch_size);
+    void ExecuteMergedRequests(BlockIORequest **requests, uint32_t number_of_requests);
 };
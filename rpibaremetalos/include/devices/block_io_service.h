@@ -0,0 +1,278 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "devices/block_io.h"
+
+#include "task/runnable.h"
+
+typedef enum class BlockIOServiceOperation : uint32_t
+{
+    READ = 0,
+    WRITE,
+    READ_VECTORED,
+    WRITE_VECTORED,
+    FLUSH,
+    DISCARD
+} BlockIOServiceOperation;
+
+/** @brief One operation passed from a submitting task to the task servicing a block device.  The request lives on the
+ *         stack of the submitting task, which waits for it to complete before returning.
+ */
+
+typedef struct BlockIOServiceRequest
+{
+    BlockIOServiceOperation operation_;
+    BlockIOPriority priority_;
+
+    uint8_t *buffer_;
+    const BlockIOSegment *segments_;
+    uint32_t number_of_segments_;
+    uint32_t block_number_;
+    uint32_t block_count_;
+
+    BlockIOResultCodes result_code_;
+    uint32_t blocks_transferred_;
+
+    minstd::atomic<uint32_t> complete_;
+} BlockIOServiceRequest;
+
+/** @brief Bounded lock-free queue of service requests with any number of producers and a single consumer.
+ *
+ *  Each slot carries a sequence number which tells producers and the consumer whose turn it is to use the slot.  Producers
+ *  claim a slot by advancing the enqueue position with a compare and exchange, so tasks on different cores never wait on
+ *  each other to queue a request.  Only one task may pop from the queue at a time.
+ */
+
+class BlockIOServiceQueue
+{
+public:
+    static constexpr uint32_t QUEUE_DEPTH = MAX_BLOCK_IO_SERVICE_QUEUE_DEPTH;
+
+    static_assert((QUEUE_DEPTH & (QUEUE_DEPTH - 1)) == 0, "Block IO service queue depth must be a power of two");
+
+    BlockIOServiceQueue();
+
+    BlockIOServiceQueue(const BlockIOServiceQueue &) = delete;
+    BlockIOServiceQueue(BlockIOServiceQueue &&) = delete;
+
+    BlockIOServiceQueue &operator=(const BlockIOServiceQueue &) = delete;
+    BlockIOServiceQueue &operator=(BlockIOServiceQueue &&) = delete;
+
+    /** @brief Adds a request to the tail of the queue.  May be called concurrently from any number of tasks.
+     *
+     *     @return false if the queue is full
+     */
+
+    bool Push(BlockIOServiceRequest *request);
+
+    /** @brief Removes the request at the head of the queue.  Must only be called by the single consumer.
+     *
+     *     @return false if the queue is empty
+     */
+
+    bool Pop(BlockIOServiceRequest *&request);
+
+    /** @brief Returns true if there is nothing for the consumer to pop.  Must only be called by the single consumer.
+     */
+
+    bool Empty() const;
+
+private:
+    typedef struct Slot
+    {
+        minstd::atomic<uint32_t> sequence_;
+        BlockIOServiceRequest *request_;
+    } Slot;
+
+    Slot slots_[QUEUE_DEPTH];
+
+    minstd::atomic<uint32_t> enqueue_position_;
+    uint32_t dequeue_position_ = 0;
+};
+
+/** @brief Set of service queues, one per IO priority class, drained in strict priority order with aging.
+ *
+ *  The consumer always takes the request at the head of the most urgent non-empty queue, unless a less urgent queue has
+ *  been passed over BLOCK_IO_PRIORITY_AGING_LIMIT times while it had requests waiting, in which case its head request
+ *  goes next.  Producers may push concurrently, only one task may pop.
+ */
+
+class BlockIOPriorityServiceQueue
+{
+public:
+    BlockIOPriorityServiceQueue() = default;
+
+    BlockIOPriorityServiceQueue(const BlockIOPriorityServiceQueue &) = delete;
+    BlockIOPriorityServiceQueue(BlockIOPriorityServiceQueue &&) = delete;
+
+    BlockIOPriorityServiceQueue &operator=(const BlockIOPriorityServiceQueue &) = delete;
+    BlockIOPriorityServiceQueue &operator=(BlockIOPriorityServiceQueue &&) = delete;
+
+    /** @brief Adds a request to the queue for its priority class.  May be called concurrently from any number of tasks.
+     *
+     *     @return false if the queue for the priority class is full
+     */
+
+    bool Push(BlockIOServiceRequest *request)
+    {
+        return queues_[static_cast<uint32_t>(request->priority_)].Push(request);
+    }
+
+    /** @brief Removes the next request to dispatch.  Must only be called by the single consumer.
+     *
+     *     @return false if all of the queues are empty
+     */
+
+    bool Pop(BlockIOServiceRequest *&request);
+
+private:
+    BlockIOServiceQueue queues_[NUMBER_OF_BLOCK_IO_PRIORITIES];
+
+    uint32_t passed_over_[NUMBER_OF_BLOCK_IO_PRIORITIES] = {};
+};
+
+/** @brief Block IO device which serializes all access to an underlying device through a single servicing task.
+ *
+ *  Device drivers like the SD card controller keep per-transfer state in the driver and cannot be driven from two cores
+ *  at once.  Every call on the service device is packaged as a request and pushed onto a lock-free queue, the task
+ *  draining the queue is the only task which touches the underlying device.  Normally that is a BlockIOServiceTask
+ *  pinned to one core, until the service task attaches, the submitting tasks take turns draining the queue themselves.
+ *
+ *  Requests are queued by IO priority class, calls without an explicit priority are INTERACTIVE.  Reads and writes of one
+ *  class popped back to back are passed on through the underlying device's asynchronous request queue, where the elevator
+ *  sorts and merges them.  A batch is dispatched as soon as a request of another class is popped, so the elevator never
+ *  undoes the order chosen by the priority queues.
+ */
+
+class BlockIOServiceDevice : public BlockIODevice
+{
+public:
+    typedef void (*WaitFunction)();
+
+    BlockIOServiceDevice() = delete;
+    BlockIOServiceDevice(const BlockIOServiceDevice &) = delete;
+    BlockIOServiceDevice(BlockIOServiceDevice &&) = delete;
+
+    BlockIOServiceDevice(bool permanent,
+                         const char *name,
+                         const char *alias,
+                         BlockIODevice &device)
+        : BlockIODevice(permanent, name, alias),
+          device_(device),
+          block_size_(device.BlockSize())
+    {
+        worker_attached_.store(0);
+        draining_.store(0);
+        requests_serviced_.store(0);
+    }
+
+    ~BlockIOServiceDevice() {}
+
+    BlockIOServiceDevice &operator=(const BlockIOServiceDevice &) = delete;
+    BlockIOServiceDevice &operator=(BlockIOServiceDevice &&) = delete;
+
+    uint32_t BlockSize() const override
+    {
+        return block_size_;
+    }
+
+    BlockIOResultCodes Seek(uint64_t offset_in_blocks) override;
+
+    ValueResult<BlockIOResultCodes, uint32_t> ReadFromBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_read) override;
+
+    ValueResult<BlockIOResultCodes, uint32_t> ReadFromCurrentOffset(uint8_t *buffer, uint32_t blocks_to_read) override;
+
+    ValueResult<BlockIOResultCodes, uint32_t> WriteBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_write) override;
+
+    ValueResult<BlockIOResultCodes, uint32_t> ReadFromBlockWithPriority(BlockIOPriority priority, uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_read) override;
+
+    ValueResult<BlockIOResultCodes, uint32_t> WriteBlockWithPriority(BlockIOPriority priority, uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_write) override;
+
+    ValueResult<BlockIOResultCodes, uint32_t> ReadBlocksV(BlockIOPriority priority, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number) override;
+
+    ValueResult<BlockIOResultCodes, uint32_t> WriteBlocksV(BlockIOPriority priority, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number) override;
+
+    BlockIOResultCodes Flush() override;
+
+    BlockIOResultCodes Discard(uint32_t block_number, uint32_t number_of_blocks) override;
+
+    BlockIODevice *UnderlyingDevice() override
+    {
+        return &device_;
+    }
+
+    /** @brief Hands the underlying device to the calling task.  From this point only the calling task drains the queue,
+     *         submitting tasks call the wait function while their requests are outstanding.
+     *
+     *     @param[in] wait_function Called by submitting tasks while they wait, typically yields the processor
+     */
+
+    void AttachWorker(WaitFunction wait_function);
+
+    /** @brief Returns the underlying device to the submitting tasks, they will drain the queue themselves.
+     */
+
+    void DetachWorker();
+
+    bool WorkerAttached() const
+    {
+        return worker_attached_.load() != 0;
+    }
+
+    /** @brief Executes the queued requests on the underlying device.  Returns immediately if another task is draining the queue.
+     *
+     *     @return Number of requests executed
+     */
+
+    uint32_t ProcessQueue();
+
+    uint64_t RequestsServiced() const
+    {
+        return requests_serviced_.load();
+    }
+
+private:
+    BlockIODevice &device_;
+    const uint32_t block_size_;
+
+    BlockIOPriorityServiceQueue queue_;
+
+    minstd::atomic<uint32_t> worker_attached_;
+    minstd::atomic<uint32_t> draining_;
+    minstd::atomic<uint64_t> requests_serviced_;
+
+    WaitFunction wait_function_ = nullptr;
+
+    uint64_t current_offset_in_blocks_ = 0;
+
+    BlockIOResultCodes Submit(BlockIOServiceRequest &request);
+    void WaitForService();
+
+    void Execute(BlockIOServiceRequest &request);
+    void DispatchDeviceRequests(BlockIORequest *device_requests, uint32_t number_of_device_requests);
+};
+
+/** @brief Kernel task which owns the device behind a BlockIOServiceDevice and executes the requests queued on it.
+ *         The task should be pinned to a single core.
+ */
+
+class BlockIOServiceTask : public Runnable
+{
+public:
+    BlockIOServiceTask(BlockIOServiceDevice &device)
+        : device_(device)
+    {
+    }
+
+    void Run() override;
+
+private:
+    BlockIOServiceDevice &device_;
+};
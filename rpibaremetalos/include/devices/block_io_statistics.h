@@ -0,0 +1,344 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+typedef enum class BlockIOCommandClass : uint32_t
+{
+    SINGLE_BLOCK_READ = 0,
+    MULTIPLE_BLOCK_READ,
+    SINGLE_BLOCK_WRITE,
+    MULTIPLE_BLOCK_WRITE,
+
+    __NUMBER_OF_COMMAND_CLASSES__
+} BlockIOCommandClass;
+
+/** @brief Log2 scale latency histogram.  Bucket 0 counts latencies under one microsecond, bucket N counts latencies
+ *         in the range [2^(N-1), 2^N) microseconds and the last bucket also collects everything longer.
+ */
+
+class BlockIOLatencyHistogram
+{
+public:
+    static constexpr uint32_t NUMBER_OF_BUCKETS = 24;
+
+    void Record(uint64_t latency_in_us)
+    {
+        buckets_[BucketForLatency(latency_in_us)]++;
+
+        count_++;
+        total_latency_in_us_ += latency_in_us;
+
+        if (latency_in_us > maximum_latency_in_us_)
+        {
+            maximum_latency_in_us_ = latency_in_us;
+        }
+    }
+
+    void Reset()
+    {
+        for (uint32_t i = 0; i < NUMBER_OF_BUCKETS; i++)
+        {
+            buckets_[i] = 0;
+        }
+
+        count_ = 0;
+        total_latency_in_us_ = 0;
+        maximum_latency_in_us_ = 0;
+    }
+
+    static uint32_t BucketForLatency(uint64_t latency_in_us)
+    {
+        if (latency_in_us == 0)
+        {
+            return 0;
+        }
+
+        uint32_t bucket = 64 - __builtin_clzll(latency_in_us);
+
+        return bucket < NUMBER_OF_BUCKETS ? bucket : NUMBER_OF_BUCKETS - 1;
+    }
+
+    static uint64_t BucketLowerBoundInMicroseconds(uint32_t bucket)
+    {
+        return bucket == 0 ? 0 : (uint64_t)1 << (bucket - 1);
+    }
+
+    uint64_t BucketCount(uint32_t bucket) const
+    {
+        return buckets_[bucket];
+    }
+
+    uint64_t Count() const
+    {
+        return count_;
+    }
+
+    uint64_t AverageLatencyInMicroseconds() const
+    {
+        return count_ == 0 ? 0 : total_latency_in_us_ / count_;
+    }
+
+    uint64_t MaximumLatencyInMicroseconds() const
+    {
+        return maximum_latency_in_us_;
+    }
+
+private:
+    uint64_t buckets_[NUMBER_OF_BUCKETS] = {};
+
+    uint64_t count_ = 0;
+    uint64_t total_latency_in_us_ = 0;
+    uint64_t maximum_latency_in_us_ = 0;
+};
+
+/** @brief Counters and latency histograms for a block IO device.  Counters are updated without locking, so values
+ *         read while IO is in progress may be slightly inconsistent with one another.
+ */
+
+class BlockIOStatistics
+{
+public:
+    void RecordRead(uint32_t blocks, uint64_t latency_in_us, bool succeeded)
+    {
+        reads_++;
+        RecordTransfer(blocks > 1 ? BlockIOCommandClass::MULTIPLE_BLOCK_READ : BlockIOCommandClass::SINGLE_BLOCK_READ, latency_in_us, succeeded);
+
+        if (succeeded)
+        {
+            blocks_read_ += blocks;
+        }
+    }
+
+    void RecordWrite(uint32_t blocks, uint64_t latency_in_us, bool succeeded)
+    {
+        writes_++;
+        RecordTransfer(blocks > 1 ? BlockIOCommandClass::MULTIPLE_BLOCK_WRITE : BlockIOCommandClass::SINGLE_BLOCK_WRITE, latency_in_us, succeeded);
+
+        if (succeeded)
+        {
+            blocks_written_ += blocks;
+        }
+    }
+
+    void RecordRetry()
+    {
+        retries_++;
+    }
+
+    void RecordQueueDepth(uint32_t queue_depth)
+    {
+        requests_queued_++;
+
+        if (queue_depth > maximum_queue_depth_)
+        {
+            maximum_queue_depth_ = queue_depth;
+        }
+    }
+
+    void RecordCompletion(uint64_t wait_in_us, bool signalled_by_interrupt)
+    {
+        if (signalled_by_interrupt)
+        {
+            interrupt_completions_++;
+        }
+        else
+        {
+            polled_completions_++;
+        }
+
+        completion_wait_.Record(wait_in_us);
+    }
+
+    void Reset()
+    {
+        reads_ = 0;
+        writes_ = 0;
+        blocks_read_ = 0;
+        blocks_written_ = 0;
+        retries_ = 0;
+        errors_ = 0;
+        requests_queued_ = 0;
+        maximum_queue_depth_ = 0;
+        interrupt_completions_ = 0;
+        polled_completions_ = 0;
+
+        completion_wait_.Reset();
+
+        for (uint32_t i = 0; i < (uint32_t)BlockIOCommandClass::__NUMBER_OF_COMMAND_CLASSES__; i++)
+        {
+            latency_[i].Reset();
+        }
+    }
+
+    uint64_t Reads() const
+    {
+        return reads_;
+    }
+
+    uint64_t Writes() const
+    {
+        return writes_;
+    }
+
+    uint64_t BlocksRead() const
+    {
+        return blocks_read_;
+    }
+
+    uint64_t BlocksWritten() const
+    {
+        return blocks_written_;
+    }
+
+    uint64_t Retries() const
+    {
+        return retries_;
+    }
+
+    uint64_t Errors() const
+    {
+        return errors_;
+    }
+
+    uint64_t RequestsQueued() const
+    {
+        return requests_queued_;
+    }
+
+    uint32_t MaximumQueueDepth() const
+    {
+        return maximum_queue_depth_;
+    }
+
+    const BlockIOLatencyHistogram &Latency(BlockIOCommandClass command_class) const
+    {
+        return latency_[(uint32_t)command_class];
+    }
+
+    uint64_t InterruptCompletions() const
+    {
+        return interrupt_completions_;
+    }
+
+    uint64_t PolledCompletions() const
+    {
+        return polled_completions_;
+    }
+
+    /** @brief Time from a command or data transfer being armed to the device driver seeing it complete, by either path.
+     */
+
+    const BlockIOLatencyHistogram &CompletionWait() const
+    {
+        return completion_wait_;
+    }
+
+private:
+    uint64_t reads_ = 0;
+    uint64_t writes_ = 0;
+    uint64_t blocks_read_ = 0;
+    uint64_t blocks_written_ = 0;
+    uint64_t retries_ = 0;
+    uint64_t errors_ = 0;
+    uint64_t requests_queued_ = 0;
+    uint32_t maximum_queue_depth_ = 0;
+    uint64_t interrupt_completions_ = 0;
+    uint64_t polled_completions_ = 0;
+
+    BlockIOLatencyHistogram completion_wait_;
+    BlockIOLatencyHistogram latency_[(uint32_t)BlockIOCommandClass::__NUMBER_OF_COMMAND_CLASSES__];
+
+    void RecordTransfer(BlockIOCommandClass command_class, uint64_t latency_in_us, bool succeeded)
+    {
+        latency_[(uint32_t)command_class].Record(latency_in_us);
+
+        if (!succeeded)
+        {
+            errors_++;
+        }
+    }
+};
+
+/** @brief Counters for a block cache.  The IO counters and latencies are kept by the device behind the cache.
+ */
+
+class BlockIOCacheStatistics
+{
+public:
+    explicit BlockIOCacheStatistics(uint32_t cache_size_in_blocks)
+        : cache_size_in_blocks_(cache_size_in_blocks)
+    {
+    }
+
+    void RecordHit()
+    {
+        hits_++;
+    }
+
+    void RecordMisses(uint32_t blocks)
+    {
+        misses_ += blocks;
+    }
+
+    void RecordWriteBack(uint32_t blocks)
+    {
+        blocks_written_back_ += blocks;
+    }
+
+    void BlockDirtied()
+    {
+        dirty_blocks_++;
+    }
+
+    void BlockCleaned()
+    {
+        dirty_blocks_--;
+    }
+
+    //  The dirty block count describes the contents of the cache, it is not a counter and is not reset
+
+    void Reset()
+    {
+        hits_ = 0;
+        misses_ = 0;
+        blocks_written_back_ = 0;
+    }
+
+    uint32_t CacheSizeInBlocks() const
+    {
+        return cache_size_in_blocks_;
+    }
+
+    uint32_t DirtyBlocks() const
+    {
+        return dirty_blocks_;
+    }
+
+    uint64_t Hits() const
+    {
+        return hits_;
+    }
+
+    uint64_t Misses() const
+    {
+        return misses_;
+    }
+
+    uint64_t BlocksWrittenBack() const
+    {
+        return blocks_written_back_;
+    }
+
+private:
+    const uint32_t cache_size_in_blocks_;
+
+    uint32_t dirty_blocks_ = 0;
+
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t blocks_written_back_ = 0;
+};
@@ -0,0 +1,218 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <__memory_resource/memory_resource.h>
+
+#include "devices/block_io.h"
+
+#include "task/runnable.h"
+
+/** @brief Write-back block cache which can be placed in front of any BlockIODevice.
+ *
+ *  Blocks are held in a fixed size LRU cache allocated from the memory resource passed to the constructor.  Reads are
+ *  satisfied from the cache when possible, runs of missing blocks are read from the underlying device with a single command.
+ *  Writes update the cache and mark the blocks dirty, dirty blocks are written to the device when they are evicted or when
+ *  the cache is flushed.  Flushing sorts the dirty blocks and coalesces contiguous blocks into multi-block writes.
+ *
+ *  Writes larger than half of the cache are passed straight through to the device so streaming writes do not
+ *  flush the working set out of the cache.
+ *
+ *  The cache lock is never held across IO on the underlying device.  Blocks being written back are flagged so they are not
+ *  evicted while the lock is dropped, and are marked clean before the write so a task writing them again in the meantime
+ *  leaves them dirty.
+ */
+
+class CachedBlockIODevice : public BlockIODevice
+{
+public:
+    CachedBlockIODevice() = delete;
+    CachedBlockIODevice(const CachedBlockIODevice &) = delete;
+    CachedBlockIODevice(CachedBlockIODevice &&) = delete;
+
+    CachedBlockIODevice(bool permanent,
+                        const char *name,
+                        const char *alias,
+                        BlockIODevice &device,
+                        minstd::pmr::memory_resource &cache_heap,
+                        uint32_t cache_size_in_blocks = DEFAULT_BLOCK_IO_CACHE_SIZE_IN_BLOCKS);
+
+    ~CachedBlockIODevice();
+
+    CachedBlockIODevice &operator=(const CachedBlockIODevice &) = delete;
+    CachedBlockIODevice &operator=(CachedBlockIODevice &&) = delete;
+
+    uint32_t BlockSize() const override
+    {
+        return block_size_;
+    }
+
+    BlockIOResultCodes Seek(uint64_t offset_in_blocks) override;
+
+    ValueResult<BlockIOResultCodes, uint32_t> ReadFromBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_read) override;
+
+    ValueResult<BlockIOResultCodes, uint32_t> ReadFromCurrentOffset(uint8_t *buffer, uint32_t blocks_to_read) override;
+
+    ValueResult<BlockIOResultCodes, uint32_t> WriteBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_write) override;
+
+    /** @brief Cache misses are read from the underlying device at the priority of the request.
+     */
+
+    ValueResult<BlockIOResultCodes, uint32_t> ReadFromBlockWithPriority(BlockIOPriority priority, uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_read) override;
+
+    /** @brief Pass-through writes and write-backs forced by evictions go to the underlying device at the priority of the request.
+     *         Flushes of dirty blocks are always background IO.
+     */
+
+    ValueResult<BlockIOResultCodes, uint32_t> WriteBlockWithPriority(BlockIOPriority priority, uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_write) override;
+
+    /** @brief Writes all dirty blocks back to the underlying device and then flushes the underlying device.
+     *         Blocks which could not be written remain dirty and will be retried on the next flush.
+     *
+     *     @return SUCCESS or the first failure returned by the underlying device
+     */
+
+    BlockIOResultCodes Flush() override;
+
+    /** @brief Drops any cached copies of the blocks, without writing them back, and passes the discard to the underlying device.
+     *
+     *     @return Result of the discard on the underlying device
+     */
+
+    BlockIOResultCodes Discard(uint32_t block_number, uint32_t number_of_blocks) override;
+
+    /** @brief Drops every block from the cache without writing dirty blocks back to the device.
+     */
+
+    void Invalidate();
+
+    BlockIODevice *UnderlyingDevice() override
+    {
+        return &device_;
+    }
+
+    const BlockIOCacheStatistics *CacheStatistics() const override
+    {
+        return &cache_statistics_;
+    }
+
+    uint32_t CacheSizeInBlocks() const
+    {
+        return cache_size_in_blocks_;
+    }
+
+    uint32_t DirtyBlocks() const
+    {
+        return cache_statistics_.DirtyBlocks();
+    }
+
+    uint64_t CacheHits() const
+    {
+        return cache_statistics_.Hits();
+    }
+
+    uint64_t CacheMisses() const
+    {
+        return cache_statistics_.Misses();
+    }
+
+    uint64_t BlocksWrittenBack() const
+    {
+        return cache_statistics_.BlocksWrittenBack();
+    }
+
+private:
+    static constexpr uint32_t INVALID_ENTRY = 0xFFFFFFFF;
+
+    typedef struct CacheEntry
+    {
+        uint32_t block_number_;
+
+        uint32_t hash_next_;
+        uint32_t lru_previous_;
+        uint32_t lru_next_;
+
+        bool valid_;
+        bool dirty_;
+        bool writeback_pending_;
+    } CacheEntry;
+
+    BlockIODevice &device_;
+    minstd::pmr::memory_resource &cache_heap_;
+
+    const uint32_t block_size_;
+    const uint32_t cache_size_in_blocks_;
+    const uint32_t hash_bucket_count_;
+
+    SpinLock cache_lock_;
+
+    CacheEntry *entries_;
+    uint32_t *hash_buckets_;
+    uint8_t *block_data_;
+    uint8_t *flush_staging_buffer_;
+    uint32_t *flush_list_;
+
+    uint32_t lru_head_ = INVALID_ENTRY;
+    uint32_t lru_tail_ = INVALID_ENTRY;
+
+    uint64_t current_offset_in_blocks_ = 0;
+
+    uint64_t device_write_generation_ = 0;
+    bool flush_in_progress_ = false;
+
+    BlockIOCacheStatistics cache_statistics_;
+
+    uint8_t *BlockData(uint32_t index)
+    {
+        return block_data_ + (static_cast<size_t>(index) * block_size_);
+    }
+
+    uint32_t HashBucket(uint32_t block_number) const
+    {
+        return (block_number * 2654435761u) & (hash_bucket_count_ - 1);
+    }
+
+    uint32_t Find(uint32_t block_number);
+
+    void LRUUnlink(uint32_t index);
+    void LRUPushFront(uint32_t index);
+    void LRUPushBack(uint32_t index);
+
+    void HashInsert(uint32_t index);
+    void HashRemove(uint32_t index);
+
+    void MarkDirty(uint32_t index);
+    void MarkClean(uint32_t index);
+    void DropEntry(uint32_t index);
+    void DiscardEntries(uint32_t block_number, uint32_t number_of_blocks);
+
+    uint32_t AllocateEntry(uint32_t block_number);
+    uint32_t DirtyVictim(uint32_t number_of_entries);
+
+    BlockIOResultCodes WriteBackEntry(uint32_t index, BlockIOPriority priority);
+    BlockIOResultCodes FlushInternal(BlockIOPriority priority);
+};
+
+/** @brief Kernel task which periodically flushes a CachedBlockIODevice so dirty blocks do not linger in the cache.
+ */
+
+class CachedBlockIOFlushTask : public Runnable
+{
+public:
+    CachedBlockIOFlushTask(CachedBlockIODevice &device,
+                           uint32_t flush_interval_in_ms = DEFAULT_BLOCK_IO_CACHE_FLUSH_INTERVAL_IN_MS)
+        : device_(device),
+          flush_interval_in_ms_(flush_interval_in_ms)
+    {
+    }
+
+    void Run() override;
+
+private:
+    CachedBlockIODevice &device_;
+    const uint32_t flush_interval_in_ms_;
+};
@@ -14,6 +14,18 @@ typedef enum EMMCCommandResponses
     RT_48_BITS_BUSY = 3
 } EMMCCommandResponses;
 
+//
+//  Auto commands the host controller can issue around a multi-block transfer.  Auto CMD12 stops an open-ended
+//      transfer once it completes, auto CMD23 sends the block count (from the arg2 register) ahead of the transfer.
+//
+
+typedef enum EMMCAutoCommands
+{
+    AC_NONE = 0,
+    AC_CMD12 = 1,
+    AC_CMD23 = 2
+} EMMCAutoCommands;
+
 //
 //  The EMMCCommand structure declaration is an old-school C bit-mapped specification.
 //      It adds up to 32 bits which is mapped onto a single uint32_t.  This is aa convenient
@@ -56,14 +68,20 @@ typedef enum EMMCCommandTypes : uint32_t
     SetDsr = 4,
     IOSetOpCond = 5,
     SwitchFunction = 6,
+    SetBusWidth = 6, //  ACMD6, shares the command descriptor with CMD6
     SelectCard = 7,
     SendIfCond = 8,
     SendCsd = 9,
     SetBlockLen = 16,
     ReadBlock = 17,
     ReadMultiple = 18,
+    SetBlockCount = 23,
+    SetWriteBlockEraseCount = 23, //  ACMD23, shares the command descriptor with CMD23
     WriteBlock = 24,
     WriteMultiple = 25,
+    EraseWriteBlockStart = 32,
+    EraseWriteBlockEnd = 33,
+    Erase = 38,
     OcrCheck = 41,
     SendSCR = 51,
     App = 55
@@ -81,7 +99,7 @@ static constexpr EMMCCommand commands[] = {
     {0, 0, 0, 0, 0, 0, RT_48_BITS, 0, 1, 0, 0, 0, SendRelativeAddr, 0},
     {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, SetDsr, 0},
     {0, 0, 0, 0, 0, 0, RT_136_BITS, 0, 0, 0, 0, 0, IOSetOpCond, 0},
-    {0, 0, 0, 0, 0, 0, RT_48_BITS, 0, 1, 0, 0, 0, SwitchFunction, 0},
+    {0, 0, 0, 0, 0, 0, RT_48_BITS, 0, 1, 0, 0, 0, SwitchFunction, 0}, //  Set Bus Width (ACMD6), CMD6 itself uses SWITCH_FUNCTION_CMD below
     {0, 0, 0, 0, 0, 0, RT_48_BITS_BUSY, 0, 1, 0, 0, 0, SelectCard, 0},
     {0, 0, 0, 0, 0, 0, RT_48_BITS, 0, 1, 0, 0, 0, SendIfCond, 0},
     {0, 0, 0, 0, 0, 0, RT_136_BITS, 0, 1, 0, 0, 0, SendCsd, 0},
@@ -93,27 +111,27 @@ static constexpr EMMCCommand commands[] = {
     RESERVED_CMD,
     {0, 0, 0, 0, 0, 0, RT_48_BITS, 0, 1, 0, 0, 0, SetBlockLen, 0},
     {0, 0, 0, 1, 0, 0, RT_48_BITS, 0, 1, 0, 1, 0, ReadBlock, 0}, //  Read Single Block
-    {0, 1, 1, 1, 1, 0, RT_48_BITS, 0, 1, 0, 1, 0, ReadMultiple, 0}, //  Read Multiple Blocks
-    RESERVED_CMD,
+    {0, 1, AC_CMD12, 1, 1, 0, RT_48_BITS, 0, 1, 0, 1, 0, ReadMultiple, 0}, //  Read Multiple Blocks
     RESERVED_CMD,
     RESERVED_CMD,
     RESERVED_CMD,
     RESERVED_CMD,
+    {0, 0, 0, 0, 0, 0, RT_48_BITS, 0, 1, 0, 0, 0, SetBlockCount, 0}, //  Set Block Count (CMD23) or Set Write Block Erase Count (ACMD23)
     {0, 0, 0, 0, 0, 0, RT_48_BITS, 0, 1, 0, 1, 0, WriteBlock, 0}, //  Write Single Block
-    {0, 1, 1, 0, 1, 0, RT_48_BITS, 0, 1, 0, 1, 0, WriteMultiple, 0}, //  Write Multiple Blocks
-    RESERVED_CMD,
-    RESERVED_CMD,
-    RESERVED_CMD,
+    {0, 1, AC_CMD12, 0, 1, 0, RT_48_BITS, 0, 1, 0, 1, 0, WriteMultiple, 0}, //  Write Multiple Blocks
     RESERVED_CMD,
     RESERVED_CMD,
     RESERVED_CMD,
     RESERVED_CMD,
     RESERVED_CMD,
     RESERVED_CMD,
+    {0, 0, 0, 0, 0, 0, RT_48_BITS, 0, 1, 0, 0, 0, EraseWriteBlockStart, 0}, //  Erase Write Block Start (CMD32)
+    {0, 0, 0, 0, 0, 0, RT_48_BITS, 0, 1, 0, 0, 0, EraseWriteBlockEnd, 0}, //  Erase Write Block End (CMD33)
     RESERVED_CMD,
     RESERVED_CMD,
     RESERVED_CMD,
     RESERVED_CMD,
+    {0, 0, 0, 0, 0, 0, RT_48_BITS_BUSY, 0, 1, 0, 0, 0, Erase, 0}, //  Erase (CMD38)
     RESERVED_CMD,
     RESERVED_CMD,
     {0, 0, 0, 0, 0, 0, RT_48_BITS, 0, 0, 0, 0, 0, OcrCheck, 0},
@@ -133,6 +151,13 @@ static constexpr EMMCCommand commands[] = {
     {0, 0, 0, 0, 0, 0, RT_48_BITS, 0, 1, 0, 0, 0, App, 0},
 };
 
+//
+//  CMD6 (Switch Function) on an SD card returns a 64 byte status block, unlike the ACMD6 which shares its index.
+//      It cannot live in the table above, so it has its own descriptor.
+//
+
+static constexpr EMMCCommand SWITCH_FUNCTION_CMD = {0, 0, 0, 1, 0, 0, RT_48_BITS, 0, 1, 0, 1, 0, SwitchFunction, 0};
+
 bool operator==(const EMMCCommand &command1, const EMMCCommand &command2)
 {
     return &command1 == &command2;
@@ -22,7 +22,10 @@ typedef struct EMMCRegisters
     volatile uint32_t cap2;
     volatile uint32_t res0[2];
     volatile uint32_t force_int;
-    volatile uint32_t res1[7];
+    volatile uint32_t adma_error_status;
+    volatile uint32_t adma_address_low;
+    volatile uint32_t adma_address_high;
+    volatile uint32_t res1[4];
     volatile uint32_t boot_timeout;
     volatile uint32_t debug_config;
     volatile uint32_t res2[2];
@@ -0,0 +1,96 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "devices/block_io.h"
+
+/** @brief Block IO device backed by a region of RAM.
+ *
+ *  The RAM disk is intended for scratch filesystems holding temporary files which never need to reach persistent
+ *  media.  The storage is supplied by the creator of the device and must remain valid for the life of the device.
+ *  Contents are lost when the system restarts.
+ */
+
+class RamDiskBlockIODevice : public BlockIODevice
+{
+public:
+    static constexpr uint32_t BLOCK_SIZE_IN_BYTES = 512;
+
+    RamDiskBlockIODevice() = delete;
+    RamDiskBlockIODevice(const RamDiskBlockIODevice &) = delete;
+    RamDiskBlockIODevice(RamDiskBlockIODevice &&) = delete;
+
+    RamDiskBlockIODevice(bool permanent,
+                         const char *name,
+                         const char *alias,
+                         uint8_t *storage,
+                         uint32_t size_in_blocks)
+        : BlockIODevice(permanent, name, alias),
+          storage_(storage),
+          size_in_blocks_(size_in_blocks)
+    {
+    }
+
+    ~RamDiskBlockIODevice() {}
+
+    RamDiskBlockIODevice &operator=(const RamDiskBlockIODevice &) = delete;
+    RamDiskBlockIODevice &operator=(RamDiskBlockIODevice &&) = delete;
+
+    uint32_t BlockSize() const override
+    {
+        return BLOCK_SIZE_IN_BYTES;
+    }
+
+    uint32_t SizeInBlocks() const
+    {
+        return size_in_blocks_;
+    }
+
+    BlockIOResultCodes Seek(uint64_t offset_in_blocks) override;
+
+    ValueResult<BlockIOResultCodes, uint32_t> ReadFromBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_read) override;
+
+    ValueResult<BlockIOResultCodes, uint32_t> ReadFromCurrentOffset(uint8_t *buffer, uint32_t blocks_to_read) override;
+
+    ValueResult<BlockIOResultCodes, uint32_t> WriteBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_write) override;
+
+    /** @brief Zero fills the discarded blocks, so stale data does not survive in freed clusters.
+     *
+     *     @return SUCCESS or RAM_DISK_BLOCK_OUT_OF_RANGE if the range extends past the end of the disk
+     */
+
+    BlockIOResultCodes Discard(uint32_t block_number, uint32_t number_of_blocks) override;
+
+private:
+    uint8_t *const storage_;
+    const uint32_t size_in_blocks_;
+
+    uint64_t offset_in_blocks_ = 0;
+
+    bool IsRangeValid(uint32_t block_number, uint32_t number_of_blocks) const
+    {
+        return (block_number <= size_in_blocks_) && (number_of_blocks <= size_in_blocks_ - block_number);
+    }
+
+    uint8_t *BlockAddress(uint32_t block_number) const
+    {
+        return storage_ + (static_cast<uint64_t>(block_number) * BLOCK_SIZE_IN_BYTES);
+    }
+};
+
+/** @brief Creates a permanent RAM disk from pages taken from the memory manager and registers it with the OS entity registry.
+ *         The pages are held for the life of the OS.
+ *
+ *     @param[in] name Name and alias for the RAM disk
+ *     @param[in] size_in_bytes Size of the RAM disk, rounded down to a whole number of blocks
+ *
+ *     @return ReferenceResult \n
+ *             Success: the new RAM disk \n
+ *             Failure: RAM_DISK_UNABLE_TO_ALLOCATE_MEMORY or FAILURE if the disk could not be registered
+ */
+
+ReferenceResult<BlockIOResultCodes, RamDiskBlockIODevice> CreateRamDisk(const char *name, uint64_t size_in_bytes);
@@ -13,6 +13,9 @@
 
 #include "filesystem_errors.h"
 
+#include "fat32_fat_cache.h"
+#include "fat32_free_cluster_bitmap.h"
+
 namespace filesystems::fat32
 {
 
@@ -44,6 +47,14 @@ namespace filesystems::fat32
     constexpr FAT32ClusterIndex FAT32EntryEOFThreshold{0x0FFFFFF8};
     constexpr FAT32ClusterIndex FAT32EntryAllocatedAndEndOfFile{0x0FFFFFFF};
 
+    //  A run of physically contiguous clusters allocated as a single chain
+
+    typedef struct FAT32Extent
+    {
+        FAT32ClusterIndex first_cluster_;
+        uint32_t number_of_clusters_;
+    } FAT32Extent;
+
     class FAT32BlockIOAdapter
     {
     public:
@@ -52,9 +63,29 @@ namespace filesystems::fat32
          *
          * @param io_device_ The block I/O device to mount the filesystem on.
          * @param first_lba_sector The first LBA sector of the filesystem.
+         * @param discard_freed_clusters If true, clusters released from a chain are discarded on the block I/O device.
+         * @param fat_cache_size_in_sectors The number of FAT sectors to cache in memory, zero disables the FAT cache.
          * @return A `ValueResult` containing a `FilesystemResultCodes` and a `FAT32BlockIOAdapter` on success.
          */
-        static ValueResult<FilesystemResultCodes, FAT32BlockIOAdapter> Mount(BlockIODevice &io_device_, uint32_t first_lba_sector);
+        static ValueResult<FilesystemResultCodes, FAT32BlockIOAdapter> Mount(BlockIODevice &io_device_,
+                                                                             uint32_t first_lba_sector,
+                                                                             bool discard_freed_clusters = DEFAULT_FAT32_DISCARD_FREED_CLUSTERS,
+                                                                             uint32_t fat_cache_size_in_sectors = DEFAULT_FAT32_FAT_CACHE_SIZE_IN_SECTORS);
+
+        /**
+         * Writes an empty FAT32 filesystem to a range of sectors on a block I/O device.  The boot sector, FSInfo sector,
+         * backup boot sector, both FATs and a root directory holding only the volume label are written.
+         *
+         * @param io_device The block I/O device to format.
+         * @param first_lba_sector The first LBA sector of the filesystem.
+         * @param number_of_sectors The number of sectors in the filesystem.
+         * @param volume_label The volume label, at most 11 characters.
+         * @return SUCCESS or the result code describing the failure.
+         */
+        static FilesystemResultCodes Format(BlockIODevice &io_device,
+                                            uint32_t first_lba_sector,
+                                            uint32_t number_of_sectors,
+                                            const char *volume_label);
 
         //  Delete default and move constructors and assignment operators
 
@@ -68,6 +99,7 @@ namespace filesystems::fat32
          * @brief Copy constructor for FAT32BlockIOAdapter.
          *
          * This constructor creates a new FAT32BlockIOAdapter object by copying the properties of another FAT32BlockIOAdapter object.
+         * The FAT cache of the new adapter starts out empty and the free cluster bitmap is not loaded.
          *
          * @param adapter_to_copy The FAT32BlockIOAdapter object to be copied.
          */
@@ -81,7 +113,12 @@ namespace filesystems::fat32
               fat_lba_(adapter_to_copy.fat_lba_),
               data_lba_(adapter_to_copy.data_lba_),
               fat32_entries_per_block_(adapter_to_copy.fat32_entries_per_block_),
-              last_empty_cluster_found_(adapter_to_copy.last_empty_cluster_found_)
+              maximum_cluster_number_(adapter_to_copy.maximum_cluster_number_),
+              last_empty_cluster_found_(adapter_to_copy.last_empty_cluster_found_),
+              discard_freed_clusters_(adapter_to_copy.discard_freed_clusters_),
+              fsinfo_lba_(adapter_to_copy.fsinfo_lba_),
+              fat_cache_(adapter_to_copy.fat_cache_),
+              free_cluster_bitmap_(adapter_to_copy.free_cluster_bitmap_)
         {
         }
 
@@ -145,6 +182,16 @@ namespace filesystems::fat32
             return root_directory_cluster_;
         }
 
+        /**
+         * Returns true if clusters released from a chain are discarded on the underlying block I/O device.
+         *
+         * @return True if freed clusters are discarded.
+         */
+        bool DiscardFreedClusters() const noexcept
+        {
+            return discard_freed_clusters_;
+        }
+
         /**
          * Returns the number of sectors per FAT.
          *
@@ -155,6 +202,36 @@ namespace filesystems::fat32
             return sectors_per_fat_;
         }
 
+        /**
+         * Returns the number of copies of the FAT written by FAT updates.  This is one if the volume has FAT mirroring disabled.
+         *
+         * @return The number of FAT copies.
+         */
+        uint32_t NumberOfFATs() const noexcept
+        {
+            return fat_cache_.NumberOfFATs();
+        }
+
+        /**
+         * Returns the FAT sector cache, primarily for statistics.
+         *
+         * @return The FAT sector cache.
+         */
+        const FAT32FATCache &FATCache() const noexcept
+        {
+            return fat_cache_;
+        }
+
+        /**
+         * Returns the free cluster bitmap, it is only usable once LoadFreeClusterBitmap() has succeeded.
+         *
+         * @return The free cluster bitmap.
+         */
+        const FAT32FreeClusterBitmap &FreeClusterBitmap() const noexcept
+        {
+            return free_cluster_bitmap_;
+        }
+
         /**
          * Returns the maximum cluster number in the FAT32 file system.
          *
@@ -162,7 +239,7 @@ namespace filesystems::fat32
          */
         FAT32ClusterIndex MaximumClusterNumber() const noexcept
         {
-            return FAT32ClusterIndex(sectors_per_fat_ * fat32_entries_per_block_);
+            return maximum_cluster_number_;
         }
 
         /**
@@ -170,12 +247,31 @@ namespace filesystems::fat32
          *
          * @param cluster The index of the cluster to read.
          * @param buffer  A pointer to the buffer where the cluster data will be stored.
+         * @param priority The IO priority class of the read, directory clusters should be read as METADATA.
          * @return The result code of the block I/O operation.
          */
         BlockIOResultCodes ReadCluster(FAT32ClusterIndex cluster,
-                                       uint8_t *buffer)
+                                       uint8_t *buffer,
+                                       BlockIOPriority priority = BlockIOPriority::INTERACTIVE)
+        {
+            return io_device_->ReadFromBlockWithPriority(priority, buffer, FATClusterToSector(cluster), logical_sectors_per_cluster_).ResultCode();
+        }
+
+        /**
+         * Reads a run of physically contiguous clusters from the FAT32 file system with a single device read.
+         *
+         * @param first_cluster The index of the first cluster to read.
+         * @param number_of_clusters The number of contiguous clusters to read.
+         * @param buffer  A pointer to the buffer where the cluster data will be stored, it must hold all the clusters.
+         * @param priority The IO priority class of the read.
+         * @return The result code of the block I/O operation.
+         */
+        BlockIOResultCodes ReadClusters(FAT32ClusterIndex first_cluster,
+                                        uint32_t number_of_clusters,
+                                        uint8_t *buffer,
+                                        BlockIOPriority priority = BlockIOPriority::INTERACTIVE)
         {
-            return io_device_->ReadFromBlock(buffer, FATClusterToSector(cluster), logical_sectors_per_cluster_).ResultCode();
+            return io_device_->ReadFromBlockWithPriority(priority, buffer, FATClusterToSector(first_cluster), logical_sectors_per_cluster_ * number_of_clusters).ResultCode();
         }
 
         /**
@@ -183,12 +279,31 @@ namespace filesystems::fat32
          *
          * @param cluster The index of the cluster to write.
          * @param buffer  A pointer to the buffer containing the data to write.
+         * @param priority The IO priority class of the write, directory clusters should be written as METADATA.
          * @return The result code of the block I/O operation.
          */
         BlockIOResultCodes WriteCluster(FAT32ClusterIndex cluster,
-                                        uint8_t *buffer)
+                                        uint8_t *buffer,
+                                        BlockIOPriority priority = BlockIOPriority::INTERACTIVE)
         {
-            return io_device_->WriteBlock(buffer, FATClusterToSector(cluster), logical_sectors_per_cluster_).ResultCode();
+            return io_device_->WriteBlockWithPriority(priority, buffer, FATClusterToSector(cluster), logical_sectors_per_cluster_).ResultCode();
+        }
+
+        /**
+         * Writes a run of physically contiguous clusters to the FAT32 file system with a single device write.
+         *
+         * @param first_cluster The index of the first cluster to write.
+         * @param number_of_clusters The number of contiguous clusters to write.
+         * @param buffer  A pointer to the buffer containing the data to write, it must hold all the clusters.
+         * @param priority The IO priority class of the write.
+         * @return The result code of the block I/O operation.
+         */
+        BlockIOResultCodes WriteClusters(FAT32ClusterIndex first_cluster,
+                                         uint32_t number_of_clusters,
+                                         uint8_t *buffer,
+                                         BlockIOPriority priority = BlockIOPriority::INTERACTIVE)
+        {
+            return io_device_->WriteBlockWithPriority(priority, buffer, FATClusterToSector(first_cluster), logical_sectors_per_cluster_ * number_of_clusters).ResultCode();
         }
 
         /**
@@ -212,7 +327,10 @@ namespace filesystems::fat32
         /**
          * Finds the next empty cluster in the FAT32 filesystem.
          *
-         * @param starting_cluster The cluster index to start searching from. Defaults to 0.
+         * With the free cluster bitmap loaded the search does not touch the FAT.  A search starting from the allocation hint
+         * wraps around to the start of the volume, a search from an explicit starting cluster does not.
+         *
+         * @param starting_cluster The cluster index to start searching from. Defaults to 0, which starts from the allocation hint.
          * @return A ValueResult object containing the result code and the index of the next empty cluster on success.
          */
         ValueResult<FilesystemResultCodes, FAT32ClusterIndex> FindNextEmptyCluster(FAT32ClusterIndex starting_cluster = FAT32ClusterIndex(0)) const;
@@ -229,18 +347,85 @@ namespace filesystems::fat32
          */
         FilesystemResultCodes UpdateFATTableEntry(FAT32ClusterIndex cluster, FAT32ClusterIndex new_value);
 
+        /**
+         * @brief Starts a FAT update transaction.
+         *
+         * Until the matching CommitFATTransaction(), FAT entry updates are collected in the FAT cache instead of being written
+         * through.  Transactions nest, only the outermost commit writes to the device.  With the FAT cache disabled, updates
+         * are written as they are made.
+         */
+        void BeginFATTransaction();
+
+        /**
+         * @brief Ends a FAT update transaction.
+         *
+         * Ending the outermost transaction writes every FAT sector changed by the transaction to every copy of the FAT, each
+         * sector once, with runs of consecutive sectors in a single request per copy.
+         *
+         * @return The result code indicating the success or failure of the operation.
+         */
+        FilesystemResultCodes CommitFATTransaction();
+
+        /**
+         * @brief Allocates a run of physically contiguous clusters and links it onto the end of a chain.
+         *
+         * The run is placed directly after the last cluster of the chain if there is free space there, otherwise it starts
+         * from the allocation hint.  With the free cluster bitmap loaded, a few free runs are examined and the first one
+         * long enough is used.  The run may be shorter than requested when free space is fragmented, callers extend the
+         * chain again for the remainder.  The FAT entries of the run are written to the device in as few sector writes
+         * as the FAT cache allows.
+         *
+         * @param last_cluster The last cluster of the chain to extend, or FAT32EntryFree to start a new chain.
+         * @param clusters_wanted The number of clusters wanted, must be at least one.
+         * @return A `ValueResult` containing the result code and the extent allocated on success.
+         */
+        ValueResult<FilesystemResultCodes, FAT32Extent> AllocateExtent(FAT32ClusterIndex last_cluster, uint32_t clusters_wanted);
+
         /**
          * @brief Releases a chain of clusters starting from the specified first cluster.
          *
          * This function releases a chain of clusters in the FAT32 file system starting from the specified first cluster.
-         * The clusters in the chain are deallocated and can be reused by other files or directories.
+         * The clusters in the chain are deallocated and can be reused by other files or directories.  The chain is released a
+         * FAT sector at a time, each sector holding part of the chain is read and written once.  Unless disabled at mount,
+         * each run of physically contiguous freed clusters is discarded on the block I/O device, but only after the FAT sectors
+         * freeing it have been written.  If the FAT cannot be written, nothing is discarded.
          *
          * @param first_cluster The index of the first cluster in the chain to be released.
          * @return The result code indicating the success or failure of the operation.
          */
         FilesystemResultCodes ReleaseChain(FAT32ClusterIndex first_cluster);
 
+        /**
+         * Allocates the FAT cache buffers, so a shortage of memory fails the mount rather than the first FAT access.
+         *
+         * @return The result code indicating the success or failure of the operation.
+         */
+        FilesystemResultCodes AllocateFATCache()
+        {
+            return fat_cache_.AllocateBuffers();
+        }
+
+        /**
+         * Builds the free cluster bitmap by scanning the FAT.  The FSInfo sector is checked against the FAT and its next free
+         * hint seeds the allocation hint.  Once loaded, the bitmap is kept current as FAT entries are updated.
+         *
+         * @return The result code indicating the success or failure of the operation.
+         */
+        FilesystemResultCodes LoadFreeClusterBitmap();
+
+        /**
+         * Writes any FAT sectors left dirty in the FAT cache back to the block I/O device and updates the FSInfo sector
+         * with the free cluster count and allocation hint, if the free cluster bitmap is loaded.
+         *
+         * @return The result code indicating the success or failure of the operation.
+         */
+        FilesystemResultCodes Flush();
+
     private:
+        //  Number of free runs examined by AllocateExtent() when looking for one long enough for the whole request
+
+        static constexpr uint32_t EXTENT_SEARCH_LIMIT = 16;
+
         BlockIODevice *io_device_ = nullptr;
 
         const FAT32ClusterIndex root_directory_cluster_;
@@ -255,8 +440,24 @@ namespace filesystems::fat32
 
         const uint32_t fat32_entries_per_block_;
 
+        const FAT32ClusterIndex maximum_cluster_number_;
+
         FAT32ClusterIndex last_empty_cluster_found_;
 
+        const bool discard_freed_clusters_;
+
+        const LogicalBlockAddress fsinfo_lba_;
+
+        mutable FAT32FATCache fat_cache_;
+
+        FAT32FreeClusterBitmap free_cluster_bitmap_;
+        bool fsinfo_dirty_ = false;
+
+        uint32_t fat_transaction_depth_ = 0;
+
+        FAT32Extent pending_discards_[MAX_FAT32_PENDING_DISCARD_RUNS];
+        uint32_t number_of_pending_discards_ = 0;
+
         //
         //  Private methods
         //
@@ -271,29 +472,44 @@ namespace filesystems::fat32
          * @param root_directory_cluster The cluster number of the root directory.
          * @param logical_sectors_per_cluster The number of logical sectors per cluster.
          * @param bytes_per_sector The number of bytes per sector.
-         * @param number_of_fats The number of File Allocation Tables (FATs) in the filesystem.
+         * @param sectors_per_fat The number of sectors in each File Allocation Table (FAT).
+         * @param number_of_fats The number of copies of the FAT kept current by FAT updates.
          * @param first_lba_sector The logical block address (LBA) of the first sector of the partition.
          * @param fat_lba The LBA of the first sector of the FAT.
          * @param data_lba The LBA of the first sector of the data region.
+         * @param maximum_cluster_number The highest cluster index backed by both the FAT and the data region.
+         * @param discard_freed_clusters If true, clusters released from a chain are discarded on the block I/O device.
+         * @param fat_cache_size_in_sectors The number of FAT sectors to cache in memory, zero disables the FAT cache.
+         * @param fsinfo_lba The LBA of the FSInfo sector, zero if the filesystem has no FSInfo sector.
          */
         FAT32BlockIOAdapter(BlockIODevice &io_device,
                             uint32_t root_directory_cluster,
                             uint32_t logical_sectors_per_cluster,
                             uint32_t bytes_per_sector,
+                            uint32_t sectors_per_fat,
                             uint32_t number_of_fats,
                             uint32_t first_lba_sector,
                             uint32_t fat_lba,
-                            uint32_t data_lba)
+                            uint32_t data_lba,
+                            uint32_t maximum_cluster_number,
+                            bool discard_freed_clusters,
+                            uint32_t fat_cache_size_in_sectors,
+                            uint32_t fsinfo_lba)
             : io_device_(&io_device),
               root_directory_cluster_(root_directory_cluster),
               logical_sectors_per_cluster_(logical_sectors_per_cluster),
               bytes_per_sector_(bytes_per_sector),
-              sectors_per_fat_(number_of_fats),
+              sectors_per_fat_(sectors_per_fat),
               first_lba_sector_(first_lba_sector),
               fat_lba_(fat_lba),
               data_lba_(data_lba),
               fat32_entries_per_block_(io_device_->BlockSize() / sizeof(uint32_t)),
-              last_empty_cluster_found_(0)
+              maximum_cluster_number_(maximum_cluster_number),
+              last_empty_cluster_found_(0),
+              discard_freed_clusters_(discard_freed_clusters),
+              fsinfo_lba_(fsinfo_lba),
+              fat_cache_(io_device, fat_lba, sectors_per_fat, number_of_fats, fat_cache_size_in_sectors),
+              free_cluster_bitmap_(maximum_cluster_number)
         {
         }
 
@@ -321,12 +537,42 @@ namespace filesystems::fat32
         }
 
         /**
-         * Reads a FAT block from the filesystem.
+         * Records a FAT entry update in the free cluster bitmap, if the bitmap is loaded.
+         *
+         * @param cluster The cluster whose FAT entry was updated.
+         * @param new_value The new value of the FAT entry.
+         */
+        void UpdateFreeClusterBitmap(FAT32ClusterIndex cluster, FAT32ClusterIndex new_value);
+
+        /**
+         * Counts the free clusters in the run starting at a free cluster.
          *
-         * @param cluster The cluster index of the FAT block to read.
-         * @param buffer  A pointer to the buffer where the data will be stored.
-         * @return        The result code indicating the success or failure of the operation.
+         * @param first_cluster The first cluster of the run, it must be free.
+         * @param maximum_length The longest run of interest.
+         * @return A `ValueResult` containing the result code and the length of the run on success.
+         */
+        ValueResult<FilesystemResultCodes, uint32_t> FreeRunLength(FAT32ClusterIndex first_cluster, uint32_t maximum_length) const;
+
+        /**
+         * Writes the free cluster count and allocation hint to the FSInfo sector, if they have changed.
+         *
+         * @return The result code indicating the success or failure of the operation.
+         */
+        FilesystemResultCodes WriteFSInfo();
+
+        /**
+         * Queues a run of physically contiguous clusters to be discarded on the block I/O device, if discard is enabled.
+         * The run is discarded when the FAT transaction freeing it commits.
+         *
+         * @param first_cluster The index of the first cluster in the run.
+         * @param number_of_clusters The number of clusters in the run, may be zero.
+         */
+        void DiscardClusters(FAT32ClusterIndex first_cluster, uint32_t number_of_clusters);
+
+        /**
+         * Flushes the block I/O device, so the FAT entries freeing the queued runs are on the media, and then discards the runs.
+         * The queued runs are dropped without being discarded if the flush fails.
          */
-        FilesystemResultCodes ReadFATBlock(FAT32ClusterIndex cluster, uint32_t *buffer) const;
+        void IssuePendingDiscards();
     };
 } // namespace filesystems::fat32
@@ -180,6 +180,21 @@ namespace filesystems::fat32
                                                               const FAT32DirectoryEntryAddress &address,
                                                               uint32_t new_size);
 
+        /**
+         * Sets both the first cluster and the size of a directory entry in a FAT32 filesystem, reading and writing the
+         * directory cluster holding the entry once.
+         *
+         * @param block_io_adapter The block I/O adapter for accessing the FAT32 filesystem.
+         * @param address The address of the directory entry to update.
+         * @param first_cluster The index of the first cluster to set.
+         * @param new_size The new size of the directory entry.
+         * @return The result code indicating the success or failure of the operation.
+         */
+        static FilesystemResultCodes UpdateDirectoryEntry(FAT32BlockIOAdapter &block_io_adapter,
+                                                          const FAT32DirectoryEntryAddress &address,
+                                                          FAT32ClusterIndex first_cluster,
+                                                          uint32_t new_size);
+
         /**
          * Converts the given parameters into a `FilesystemDirectory` object of type `FAT32Directory`.
          *
@@ -1370,7 +1370,7 @@ namespace filesystems::fat32
         {
             if (buffer_is_empty_)
             {
-                if (directory_cluster_.block_io_adapter_.ReadCluster(current_entry_.cluster_, buffer_.data()) != BlockIOResultCodes::SUCCESS)
+                if (directory_cluster_.block_io_adapter_.ReadCluster(current_entry_.cluster_, buffer_.data(), BlockIOPriority::METADATA) != BlockIOResultCodes::SUCCESS)
                 {
                     LogDebug1("Failed to read directory cluster: %u\n", current_entry_.cluster_);
                     return FilesystemResultCodes::FAT32_DEVICE_READ_ERROR;
@@ -0,0 +1,125 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "synchronization.h"
+
+#include "filesystem/fat32_blockio_adapter.h"
+
+namespace filesystems::fat32
+{
+    /**
+     * @brief Run-length map from cluster positions in a file to the clusters holding them.
+     *
+     * Each extent of the map records a run of physically contiguous clusters in the file's chain and the position in the file
+     * of its first cluster.  The map is built lazily, the chain is only walked as far as the furthest position looked up so
+     * far, so each FAT entry of the chain is read once no matter how the file is accessed.  Looking up a position already
+     * mapped is a binary search over the extents and does no IO.
+     *
+     * When a lookup runs past the end of the mapped chain, the walk resumes from the last cluster mapped.  Clusters added to
+     * the end of the chain after it was mapped are picked up that way, without having to tell the map.  The extents are
+     * allocated from the dynamic heap and grow as needed.
+     *
+     * Lookups and resets are serialized with a spin lock, so tasks reading different parts of one file can share its map.  The
+     * lock is dropped while the FAT is read to walk the chain further, the clusters walked are published to the map once the
+     * lock is taken again, so lookups of positions already mapped never wait on the device.
+     */
+
+    class FAT32ExtentMap
+    {
+    public:
+        explicit FAT32ExtentMap(FAT32ClusterIndex first_cluster)
+            : first_cluster_(first_cluster)
+        {
+        }
+
+        FAT32ExtentMap() = delete;
+        FAT32ExtentMap(const FAT32ExtentMap &) = delete;
+        FAT32ExtentMap(FAT32ExtentMap &&) = delete;
+
+        ~FAT32ExtentMap();
+
+        FAT32ExtentMap &operator=(const FAT32ExtentMap &) = delete;
+        FAT32ExtentMap &operator=(FAT32ExtentMap &&) = delete;
+
+        /**
+         * Discards the map and starts it over for the chain beginning at a cluster.
+         *
+         * @param first_cluster The first cluster of the chain, FAT32EntryFree for an empty file.
+         */
+        void Reset(FAT32ClusterIndex first_cluster);
+
+        /**
+         * Returns the run of physically contiguous clusters starting at a cluster position in the file.
+         *
+         * @param block_io_adapter The adapter used to read the FAT if the chain has to be walked further.
+         * @param cluster_in_file The position in the file in clusters, zero is the first cluster of the file.
+         * @param clusters_wanted The length of the run the caller is after.  The chain is mapped far enough to cover it, so
+         *                        the extent returned is not cut short just because the rest of the run is not mapped yet.
+         * @return A `ValueResult` containing the result code and, on success, the extent from the cluster at the position to
+         *         the end of its run as far as it has been mapped.  If the chain ends before the position, the first cluster
+         *         of the extent is FAT32EntryAllocatedAndEndOfFile and the extent has no clusters.  Fails with
+         *         FAT32_UNABLE_TO_ALLOCATE_EXTENT_MAP if the map cannot grow to cover the position.
+         */
+        ValueResult<FilesystemResultCodes, FAT32Extent> ExtentAt(const FAT32BlockIOAdapter &block_io_adapter,
+                                                                 uint32_t cluster_in_file,
+                                                                 uint32_t clusters_wanted = 1);
+
+        /**
+         * Returns the cluster at a cluster position in the file.
+         *
+         * @param block_io_adapter The adapter used to read the FAT if the chain has to be walked further.
+         * @param cluster_in_file The position in the file in clusters, zero is the first cluster of the file.
+         * @return A `ValueResult` containing the result code and, on success, the cluster index or FAT32EntryAllocatedAndEndOfFile
+         *         if the chain ends before the position.
+         */
+        ValueResult<FilesystemResultCodes, FAT32ClusterIndex> ClusterAt(const FAT32BlockIOAdapter &block_io_adapter, uint32_t cluster_in_file);
+
+        uint32_t NumberOfExtents() const noexcept
+        {
+            return number_of_extents_;
+        }
+
+        uint32_t ClustersMapped() const noexcept
+        {
+            return number_of_extents_ == 0 ? 0 : extents_[number_of_extents_ - 1].first_cluster_in_file_ + extents_[number_of_extents_ - 1].number_of_clusters_;
+        }
+
+    private:
+        static constexpr uint32_t INITIAL_CAPACITY = 8;
+        static constexpr uint32_t WALK_BATCH_SIZE = 32;
+
+        typedef struct MappedExtent
+        {
+            uint32_t first_cluster_in_file_;
+            uint32_t first_cluster_;
+            uint32_t number_of_clusters_;
+        } MappedExtent;
+
+        FAT32ClusterIndex first_cluster_;
+
+        SpinLock map_lock_;
+
+        MappedExtent *extents_ = nullptr;
+        uint32_t number_of_extents_ = 0;
+        uint32_t capacity_ = 0;
+
+        //  Bumped by every reset, so a walk started before a reset is not published to the new map
+
+        uint32_t generation_ = 0;
+
+        //  Called and returns with the lock held, the lock is dropped while the FAT is read
+
+        FilesystemResultCodes MapThrough(const FAT32BlockIOAdapter &block_io_adapter, uint32_t cluster_in_file);
+
+        //  Fails only if the extent array has to grow and the heap is exhausted, the map is left as it was
+
+        FilesystemResultCodes AddCluster(uint32_t cluster);
+
+        void Release();
+    };
+} // namespace filesystems::fat32
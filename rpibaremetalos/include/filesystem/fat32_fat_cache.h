@@ -0,0 +1,199 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "os_config.h"
+
+#include "devices/block_io.h"
+
+#include "filesystem_errors.h"
+
+namespace filesystems::fat32
+{
+    /**
+     * @brief Sector granular, write-back LRU cache of the File Allocation Table.
+     *
+     * FAT sectors are held in memory allocated from the filesystem cache heap.  Reads of FAT entries are satisfied from the
+     * cache, missing sectors are read from the device one at a time.  Entries may be written through to the device immediately
+     * or left dirty in the cache, dirty sectors are written back when they are evicted or when the cache is flushed.  If the
+     * FAT is no larger than the cache, the whole FAT ends up resident.
+     *
+     * The cache buffers are allocated when the filesystem is mounted, or on first use, so copies of the cache made while
+     * mounting cost nothing.  A copy starts out empty, it does not share or copy the cached sectors.
+     *
+     * Every FAT sector written goes to each copy of the FAT on the volume, so the copies stay identical.  A flush writes the
+     * dirty sectors in FAT order and each run of consecutive dirty sectors goes out as a single request per FAT copy.  The
+     * cache lock is never held across device IO.  Sectors being written back are not evicted and one updated in the meantime
+     * is left dirty.  A sector being read in is claimed first, so other tasks after it wait for the read instead of issuing
+     * their own.
+     *
+     * A cache size of zero disables caching, every access goes to the device.
+     */
+
+    class FAT32FATCache
+    {
+    public:
+        FAT32FATCache(BlockIODevice &io_device,
+                      uint32_t fat_lba,
+                      uint32_t sectors_per_fat,
+                      uint32_t number_of_fats,
+                      uint32_t cache_size_in_sectors);
+
+        FAT32FATCache(const FAT32FATCache &cache_to_copy);
+
+        FAT32FATCache() = delete;
+        FAT32FATCache(FAT32FATCache &&) = delete;
+
+        ~FAT32FATCache();
+
+        FAT32FATCache &operator=(const FAT32FATCache &) = delete;
+        FAT32FATCache &operator=(FAT32FATCache &&) = delete;
+
+        /**
+         * Allocates the cache buffers from the filesystem cache heap if they have not been allocated already.  Does nothing
+         * when caching is disabled.
+         *
+         * @return SUCCESS or FAT32_UNABLE_TO_ALLOCATE_FAT_CACHE if the heap is exhausted.
+         */
+        FilesystemResultCodes AllocateBuffers();
+
+        /**
+         * Returns the value of a FAT entry.
+         *
+         * @param cluster The index of the FAT entry, the caller must insure it lies within the FAT.
+         * @return A `ValueResult` containing the result code and the raw value of the FAT entry on success.
+         */
+        ValueResult<FilesystemResultCodes, uint32_t> ReadEntry(uint32_t cluster);
+
+        /**
+         * Sets the value of a FAT entry.
+         *
+         * @param cluster The index of the FAT entry, the caller must insure it lies within the FAT.
+         * @param value The new value for the FAT entry.
+         * @param write_through If true the sector holding the entry is written to the device before returning, otherwise
+         *                      the sector is left dirty in the cache.
+         * @return SUCCESS or the result code describing the failure.
+         */
+        FilesystemResultCodes WriteEntry(uint32_t cluster, uint32_t value, bool write_through);
+
+        /**
+         * Frees the entries of a cluster chain held in the FAT sector containing its first cluster.  The chain is followed
+         * from entry to entry until it leaves the sector, so the sector is read and modified once however many of the chain's
+         * entries it holds.  With the cache enabled the sector is left dirty in the cache, otherwise it is written straight back
+         * to the device.
+         *
+         * @param first_cluster The first cluster to free, the caller must insure it lies within the FAT.
+         * @param maximum_cluster_number The highest cluster number on the volume, the chain is not followed past it.
+         * @param released_clusters Receives the clusters freed, in chain order.  It must have room for EntriesPerSector() entries.
+         * @param number_released Receives the number of clusters freed.
+         * @return A `ValueResult` containing the result code and, on success, the raw FAT value which ended the walk.  That is
+         *         the next cluster of the chain if it lies in another sector, otherwise an end of chain marker or an invalid
+         *         link for the caller to deal with.
+         */
+        ValueResult<FilesystemResultCodes, uint32_t> ReleaseChainInSector(uint32_t first_cluster,
+                                                                          uint32_t maximum_cluster_number,
+                                                                          uint32_t *released_clusters,
+                                                                          uint32_t &number_released);
+
+        /**
+         * Writes all dirty sectors back to the device.  Sectors which cannot be written remain dirty.
+         *
+         * @return SUCCESS or FAT32_UNABLE_TO_WRITE_FAT_TABLE_SECTOR if any sector could not be written.
+         */
+        FilesystemResultCodes Flush();
+
+        /**
+         * Drops every sector from the cache without writing dirty sectors back to the device.
+         */
+        void Invalidate();
+
+        uint32_t NumberOfFATs() const noexcept
+        {
+            return number_of_fats_;
+        }
+
+        uint32_t EntriesPerSector() const noexcept
+        {
+            return entries_per_sector_;
+        }
+
+        uint32_t CacheSizeInSectors() const noexcept
+        {
+            return cache_size_in_sectors_;
+        }
+
+        uint32_t DirtySectors() const noexcept
+        {
+            return dirty_sectors_;
+        }
+
+        uint64_t Hits() const noexcept
+        {
+            return hits_;
+        }
+
+        uint64_t Misses() const noexcept
+        {
+            return misses_;
+        }
+
+        uint64_t SectorsWrittenBack() const noexcept
+        {
+            return sectors_written_back_;
+        }
+
+    private:
+        static constexpr uint32_t INVALID_ENTRY = 0xFFFFFFFF;
+
+        typedef struct CacheEntry
+        {
+            uint32_t fat_sector_;
+            uint64_t last_used_;
+
+            bool valid_;
+            bool dirty_;
+            bool writeback_pending_;
+            bool load_pending_;
+        } CacheEntry;
+
+        BlockIODevice *io_device_;
+
+        const uint32_t fat_lba_;
+        const uint32_t sectors_per_fat_;
+        const uint32_t number_of_fats_;
+        const uint32_t entries_per_sector_;
+        const uint32_t cache_size_in_sectors_;
+
+        SpinLock cache_lock_;
+
+        CacheEntry *entries_ = nullptr;
+        uint32_t *sector_data_ = nullptr;
+
+        uint32_t most_recent_entry_ = INVALID_ENTRY;
+        uint64_t use_counter_ = 0;
+
+        uint32_t dirty_sectors_ = 0;
+        bool flush_in_progress_ = false;
+
+        uint64_t hits_ = 0;
+        uint64_t misses_ = 0;
+        uint64_t sectors_written_back_ = 0;
+
+        uint32_t *SectorData(uint32_t index)
+        {
+            return sector_data_ + (static_cast<size_t>(index) * entries_per_sector_);
+        }
+
+        ValueResult<FilesystemResultCodes, uint32_t> LoadSector(uint32_t fat_sector);
+
+        FilesystemResultCodes WriteBack(uint32_t index);
+
+        bool WriteBackPending() const;
+
+        FilesystemResultCodes WriteToAllFATs(const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t first_fat_sector);
+    };
+} // namespace filesystems::fat32
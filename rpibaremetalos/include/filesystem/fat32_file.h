@@ -5,6 +5,7 @@
 #pragma once
 
 #include "filesystem/fat32_directory_cluster.h"
+#include "filesystem/fat32_extent_map.h"
 #include "filesystem/filesystems.h"
 
 namespace filesystems::fat32
@@ -25,12 +26,15 @@ namespace filesystems::fat32
               mode_(mode),
               directory_entry_address_(GetOpaqueData(directory_entry).directory_entry_address_),
               first_cluster_(GetOpaqueData(directory_entry).FirstCluster()),
+              extent_map_(GetOpaqueData(directory_entry).FirstCluster()),
               current_cluster_(GetOpaqueData(directory_entry).FirstCluster()),
               byte_offset_into_cluster_(byte_offset_into_cluster),
               byte_offset_into_file_(byte_offset_into_file)
         {
         }
 
+        ~FAT32File();
+
         const UUID &ID() const override
         {
             return file_uuid_;
@@ -88,11 +92,32 @@ namespace filesystems::fat32
         FilesystemResultCodes Write(const minstd::buffer<uint8_t> &buffer) override;
         FilesystemResultCodes Append(const minstd::buffer<uint8_t> &buffer) override;
 
+        FilesystemResultCodes ReadAt(uint32_t offset, minstd::buffer<uint8_t> &buffer) override;
+        FilesystemResultCodes WriteAt(uint32_t offset, const minstd::buffer<uint8_t> &buffer) override;
+
+        FilesystemResultCodes Preallocate(uint32_t bytes) override;
+
         FilesystemResultCodes SeekEnd() override;
         FilesystemResultCodes Seek(uint32_t position) override;
 
+        PointerResult<FilesystemResultCodes, FileMapping> Map(uint32_t offset, uint32_t length, FileModes mode) override;
+
+        //  Page IO for FAT32FileMapping.  A page starts on a cluster boundary and holds a whole number of clusters, the part
+        //      of a page past the end of the file's cluster chain is zeroed on read.  Only the dirty part of a page is written
+        //      back, it has to lie within the file.
+
+        FilesystemResultCodes ReadPage(uint32_t page_offset, uint8_t *page, uint32_t page_size);
+        FilesystemResultCodes WritePageRange(uint32_t offset, const uint8_t *data, uint32_t length);
+
+        FilesystemResultCodes Flush() override;
+
         FilesystemResultCodes Close() override;
 
+        bool DirectoryEntryDirty() const noexcept
+        {
+            return directory_entry_dirty_;
+        }
+
     private:
         const UUID file_uuid_;
         const UUID filesystem_uuid_;
@@ -107,8 +132,58 @@ namespace filesystems::fat32
 
         FAT32ClusterIndex first_cluster_;
 
+        //  Changes to the size and first cluster are held here and written to the directory entry on Flush() or Close(),
+        //      rather than costing a directory cluster read and write on every write which grows the file.
+
+        bool directory_entry_dirty_ = false;
+
+        //  Maps positions in the file to clusters, so seeks and random reads do not walk the chain.  It is shared by the
+        //      cursor based calls and ReadAt()/WriteAt(), which use it to find clusters without touching the file position.
+
+        FAT32ExtentMap extent_map_;
+
         FAT32ClusterIndex current_cluster_;
         uint32_t byte_offset_into_cluster_;
         uint32_t byte_offset_into_file_;
+
+        //  Read-ahead state.  Reads which start where the previous read ended are treated as sequential and the
+        //      following clusters in the chain are prefetched into the read-ahead buffer.  The window doubles each
+        //      time it is consumed by a sequential reader and drops back to a single cluster on a seek.  Cluster aligned
+        //      writes of whole clusters go straight from the caller's buffer to the device, the read-ahead buffer also stages
+        //      cluster aligned reads and serves as the bounce buffer for partial clusters.
+
+        uint8_t *read_ahead_buffer_ = nullptr;
+        uint32_t read_ahead_buffer_size_ = 0;
+        uint32_t read_ahead_clusters_[MAX_FAT32_READ_AHEAD_CLUSTERS];
+        uint32_t read_ahead_cluster_count_ = 0;
+        uint32_t read_ahead_window_ = 1;
+        uint32_t next_sequential_read_offset_ = 0;
+
+        ValueResult<FilesystemResultCodes, const uint8_t *> ReadCurrentCluster(FAT32BlockIOAdapter &block_io_adapter,
+                                                                               bool sequential);
+
+        FilesystemResultCodes ReadClustersIntoBuffer(FAT32BlockIOAdapter &block_io_adapter,
+                                                     minstd::buffer<uint8_t> &buffer,
+                                                     uint32_t bytes_left_in_file,
+                                                     uint32_t &bytes_read);
+
+        uint8_t *ClusterBuffer(uint32_t bytes_per_cluster);
+
+        const uint8_t *PrefetchedCluster(FAT32ClusterIndex cluster, uint32_t bytes_per_cluster) const;
+
+        ValueResult<FilesystemResultCodes, FAT32ClusterIndex> NextClusterInFile(FAT32BlockIOAdapter &block_io_adapter);
+
+        //  Writes at an explicit offset into clusters already in the chain, without touching the file position or the size
+
+        FilesystemResultCodes WriteWithinFile(FAT32BlockIOAdapter &block_io_adapter, uint32_t offset, const uint8_t *data, uint32_t length);
+
+        //  Writes at an explicit offset past the end of the file, extending the chain and the size.  The file position is
+        //      left alone, apart from an empty file's position moving onto its new first cluster.
+
+        FilesystemResultCodes WriteBeyondEndOfFile(FAT32BlockIOAdapter &block_io_adapter, uint32_t offset, const uint8_t *data, uint32_t length);
+
+        //  Makes the chain at least the given number of clusters long, clusters past the end of the file are left in it
+
+        FilesystemResultCodes ExtendChain(FAT32BlockIOAdapter &block_io_adapter, uint32_t clusters_needed);
     };
 } // namespace filesystems::fat32
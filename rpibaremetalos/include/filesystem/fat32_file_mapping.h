@@ -0,0 +1,102 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "filesystem/filesystems.h"
+
+namespace filesystems::fat32
+{
+    /**
+     * @brief Mapping of a range of an open FAT32 file into memory.
+     *
+     * Only a small table of pages is allocated when the mapping is created.  Each page is allocated from the dynamic heap and
+     * read the first time it is accessed.  A page is FileMapping::PAGE_SIZE bytes or one cluster, whichever is larger, so
+     * each page starts on a cluster boundary and is read from the file's clusters directly, a run of contiguous clusters at
+     * a time.
+     *
+     * Each page tracks the span of bytes accessed for write and only that span is written back, so data written through
+     * the file elsewhere in the page is left alone.  Bytes between two writes to the same page are part of the span.
+     *
+     * The mapping finds its file through the file map, so it must be flushed or unmapped before the file is closed.  Reads
+     * and writes through the file itself are not reflected in pages which are already in memory.
+     */
+
+    class FAT32FileMapping : public FileMapping
+    {
+    public:
+        FAT32FileMapping(const UUID &file_uuid,
+                         uint32_t offset,
+                         uint32_t length,
+                         FileModes mode,
+                         uint32_t page_size);
+
+        FAT32FileMapping() = delete;
+        FAT32FileMapping(const FAT32FileMapping &) = delete;
+        FAT32FileMapping(FAT32FileMapping &&) = delete;
+
+        ~FAT32FileMapping();
+
+        FAT32FileMapping &operator=(const FAT32FileMapping &) = delete;
+        FAT32FileMapping &operator=(FAT32FileMapping &&) = delete;
+
+        uint32_t Offset() const override
+        {
+            return offset_;
+        }
+
+        uint32_t Length() const override
+        {
+            return length_;
+        }
+
+        uint32_t PageSize() const override
+        {
+            return page_size_;
+        }
+
+        /**
+         * Returns the number of pages of the mapping which have been read from the file.
+         *
+         * @return The number of pages in memory.
+         */
+        uint32_t PagesPresent() const noexcept;
+
+        ValueResult<FilesystemResultCodes, const uint8_t *> Access(uint32_t offset, uint32_t length) override;
+        ValueResult<FilesystemResultCodes, uint8_t *> AccessForWrite(uint32_t offset, uint32_t length) override;
+
+        FilesystemResultCodes Flush() override;
+
+        FilesystemResultCodes Unmap() override;
+
+    private:
+        //  A page is clean when its dirty span is empty
+
+        typedef struct Page
+        {
+            uint8_t *data_;
+            uint32_t dirty_start_;
+            uint32_t dirty_end_;
+        } Page;
+
+        const UUID file_uuid_;
+
+        const uint32_t offset_;
+        const uint32_t length_;
+        const FileModes mode_;
+
+        const uint32_t page_size_;
+        const uint32_t first_page_offset_;
+        const uint32_t number_of_pages_;
+
+        Page *pages_ = nullptr;
+        bool unmapped_ = false;
+
+        ValueResult<FilesystemResultCodes, uint8_t *> FaultIn(uint32_t offset, uint32_t length, bool for_write);
+
+        void Release();
+    };
+} // namespace filesystems::fat32
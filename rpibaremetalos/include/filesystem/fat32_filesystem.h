@@ -56,7 +56,16 @@ namespace filesystems::fat32
                                                                            const char *alias,
                                                                            bool boot,
                                                                            BlockIODevice &io_device,
-                                                                           const MassStoragePartition &partition);
+                                                                           const MassStoragePartition &partition,
+                                                                           bool discard_freed_clusters = DEFAULT_FAT32_DISCARD_FREED_CLUSTERS,
+                                                                           uint32_t fat_cache_size_in_sectors = DEFAULT_FAT32_FAT_CACHE_SIZE_IN_SECTORS,
+                                                                           bool free_cluster_bitmap = DEFAULT_FAT32_FREE_CLUSTER_BITMAP);
+
+        //  Writes a master boot record and a single, empty FAT32 partition spanning the device
+
+        static FilesystemResultCodes Format(BlockIODevice &io_device,
+                                            uint32_t number_of_blocks,
+                                            const char *volume_label);
 
         FAT32Filesystem(bool permanent,
                         const char *name,
@@ -73,7 +82,7 @@ namespace filesystems::fat32
 
         FAT32Filesystem() = delete;
 
-        virtual ~FAT32Filesystem() {}
+        virtual ~FAT32Filesystem();
 
         const minstd::string &VolumeLabel() const noexcept
         {
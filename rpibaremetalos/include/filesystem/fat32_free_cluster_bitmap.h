@@ -0,0 +1,126 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "os_config.h"
+
+#include "synchronization.h"
+
+#include "filesystem/filesystem_errors.h"
+
+namespace filesystems::fat32
+{
+    /**
+     * @brief In-memory bitmap of the free clusters on a FAT32 volume, one bit per cluster.
+     *
+     * A second level summary bitmap has one bit per 64 bit word of the cluster bitmap, set when the word holds at least one
+     * free cluster.  A search for a free cluster skips 4096 allocated clusters per summary bit examined, so finding a free
+     * cluster does not slow down as the volume fills.  The free cluster count is maintained as clusters are marked free
+     * and allocated.
+     *
+     * The bitmap storage is allocated from the filesystem cache heap by Initialize().  A copy of the bitmap copies only the
+     * size of the volume, it has to be initialized again before use.
+     */
+
+    class FAT32FreeClusterBitmap
+    {
+    public:
+        static constexpr uint32_t NO_FREE_CLUSTER = 0xFFFFFFFF;
+
+        FAT32FreeClusterBitmap(uint32_t maximum_cluster_number);
+
+        FAT32FreeClusterBitmap(const FAT32FreeClusterBitmap &bitmap_to_copy);
+
+        FAT32FreeClusterBitmap() = delete;
+        FAT32FreeClusterBitmap(FAT32FreeClusterBitmap &&) = delete;
+
+        ~FAT32FreeClusterBitmap();
+
+        FAT32FreeClusterBitmap &operator=(const FAT32FreeClusterBitmap &) = delete;
+        FAT32FreeClusterBitmap &operator=(FAT32FreeClusterBitmap &&) = delete;
+
+        /**
+         * Allocates the bitmap storage with every cluster marked as allocated.  Any existing storage is released first.
+         *
+         * @return SUCCESS or FAT32_UNABLE_TO_ALLOCATE_FREE_CLUSTER_BITMAP if the heap is exhausted, the bitmap is left
+         *         uninitialized.
+         */
+        FilesystemResultCodes Initialize();
+
+        /**
+         * Frees the bitmap storage, the bitmap must be initialized again before use.
+         */
+        void Release();
+
+        /**
+         * Returns true once the bitmap has been initialized.
+         *
+         * @return True if the bitmap can be used.
+         */
+        bool Initialized() const noexcept
+        {
+            return clusters_ != nullptr;
+        }
+
+        /**
+         * Returns the number of clusters currently marked as free.
+         *
+         * @return The number of free clusters.
+         */
+        uint32_t FreeClusters() const noexcept
+        {
+            return free_clusters_;
+        }
+
+        /**
+         * Marks a cluster as free, the caller must insure the cluster lies within the volume.
+         *
+         * @param cluster The index of the cluster to mark.
+         */
+        void MarkFree(uint32_t cluster);
+
+        /**
+         * Marks a cluster as allocated, the caller must insure the cluster lies within the volume.
+         *
+         * @param cluster The index of the cluster to mark.
+         */
+        void MarkAllocated(uint32_t cluster);
+
+        /**
+         * Finds the lowest numbered free cluster in a range of clusters.
+         *
+         * @param first_cluster The first cluster to consider.
+         * @param end_cluster One past the last cluster to consider.
+         * @return The index of the free cluster or NO_FREE_CLUSTER if every cluster in the range is allocated.
+         */
+        uint32_t FindFree(uint32_t first_cluster, uint32_t end_cluster) const;
+
+        /**
+         * Counts the free clusters in the run starting at a cluster, stopping at the first allocated cluster.
+         *
+         * @param first_cluster The first cluster of the run.
+         * @param end_cluster One past the last cluster to consider.
+         * @param maximum_length The longest run of interest, counting stops once the run reaches this length.
+         * @return The number of free clusters in the run, zero if the first cluster is allocated.
+         */
+        uint32_t FreeRunLength(uint32_t first_cluster, uint32_t end_cluster, uint32_t maximum_length) const;
+
+    private:
+        static constexpr uint32_t BITS_PER_WORD = 64;
+
+        const uint32_t number_of_clusters_;
+        const uint32_t number_of_words_;
+        const uint32_t number_of_summary_words_;
+
+        mutable SpinLock bitmap_lock_;
+
+        uint64_t *clusters_ = nullptr;
+        uint64_t *summary_ = nullptr;
+
+        uint32_t free_clusters_ = 0;
+    };
+} // namespace filesystems::fat32
@@ -117,6 +117,39 @@ namespace filesystems
             return file->Append(buffer);
         }
 
+        FilesystemResultCodes ReadAt(uint32_t offset, minstd::buffer<uint8_t> &buffer)
+        {
+            using Result = FilesystemResultCodes;
+
+            auto file = GetFileMap().GetFileByUUID(file_uuid_);
+
+            ReturnOnFailure(file);
+
+            return file->ReadAt(offset, buffer);
+        }
+
+        FilesystemResultCodes WriteAt(uint32_t offset, const minstd::buffer<uint8_t> &buffer)
+        {
+            using Result = FilesystemResultCodes;
+
+            auto file = GetFileMap().GetFileByUUID(file_uuid_);
+
+            ReturnOnFailure(file);
+
+            return file->WriteAt(offset, buffer);
+        }
+
+        FilesystemResultCodes Preallocate(uint32_t bytes)
+        {
+            using Result = FilesystemResultCodes;
+
+            auto file = GetFileMap().GetFileByUUID(file_uuid_);
+
+            ReturnOnFailure(file);
+
+            return file->Preallocate(bytes);
+        }
+
         FilesystemResultCodes Seek(uint32_t position)
         {
             using Result = FilesystemResultCodes;
@@ -139,6 +172,28 @@ namespace filesystems
             return file->SeekEnd();
         }
 
+        PointerResult<FilesystemResultCodes, FileMapping> Map(uint32_t offset, uint32_t length, FileModes mode)
+        {
+            using Result = PointerResult<FilesystemResultCodes, FileMapping>;
+
+            auto file = GetFileMap().GetFileByUUID(file_uuid_);
+
+            ReturnOnFailure(file);
+
+            return file->Map(offset, length, mode);
+        }
+
+        FilesystemResultCodes Flush()
+        {
+            using Result = FilesystemResultCodes;
+
+            auto file = GetFileMap().GetFileByUUID(file_uuid_);
+
+            ReturnOnFailure(file);
+
+            return file->Flush();
+        }
+
         FilesystemResultCodes Close()
         {
             using Result = FilesystemResultCodes;
@@ -23,6 +23,7 @@ namespace filesystems
         UNABLE_TO_READ_MASTER_BOOT_RECORD,
         BAD_MASTER_BOOT_RECORD_MAGIC_NUMBER,
         UNRECOGNIZED_FILESYSTEM_TYPE,
+        UNABLE_TO_WRITE_MASTER_BOOT_RECORD,
 
         //
         //  Non filesystem specific errors
@@ -46,6 +47,11 @@ namespace filesystems
         FILE_ALREADY_OPENED_EXCLUSIVELY,
         FILE_NOT_OPEN,
         FILE_IS_CLOSED,
+        MAPPING_OUT_OF_RANGE,
+        MAPPING_NOT_OPENED_FOR_WRITE,
+        MAPPING_RANGE_SPANS_PAGES,
+        MAPPING_UNABLE_TO_ALLOCATE_PAGE,
+        POSITION_PAST_END_OF_FILE,
 
         //
         //  Result codes for FAT32 Filesystem
@@ -67,6 +73,12 @@ namespace filesystems
         FAT32_UNABLE_TO_FIND_EMPTY_BLOCK_OF_DIRECTORY_ENTRIES,
         FAT32_ALREADY_AT_FIRST_CLUSTER,
         FAT32_CLUSTER_NOT_PRESENT_IN_CHAIN,
+        FAT32_UNABLE_TO_FORMAT_DEVICE,
+        FAT32_VOLUME_TOO_SMALL_TO_FORMAT,
+        FAT32_UNABLE_TO_ALLOCATE_FAT_CACHE,
+        FAT32_UNABLE_TO_ALLOCATE_CLUSTER_BUFFER,
+        FAT32_UNABLE_TO_ALLOCATE_FREE_CLUSTER_BITMAP,
+        FAT32_UNABLE_TO_ALLOCATE_EXTENT_MAP,
 
         //
         //  End of error codes flag
@@ -212,6 +212,54 @@ namespace filesystems
         }
     };
 
+    //  A window onto a range of an open file, held in memory in page sized units.  The range is rounded out to whole pages,
+    //      which are allocated and read from the file the first time they are accessed, so a caller touching a few pages of
+    //      a large mapping only holds and reads those pages.  Pages are not contiguous in memory, so each access has to lie
+    //      within a single page.  The bytes accessed for write are written back to the file by Flush() and Unmap().  Writes
+    //      through a mapping never change the size of the file.
+
+    class FileMapping
+    {
+    public:
+        static constexpr uint32_t PAGE_SIZE = 4096;
+
+        FileMapping() = default;
+        FileMapping(const FileMapping &mapping) = delete;
+        FileMapping(FileMapping &&mapping) = delete;
+
+        FileMapping &operator=(const FileMapping &mapping) = delete;
+        FileMapping &operator=(FileMapping &&mapping) = delete;
+
+        virtual ~FileMapping()
+        {
+        }
+
+        //  Offset into the file and length of the range mapped, as requested by the caller
+
+        virtual uint32_t Offset() const = 0;
+        virtual uint32_t Length() const = 0;
+
+        //  Size of the pages the mapping is held in.  Pages are aligned to the page size in the file, not in the mapping.
+
+        virtual uint32_t PageSize() const = 0;
+
+        //  Returns a pointer to a range of the mapping, reading the page holding it if it is not already in memory.  The
+        //      offset is relative to the start of the mapping, the range may not cross a page boundary and the pointer stays
+        //      valid until the mapping is unmapped.
+
+        virtual ValueResult<FilesystemResultCodes, const uint8_t *> Access(uint32_t offset, uint32_t length) = 0;
+
+        //  As Access(), but the range is marked dirty so changes made through the pointer are written back
+
+        virtual ValueResult<FilesystemResultCodes, uint8_t *> AccessForWrite(uint32_t offset, uint32_t length) = 0;
+
+        virtual FilesystemResultCodes Flush() = 0;
+
+        //  Flushes the mapping and releases its memory, the mapping may not be used afterwards
+
+        virtual FilesystemResultCodes Unmap() = 0;
+    };
+
     class File
     {
     public:
@@ -239,9 +287,29 @@ namespace filesystems
         virtual FilesystemResultCodes Write(const minstd::buffer<uint8_t> &buffer) = 0;
         virtual FilesystemResultCodes Append(const minstd::buffer<uint8_t> &buffer) = 0;
 
+        //  Positional reads and writes, which neither use nor move the file position.  ReadAt() reads from the offset until
+        //      the buffer is full or the end of the file is reached.  WriteAt() may start anywhere up to the end of the file and
+        //      grows the file if it writes past the end.
+
+        virtual FilesystemResultCodes ReadAt(uint32_t offset, minstd::buffer<uint8_t> &buffer) = 0;
+        virtual FilesystemResultCodes WriteAt(uint32_t offset, const minstd::buffer<uint8_t> &buffer) = 0;
+
+        //  Reserves storage for the file to grow to the number of bytes specified, the size of the file is not changed
+
+        virtual FilesystemResultCodes Preallocate(uint32_t bytes) = 0;
+
         virtual FilesystemResultCodes SeekEnd() = 0;
         virtual FilesystemResultCodes Seek(uint32_t position) = 0;
 
+        //  Maps a range of the file into memory, the range must lie within the file.  The mode must include WRITE for the
+        //      mapping to be written through.
+
+        virtual PointerResult<FilesystemResultCodes, FileMapping> Map(uint32_t offset, uint32_t length, FileModes mode) = 0;
+
+        //  Writes metadata held in memory by the open file, such as its size, back to the filesystem.  Close() flushes as well.
+
+        virtual FilesystemResultCodes Flush() = 0;
+
         virtual FilesystemResultCodes Close() = 0;
     };
 
@@ -337,5 +405,7 @@ namespace filesystems
 
     SimpleSuccessOrFailure MountSDCardFilesystems();
 
+    SimpleSuccessOrFailure MountRamDiskFilesystem(const char *name, uint64_t size_in_bytes);
+
     ReferenceResult<FilesystemResultCodes, Filesystem> GetBootFilesystem();
 } // namespace filesystems
@@ -13,5 +13,9 @@ namespace filesystems
 {
 
     FilesystemResultCodes GetPartitions(BlockIODevice &io_device, MassStoragePartitions &partitions);
-    
+
+    //  Writes a master boot record with a single FAT32 partition covering the specified sectors
+
+    FilesystemResultCodes WriteMasterBootRecord(BlockIODevice &io_device, uint32_t first_sector, uint32_t number_of_sectors);
+
 } // namespace filesystems
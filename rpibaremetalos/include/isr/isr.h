@@ -20,6 +20,7 @@ typedef enum class Interrupts : uint32_t
     SYSTEM_TIMER_1 = 65,
     SYSTEM_TIMER_2 = 66,
     SYSTEM_TIMER_3 = 67,
+    EMMC = 126,
 } Interrupts;
 
 const char *ToString(Interrupts interrupt);
@@ -31,7 +32,8 @@ typedef enum InterruptServiceRoutineType : uint32_t
     HALT_CORE = 1,
     IMPERATIVE_CORE_TASK_SWITCH = 2,
     SYSTEM_TIMER_RESCHEDULE = 3,
-    TASK_SCHEDULER = 4
+    TASK_SCHEDULER = 4,
+    BLOCK_IO_COMPLETION = 5
 } InterruptServiceRoutineType;
 
 class InterruptServiceRoutine
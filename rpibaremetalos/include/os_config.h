@@ -71,6 +71,26 @@ constexpr size_t MAX_OS_ENTITY_NAME_LENGTH = 64;
 constexpr size_t MAX_TASK_NAME_LENGTH = 64;
 constexpr size_t MAX_ACTIVE_TASKS_PER_CORE = 1024;
 
+//
+//  Block IO limits
+//
+
+constexpr size_t MAX_QUEUED_BLOCK_IO_REQUESTS = 32;
+constexpr size_t MAX_BLOCK_IO_MERGED_BLOCKS = 256;            //  Largest multi-block transfer the elevator will build from queued requests
+constexpr size_t MAX_BLOCK_IO_MERGE_READ_GAP_IN_BLOCKS = 8;   //  Reads separated by a gap this size or smaller are merged, the gap is read and discarded
+constexpr uint32_t MIN_SD_CARD_PRE_ERASE_BLOCKS = 16;          //  Multi-block SD card writes of at least this many blocks are preceded by ACMD23
+constexpr uint32_t MAX_SD_CARD_ERASE_BLOCKS = 8192;            //  Largest range erased by one SD card erase command, keeps each erase within the busy timeout
+constexpr uint32_t SD_CARD_DMA_BOUNCE_BUFFER_BLOCKS = 64;      //  Size of the aligned buffer misaligned SD card transfers are staged through so they can still use DMA
+constexpr size_t BLOCK_IO_BUFFER_ALIGNMENT = 64;               //  Alignment of data buffers handed to block devices, DMA needs buffers on a cache line boundary
+
+constexpr uint32_t MAX_BLOCK_IO_SERVICE_QUEUE_DEPTH = 64;      //  Requests waiting for a block IO service task, must be a power of two
+constexpr uint32_t DEFAULT_BLOCK_IO_SERVICE_CORE = 3;          //  Core the SD card IO service task is pinned to
+constexpr uint32_t BLOCK_IO_PRIORITY_AGING_LIMIT = 8;          //  Dispatches of more urgent IO a waiting priority class will sit through before it goes next
+
+constexpr size_t DEFAULT_BLOCK_IO_CACHE_SIZE_IN_BLOCKS = 512;         //  Blocks held by the write-back cache placed in front of the SD card
+constexpr size_t BLOCK_IO_CACHE_FLUSH_STAGING_BLOCKS = 16;            //  Largest run of contiguous dirty blocks written back with a single command
+constexpr uint32_t DEFAULT_BLOCK_IO_CACHE_FLUSH_INTERVAL_IN_MS = 1000; //  Period of the background task writing dirty blocks back to the media
+
 //
 //  Filesystem limits
 //
@@ -85,4 +105,21 @@ constexpr size_t DEFAULT_DIRECTORY_CACHE_SIZE = 4096;
 
 constexpr size_t MAX_FAT32_SHORT_FILENAME_SEARCH_TABLE_SIZE = 100;
 
+constexpr bool DEFAULT_FAT32_DISCARD_FREED_CLUSTERS = true;     //  Mount default for discarding clusters on the device when they are freed
+constexpr uint32_t DEFAULT_FAT32_FAT_CACHE_SIZE_IN_SECTORS = 128; //  Mount default for the number of FAT sectors cached in memory, zero disables the cache
+constexpr bool DEFAULT_FAT32_FREE_CLUSTER_BITMAP = true;        //  Mount default for building a free cluster bitmap, so allocation does not scan the FAT
+constexpr size_t MAX_FAT32_PENDING_DISCARD_RUNS = 32;            //  Freed cluster runs held until the FAT freeing them is on the device, runs beyond this are not discarded
+
+constexpr size_t MAX_FAT32_READ_AHEAD_CLUSTERS = 16;             //  Upper limit on the read-ahead window for sequential file reads
+constexpr size_t MAX_FAT32_READ_AHEAD_BYTES = 64 * BYTES_1K;      //  Read-ahead window is also limited in bytes, so large clusters do not pin too much memory
+
+constexpr uint32_t FAT32_FORMAT_PARTITION_FIRST_SECTOR = 64;      //  Sector where the partition starts when a device is formatted, sectors before it hold the MBR
+
+//
+//  RAM Disk
+//
+
+constexpr uint64_t DEFAULT_RAM_DISK_SIZE_IN_BYTES = 48 * BYTES_1M;  //  Size of the scratch RAM disk created at boot, zero disables the RAM disk.  FAT32 needs at least 33MB.
+constexpr const char *DEFAULT_RAM_DISK_NAME = "RAMDISK";            //  Name of the RAM disk device, also used as the volume label of the scratch filesystem
+
 #endif
@@ -67,13 +67,18 @@ typedef enum class BCM2837ARMCInterruptRequestRegisters
 //
 //	System Timers 0 and 2 are reserved for the GPU on the 2837
 //
+//  The system timers are in the IRQ pending/enable 1 registers, the EMMC controller
+//      is GPU IRQ 62 which is bit 30 of the IRQ pending/enable 2 registers.
+//
 
 typedef enum class BCM2837Interrupts : int32_t
 {
     NO_SUCH_INTERRUPT = -1,
 
     SYSTEM_TIMER_1 = 2,
-    SYSTEM_TIMER_3 = 8
+    SYSTEM_TIMER_3 = 8,
+
+    EMMC = 0x40000000
 } BCM2837Interrupts;
 
 class BCM2837ExceptionManager : public ExceptionManager
@@ -166,6 +171,9 @@ private:
         case Interrupts::SYSTEM_TIMER_3:
             return BCM2837Interrupts::SYSTEM_TIMER_3;
 
+        case Interrupts::EMMC:
+            return BCM2837Interrupts::EMMC;
+
         default:
             return BCM2837Interrupts::NO_SUCH_INTERRUPT;
         }
@@ -183,6 +191,9 @@ private:
         case BCM2837Interrupts::SYSTEM_TIMER_3:
             return Interrupts::SYSTEM_TIMER_3;
 
+        case BCM2837Interrupts::EMMC:
+            return Interrupts::EMMC;
+
         default:
             LogError("No such interrupt: %d\n", interrupt);
 
@@ -262,6 +273,10 @@ private:
         case Interrupts::SYSTEM_TIMER_3:
             SetRegister(BCM2837ARMCInterruptRequestRegisters::ENABLE_IRQS_1, (uint32_t)BCM2837Interrupts::SYSTEM_TIMER_3);
             return true;
+
+        case Interrupts::EMMC:
+            SetRegister(BCM2837ARMCInterruptRequestRegisters::ENABLE_IRQS_2, (uint32_t)BCM2837Interrupts::EMMC);
+            return true;
         }
 
         return false;
@@ -347,6 +362,10 @@ private:
         case Interrupts::SYSTEM_TIMER_3:
             SetRegister(BCM2837ARMCInterruptRequestRegisters::DISABLE_IRQS_1, (uint32_t)BCM2837Interrupts::SYSTEM_TIMER_3);
             return true;
+
+        case Interrupts::EMMC:
+            SetRegister(BCM2837ARMCInterruptRequestRegisters::DISABLE_IRQS_2, (uint32_t)BCM2837Interrupts::EMMC);
+            return true;
         }
 
         return false;
@@ -52,7 +52,8 @@ typedef enum class BCM2711Interrupts : int32_t
     SYSTEM_TIMER_0 = 0x60,
     SYSTEM_TIMER_1 = 0x61,
     SYSTEM_TIMER_2 = 0x62,
-    SYSTEM_TIMER_3 = 0x63
+    SYSTEM_TIMER_3 = 0x63,
+    EMMC = 0x9E //  EMMC2 controller, VC IRQ 62
 } BCM2711Interrupts;
 
 inline bool IsMailboxInterrupt(BCM2711Interrupts interrupt)
@@ -105,11 +106,19 @@ private:
         *((volatile uint32_t *)(BCM2711_GIC400_BASE + (uint32_t)reg)) = value;
     }
 
+    uint32_t GICInterruptNumber(uint32_t core_id, BCM2711Interrupts interrupt)
+    {
+        //  Only the core mailboxes have a separate interrupt for each core, 4 apart.  Peripheral interrupts have a single
+        //      number shared by all cores, they are steered to a core through the CPU target register.
+
+        return static_cast<uint32_t>(interrupt) + (IsMailboxInterrupt(interrupt) ? (4 * core_id) : 0);
+    }
+
     void Enable2711Interrupt(uint32_t core_id, BCM2711Interrupts interrupt)
     {
         //  There are 256 interrupts which are enabled/disabled by bits in one of 8 32 bit registers
 
-        uint32_t interrupt_num = static_cast<uint32_t>(interrupt) + (4 * core_id);
+        uint32_t interrupt_num = GICInterruptNumber(core_id, interrupt);
 
         unsigned int reg_num = interrupt_num / 32;
         unsigned int bit_mask = 1 << (interrupt_num % 32);
@@ -129,7 +138,7 @@ private:
     {
         //  There are 256 interrupts which are enabled/disabled by bits in one of 8 32 bit registers
 
-        uint32_t interrupt_num = static_cast<uint32_t>(interrupt) + (4 * core_id);
+        uint32_t interrupt_num = GICInterruptNumber(core_id, interrupt);
 
         unsigned int reg_num = interrupt_num / 32;
         unsigned int bit_mask = 1 << (interrupt_num % 32);
@@ -198,6 +207,9 @@ private:
         case Interrupts::SYSTEM_TIMER_3:
             return BCM2711Interrupts::SYSTEM_TIMER_3;
 
+        case Interrupts::EMMC:
+            return BCM2711Interrupts::EMMC;
+
         default:
             return BCM2711Interrupts::NO_SUCH_INTERRUPT;
         }
@@ -243,6 +255,9 @@ private:
         case BCM2711Interrupts::SYSTEM_TIMER_3:
             return Interrupts::SYSTEM_TIMER_3;
 
+        case BCM2711Interrupts::EMMC:
+            return Interrupts::EMMC;
+
         default:
             break;
         }
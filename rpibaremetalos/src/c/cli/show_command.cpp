@@ -12,10 +12,16 @@
 #include "platform/kernel_command_line.h"
 
 #include "devices/character_io.h"
+#include "devices/block_io.h"
+
+#include "os_entity.h"
 
 #include "heaps.h"
 
 #include <format>
+#include <list>
+#include <__memory_resource/monotonic_buffer_resource.h>
+#include <__memory_resource/polymorphic_allocator.h>
 
 extern CharacterIODevice *stdout;
 
@@ -24,6 +30,7 @@ namespace cli::commands
     //  Create instances of the individual show commands
 
     const CLIShowDiagnosticsCommand CLIShowDiagnosticsCommand::instance;
+    const CLIShowBlockIOCommand CLIShowBlockIOCommand::instance;
 
     //  Create the top-level show command
 
@@ -87,4 +94,126 @@ namespace cli::commands
         context.output_stream_ << "\n\n";
     }
 
-} // namespace cli
\ No newline at end of file
+    //  Command to show block IO statistics
+
+    static void ShowLatencyHistogram(CLISessionContext &context,
+                                     const char *command_class_name,
+                                     const BlockIOLatencyHistogram &histogram)
+    {
+        minstd::fixed_string<256> format_buffer;
+
+        if (histogram.Count() == 0)
+        {
+            return;
+        }
+
+        context.output_stream_ << minstd::format(format_buffer, "    {} Latency: {} commands, {}us average, {}us maximum\n", command_class_name, histogram.Count(), histogram.AverageLatencyInMicroseconds(), histogram.MaximumLatencyInMicroseconds());
+
+        for (uint32_t bucket = 0; bucket < BlockIOLatencyHistogram::NUMBER_OF_BUCKETS; bucket++)
+        {
+            if (histogram.BucketCount(bucket) > 0)
+            {
+                context.output_stream_ << minstd::format(format_buffer, "        >= {}us: {}\n", BlockIOLatencyHistogram::BucketLowerBoundInMicroseconds(bucket), histogram.BucketCount(bucket));
+            }
+        }
+    }
+
+    static void ShowBlockIODeviceStatistics(CLISessionContext &context,
+                                            BlockIODevice &device)
+    {
+        minstd::fixed_string<256> format_buffer;
+
+        //  Layered devices like service queues pass their IO on, the counters and latencies are kept by the device at the
+        //      bottom of the stack
+
+        BlockIODevice *media_device = &device;
+
+        while (media_device->UnderlyingDevice() != nullptr)
+        {
+            media_device = media_device->UnderlyingDevice();
+        }
+
+        const BlockIOStatistics &statistics = media_device->Statistics();
+
+        if (media_device == &device)
+        {
+            context.output_stream_ << minstd::format(format_buffer, "Block Device: '{}'\n", device.Name());
+        }
+        else
+        {
+            context.output_stream_ << minstd::format(format_buffer, "Block Device: '{}' on '{}'\n", device.Name(), media_device->Name());
+        }
+
+        context.output_stream_ << minstd::format(format_buffer, "    Reads: {} commands, {} blocks\n", statistics.Reads(), statistics.BlocksRead());
+        context.output_stream_ << minstd::format(format_buffer, "    Writes: {} commands, {} blocks\n", statistics.Writes(), statistics.BlocksWritten());
+        context.output_stream_ << minstd::format(format_buffer, "    Retries: {}, Errors: {}\n", statistics.Retries(), statistics.Errors());
+        context.output_stream_ << minstd::format(format_buffer, "    Queued Requests: {}, Current Queue Depth: {}, Maximum Queue Depth: {}\n", statistics.RequestsQueued(), media_device->QueuedRequests(), statistics.MaximumQueueDepth());
+
+        ShowLatencyHistogram(context, "Single Block Read", statistics.Latency(BlockIOCommandClass::SINGLE_BLOCK_READ));
+        ShowLatencyHistogram(context, "Multiple Block Read", statistics.Latency(BlockIOCommandClass::MULTIPLE_BLOCK_READ));
+        ShowLatencyHistogram(context, "Single Block Write", statistics.Latency(BlockIOCommandClass::SINGLE_BLOCK_WRITE));
+        ShowLatencyHistogram(context, "Multiple Block Write", statistics.Latency(BlockIOCommandClass::MULTIPLE_BLOCK_WRITE));
+
+        if ((statistics.InterruptCompletions() + statistics.PolledCompletions()) > 0)
+        {
+            context.output_stream_ << minstd::format(format_buffer, "    Completions: {} by interrupt, {} by polling\n", statistics.InterruptCompletions(), statistics.PolledCompletions());
+
+            ShowLatencyHistogram(context, "Completion Wait", statistics.CompletionWait());
+        }
+    }
+
+    void CLIShowBlockIOCommand::ProcessToken(CommandParser &parser,
+                                             CLISessionContext &context) const
+    {
+        minstd::fixed_string<256> format_buffer;
+
+        //  Get the list of block devices
+
+        using uuid_node_type = minstd::list<UUID>::node_type;
+        alignas(uuid_node_type) uint8_t uuid_list_buffer[sizeof(uuid_node_type) * MAX_CLI_BLOCK_DEVICES_TO_LIST + alignof(uuid_node_type) * MAX_CLI_BLOCK_DEVICES_TO_LIST];
+        minstd::pmr::monotonic_buffer_resource uuid_list_resource(uuid_list_buffer, sizeof(uuid_list_buffer), nullptr);
+        minstd::pmr::polymorphic_allocator<uuid_node_type> uuid_list_allocator(&uuid_list_resource);
+        minstd::list<UUID> block_device_ids(uuid_list_allocator);
+
+        GetOSEntityRegistry().FindEntitiesByType(OSEntityTypes::BLOCK_DEVICE, block_device_ids);
+
+        if (block_device_ids.empty())
+        {
+            context.output_stream_ << "No block devices available\n";
+            return;
+        }
+
+        //  Caches report hit rates, the IO counters and latencies come from the device behind the cache
+
+        for (const auto &block_device_id : block_device_ids)
+        {
+            auto block_device_entity = GetOSEntityRegistry().GetEntityById(block_device_id);
+
+            if (block_device_entity.Failed())
+            {
+                context.output_stream_ << "Error getting block device\n";
+                continue;
+            }
+
+            auto &block_device = static_cast<BlockIODevice &>(block_device_entity);
+
+            const BlockIOCacheStatistics *cache_statistics = block_device.CacheStatistics();
+
+            if ((cache_statistics == nullptr) || (block_device.UnderlyingDevice() == nullptr))
+            {
+                ShowBlockIODeviceStatistics(context, block_device);
+            }
+            else
+            {
+                context.output_stream_ << minstd::format(format_buffer, "Block Cache: '{}'\n", block_device.Name());
+                context.output_stream_ << minstd::format(format_buffer, "    {} blocks, {} dirty, {} hits, {} misses, {} blocks written back\n", cache_statistics->CacheSizeInBlocks(), cache_statistics->DirtyBlocks(), cache_statistics->Hits(), cache_statistics->Misses(), cache_statistics->BlocksWrittenBack());
+                context.output_stream_ << minstd::format(format_buffer, "    Queued Requests: {}, Maximum Queue Depth: {}\n", block_device.Statistics().RequestsQueued(), block_device.Statistics().MaximumQueueDepth());
+
+                ShowBlockIODeviceStatistics(context, *block_device.UnderlyingDevice());
+            }
+
+            context.output_stream_ << "\n";
+        }
+    }
+
+} // namespace cli
@@ -4,6 +4,16 @@
 
 #include "devices/block_io.h"
 
+#include <string.h>
+
+#include "heaps.h"
+
+#include "task/system_calls.h"
+
+//  Bounce buffers are cache line aligned so devices with DMA engines can transfer directly into them
+
+static constexpr size_t BOUNCE_BUFFER_ALIGNMENT = 64;
+
 //
 //  These messages must be ordered identically to the result codes
 //
@@ -12,6 +22,12 @@ static const char *const BlockIOErrorMessages[] = {
     "SUCCESS",
     "FAILURE - Unspecified failure",
 
+    "REQUEST_QUEUE_FULL - Device request queue is full",
+    "REQUEST_ALREADY_QUEUED - Request is already queued or in flight",
+
+    "RAM_DISK_BLOCK_OUT_OF_RANGE - Block number is beyond the end of the RAM disk",
+    "RAM_DISK_UNABLE_TO_ALLOCATE_MEMORY - Unable to allocate memory for the RAM disk",
+
     "EMMC_READ_FAILED - Read from SD Card Failed",
     "EMMC_INVALID_STORAGE_OFFSET - Invalid offset into SD card storage.  Most likely the offset is incompatible with the device block size.",
     "EMMC_DATA_COMMAND_MAX_RETRIES - Maximum retries exceeded attempting to execute Data command",
@@ -35,7 +51,9 @@ static const char *const BlockIOErrorMessages[] = {
     "EMMC_TIMEOUT_WAITING_FOR_INHIBITS_TO_CLEAR - Timeout while waiting for SD Command or Data Inhibits to clear",
     "EMMC_TIMEOUT_FOR_CARD_RESET - Timeout waiting for SD Card reset",
     "EMMC_TIMEOUT_WHILE_PROBING_FOR_SDHC_CARD - Timeout while probing for SDHC Card",
-    "EMMC_TIMEOUT_FOR_ISSUE_COMMAND - Issue Command, Timeout"};
+    "EMMC_TIMEOUT_FOR_ISSUE_COMMAND - Issue Command, Timeout",
+    "EMMC_DATA_LINE_FAILED_TO_RESET_CORRECTLY - Data line failed to reset correctly",
+    "EMMC_ERASE_FAILED - Erase of SD Card blocks failed"};
 
 //
 //  Insure the number of messages equals the number of error codes.
@@ -47,3 +65,486 @@ const char *BlockIODevice::GetMessageForResultCode(BlockIOResultCodes code)
 {
     return BlockIOErrorMessages[static_cast<uint32_t>(code)];
 }
+
+//
+//  Vectored IO - devices without scatter-gather support stage the transfer in a bounce buffer so it is still a single command
+//
+
+static uint32_t TotalBlocks(const BlockIOSegment *segments, uint32_t number_of_segments)
+{
+    uint32_t total_blocks = 0;
+
+    for (uint32_t i = 0; i < number_of_segments; i++)
+    {
+        total_blocks += segments[i].block_count_;
+    }
+
+    return total_blocks;
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> BlockIODevice::ReadBlocksV(BlockIOPriority priority, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number)
+{
+    using Result = ValueResult<BlockIOResultCodes, uint32_t>;
+
+    if (number_of_segments == 0)
+    {
+        return Result::Success(0);
+    }
+
+    if (number_of_segments == 1)
+    {
+        return ReadFromBlockWithPriority(priority, segments[0].buffer_, block_number, segments[0].block_count_);
+    }
+
+    uint32_t total_blocks = TotalBlocks(segments, number_of_segments);
+    uint32_t block_size = BlockSize();
+
+    uint8_t *bounce_buffer = static_cast<uint8_t *>(__os_dynamic_heap_resource.allocate(total_blocks * block_size, BOUNCE_BUFFER_ALIGNMENT));
+
+    if (bounce_buffer == nullptr)
+    {
+        return Result::Failure(BlockIOResultCodes::FAILURE);
+    }
+
+    auto read_result = ReadFromBlockWithPriority(priority, bounce_buffer, block_number, total_blocks);
+
+    if (read_result.Successful())
+    {
+        uint8_t *source = bounce_buffer;
+
+        for (uint32_t i = 0; i < number_of_segments; i++)
+        {
+            memcpy(segments[i].buffer_, source, segments[i].block_count_ * block_size);
+            source += segments[i].block_count_ * block_size;
+        }
+    }
+
+    __os_dynamic_heap_resource.deallocate(bounce_buffer, total_blocks * block_size, BOUNCE_BUFFER_ALIGNMENT);
+
+    return read_result;
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> BlockIODevice::WriteBlocksV(BlockIOPriority priority, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number)
+{
+    using Result = ValueResult<BlockIOResultCodes, uint32_t>;
+
+    if (number_of_segments == 0)
+    {
+        return Result::Success(0);
+    }
+
+    if (number_of_segments == 1)
+    {
+        return WriteBlockWithPriority(priority, segments[0].buffer_, block_number, segments[0].block_count_);
+    }
+
+    uint32_t total_blocks = TotalBlocks(segments, number_of_segments);
+    uint32_t block_size = BlockSize();
+
+    uint8_t *bounce_buffer = static_cast<uint8_t *>(__os_dynamic_heap_resource.allocate(total_blocks * block_size, BOUNCE_BUFFER_ALIGNMENT));
+
+    if (bounce_buffer == nullptr)
+    {
+        return Result::Failure(BlockIOResultCodes::FAILURE);
+    }
+
+    uint8_t *destination = bounce_buffer;
+
+    for (uint32_t i = 0; i < number_of_segments; i++)
+    {
+        memcpy(destination, segments[i].buffer_, segments[i].block_count_ * block_size);
+        destination += segments[i].block_count_ * block_size;
+    }
+
+    auto write_result = WriteBlockWithPriority(priority, bounce_buffer, block_number, total_blocks);
+
+    __os_dynamic_heap_resource.deallocate(bounce_buffer, total_blocks * block_size, BOUNCE_BUFFER_ALIGNMENT);
+
+    return write_result;
+}
+
+//
+//  Asynchronous request queue
+//
+
+BlockIOResultCodes BlockIODevice::SubmitRequest(BlockIORequest &request)
+{
+    LockGuard lock(request_queue_lock_);
+
+    if ((request.state_ == BlockIORequestState::QUEUED) || (request.state_ == BlockIORequestState::IN_FLIGHT))
+    {
+        return BlockIOResultCodes::REQUEST_ALREADY_QUEUED;
+    }
+
+    if (queued_request_count_ >= MAX_QUEUED_BLOCK_IO_REQUESTS)
+    {
+        return BlockIOResultCodes::REQUEST_QUEUE_FULL;
+    }
+
+    request.state_ = BlockIORequestState::QUEUED;
+    request.result_code_ = BlockIOResultCodes::SUCCESS;
+    request.blocks_transferred_ = 0;
+
+    request_queue_[(request_queue_head_ + queued_request_count_) % MAX_QUEUED_BLOCK_IO_REQUESTS] = &request;
+    queued_request_count_ = queued_request_count_ + 1;
+
+    statistics_.RecordQueueDepth(queued_request_count_);
+
+    return BlockIOResultCodes::SUCCESS;
+}
+
+//
+//  Elevator - requests are pulled from the queue in batches, sorted by block number and adjacent requests merged
+//
+
+static inline uint32_t EndBlock(const BlockIORequest &request)
+{
+    return request.BlockNumber() + request.BlockCount();
+}
+
+static inline bool Overlaps(const BlockIORequest &first, const BlockIORequest &second)
+{
+    return (first.BlockNumber() < EndBlock(second)) && (second.BlockNumber() < EndBlock(first));
+}
+
+uint32_t BlockIODevice::DequeueBatch(BlockIORequest **batch)
+{
+    LockGuard lock(request_queue_lock_);
+
+    uint32_t batch_size = 0;
+
+    while (queued_request_count_ > 0)
+    {
+        BlockIORequest *next_request = request_queue_[request_queue_head_];
+
+        //  Sorting the batch would reorder a write and any other request touching the same blocks,
+        //      so stop the batch at the first such request.  It will lead off the next batch.
+
+        for (uint32_t i = 0; i < batch_size; i++)
+        {
+            if (((next_request->Direction() == BlockIODirection::WRITE) || (batch[i]->Direction() == BlockIODirection::WRITE)) &&
+                Overlaps(*next_request, *batch[i]))
+            {
+                return batch_size;
+            }
+        }
+
+        request_queue_head_ = (request_queue_head_ + 1) % MAX_QUEUED_BLOCK_IO_REQUESTS;
+        queued_request_count_ = queued_request_count_ - 1;
+
+        next_request->state_ = BlockIORequestState::IN_FLIGHT;
+
+        batch[batch_size++] = next_request;
+    }
+
+    //  Queue is empty, so release the device for processing while we hold the lock.  Any requests
+    //      submitted after this point will be picked up by the next call to ProcessRequests().
+
+    if (batch_size == 0)
+    {
+        processing_requests_ = false;
+    }
+
+    return batch_size;
+}
+
+void BlockIODevice::ExecuteBatch(BlockIORequest **batch, uint32_t batch_size)
+{
+    //  Insertion sort by priority class and then block number, the batch is small and the sort is stable.  More urgent
+    //      requests go first, the elevator only reorders requests within a class.
+
+    for (uint32_t i = 1; i < batch_size; i++)
+    {
+        BlockIORequest *current = batch[i];
+        uint32_t j = i;
+
+        while ((j > 0) &&
+               ((batch[j - 1]->Priority() > current->Priority()) ||
+                ((batch[j - 1]->Priority() == current->Priority()) && (batch[j - 1]->BlockNumber() > current->BlockNumber()))))
+        {
+            batch[j] = batch[j - 1];
+            j--;
+        }
+
+        batch[j] = current;
+    }
+
+    //  Walk the sorted batch and gather runs of requests which can be merged into a single transfer.
+    //      Writes must be exactly contiguous, reads may have small gaps which are read and discarded.
+
+    uint32_t run_start = 0;
+
+    while (run_start < batch_size)
+    {
+        const BlockIORequest &first = *batch[run_start];
+
+        uint32_t run_end_block = EndBlock(first);
+        uint32_t run_end = run_start + 1;
+
+        while (run_end < batch_size)
+        {
+            const BlockIORequest &next = *batch[run_end];
+
+            if ((next.Direction() != first.Direction()) ||
+                (next.Priority() != first.Priority()) ||
+                (next.BlockNumber() < run_end_block) ||
+                (EndBlock(next) - first.BlockNumber() > MAX_BLOCK_IO_MERGED_BLOCKS))
+            {
+                break;
+            }
+
+            uint32_t gap = next.BlockNumber() - run_end_block;
+
+            if ((gap > 0) && ((first.Direction() == BlockIODirection::WRITE) || (gap > MAX_BLOCK_IO_MERGE_READ_GAP_IN_BLOCKS)))
+            {
+                break;
+            }
+
+            run_end_block = EndBlock(next);
+            run_end++;
+        }
+
+        ExecuteMergedRequests(&batch[run_start], run_end - run_start);
+
+        run_start = run_end;
+    }
+}
+
+void BlockIODevice::ExecuteMergedRequests(BlockIORequest **requests, uint32_t number_of_requests)
+{
+    //  Single requests go straight to the device
+
+    if (number_of_requests == 1)
+    {
+        auto execute_result = ExecuteRequest(*requests[0]);
+
+        CompleteRequest(*requests[0], execute_result.ResultCode(), execute_result.Successful() ? *execute_result : 0);
+        return;
+    }
+
+    BlockIODirection direction = requests[0]->Direction();
+    uint32_t first_block = requests[0]->BlockNumber();
+    uint32_t total_blocks = EndBlock(*requests[number_of_requests - 1]) - first_block;
+    uint32_t block_size = BlockSize();
+
+    //  If the caller's buffers happen to sit back to back in memory with no gaps between the blocks, then
+    //      the transfer can go directly into them.  If there are no gaps between the blocks but the buffers are
+    //      scattered, the transfer is a vectored transfer over the request buffers.  Otherwise we stage the
+    //      transfer in a bounce buffer.
+
+    bool requests_abut = true;
+    bool buffers_are_contiguous = true;
+
+    for (uint32_t i = 1; i < number_of_requests; i++)
+    {
+        if (requests[i]->BlockNumber() != EndBlock(*requests[i - 1]))
+        {
+            requests_abut = false;
+            buffers_are_contiguous = false;
+            break;
+        }
+
+        if (requests[i]->Buffer() != requests[i - 1]->Buffer() + (requests[i - 1]->BlockCount() * block_size))
+        {
+            buffers_are_contiguous = false;
+        }
+    }
+
+    if (requests_abut && !buffers_are_contiguous)
+    {
+        BlockIOSegment segments[MAX_QUEUED_BLOCK_IO_REQUESTS];
+
+        //  The merged transfer goes at the priority of the most urgent request in it
+
+        BlockIOPriority priority = requests[0]->Priority();
+
+        for (uint32_t i = 0; i < number_of_requests; i++)
+        {
+            segments[i] = {requests[i]->Buffer(), requests[i]->BlockCount()};
+
+            if (static_cast<uint32_t>(requests[i]->Priority()) < static_cast<uint32_t>(priority))
+            {
+                priority = requests[i]->Priority();
+            }
+        }
+
+        auto vectored_result = (direction == BlockIODirection::READ) ? ReadBlocksV(priority, segments, number_of_requests, first_block)
+                                                                     : WriteBlocksV(priority, segments, number_of_requests, first_block);
+
+        for (uint32_t i = 0; i < number_of_requests; i++)
+        {
+            if (vectored_result.Successful())
+            {
+                CompleteRequest(*requests[i], BlockIOResultCodes::SUCCESS, requests[i]->BlockCount());
+            }
+            else
+            {
+                ExecuteMergedRequests(&requests[i], 1);
+            }
+        }
+
+        return;
+    }
+
+    uint8_t *transfer_buffer = requests[0]->Buffer();
+
+    if (!buffers_are_contiguous)
+    {
+        transfer_buffer = static_cast<uint8_t *>(__os_dynamic_heap_resource.allocate(total_blocks * block_size, BOUNCE_BUFFER_ALIGNMENT));
+
+        //  If we cannot get a bounce buffer, fall back to executing the requests one at a time
+
+        if (transfer_buffer == nullptr)
+        {
+            for (uint32_t i = 0; i < number_of_requests; i++)
+            {
+                ExecuteMergedRequests(&requests[i], 1);
+            }
+
+            return;
+        }
+
+        if (direction == BlockIODirection::WRITE)
+        {
+            for (uint32_t i = 0; i < number_of_requests; i++)
+            {
+                memcpy(transfer_buffer + ((requests[i]->BlockNumber() - first_block) * block_size), requests[i]->Buffer(), requests[i]->BlockCount() * block_size);
+            }
+        }
+    }
+
+    //  The merged transfer carries the most urgent priority of the requests folded into it
+
+    BlockIOPriority priority = requests[0]->Priority();
+
+    for (uint32_t i = 1; i < number_of_requests; i++)
+    {
+        if (requests[i]->Priority() < priority)
+        {
+            priority = requests[i]->Priority();
+        }
+    }
+
+    BlockIORequest merged_request(direction, transfer_buffer, first_block, total_blocks, nullptr, nullptr, priority);
+
+    auto execute_result = ExecuteRequest(merged_request);
+
+    if (execute_result.Successful())
+    {
+        //  Split the completion back out to the individual requests
+
+        for (uint32_t i = 0; i < number_of_requests; i++)
+        {
+            if (!buffers_are_contiguous && (direction == BlockIODirection::READ))
+            {
+                memcpy(requests[i]->Buffer(), transfer_buffer + ((requests[i]->BlockNumber() - first_block) * block_size), requests[i]->BlockCount() * block_size);
+            }
+
+            CompleteRequest(*requests[i], BlockIOResultCodes::SUCCESS, requests[i]->BlockCount());
+        }
+    }
+
+    if (!buffers_are_contiguous)
+    {
+        __os_dynamic_heap_resource.deallocate(transfer_buffer, total_blocks * block_size, BOUNCE_BUFFER_ALIGNMENT);
+    }
+
+    //  If the merged transfer failed, retry the requests one at a time so only those which really fail are reported as failures
+
+    if (execute_result.Failed())
+    {
+        for (uint32_t i = 0; i < number_of_requests; i++)
+        {
+            ExecuteMergedRequests(&requests[i], 1);
+        }
+    }
+}
+
+uint32_t BlockIODevice::ProcessRequests()
+{
+    //  Only one task drives the device at a time, if another task is already processing the queue
+    //      it will pick up any requests queued while it runs.
+
+    {
+        LockGuard lock(request_queue_lock_);
+
+        if (processing_requests_)
+        {
+            return 0;
+        }
+
+        processing_requests_ = true;
+    }
+
+    uint32_t requests_completed = 0;
+
+    BlockIORequest *batch[MAX_QUEUED_BLOCK_IO_REQUESTS];
+
+    //  DequeueBatch() clears the processing flag under the lock when the queue is empty
+
+    for (uint32_t batch_size = DequeueBatch(batch); batch_size > 0; batch_size = DequeueBatch(batch))
+    {
+        ExecuteBatch(batch, batch_size);
+
+        requests_completed += batch_size;
+    }
+
+    return requests_completed;
+}
+
+BlockIOResultCodes BlockIODevice::WaitForRequest(BlockIORequest &request)
+{
+    while (!request.IsComplete())
+    {
+        if (request.State() == BlockIORequestState::IDLE)
+        {
+            return BlockIOResultCodes::FAILURE;
+        }
+
+        //  If another task is processing the queue, give up the processor until it gets to our request
+
+        if ((ProcessRequests() == 0) && !request.IsComplete())
+        {
+            sc_Yield();
+        }
+    }
+
+    //  Pairs with the release in CompleteRequest(), the results are read only after the request is seen complete
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return request.ResultCode();
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> BlockIODevice::ExecuteRequest(BlockIORequest &request)
+{
+    if (request.Direction() == BlockIODirection::WRITE)
+    {
+        return WriteBlockWithPriority(request.Priority(), request.Buffer(), request.BlockNumber(), request.BlockCount());
+    }
+
+    return ReadFromBlockWithPriority(request.Priority(), request.Buffer(), request.BlockNumber(), request.BlockCount());
+}
+
+void BlockIODevice::CompleteRequest(BlockIORequest &request, BlockIOResultCodes result_code, uint32_t blocks_transferred)
+{
+    //  Completion must be the last touch of the request, a task waiting on it may return and release the request as soon
+    //      as it sees it complete.  So the callback is copied out first, and the results are published ahead of the state.
+
+    BlockIOCompletionCallback callback = request.callback_;
+    void *callback_context = request.callback_context_;
+
+    request.result_code_ = result_code;
+    request.blocks_transferred_ = blocks_transferred;
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    request.state_ = BlockIORequestState::COMPLETE;
+
+    //  The callback may re-submit the request, so it runs after the request is marked complete
+
+    if (callback != nullptr)
+    {
+        callback(request, callback_context);
+    }
+}
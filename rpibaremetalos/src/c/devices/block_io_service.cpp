@@ -0,0 +1,469 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "devices/block_io_service.h"
+
+#include "heaps.h"
+
+namespace
+{
+    void InitializeRequest(BlockIOServiceRequest &request,
+                           BlockIOServiceOperation operation,
+                           BlockIOPriority priority,
+                           uint8_t *buffer,
+                           const BlockIOSegment *segments,
+                           uint32_t number_of_segments,
+                           uint32_t block_number,
+                           uint32_t block_count)
+    {
+        request.operation_ = operation;
+        request.priority_ = priority;
+        request.buffer_ = buffer;
+        request.segments_ = segments;
+        request.number_of_segments_ = number_of_segments;
+        request.block_number_ = block_number;
+        request.block_count_ = block_count;
+        request.result_code_ = BlockIOResultCodes::SUCCESS;
+        request.blocks_transferred_ = 0;
+        request.complete_.store(0);
+    }
+
+    void RecordTransfer(BlockIOServiceRequest &request, const ValueResult<BlockIOResultCodes, uint32_t> &transfer_result)
+    {
+        request.result_code_ = transfer_result.ResultCode();
+        request.blocks_transferred_ = transfer_result.Successful() ? *transfer_result : 0;
+    }
+
+    void CompleteServiceRequest(BlockIORequest &device_request, void *context)
+    {
+        BlockIOServiceRequest &request = *static_cast<BlockIOServiceRequest *>(context);
+
+        request.result_code_ = device_request.ResultCode();
+        request.blocks_transferred_ = Failed(device_request.ResultCode()) ? 0 : device_request.BlocksTransferred();
+
+        //  Completion must be the last touch of the request, the submitting task may return as soon as it sees it
+
+        request.complete_.store(1);
+    }
+}
+
+//
+//  Lock-free multi-producer, single consumer queue
+//
+
+BlockIOServiceQueue::BlockIOServiceQueue()
+{
+    for (uint32_t i = 0; i < QUEUE_DEPTH; i++)
+    {
+        slots_[i].sequence_.store(i);
+        slots_[i].request_ = nullptr;
+    }
+
+    enqueue_position_.store(0);
+}
+
+bool BlockIOServiceQueue::Push(BlockIOServiceRequest *request)
+{
+    uint32_t position = enqueue_position_.load();
+
+    while (true)
+    {
+        Slot &slot = slots_[position & (QUEUE_DEPTH - 1)];
+
+        int32_t difference = static_cast<int32_t>(slot.sequence_.load() - position);
+
+        if (difference == 0)
+        {
+            //  The slot is free for this position, try to claim it.  If another producer got there first
+            //      the compare and exchange reloads the position and we try again.
+
+            if (enqueue_position_.compare_exchange_strong(position, position + 1))
+            {
+                slot.request_ = request;
+
+                //  Publishing the sequence number hands the slot to the consumer
+
+                slot.sequence_.store(position + 1);
+
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            //  The consumer has not emptied the slot from the previous lap, so the queue is full
+
+            return false;
+        }
+        else
+        {
+            position = enqueue_position_.load();
+        }
+    }
+}
+
+bool BlockIOServiceQueue::Pop(BlockIOServiceRequest *&request)
+{
+    Slot &slot = slots_[dequeue_position_ & (QUEUE_DEPTH - 1)];
+
+    if (static_cast<int32_t>(slot.sequence_.load() - (dequeue_position_ + 1)) < 0)
+    {
+        return false;
+    }
+
+    request = slot.request_;
+
+    //  Hand the slot back to the producers for the next lap around the ring
+
+    slot.sequence_.store(dequeue_position_ + QUEUE_DEPTH);
+
+    dequeue_position_++;
+
+    return true;
+}
+
+bool BlockIOServiceQueue::Empty() const
+{
+    const Slot &slot = slots_[dequeue_position_ & (QUEUE_DEPTH - 1)];
+
+    return static_cast<int32_t>(slot.sequence_.load() - (dequeue_position_ + 1)) < 0;
+}
+
+//
+//  Priority classes with aging
+//
+
+bool BlockIOPriorityServiceQueue::Pop(BlockIOServiceRequest *&request)
+{
+    uint32_t dispatched = NUMBER_OF_BLOCK_IO_PRIORITIES;
+
+    //  A class which has been passed over too many times goes ahead of the more urgent classes
+
+    for (uint32_t priority = 1; priority < NUMBER_OF_BLOCK_IO_PRIORITIES; priority++)
+    {
+        if ((passed_over_[priority] >= BLOCK_IO_PRIORITY_AGING_LIMIT) && queues_[priority].Pop(request))
+        {
+            dispatched = priority;
+            break;
+        }
+    }
+
+    //  Otherwise strict priority order
+
+    if (dispatched == NUMBER_OF_BLOCK_IO_PRIORITIES)
+    {
+        for (uint32_t priority = 0; priority < NUMBER_OF_BLOCK_IO_PRIORITIES; priority++)
+        {
+            if (queues_[priority].Pop(request))
+            {
+                dispatched = priority;
+                break;
+            }
+        }
+    }
+
+    if (dispatched == NUMBER_OF_BLOCK_IO_PRIORITIES)
+    {
+        return false;
+    }
+
+    //  Age every less urgent class which still has requests waiting
+
+    passed_over_[dispatched] = 0;
+
+    for (uint32_t priority = dispatched + 1; priority < NUMBER_OF_BLOCK_IO_PRIORITIES; priority++)
+    {
+        if (!queues_[priority].Empty())
+        {
+            passed_over_[priority]++;
+        }
+    }
+
+    return true;
+}
+
+//
+//  Block IO Service Device
+//
+
+BlockIOResultCodes BlockIOServiceDevice::Seek(uint64_t offset_in_blocks)
+{
+    current_offset_in_blocks_ = offset_in_blocks;
+
+    return BlockIOResultCodes::SUCCESS;
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> BlockIOServiceDevice::ReadFromBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_read)
+{
+    return ReadFromBlockWithPriority(BlockIOPriority::INTERACTIVE, buffer, block_number, blocks_to_read);
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> BlockIOServiceDevice::ReadFromBlockWithPriority(BlockIOPriority priority, uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_read)
+{
+    using Result = ValueResult<BlockIOResultCodes, uint32_t>;
+
+    BlockIOServiceRequest request;
+
+    InitializeRequest(request, BlockIOServiceOperation::READ, priority, buffer, nullptr, 0, block_number, blocks_to_read);
+
+    BlockIOResultCodes result = Submit(request);
+
+    if (Failed(result))
+    {
+        return Result::Failure(result);
+    }
+
+    return Result::Success(request.blocks_transferred_);
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> BlockIOServiceDevice::ReadFromCurrentOffset(uint8_t *buffer, uint32_t blocks_to_read)
+{
+    auto read_result = ReadFromBlock(buffer, static_cast<uint32_t>(current_offset_in_blocks_), blocks_to_read);
+
+    if (read_result.Successful())
+    {
+        current_offset_in_blocks_ += *read_result;
+    }
+
+    return read_result;
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> BlockIOServiceDevice::WriteBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_write)
+{
+    return WriteBlockWithPriority(BlockIOPriority::INTERACTIVE, buffer, block_number, blocks_to_write);
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> BlockIOServiceDevice::WriteBlockWithPriority(BlockIOPriority priority, uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_write)
+{
+    using Result = ValueResult<BlockIOResultCodes, uint32_t>;
+
+    BlockIOServiceRequest request;
+
+    InitializeRequest(request, BlockIOServiceOperation::WRITE, priority, buffer, nullptr, 0, block_number, blocks_to_write);
+
+    BlockIOResultCodes result = Submit(request);
+
+    if (Failed(result))
+    {
+        return Result::Failure(result);
+    }
+
+    return Result::Success(request.blocks_transferred_);
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> BlockIOServiceDevice::ReadBlocksV(BlockIOPriority priority, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number)
+{
+    using Result = ValueResult<BlockIOResultCodes, uint32_t>;
+
+    BlockIOServiceRequest request;
+
+    InitializeRequest(request, BlockIOServiceOperation::READ_VECTORED, priority, nullptr, segments, number_of_segments, block_number, 0);
+
+    BlockIOResultCodes result = Submit(request);
+
+    if (Failed(result))
+    {
+        return Result::Failure(result);
+    }
+
+    return Result::Success(request.blocks_transferred_);
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> BlockIOServiceDevice::WriteBlocksV(BlockIOPriority priority, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number)
+{
+    using Result = ValueResult<BlockIOResultCodes, uint32_t>;
+
+    BlockIOServiceRequest request;
+
+    InitializeRequest(request, BlockIOServiceOperation::WRITE_VECTORED, priority, nullptr, segments, number_of_segments, block_number, 0);
+
+    BlockIOResultCodes result = Submit(request);
+
+    if (Failed(result))
+    {
+        return Result::Failure(result);
+    }
+
+    return Result::Success(request.blocks_transferred_);
+}
+
+BlockIOResultCodes BlockIOServiceDevice::Flush()
+{
+    BlockIOServiceRequest request;
+
+    InitializeRequest(request, BlockIOServiceOperation::FLUSH, BlockIOPriority::INTERACTIVE, nullptr, nullptr, 0, 0, 0);
+
+    return Submit(request);
+}
+
+BlockIOResultCodes BlockIOServiceDevice::Discard(uint32_t block_number, uint32_t number_of_blocks)
+{
+    BlockIOServiceRequest request;
+
+    //  Discards are only hints, they can wait behind everything else
+
+    InitializeRequest(request, BlockIOServiceOperation::DISCARD, BlockIOPriority::BACKGROUND, nullptr, nullptr, 0, block_number, number_of_blocks);
+
+    return Submit(request);
+}
+
+void BlockIOServiceDevice::AttachWorker(WaitFunction wait_function)
+{
+    //  The wait function must be visible before submitting tasks see the worker is attached
+
+    wait_function_ = wait_function;
+    worker_attached_.store(1);
+}
+
+void BlockIOServiceDevice::DetachWorker()
+{
+    worker_attached_.store(0);
+}
+
+uint32_t BlockIOServiceDevice::ProcessQueue()
+{
+    //  Only one task may drain the queue, if another task is already draining it then it will
+    //      pick up anything we would have found.
+
+    uint32_t not_draining = 0;
+
+    if (!draining_.compare_exchange_strong(not_draining, 1))
+    {
+        return 0;
+    }
+
+    uint32_t requests_executed = 0;
+
+    //  Reads and writes are queued on the underlying device as they are popped and dispatched together, so the device's
+    //      elevator can sort and merge them.  Any other operation first dispatches the reads and writes popped ahead of it,
+    //      so operations still reach the device in the order they were popped.  A batch only holds requests of one
+    //      priority class, the elevator sorts by block number and would otherwise undo the order the queues chose.
+
+    alignas(BlockIORequest) uint8_t device_request_buffer[sizeof(BlockIORequest) * MAX_QUEUED_BLOCK_IO_REQUESTS];
+    BlockIORequest *device_requests = reinterpret_cast<BlockIORequest *>(device_request_buffer);
+    uint32_t number_of_device_requests = 0;
+
+    BlockIOServiceRequest *request;
+
+    while (queue_.Pop(request))
+    {
+        requests_executed++;
+
+        if ((request->operation_ != BlockIOServiceOperation::READ) && (request->operation_ != BlockIOServiceOperation::WRITE))
+        {
+            DispatchDeviceRequests(device_requests, number_of_device_requests);
+            number_of_device_requests = 0;
+
+            Execute(*request);
+            continue;
+        }
+
+        if ((number_of_device_requests == MAX_QUEUED_BLOCK_IO_REQUESTS) ||
+            ((number_of_device_requests > 0) && (device_requests[0].Priority() != request->priority_)))
+        {
+            DispatchDeviceRequests(device_requests, number_of_device_requests);
+            number_of_device_requests = 0;
+        }
+
+        BlockIORequest *device_request = new (&device_requests[number_of_device_requests]) BlockIORequest(request->operation_ == BlockIOServiceOperation::WRITE ? BlockIODirection::WRITE : BlockIODirection::READ,
+                                                                                                            request->buffer_,
+                                                                                                            request->block_number_,
+                                                                                                            request->block_count_,
+                                                                                                            CompleteServiceRequest,
+                                                                                                            request,
+                                                                                                            request->priority_);
+
+        BlockIOResultCodes submit_result = device_.SubmitRequest(*device_request);
+
+        if (Failed(submit_result))
+        {
+            request->result_code_ = submit_result;
+            request->complete_.store(1);
+            continue;
+        }
+
+        number_of_device_requests++;
+    }
+
+    DispatchDeviceRequests(device_requests, number_of_device_requests);
+
+    draining_.store(0);
+
+    requests_serviced_.fetch_add(requests_executed);
+
+    return requests_executed;
+}
+
+BlockIOResultCodes BlockIOServiceDevice::Submit(BlockIOServiceRequest &request)
+{
+    while (!queue_.Push(&request))
+    {
+        WaitForService();
+    }
+
+    while (request.complete_.load() == 0)
+    {
+        WaitForService();
+    }
+
+    return request.result_code_;
+}
+
+void BlockIOServiceDevice::WaitForService()
+{
+    //  Without a worker the submitting tasks drain the queue themselves, ProcessQueue() insures only one
+    //      of them drives the underlying device at a time.
+
+    if (worker_attached_.load() == 0)
+    {
+        ProcessQueue();
+    }
+    else if (wait_function_ != nullptr)
+    {
+        wait_function_();
+    }
+}
+
+void BlockIOServiceDevice::DispatchDeviceRequests(BlockIORequest *device_requests, uint32_t number_of_device_requests)
+{
+    //  The first wait runs the device queue, which completes the whole batch unless another task is already running it
+
+    for (uint32_t i = 0; i < number_of_device_requests; i++)
+    {
+        device_.WaitForRequest(device_requests[i]);
+    }
+}
+
+void BlockIOServiceDevice::Execute(BlockIOServiceRequest &request)
+{
+    switch (request.operation_)
+    {
+    case BlockIOServiceOperation::READ:
+        RecordTransfer(request, device_.ReadFromBlockWithPriority(request.priority_, request.buffer_, request.block_number_, request.block_count_));
+        break;
+
+    case BlockIOServiceOperation::WRITE:
+        RecordTransfer(request, device_.WriteBlockWithPriority(request.priority_, request.buffer_, request.block_number_, request.block_count_));
+        break;
+
+    case BlockIOServiceOperation::READ_VECTORED:
+        RecordTransfer(request, device_.ReadBlocksV(request.priority_, request.segments_, request.number_of_segments_, request.block_number_));
+        break;
+
+    case BlockIOServiceOperation::WRITE_VECTORED:
+        RecordTransfer(request, device_.WriteBlocksV(request.priority_, request.segments_, request.number_of_segments_, request.block_number_));
+        break;
+
+    case BlockIOServiceOperation::FLUSH:
+        request.result_code_ = device_.Flush();
+        break;
+
+    case BlockIOServiceOperation::DISCARD:
+        request.result_code_ = device_.Discard(request.block_number_, request.block_count_);
+        break;
+    }
+
+    //  Completion must be the last touch of the request, the submitting task may return as soon as it sees it
+
+    request.complete_.store(1);
+}
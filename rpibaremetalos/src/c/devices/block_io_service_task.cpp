@@ -0,0 +1,30 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "devices/block_io_service.h"
+
+#include "task/system_calls.h"
+
+namespace
+{
+    //  Tasks waiting on the service task give up the processor rather than spinning
+
+    void YieldWhileWaiting()
+    {
+        sc_Yield();
+    }
+}
+
+void BlockIOServiceTask::Run()
+{
+    device_.AttachWorker(YieldWhileWaiting);
+
+    while (true)
+    {
+        if (device_.ProcessQueue() == 0)
+        {
+            Yield();
+        }
+    }
+}
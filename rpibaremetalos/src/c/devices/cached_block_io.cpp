@@ -0,0 +1,787 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "devices/cached_block_io.h"
+
+#include <string.h>
+
+#include "task/system_calls.h"
+
+namespace
+{
+    uint32_t HashBucketCount(uint32_t cache_size_in_blocks)
+    {
+        uint32_t bucket_count = 1;
+
+        while (bucket_count < cache_size_in_blocks)
+        {
+            bucket_count <<= 1;
+        }
+
+        return bucket_count;
+    }
+}
+
+CachedBlockIODevice::CachedBlockIODevice(bool permanent,
+                                         const char *name,
+                                         const char *alias,
+                                         BlockIODevice &device,
+                                         minstd::pmr::memory_resource &cache_heap,
+                                         uint32_t cache_size_in_blocks)
+    : BlockIODevice(permanent, name, alias),
+      device_(device),
+      cache_heap_(cache_heap),
+      block_size_(device.BlockSize()),
+      cache_size_in_blocks_(cache_size_in_blocks),
+      hash_bucket_count_(HashBucketCount(cache_size_in_blocks)),
+      cache_statistics_(cache_size_in_blocks)
+{
+    entries_ = static_cast<CacheEntry *>(cache_heap_.allocate(sizeof(CacheEntry) * cache_size_in_blocks_, alignof(CacheEntry)));
+    hash_buckets_ = static_cast<uint32_t *>(cache_heap_.allocate(sizeof(uint32_t) * hash_bucket_count_, alignof(uint32_t)));
+    block_data_ = static_cast<uint8_t *>(cache_heap_.allocate(static_cast<size_t>(cache_size_in_blocks_) * block_size_, BLOCK_IO_BUFFER_ALIGNMENT));
+    flush_staging_buffer_ = static_cast<uint8_t *>(cache_heap_.allocate(BLOCK_IO_CACHE_FLUSH_STAGING_BLOCKS * block_size_, BLOCK_IO_BUFFER_ALIGNMENT));
+    flush_list_ = static_cast<uint32_t *>(cache_heap_.allocate(sizeof(uint32_t) * cache_size_in_blocks_, alignof(uint32_t)));
+
+    for (uint32_t i = 0; i < hash_bucket_count_; i++)
+    {
+        hash_buckets_[i] = INVALID_ENTRY;
+    }
+
+    //  Every entry starts out invalid on the LRU list, so the empty entries are used before anything is evicted
+
+    for (uint32_t i = 0; i < cache_size_in_blocks_; i++)
+    {
+        entries_[i].block_number_ = 0;
+        entries_[i].hash_next_ = INVALID_ENTRY;
+        entries_[i].valid_ = false;
+        entries_[i].dirty_ = false;
+        entries_[i].writeback_pending_ = false;
+
+        LRUPushBack(i);
+    }
+}
+
+CachedBlockIODevice::~CachedBlockIODevice()
+{
+    {
+        LockGuard lock(cache_lock_);
+
+        FlushInternal(BlockIOPriority::BACKGROUND);
+    }
+
+    cache_heap_.deallocate(flush_list_, sizeof(uint32_t) * cache_size_in_blocks_, alignof(uint32_t));
+    cache_heap_.deallocate(flush_staging_buffer_, BLOCK_IO_CACHE_FLUSH_STAGING_BLOCKS * block_size_, BLOCK_IO_BUFFER_ALIGNMENT);
+    cache_heap_.deallocate(block_data_, static_cast<size_t>(cache_size_in_blocks_) * block_size_, BLOCK_IO_BUFFER_ALIGNMENT);
+    cache_heap_.deallocate(hash_buckets_, sizeof(uint32_t) * hash_bucket_count_, alignof(uint32_t));
+    cache_heap_.deallocate(entries_, sizeof(CacheEntry) * cache_size_in_blocks_, alignof(CacheEntry));
+}
+
+BlockIOResultCodes CachedBlockIODevice::Seek(uint64_t offset_in_blocks)
+{
+    current_offset_in_blocks_ = offset_in_blocks;
+
+    return BlockIOResultCodes::SUCCESS;
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> CachedBlockIODevice::ReadFromCurrentOffset(uint8_t *buffer, uint32_t blocks_to_read)
+{
+    auto read_result = ReadFromBlock(buffer, static_cast<uint32_t>(current_offset_in_blocks_), blocks_to_read);
+
+    if (read_result.Successful())
+    {
+        current_offset_in_blocks_ += *read_result;
+    }
+
+    return read_result;
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> CachedBlockIODevice::ReadFromBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_read)
+{
+    return ReadFromBlockWithPriority(BlockIOPriority::INTERACTIVE, buffer, block_number, blocks_to_read);
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> CachedBlockIODevice::ReadFromBlockWithPriority(BlockIOPriority priority, uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_read)
+{
+    using Result = ValueResult<BlockIOResultCodes, uint32_t>;
+
+    LockGuard lock(cache_lock_);
+
+    //  Large reads are not added to the cache, they would only push out the working set
+
+    bool populate_cache = blocks_to_read <= (cache_size_in_blocks_ / 2);
+
+    uint32_t current_block = 0;
+
+    while (current_block < blocks_to_read)
+    {
+        uint32_t index = Find(block_number + current_block);
+
+        if (index != INVALID_ENTRY)
+        {
+            memcpy(buffer + (current_block * block_size_), BlockData(index), block_size_);
+
+            LRUUnlink(index);
+            LRUPushFront(index);
+
+            cache_statistics_.RecordHit();
+            current_block++;
+            continue;
+        }
+
+        //  Gather the run of missing blocks and read them from the device with a single command
+
+        uint32_t run_length = 1;
+
+        while ((current_block + run_length < blocks_to_read) && (Find(block_number + current_block + run_length) == INVALID_ENTRY))
+        {
+            run_length++;
+        }
+
+        //  Dirty blocks the run would push out of the cache are written back before the read.  The lock is dropped for the
+        //      write-back, so the cache is looked at again afterwards.  If a dirty block cannot be written back the data read
+        //      is still good, it just is not cached.
+
+        if (populate_cache)
+        {
+            uint32_t victim = DirtyVictim(run_length);
+
+            if (victim != INVALID_ENTRY)
+            {
+                if (Failed(WriteBackEntry(victim, priority)))
+                {
+                    populate_cache = false;
+                }
+
+                continue;
+            }
+        }
+
+        uint8_t *run_buffer = buffer + (current_block * block_size_);
+        uint64_t write_generation = device_write_generation_;
+
+        cache_lock_.Unlock();
+
+        auto read_result = device_.ReadFromBlockWithPriority(priority, run_buffer, block_number + current_block, run_length);
+
+        cache_lock_.Lock();
+
+        if (read_result.Failed())
+        {
+            return Result::Failure(read_result.ResultCode());
+        }
+
+        cache_statistics_.RecordMisses(run_length);
+
+        //  Blocks written to the device while the lock was dropped may have been read before or after the write, so the run
+        //      is only cached if nothing was written in the meantime.
+
+        bool populate_run = populate_cache && (device_write_generation_ == write_generation);
+
+        for (uint32_t i = 0; i < run_length; i++)
+        {
+            uint8_t *block_buffer = run_buffer + (i * block_size_);
+
+            //  A copy cached while the lock was dropped is at least as recent as the one just read
+
+            index = Find(block_number + current_block + i);
+
+            if (index != INVALID_ENTRY)
+            {
+                memcpy(block_buffer, BlockData(index), block_size_);
+                continue;
+            }
+
+            if (!populate_run)
+            {
+                continue;
+            }
+
+            index = AllocateEntry(block_number + current_block + i);
+
+            //  Another task may have dirtied the entries made room for while the lock was dropped
+
+            if (index == INVALID_ENTRY)
+            {
+                populate_run = false;
+                continue;
+            }
+
+            memcpy(BlockData(index), block_buffer, block_size_);
+        }
+
+        current_block += run_length;
+    }
+
+    return Result::Success(blocks_to_read);
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> CachedBlockIODevice::WriteBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_write)
+{
+    return WriteBlockWithPriority(BlockIOPriority::INTERACTIVE, buffer, block_number, blocks_to_write);
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> CachedBlockIODevice::WriteBlockWithPriority(BlockIOPriority priority, uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_write)
+{
+    using Result = ValueResult<BlockIOResultCodes, uint32_t>;
+
+    //  Large writes go straight to the device.  Cached copies of the blocks are dropped before the write is issued, once
+    //      any write-back of an older copy has reached the device, so nothing older can land on top of the new data.
+
+    if (blocks_to_write > (cache_size_in_blocks_ / 2))
+    {
+        {
+            LockGuard lock(cache_lock_);
+
+            //  Reads in flight are not cached once the write generation moves on
+
+            device_write_generation_++;
+
+            for (uint32_t i = 0; i < blocks_to_write; i++)
+            {
+                uint32_t index = Find(block_number + i);
+
+                while ((index != INVALID_ENTRY) && entries_[index].writeback_pending_)
+                {
+                    cache_lock_.Unlock();
+                    sc_Yield();
+                    cache_lock_.Lock();
+
+                    index = Find(block_number + i);
+                }
+
+                if (index != INVALID_ENTRY)
+                {
+                    DropEntry(index);
+                }
+            }
+        }
+
+        auto write_result = device_.WriteBlockWithPriority(priority, buffer, block_number, blocks_to_write);
+
+        {
+            LockGuard lock(cache_lock_);
+
+            device_write_generation_++;
+
+            //  A clean copy cached while the write was in flight may have been read from the device before the write
+            //      landed, so it is dropped.  Dirty copies were written by other tasks in the meantime and are kept.
+
+            for (uint32_t i = 0; i < blocks_to_write; i++)
+            {
+                uint32_t index = Find(block_number + i);
+
+                if ((index != INVALID_ENTRY) && !entries_[index].dirty_ && !entries_[index].writeback_pending_)
+                {
+                    DropEntry(index);
+                }
+            }
+        }
+
+        if (write_result.Failed())
+        {
+            return Result::Failure(write_result.ResultCode());
+        }
+
+        return Result::Success(blocks_to_write);
+    }
+
+    LockGuard lock(cache_lock_);
+
+    uint32_t current_block = 0;
+
+    while (current_block < blocks_to_write)
+    {
+        uint32_t index = Find(block_number + current_block);
+
+        if (index == INVALID_ENTRY)
+        {
+            index = AllocateEntry(block_number + current_block);
+
+            if (index == INVALID_ENTRY)
+            {
+                uint32_t victim = DirtyVictim(1);
+
+                //  Every entry is being written back by other tasks, wait for one of them to finish
+
+                if (victim == INVALID_ENTRY)
+                {
+                    cache_lock_.Unlock();
+                    sc_Yield();
+                    cache_lock_.Lock();
+                    continue;
+                }
+
+                //  The least recently used block is dirty and has to be written back to make room.  If that fails only this
+                //      write fails, the block is moved out of the way so the next write tries a different one.  The lock is
+                //      dropped for the write-back, so look for the block again afterwards.
+
+                BlockIOResultCodes write_back_result = WriteBackEntry(victim, priority);
+
+                if (Failed(write_back_result))
+                {
+                    return Result::Failure(write_back_result);
+                }
+
+                continue;
+            }
+        }
+        else
+        {
+            LRUUnlink(index);
+            LRUPushFront(index);
+        }
+
+        memcpy(BlockData(index), buffer + (current_block * block_size_), block_size_);
+        MarkDirty(index);
+
+        current_block++;
+    }
+
+    return Result::Success(blocks_to_write);
+}
+
+BlockIOResultCodes CachedBlockIODevice::Flush()
+{
+    BlockIOResultCodes result;
+
+    {
+        LockGuard lock(cache_lock_);
+
+        //  Write-back is background work, it should not hold up reads of metadata or foreground data
+
+        result = FlushInternal(BlockIOPriority::BACKGROUND);
+    }
+
+    if (Failed(result))
+    {
+        return result;
+    }
+
+    return device_.Flush();
+}
+
+BlockIOResultCodes CachedBlockIODevice::Discard(uint32_t block_number, uint32_t number_of_blocks)
+{
+    {
+        LockGuard lock(cache_lock_);
+
+        DiscardEntries(block_number, number_of_blocks);
+    }
+
+    return device_.Discard(block_number, number_of_blocks);
+}
+
+void CachedBlockIODevice::DiscardEntries(uint32_t block_number, uint32_t number_of_blocks)
+{
+    //  Cached copies of discarded blocks are dropped, dirty or not, so they are not written back over the erased blocks.
+    //      For ranges larger than the cache it is quicker to scan the cache entries than to look up each block.
+
+    if (number_of_blocks > cache_size_in_blocks_)
+    {
+        for (uint32_t i = 0; i < cache_size_in_blocks_; i++)
+        {
+            if (entries_[i].valid_ &&
+                (entries_[i].block_number_ >= block_number) &&
+                (entries_[i].block_number_ - block_number < number_of_blocks))
+            {
+                DropEntry(i);
+            }
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0; i < number_of_blocks; i++)
+        {
+            uint32_t index = Find(block_number + i);
+
+            if (index != INVALID_ENTRY)
+            {
+                DropEntry(index);
+            }
+        }
+    }
+}
+
+void CachedBlockIODevice::Invalidate()
+{
+    LockGuard lock(cache_lock_);
+
+    for (uint32_t i = 0; i < cache_size_in_blocks_; i++)
+    {
+        if (entries_[i].valid_)
+        {
+            DropEntry(i);
+        }
+    }
+}
+
+BlockIOResultCodes CachedBlockIODevice::FlushInternal(BlockIOPriority priority)
+{
+    //  Called with the cache lock held.  The flush list and staging buffer are shared, so only one flush runs at a time.
+
+    while (flush_in_progress_)
+    {
+        cache_lock_.Unlock();
+        sc_Yield();
+        cache_lock_.Lock();
+    }
+
+    flush_in_progress_ = true;
+
+    //  Collect the dirty entries and sort them by block number so contiguous blocks can be written together.  Blocks with
+    //      an eviction write-back still outstanding are waited for, a second write of the block could overtake the first.
+
+    uint32_t dirty_count = 0;
+
+    for (uint32_t i = 0; i < cache_size_in_blocks_; i++)
+    {
+        while (entries_[i].writeback_pending_)
+        {
+            cache_lock_.Unlock();
+            sc_Yield();
+            cache_lock_.Lock();
+        }
+
+        if (entries_[i].dirty_)
+        {
+            flush_list_[dirty_count++] = i;
+        }
+    }
+
+    for (uint32_t i = 1; i < dirty_count; i++)
+    {
+        uint32_t index = flush_list_[i];
+        uint32_t j = i;
+
+        while ((j > 0) && (entries_[flush_list_[j - 1]].block_number_ > entries_[index].block_number_))
+        {
+            flush_list_[j] = flush_list_[j - 1];
+            j--;
+        }
+
+        flush_list_[j] = index;
+    }
+
+    //  Write back each run of contiguous blocks.  If the cached copies happen to be adjacent in the cache they are written
+    //      in place, otherwise they are gathered into the staging buffer.  The lock is dropped for each write, so entries
+    //      cleaned or evicted in the meantime are skipped and the rest are checked again when the write completes.
+
+    BlockIOResultCodes result = BlockIOResultCodes::SUCCESS;
+
+    uint32_t current = 0;
+
+    while (current < dirty_count)
+    {
+        if (!entries_[flush_list_[current]].dirty_ || entries_[flush_list_[current]].writeback_pending_)
+        {
+            current++;
+            continue;
+        }
+
+        uint32_t first_block = entries_[flush_list_[current]].block_number_;
+        uint32_t run_length = 1;
+        bool adjacent_in_cache = true;
+
+        while ((current + run_length < dirty_count) &&
+               (run_length < BLOCK_IO_CACHE_FLUSH_STAGING_BLOCKS) &&
+               entries_[flush_list_[current + run_length]].dirty_ &&
+               !entries_[flush_list_[current + run_length]].writeback_pending_ &&
+               (entries_[flush_list_[current + run_length]].block_number_ == first_block + run_length))
+        {
+            adjacent_in_cache &= (flush_list_[current + run_length] == flush_list_[current] + run_length);
+            run_length++;
+        }
+
+        uint8_t *source = BlockData(flush_list_[current]);
+
+        if (!adjacent_in_cache)
+        {
+            for (uint32_t i = 0; i < run_length; i++)
+            {
+                memcpy(flush_staging_buffer_ + (i * block_size_), BlockData(flush_list_[current + i]), block_size_);
+            }
+
+            source = flush_staging_buffer_;
+        }
+
+        //  Blocks are marked clean before the write, a task writing one of them while the lock is dropped dirties it again
+
+        for (uint32_t i = 0; i < run_length; i++)
+        {
+            entries_[flush_list_[current + i]].writeback_pending_ = true;
+            MarkClean(flush_list_[current + i]);
+        }
+
+        cache_lock_.Unlock();
+
+        auto write_result = device_.WriteBlockWithPriority(priority, source, first_block, run_length);
+
+        cache_lock_.Lock();
+
+        device_write_generation_++;
+
+        for (uint32_t i = 0; i < run_length; i++)
+        {
+            CacheEntry &entry = entries_[flush_list_[current + i]];
+
+            entry.writeback_pending_ = false;
+
+            if (write_result.Failed() && entry.valid_ && (entry.block_number_ == first_block + i))
+            {
+                MarkDirty(flush_list_[current + i]);
+            }
+        }
+
+        if (write_result.Successful())
+        {
+            cache_statistics_.RecordWriteBack(run_length);
+        }
+        else if (result == BlockIOResultCodes::SUCCESS)
+        {
+            result = write_result.ResultCode();
+        }
+
+        current += run_length;
+    }
+
+    flush_in_progress_ = false;
+
+    return result;
+}
+
+BlockIOResultCodes CachedBlockIODevice::WriteBackEntry(uint32_t index, BlockIOPriority priority)
+{
+    //  Called with the cache lock held, the lock is dropped for the write.  The entry cannot be evicted while the write is
+    //      outstanding.  The caller is waiting on the write-back, so it goes at the caller's priority.
+
+    CacheEntry &entry = entries_[index];
+    uint32_t block_number = entry.block_number_;
+
+    entry.writeback_pending_ = true;
+    MarkClean(index);
+
+    cache_lock_.Unlock();
+
+    auto write_result = device_.WriteBlockWithPriority(priority, BlockData(index), block_number, 1);
+
+    cache_lock_.Lock();
+
+    device_write_generation_++;
+
+    entry.writeback_pending_ = false;
+
+    if (write_result.Failed())
+    {
+        //  The block stays dirty but moves to the front of the LRU list, so later allocations do not keep tripping over it
+
+        if (entry.valid_ && (entry.block_number_ == block_number))
+        {
+            MarkDirty(index);
+
+            LRUUnlink(index);
+            LRUPushFront(index);
+        }
+
+        return write_result.ResultCode();
+    }
+
+    cache_statistics_.RecordWriteBack(1);
+
+    return BlockIOResultCodes::SUCCESS;
+}
+
+uint32_t CachedBlockIODevice::Find(uint32_t block_number)
+{
+    uint32_t index = hash_buckets_[HashBucket(block_number)];
+
+    while ((index != INVALID_ENTRY) && (entries_[index].block_number_ != block_number))
+    {
+        index = entries_[index].hash_next_;
+    }
+
+    return index;
+}
+
+uint32_t CachedBlockIODevice::DirtyVictim(uint32_t number_of_entries)
+{
+    //  Returns the first dirty entry among the next entries AllocateEntry() would hand out
+
+    uint32_t index = lru_tail_;
+
+    while ((index != INVALID_ENTRY) && (number_of_entries > 0))
+    {
+        if (!entries_[index].writeback_pending_)
+        {
+            if (entries_[index].dirty_)
+            {
+                return index;
+            }
+
+            number_of_entries--;
+        }
+
+        index = entries_[index].lru_previous_;
+    }
+
+    return INVALID_ENTRY;
+}
+
+uint32_t CachedBlockIODevice::AllocateEntry(uint32_t block_number)
+{
+    //  The entry nearest the tail of the LRU list which is not being written back is either unused or the least recently
+    //      used block.  Dirty blocks are never written back here, INVALID_ENTRY is returned instead.
+
+    uint32_t index = lru_tail_;
+
+    while ((index != INVALID_ENTRY) && entries_[index].writeback_pending_)
+    {
+        index = entries_[index].lru_previous_;
+    }
+
+    if ((index == INVALID_ENTRY) || entries_[index].dirty_)
+    {
+        return INVALID_ENTRY;
+    }
+
+    CacheEntry &entry = entries_[index];
+
+    if (entry.valid_)
+    {
+        HashRemove(index);
+    }
+
+    entry.block_number_ = block_number;
+    entry.valid_ = true;
+
+    HashInsert(index);
+
+    LRUUnlink(index);
+    LRUPushFront(index);
+
+    return index;
+}
+
+void CachedBlockIODevice::LRUUnlink(uint32_t index)
+{
+    CacheEntry &entry = entries_[index];
+
+    if (entry.lru_previous_ != INVALID_ENTRY)
+    {
+        entries_[entry.lru_previous_].lru_next_ = entry.lru_next_;
+    }
+    else
+    {
+        lru_head_ = entry.lru_next_;
+    }
+
+    if (entry.lru_next_ != INVALID_ENTRY)
+    {
+        entries_[entry.lru_next_].lru_previous_ = entry.lru_previous_;
+    }
+    else
+    {
+        lru_tail_ = entry.lru_previous_;
+    }
+
+    entry.lru_previous_ = INVALID_ENTRY;
+    entry.lru_next_ = INVALID_ENTRY;
+}
+
+void CachedBlockIODevice::LRUPushFront(uint32_t index)
+{
+    CacheEntry &entry = entries_[index];
+
+    entry.lru_previous_ = INVALID_ENTRY;
+    entry.lru_next_ = lru_head_;
+
+    if (lru_head_ != INVALID_ENTRY)
+    {
+        entries_[lru_head_].lru_previous_ = index;
+    }
+    else
+    {
+        lru_tail_ = index;
+    }
+
+    lru_head_ = index;
+}
+
+void CachedBlockIODevice::LRUPushBack(uint32_t index)
+{
+    CacheEntry &entry = entries_[index];
+
+    entry.lru_previous_ = lru_tail_;
+    entry.lru_next_ = INVALID_ENTRY;
+
+    if (lru_tail_ != INVALID_ENTRY)
+    {
+        entries_[lru_tail_].lru_next_ = index;
+    }
+    else
+    {
+        lru_head_ = index;
+    }
+
+    lru_tail_ = index;
+}
+
+void CachedBlockIODevice::HashInsert(uint32_t index)
+{
+    uint32_t bucket = HashBucket(entries_[index].block_number_);
+
+    entries_[index].hash_next_ = hash_buckets_[bucket];
+    hash_buckets_[bucket] = index;
+}
+
+void CachedBlockIODevice::HashRemove(uint32_t index)
+{
+    uint32_t *link = &hash_buckets_[HashBucket(entries_[index].block_number_)];
+
+    while (*link != INVALID_ENTRY)
+    {
+        if (*link == index)
+        {
+            *link = entries_[index].hash_next_;
+            break;
+        }
+
+        link = &entries_[*link].hash_next_;
+    }
+
+    entries_[index].hash_next_ = INVALID_ENTRY;
+}
+
+void CachedBlockIODevice::MarkDirty(uint32_t index)
+{
+    if (!entries_[index].dirty_)
+    {
+        entries_[index].dirty_ = true;
+        cache_statistics_.BlockDirtied();
+    }
+}
+
+void CachedBlockIODevice::MarkClean(uint32_t index)
+{
+    if (entries_[index].dirty_)
+    {
+        entries_[index].dirty_ = false;
+        cache_statistics_.BlockCleaned();
+    }
+}
+
+void CachedBlockIODevice::DropEntry(uint32_t index)
+{
+    if (entries_[index].valid_)
+    {
+        HashRemove(index);
+    }
+
+    MarkClean(index);
+    entries_[index].valid_ = false;
+
+    //  Unused entries go to the tail of the LRU list so they are reused first
+
+    LRUUnlink(index);
+    LRUPushBack(index);
+}
@@ -0,0 +1,38 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "devices/cached_block_io.h"
+
+#include "devices/log.h"
+#include "devices/physical_timer.h"
+
+void CachedBlockIOFlushTask::Run()
+{
+    auto last_flush = PhysicalTimer::Now();
+
+    while (true)
+    {
+        Yield();
+
+        auto elapsed_ms = minstd::chrono::duration_cast<minstd::chrono::milliseconds>(PhysicalTimer::Now() - last_flush).count();
+
+        if ((uint32_t)elapsed_ms < flush_interval_in_ms_)
+        {
+            PhysicalTimer::Wait(milliseconds(10));
+            continue;
+        }
+
+        if (device_.DirtyBlocks() > 0)
+        {
+            BlockIOResultCodes flush_result = device_.Flush();
+
+            if (Failed(flush_result))
+            {
+                LogError("Background flush of block cache %s failed: %s\n", device_.Name().c_str(), device_.GetMessageForResultCode(flush_result));
+            }
+        }
+
+        last_flush = PhysicalTimer::Now();
+    }
+}
@@ -3,6 +3,7 @@
 // license that can be found in the LICENSE file.
 
 #include <stdint.h>
+#include <string.h>
 
 #include <memory>
 
@@ -14,6 +15,11 @@
 #include "devices/log.h"
 #include "platform/gpu_mailbox_messages.h"
 #include "devices/physical_timer.h"
+#include "platform/mmu_manager.h"
+#include "platform/exception_manager.h"
+
+#include "isr/isr.h"
+#include "task/tasks.h"
 
 #include "devices/emmc.h"
 
@@ -78,6 +84,7 @@ namespace EmmcImpl
         InterruptRegErrorMask = 0xFFFF0000,
         InterruptRegEnableAll = 0xFFFFFFFF,
 
+        InterruptRegADMAError = 0x02000000,
         InterruptRegAutoCommandError = 0x01000000,
         InterruptRegDataLineEndBitNot1Error = 0x00400000,
         InterruptRegDataCRCError = 0x00200000,
@@ -97,6 +104,127 @@ namespace EmmcImpl
         InterruptRegCommandDone = 0x0000001
     } InterruptRegisterBitmap;
 
+    //
+    //  Control 0 Register flags.  The DMA select field chooses between SDMA and ADMA2.
+    //
+
+    typedef enum ControlReg0Bitmap : uint32_t
+    {
+        ControlReg0DataWidth4Bit = 0x00000002,
+        ControlReg0HighSpeedEnable = 0x00000004,
+        ControlReg0DMASelectMask = 0x00000018,
+        ControlReg0DMASelectADMA2 = 0x00000010
+    } ControlReg0Bitmap;
+
+    //
+    //  Command/Transfer Mode Register flags
+    //
+
+    typedef enum CommandRegBitmap : uint32_t
+    {
+        CommandRegDMAEnable = 0x00000001
+    } CommandRegBitmap;
+
+    //
+    //  Capabilities Register 1 flags.  The base clock field is in MHz.
+    //
+
+    typedef enum Capabilities1Bitmap : uint32_t
+    {
+        Capabilities1ADMA2Support = 0x00080000,
+        Capabilities1BaseClockShift = 8,
+        Capabilities1BaseClockMask = 0xFF
+    } Capabilities1Bitmap;
+
+    //
+    //  Host controller specification version, held in the upper half of the slot interrupt status register.
+    //      Auto CMD23 first appears in version 3.00 of the specification.
+    //
+
+    typedef enum HostControllerVersion : uint32_t
+    {
+        HostControllerVersionShift = 16,
+        HostControllerVersionMask = 0xFF,
+        HostControllerVersion300 = 2
+    } HostControllerVersion;
+
+    //
+    //  SD clock divider limits.  Before version 3.00 the divider is 8 bits wide and must be a power of 2,
+    //      from 3.00 on it is 10 bits wide and may take any value.  In both cases SDCLK = base clock / (2 * divider).
+    //
+
+    static constexpr uint32_t MAX_8_BIT_CLOCK_DIVIDER = 0x80;
+    static constexpr uint32_t MAX_10_BIT_CLOCK_DIVIDER = 0x3FF;
+
+    //
+    //  SCR fields for the optional commands, bit 33 of the register flags CMD23 support
+    //
+
+    static constexpr uint32_t SCR_CMD23_SUPPORTED_BIT = 33 - 32;
+
+    //
+    //  SCR bus widths field, bits 51:48 of the register.  Bit 50 flags 4 bit bus support.
+    //
+
+    static constexpr uint32_t SCR_BUS_WIDTHS_SHIFT = 48 - 32;
+    static constexpr uint32_t SCR_BUS_WIDTHS_MASK = 0xF;
+    static constexpr uint32_t SCR_BUS_WIDTH_4_BIT = 0x4;
+
+    //
+    //  ACMD6 argument for a 4 bit data bus
+    //
+
+    static constexpr uint32_t ACMD6_BUS_WIDTH_4_BIT = 0x2;
+
+    //
+    //  CMD6 switches function group 1 (access mode) to high speed with this argument, the other groups are left unchanged.
+    //      The function the card actually selected for group 1 is in bits 379:376 of the 64 byte status block it returns.
+    //
+
+    static constexpr uint32_t CMD6_SWITCH_TO_HIGH_SPEED = 0x80FFFFF1;
+    static constexpr uint32_t CMD6_STATUS_SIZE_IN_BYTES = 64;
+    static constexpr uint32_t CMD6_STATUS_GROUP1_SELECTION_BYTE = 16;
+    static constexpr uint32_t CMD6_STATUS_GROUP1_SELECTION_MASK = 0x0F;
+    static constexpr uint32_t CMD6_HIGH_SPEED_FUNCTION = 0x1;
+
+    //
+    //  ACMD23 carries the pre-erase count in the low 23 bits of its argument
+    //
+
+    static constexpr uint32_t ACMD23_MAX_ERASE_COUNT = 0x007FFFFF;
+
+    //
+    //  ADMA2 Descriptors.  The 32 bit descriptor format is used, so buffers must be in the low 4GB of the bus
+    //      address space and every data address and length must be 4 byte aligned.
+    //
+
+    typedef enum ADMA2DescriptorAttributes : uint16_t
+    {
+        ADMA2DescriptorValid = 0x0001,
+        ADMA2DescriptorEnd = 0x0002,
+        ADMA2DescriptorInterrupt = 0x0004,
+        ADMA2DescriptorTransferData = 0x0020
+    } ADMA2DescriptorAttributes;
+
+    typedef struct ADMA2Descriptor
+    {
+        uint16_t attributes;
+        uint16_t length;
+        uint32_t address;
+    } ADMA2Descriptor;
+
+    static constexpr uint32_t ADMA2_MAX_DESCRIPTORS = 64;
+    static constexpr uint32_t ADMA2_MAX_BYTES_PER_DESCRIPTOR = 32768;
+
+    //  DMA buffers must start and end on a cache line boundary, otherwise cache maintenance on the partial lines
+    //      at either end of the buffer could clobber data written by the controller.
+
+    static constexpr uint32_t DMA_CACHE_LINE_SIZE = 64;
+
+    static_assert((BLOCK_IO_BUFFER_ALIGNMENT % DMA_CACHE_LINE_SIZE) == 0, "Block IO buffers must be aligned for DMA");
+
+    static constexpr uint32_t DMA_BOUNCE_BUFFER_SIZE_IN_BYTES = SD_CARD_DMA_BOUNCE_BUFFER_BLOCKS * 512;
+
     //
     //  Code follows
     //
@@ -106,6 +234,83 @@ namespace EmmcImpl
         return code != BlockIOResultCodes::SUCCESS;
     }
 
+    static void CleanAndInvalidateDataCache(const void *address, uint32_t length)
+    {
+        uintptr_t current_line = (uintptr_t)address & ~((uintptr_t)DMA_CACHE_LINE_SIZE - 1);
+        uintptr_t end = (uintptr_t)address + length;
+
+        for (; current_line < end; current_line += DMA_CACHE_LINE_SIZE)
+        {
+            CLEAN_AND_INVALIDATE_DATA_CACHE_LINE(current_line);
+        }
+
+        DATA_SYNCHRONIZATION_BARRIER;
+    }
+
+    static bool SegmentsAreDMAAligned(const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_size)
+    {
+        for (uint32_t segment = 0; segment < number_of_segments; segment++)
+        {
+            if ((((uintptr_t)segments[segment].buffer_ % DMA_CACHE_LINE_SIZE) != 0) ||
+                (((segments[segment].block_count_ * block_size) % DMA_CACHE_LINE_SIZE) != 0))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static uint32_t TotalBlocksInSegments(const BlockIOSegment *segments, uint32_t number_of_segments)
+    {
+        uint32_t total_blocks = 0;
+
+        for (uint32_t segment = 0; segment < number_of_segments; segment++)
+        {
+            total_blocks += segments[segment].block_count_;
+        }
+
+        return total_blocks;
+    }
+
+    //
+    //  Copies between the caller's segments and a bounce buffer, picking up where the previous copy left off in the segments
+    //
+
+    static void CopySegmentsAndBounceBuffer(const BlockIOSegment *segments,
+                                            uint32_t &current_segment,
+                                            uint32_t &offset_into_segment,
+                                            uint8_t *bounce_buffer,
+                                            uint32_t bytes_to_copy,
+                                            uint32_t block_size,
+                                            bool to_bounce_buffer)
+    {
+        while (bytes_to_copy > 0)
+        {
+            uint32_t bytes_left_in_segment = (segments[current_segment].block_count_ * block_size) - offset_into_segment;
+            uint32_t bytes_this_pass = bytes_to_copy < bytes_left_in_segment ? bytes_to_copy : bytes_left_in_segment;
+
+            if (to_bounce_buffer)
+            {
+                memcpy(bounce_buffer, segments[current_segment].buffer_ + offset_into_segment, bytes_this_pass);
+            }
+            else
+            {
+                memcpy(segments[current_segment].buffer_ + offset_into_segment, bounce_buffer, bytes_this_pass);
+            }
+
+            bounce_buffer += bytes_this_pass;
+            bytes_to_copy -= bytes_this_pass;
+            offset_into_segment += bytes_this_pass;
+
+            if (offset_into_segment == segments[current_segment].block_count_ * block_size)
+            {
+                current_segment++;
+                offset_into_segment = 0;
+            }
+        }
+    }
+
 #define RETURN_IF_FAILED(cmd) \
     {                         \
         auto result = cmd;    \
@@ -115,6 +320,42 @@ namespace EmmcImpl
         }                     \
     }
 
+    //
+    //  ISR for the EMMC controller interrupt.  The ISR latches the interrupt flags and masks the interrupt signal,
+    //      the task waiting on the command or data transfer picks up the latched flags.
+    //
+
+    class SDCardController;
+
+    class EMMCCompletionISR : public InterruptServiceRoutine
+    {
+    public:
+        explicit EMMCCompletionISR(SDCardController &controller)
+            : controller_(controller)
+        {
+        }
+
+        constexpr Interrupts InterruptType() const noexcept override
+        {
+            return Interrupts::EMMC;
+        }
+
+        constexpr InterruptServiceRoutineType ISRType() const noexcept override
+        {
+            return InterruptServiceRoutineType::BLOCK_IO_COMPLETION;
+        }
+
+        const char *Name() const noexcept override
+        {
+            return "EMMC Completion ISR";
+        }
+
+        void HandleInterrupt() override;
+
+    private:
+        SDCardController &controller_;
+    };
+
     //
     //  External Mass Media Controller Implementation
     //
@@ -129,7 +370,8 @@ namespace EmmcImpl
             : ExternalMassMediaController(permanent, name, alias),
               platform_info_(platform_info),
               mmio_base_(platform_info.GetMMIOBase()),
-              registers_((EMMCRegisters *)platform_info.GetEMMCBase())
+              registers_((EMMCRegisters *)platform_info.GetEMMCBase()),
+              completion_isr_(*this)
         {
         }
 
@@ -142,6 +384,18 @@ namespace EmmcImpl
 
         BlockIOResultCodes Initialize() override;
 
+        void HandleCompletionInterrupt()
+        {
+            //  Mask the interrupt signal so the (level triggered) interrupt line drops.  The flags themselves are left set
+            //      in the interrupt register and are cleared by the code waiting on the command.
+
+            uint32_t interrupt_flags = registers_->int_flags;
+
+            registers_->int_enable = 0;
+
+            signalled_interrupt_flags_ |= interrupt_flags;
+        }
+
         BlockIOResultCodes Seek(uint64_t offset_in_blocks) override;
 
         ValueResult<BlockIOResultCodes, uint32_t> ReadFromBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_read) override;
@@ -149,6 +403,14 @@ namespace EmmcImpl
 
         ValueResult<BlockIOResultCodes, uint32_t> WriteBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_write) override;
 
+        ValueResult<BlockIOResultCodes, uint32_t> ReadBlocksV(BlockIOPriority priority, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number) override;
+        ValueResult<BlockIOResultCodes, uint32_t> WriteBlocksV(BlockIOPriority priority, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number) override;
+
+        BlockIOResultCodes Discard(uint32_t block_number, uint32_t number_of_blocks) override;
+
+    protected:
+        ValueResult<BlockIOResultCodes, uint32_t> ExecuteRequest(BlockIORequest &request) override;
+
     private:
         const PlatformInfo &platform_info_;
 
@@ -156,18 +418,36 @@ namespace EmmcImpl
         EMMCRegisters *registers_;
 
         uint32_t emmc_host_clock_rate_;
+        uint32_t host_controller_version_;
 
         uint32_t transfer_blocks_;
         uint32_t block_size_;
         uint32_t last_response_[4];
         bool is_sdhc_card_;
         uint64_t offset_in_blocks_;
-        void *buffer_;
+        const BlockIOSegment *segments_;
+        uint32_t number_of_segments_;
 
         uint16_t operating_conditions_register_;
         uint32_t relative_card_address_register_;
         SDCardConfigurationRegister sd_card_configuration_register_;
 
+        bool adma2_supported_;
+        bool use_dma_for_transfer_;
+
+        bool set_block_count_supported_;
+        bool auto_cmd23_supported_;
+
+        bool four_bit_bus_;
+        bool high_speed_;
+
+        alignas(DMA_CACHE_LINE_SIZE) ADMA2Descriptor adma2_descriptor_table_[ADMA2_MAX_DESCRIPTORS];
+        alignas(DMA_CACHE_LINE_SIZE) uint8_t dma_bounce_buffer_[DMA_BOUNCE_BUFFER_SIZE_IN_BYTES];
+
+        EMMCCompletionISR completion_isr_;
+        bool interrupt_driven_completion_ = false;
+        volatile uint32_t signalled_interrupt_flags_ = 0;
+
         EMMCCommand GetCommand(EMMCCommandTypes command_type) const
         {
             return commands[static_cast<uint32_t>(command_type)];
@@ -188,6 +468,8 @@ namespace EmmcImpl
             return false;
         }
 
+        bool WaitForCompletion(uint32_t mask, milliseconds timeout);
+
         bool IsV2Card();
         BlockIOResultCodes IsUsableCard();
         BlockIOResultCodes SetIsSDHCCard(bool v2_card);
@@ -198,21 +480,100 @@ namespace EmmcImpl
         BlockIOResultCodes CheckOperatingConditionsRegister();
         BlockIOResultCodes CheckRelativeCardAddressRegister();
         BlockIOResultCodes SetSDCardConfigurationRegister();
+        bool EnableFourBitBus();
+        bool EnableHighSpeed();
 
         ValueResultWithErrorInfo<BlockIOResultCodes, int32_t, uint32_t> Command(EMMCCommandTypes command, uint32_t arg, uint32_t timeout);
         ValueResultWithErrorInfo<BlockIOResultCodes, int32_t, uint32_t> AppCommand(EMMCCommandTypes command, uint32_t arg, uint32_t timeout);
         BlockIOResultCodes ResetCommand();
+        BlockIOResultCodes ResetDataLine();
         ValueResultWithErrorInfo<BlockIOResultCodes, int32_t, uint32_t> IssueCommand(EMMCCommand cmd, uint32_t arg, uint32_t timeout);
-        BlockIOResultCodes DataCommand(bool write, uint8_t *buffer, uint32_t bytes_to_process, uint32_t block_number);
+        BlockIOResultCodes Transfer(bool write, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number);
+        BlockIOResultCodes BouncedTransfer(bool write, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number);
+        BlockIOResultCodes DataCommand(bool write, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number);
+        ValueResultWithErrorInfo<BlockIOResultCodes, int32_t, uint32_t> IssueDataCommand(EMMCCommandTypes command_type, bool write, uint32_t block_number);
+        void RecordDataCommand(bool write, uint32_t blocks, minstd::chrono::time_point<minstd::chrono::nanoseconds> start_time, bool succeeded);
 
         BlockIOResultCodes TransferData(EMMCCommand cmd);
 
+        bool PrepareDMATransfer(const BlockIOSegment *segments, uint32_t number_of_segments);
+
         void ConfigureGPIO();
         BlockIOResultCodes SetupClock();
         uint32_t GetClockDivider(uint32_t base_clock, uint32_t target_rate);
         BlockIOResultCodes SwitchClockRate(uint32_t base_clock, uint32_t target_rate);
     };
 
+    void EMMCCompletionISR::HandleInterrupt()
+    {
+        controller_.HandleCompletionInterrupt();
+    }
+
+    bool SDCardController::WaitForCompletion(uint32_t mask, milliseconds timeout)
+    {
+        //  The error flag is a summary bit, the interrupt signal has to be enabled for the individual error bits
+
+        if (mask & InterruptRegError)
+        {
+            mask |= InterruptRegErrorMask;
+        }
+
+        if (registers_->int_flags & mask)
+        {
+            statistics_.RecordCompletion(0, false);
+            return true;
+        }
+
+        //  If the completion ISR is registered, arm the interrupt signal for the flags we are waiting on.
+        //      Clear the latched flags with the signal masked so a late interrupt from the previous wait cannot leak through.
+
+        if (interrupt_driven_completion_)
+        {
+            registers_->int_enable = 0;
+            signalled_interrupt_flags_ = 0;
+            registers_->int_enable = mask;
+        }
+
+        auto start = PhysicalTimer::Now();
+
+        while (true)
+        {
+            uint64_t elapsed_in_usec = minstd::chrono::duration_cast<minstd::chrono::microseconds>(PhysicalTimer::Now() - start).count();
+
+            if (signalled_interrupt_flags_ & mask)
+            {
+                statistics_.RecordCompletion(elapsed_in_usec, true);
+                return true;
+            }
+
+            //  Without the ISR we poll the interrupt register.  With the ISR we still check the register once the wait has
+            //      gone on for more than a millisecond, which covers the case of interrupts not yet being enabled on the core.
+
+            if (!interrupt_driven_completion_ || (elapsed_in_usec > 1000))
+            {
+                if (registers_->int_flags & mask)
+                {
+                    statistics_.RecordCompletion(elapsed_in_usec, false);
+                    return true;
+                }
+            }
+
+            if (elapsed_in_usec > (uint64_t)timeout.count() * 1000)
+            {
+                return false;
+            }
+
+            if (interrupt_driven_completion_)
+            {
+                task::Task::GetTask().Yield();
+            }
+            else
+            {
+                PhysicalTimer::Wait(microseconds(10));
+            }
+        }
+    }
+
     BlockIOResultCodes SDCardController::TransferData(EMMCCommand cmd)
     {
         uint32_t read_or_write_ready_interrupt = 0;
@@ -230,13 +591,26 @@ namespace EmmcImpl
             read_or_write_ready_interrupt = InterruptRegReadReady;
         }
 
-        uint32_t *data = (uint32_t *)buffer_;
+        //  Walk the segments of the transfer, moving to the next segment when the current one is full
+
+        uint32_t current_segment = 0;
+        uint32_t blocks_left_in_segment = segments_[0].block_count_;
+        uint32_t *data = (uint32_t *)segments_[0].buffer_;
 
         for (uint32_t block = 0; block < transfer_blocks_; block++)
         {
+            if (blocks_left_in_segment == 0)
+            {
+                current_segment++;
+                blocks_left_in_segment = segments_[current_segment].block_count_;
+                data = (uint32_t *)segments_[current_segment].buffer_;
+            }
+
+            blocks_left_in_segment--;
+
             //  Wait for the card to be ready for the read or write operation
 
-            WaitForInterrupt(registers_->int_flags, read_or_write_ready_interrupt | InterruptRegError, true, 2000);
+            WaitForCompletion(read_or_write_ready_interrupt | InterruptRegError, milliseconds(2000));
 
             uint32_t intr_val = registers_->int_flags;
 
@@ -272,6 +646,78 @@ namespace EmmcImpl
         return BlockIOResultCodes::SUCCESS;
     }
 
+    bool SDCardController::PrepareDMATransfer(const BlockIOSegment *segments, uint32_t number_of_segments)
+    {
+        //  Fall back to PIO if the host has no ADMA2 engine
+
+        if (!adma2_supported_)
+        {
+            return false;
+        }
+
+        //  Build the descriptor table over the caller's segments, each segment takes one or more descriptors.
+        //      If any segment cannot be handed to the controller safely, the whole transfer falls back to PIO.
+
+        uint32_t descriptor_count = 0;
+
+        for (uint32_t segment = 0; segment < number_of_segments; segment++)
+        {
+            uint8_t *buffer = segments[segment].buffer_;
+            uint32_t bytes_remaining = segments[segment].block_count_ * block_size_;
+
+            if ((bytes_remaining == 0) ||
+                (((uintptr_t)buffer % DMA_CACHE_LINE_SIZE) != 0) ||
+                ((bytes_remaining % DMA_CACHE_LINE_SIZE) != 0))
+            {
+                return false;
+            }
+
+            uint64_t bus_address = (uint64_t)MMUManager::Instance().ARMToGPUAddress(buffer);
+
+            if ((bus_address + bytes_remaining) > 0x100000000ULL)
+            {
+                return false;
+            }
+
+            while (bytes_remaining > 0)
+            {
+                if (descriptor_count >= ADMA2_MAX_DESCRIPTORS)
+                {
+                    return false;
+                }
+
+                uint32_t bytes_for_descriptor = bytes_remaining > ADMA2_MAX_BYTES_PER_DESCRIPTOR ? ADMA2_MAX_BYTES_PER_DESCRIPTOR : bytes_remaining;
+
+                adma2_descriptor_table_[descriptor_count].attributes = ADMA2DescriptorValid | ADMA2DescriptorTransferData;
+                adma2_descriptor_table_[descriptor_count].length = (uint16_t)bytes_for_descriptor;
+                adma2_descriptor_table_[descriptor_count].address = (uint32_t)bus_address;
+
+                bus_address += bytes_for_descriptor;
+                bytes_remaining -= bytes_for_descriptor;
+                descriptor_count++;
+            }
+        }
+
+        if (descriptor_count == 0)
+        {
+            return false;
+        }
+
+        adma2_descriptor_table_[descriptor_count - 1].attributes |= ADMA2DescriptorEnd;
+
+        //  Push the descriptors and any dirty buffer lines out to memory and drop the cached copies
+        //      so the CPU will not read stale data once the controller has written the buffers.
+
+        CleanAndInvalidateDataCache(adma2_descriptor_table_, descriptor_count * sizeof(ADMA2Descriptor));
+
+        for (uint32_t segment = 0; segment < number_of_segments; segment++)
+        {
+            CleanAndInvalidateDataCache(segments[segment].buffer_, segments[segment].block_count_ * block_size_);
+        }
+
+        return true;
+    }
+
     ValueResultWithErrorInfo<BlockIOResultCodes, int32_t, uint32_t> SDCardController::IssueCommand(EMMCCommand command, uint32_t arg, uint32_t timeout)
     {
         using Result = ValueResultWithErrorInfo<BlockIOResultCodes, int32_t, uint32_t>;
@@ -294,35 +740,26 @@ namespace EmmcImpl
             return Result::Failure(BlockIOResultCodes::EMMC_ISSUE_COMMAND_TRANSFER_BLOCKS_IS_TOO_LARGE);
         }
 
-        registers_->block_size_count = block_size_ | (transfer_blocks_ << 16);
-        registers_->arg1 = arg;
-        registers_->cmd_xfer_mode = command_reg;
-
-        PhysicalTimer::Wait(milliseconds(10));
-
-        uint32_t times = 0;
+        //  If the data for this command is moving by DMA, point the controller at the descriptor table
 
-        while (times < timeout)
+        if (command.is_data && use_dma_for_transfer_)
         {
-            uint32_t interrupt_flags = registers_->int_flags;
-
-            //  Break the loop if the command is complete or if there is an error.
-            //      There appears to be a difference between error signalling from real HW and QEMU - but this appears to be OK.
+            registers_->adma_address_low = (uint32_t)(uintptr_t)MMUManager::Instance().ARMToGPUAddress(adma2_descriptor_table_);
+            registers_->adma_address_high = 0;
 
-            if (interrupt_flags & (InterruptRegError | InterruptRegCommandDone))
-            {
-                break;
-            }
+            command_reg |= CommandRegDMAEnable;
+        }
 
-            //  Wait for a millsecond and try again
+        auto command_start = PhysicalTimer::Now();
 
-            PhysicalTimer::Wait(milliseconds(1));
-            times++;
-        }
+        registers_->block_size_count = block_size_ | (transfer_blocks_ << 16);
+        registers_->arg1 = arg;
+        registers_->cmd_xfer_mode = command_reg;
 
-        //  Exit now if we timed out
+        //  Wait for the command to complete or for an error.
+        //      There appears to be a difference between error signalling from real HW and QEMU - but this appears to be OK.
 
-        if (times >= timeout)
+        if (!WaitForCompletion(InterruptRegError | InterruptRegCommandDone, milliseconds(timeout)))
         {
             return Result::Failure(BlockIOResultCodes::EMMC_TIMEOUT_FOR_ISSUE_COMMAND);
         }
@@ -356,16 +793,17 @@ namespace EmmcImpl
             break;
         }
 
-        //  If this is a data command, then transfer the data
+        //  If this is a data command, then transfer the data.  For DMA transfers the controller moves the data
+        //      on its own and we simply wait for the data done interrupt below.
 
-        if (command.is_data)
+        if (command.is_data && !use_dma_for_transfer_)
         {
             TransferData(command);
         }
 
         if ((command.response_type == RT_48_BITS_BUSY) || command.is_data)
         {
-            WaitForInterrupt(registers_->int_flags, InterruptRegError | InterruptRegDataDone, true, 2000);
+            WaitForCompletion(InterruptRegError | InterruptRegDataDone, milliseconds(2000));
 
             interrupt_flags = registers_->int_flags;
 
@@ -382,6 +820,9 @@ namespace EmmcImpl
             }
         }
 
+        LogDebug1("EMMC command %u completed in %u usec\n", (uint32_t)command.index,
+                  (uint32_t)minstd::chrono::duration_cast<minstd::chrono::microseconds>(PhysicalTimer::Now() - command_start).count());
+
         return Result::Success();
     }
 
@@ -414,6 +855,18 @@ namespace EmmcImpl
         return BlockIOResultCodes::EMMC_COMMAND_LINE_FAILED_TO_RESET_CORRECTLY;
     }
 
+    BlockIOResultCodes SDCardController::ResetDataLine()
+    {
+        registers_->control[1] |= ControlReg1ResetData;
+
+        if (!WaitForInterrupt(registers_->control[1], ControlReg1ResetData, false, 10000))
+        {
+            return BlockIOResultCodes::EMMC_DATA_LINE_FAILED_TO_RESET_CORRECTLY;
+        }
+
+        return BlockIOResultCodes::SUCCESS;
+    }
+
     ValueResultWithErrorInfo<BlockIOResultCodes, int32_t, uint32_t> SDCardController::AppCommand(EMMCCommandTypes command, uint32_t arg, uint32_t timeout)
     {
         using Result = ValueResultWithErrorInfo<BlockIOResultCodes, int32_t, uint32_t>;
@@ -631,7 +1084,10 @@ namespace EmmcImpl
         bsc |= 0x200;  // set bottom bits to 512
         registers_->block_size_count = bsc;
 
-        buffer_ = &sd_card_configuration_register_.scr[0];
+        BlockIOSegment scr_segment = {(uint8_t *)&sd_card_configuration_register_.scr[0], 1};
+
+        segments_ = &scr_segment;
+        number_of_segments_ = 1;
         block_size_ = 8;
         transfer_blocks_ = 1;
 
@@ -650,6 +1106,10 @@ namespace EmmcImpl
         uint32_t spec3 = (scr0 >> (47 - 32)) & 0x1;
         uint32_t spec4 = (scr0 >> (42 - 32)) & 0x1;
 
+        set_block_count_supported_ = ((scr0 >> SCR_CMD23_SUPPORTED_BIT) & 0x1) != 0;
+
+        sd_card_configuration_register_.bus_widths = (scr0 >> SCR_BUS_WIDTHS_SHIFT) & SCR_BUS_WIDTHS_MASK;
+
         if (spec == 0)
         {
             sd_card_configuration_register_.version = 1;
@@ -681,6 +1141,95 @@ namespace EmmcImpl
         return BlockIOResultCodes::SUCCESS;
     }
 
+    bool SDCardController::EnableFourBitBus()
+    {
+        if ((sd_card_configuration_register_.bus_widths & SCR_BUS_WIDTH_4_BIT) == 0)
+        {
+            LogDebug1("EMMC card does not support a 4 bit bus\n");
+            return false;
+        }
+
+        if (AppCommand(EMMCCommandTypes::SetBusWidth, ACMD6_BUS_WIDTH_4_BIT, 2000).Failed())
+        {
+            LogWarning("EMMC_WARN: ACMD6 failed, staying with a 1 bit bus\n");
+
+            ResetCommand();
+            return false;
+        }
+
+        //  The card has switched, so the host has to follow
+
+        registers_->control[0] |= ControlReg0DataWidth4Bit;
+
+        return true;
+    }
+
+    bool SDCardController::EnableHighSpeed()
+    {
+        //  CMD6 first appears in version 1.10 of the physical layer specification
+
+        if ((sd_card_configuration_register_.version == 1) || (sd_card_configuration_register_.version == 0xFFFFFFFF))
+        {
+            LogDebug1("EMMC card does not support CMD6, staying at normal speed\n");
+            return false;
+        }
+
+        //  No point asking for 50MHz if the base clock cannot deliver more than 25MHz
+
+        if (emmc_host_clock_rate_ <= SDClockNormalRate)
+        {
+            return false;
+        }
+
+        //  Ask the card to switch to high speed, the 64 byte status block tells us if it did
+
+        alignas(4) uint8_t switch_status[CMD6_STATUS_SIZE_IN_BYTES];
+
+        BlockIOSegment status_segment = {switch_status, 1};
+
+        segments_ = &status_segment;
+        number_of_segments_ = 1;
+        block_size_ = CMD6_STATUS_SIZE_IN_BYTES;
+        transfer_blocks_ = 1;
+
+        auto switch_result = IssueCommand(SWITCH_FUNCTION_CMD, CMD6_SWITCH_TO_HIGH_SPEED, 2000);
+
+        block_size_ = 512;
+
+        if (switch_result.Failed())
+        {
+            LogWarning("EMMC_WARN: CMD6 failed, staying at normal speed\n");
+
+            ResetCommand();
+            ResetDataLine();
+            return false;
+        }
+
+        if ((switch_status[CMD6_STATUS_GROUP1_SELECTION_BYTE] & CMD6_STATUS_GROUP1_SELECTION_MASK) != CMD6_HIGH_SPEED_FUNCTION)
+        {
+            LogDebug1("EMMC card refused the switch to high speed\n");
+            return false;
+        }
+
+        //  The card switches within 8 clocks of the end of the status block, then the host follows
+
+        PhysicalTimer::Wait(milliseconds(1));
+
+        registers_->control[0] |= ControlReg0HighSpeedEnable;
+
+        if (Failure(SwitchClockRate(emmc_host_clock_rate_, SDClockHighRate)))
+        {
+            //  The card is already in high speed mode, which runs fine at the normal clock rate
+
+            registers_->control[0] &= ~ControlReg0HighSpeedEnable;
+
+            LogWarning("EMMC_WARN: Unable to raise the SD clock, staying at normal speed\n");
+            return false;
+        }
+
+        return true;
+    }
+
     BlockIOResultCodes SDCardController::ResetCard()
     {
         registers_->control[1] = ControlReg1ResetHost;
@@ -713,7 +1262,18 @@ namespace EmmcImpl
 
         emmc_host_clock_rate_ = getEMMCClockRateTag.GetRateInHz();
 
-        LogDebug1("EMMC Host Clock Rate: %u Hz\n", getEMMCClockRateTag.GetRateInHz());
+        //  If the mailbox cannot tell us, fall back to the base clock the controller advertises
+
+        if (emmc_host_clock_rate_ == 0)
+        {
+            emmc_host_clock_rate_ = ((registers_->cap1 >> Capabilities1BaseClockShift) & Capabilities1BaseClockMask) * 1000000;
+        }
+
+        LogDebug1("EMMC Host Clock Rate: %u Hz\n", emmc_host_clock_rate_);
+
+        //  The divider format depends on the host controller version
+
+        host_controller_version_ = (registers_->slot_int_status >> HostControllerVersionShift) & HostControllerVersionMask;
 
         //  Setup the clock
 
@@ -751,6 +1311,32 @@ namespace EmmcImpl
 
         RETURN_IF_FAILED(SetSDCardConfigurationRegister());
 
+        //  Widen the bus and raise the clock as far as the card will go, if the card (or emulator) refuses we stay
+        //      in the default 1 bit, 25MHz mode.
+
+        four_bit_bus_ = EnableFourBitBus();
+        high_speed_ = EnableHighSpeed();
+
+        LogDebug1("EMMC using %u bit bus at %u Hz\n", four_bit_bus_ ? 4 : 1, high_speed_ ? SDClockHighRate : SDClockNormalRate);
+
+        //  Select ADMA2 if the host controller supports it, otherwise all data will be moved with PIO
+
+        adma2_supported_ = (registers_->cap1 & Capabilities1ADMA2Support) != 0;
+
+        if (adma2_supported_)
+        {
+            registers_->control[0] = (registers_->control[0] & ~ControlReg0DMASelectMask) | ControlReg0DMASelectADMA2;
+        }
+
+        LogDebug1(adma2_supported_ ? "EMMC using ADMA2 for data transfers\n" : "EMMC using PIO for data transfers\n");
+
+        //  Multi-block transfers are bounded with CMD23 when the card supports it, the controller sends it for us if it can
+
+        auto_cmd23_supported_ = set_block_count_supported_ && (host_controller_version_ >= HostControllerVersion300);
+
+        LogDebug1(set_block_count_supported_ ? (auto_cmd23_supported_ ? "EMMC using auto CMD23 for multi-block transfers\n" : "EMMC using CMD23 for multi-block transfers\n")
+                                             : "EMMC using open-ended multi-block transfers\n");
+
         // enable all interrupts
 
         registers_->int_flags = InterruptRegEnableAll;
@@ -768,6 +1354,12 @@ namespace EmmcImpl
         operating_conditions_register_ = 0;
         relative_card_address_register_ = 0;
         offset_in_blocks_ = 0;
+        adma2_supported_ = false;
+        use_dma_for_transfer_ = false;
+        set_block_count_supported_ = false;
+        auto_cmd23_supported_ = false;
+        four_bit_bus_ = false;
+        high_speed_ = false;
 
         ConfigureGPIO();
 
@@ -788,6 +1380,22 @@ namespace EmmcImpl
 
         LogDebug1("%s", last_reset_result == BlockIOResultCodes::SUCCESS ? "SD Card Initialized\n" : "SD Card Initialization Failed\n");
 
+        //  Once the card is up, switch from polling to interrupt driven completion for commands and data transfers.
+        //      On RPI4 the GIC steers the interrupt to the core the block IO service task is pinned to, as that is where
+        //      the waits happen.  On RPI3 GPU interrupts always reach core 0.  Waits on any other core than the one taking
+        //      the interrupt, including those before the service task attaches, yield and pick up the completion from the
+        //      interrupt register after the first millisecond.
+
+        if ((last_reset_result == BlockIOResultCodes::SUCCESS) && !interrupt_driven_completion_)
+        {
+            interrupt_driven_completion_ = GetExceptionManager().AddInterruptServiceRoutine(&completion_isr_, CoreList(DEFAULT_BLOCK_IO_SERVICE_CORE));
+
+            if (!interrupt_driven_completion_)
+            {
+                LogWarning("EMMC_WARN: Unable to register completion ISR, falling back to polling\n");
+            }
+        }
+
         return last_reset_result;
     }
 
@@ -811,52 +1419,43 @@ namespace EmmcImpl
 
     uint32_t SDCardController::GetClockDivider(uint32_t base_clock, uint32_t desired_frequency)
     {
-        //  Finder a divider which will give us a frequency <= desired_frequency starting with base_clock
+        //  The SD clock is the base clock divided by twice the divider, a divider of zero passes the base clock straight through.
+        //      Round the divider up so the SD clock never exceeds the desired frequency.
 
-        uint32_t closest_integral_divider = 0;
+        uint32_t divider = 0;
 
-        if (desired_frequency > base_clock)
+        if (desired_frequency < base_clock)
         {
-            closest_integral_divider = 1;
+            divider = (base_clock + (2 * desired_frequency) - 1) / (2 * desired_frequency);
         }
-        else
-        {
-            closest_integral_divider = base_clock / desired_frequency;
 
-            //  If the base clock is an integral multiple of the desired_frequency, then increment the 'closest divider'
-            //      by 1 to insure we fall below the desired frequency after division.
+        if (host_controller_version_ >= HostControllerVersion300)
+        {
+            //  10 bit programmable divider
 
-            if (base_clock % desired_frequency)
+            if (divider > MAX_10_BIT_CLOCK_DIVIDER)
             {
-                closest_integral_divider++;
+                divider = MAX_10_BIT_CLOCK_DIVIDER;
             }
         }
-
-        //  Cap the divider at 1024
-
-        if (closest_integral_divider > 1024)
+        else if (divider > 0)
         {
-            closest_integral_divider = 1024;
-        }
-
-        //  Find the closest power of 2 larger than the divider
+            //  8 bit divider, which must be a power of 2
 
-        uint32_t power_of_2_divider = 1;
+            uint32_t power_of_2_divider = 1;
 
-        for (power_of_2_divider = 1; power_of_2_divider < closest_integral_divider; power_of_2_divider *= 2)
-            ;
+            for (; (power_of_2_divider < divider) && (power_of_2_divider < MAX_8_BIT_CLOCK_DIVIDER); power_of_2_divider *= 2)
+                ;
 
-        //  Cap the power of 2 divider at 15
+            divider = power_of_2_divider;
+        }
 
-        //        if (power_of_2_divider > 15)
-        //        {
-        //            power_of_2_divider = 15;
-        //        }
+        LogDebug1("SD Card Clock Rate Divider: %u for target: %u\n", divider, desired_frequency);
 
-        LogDebug1("SD Card Clock Rate Divider: %u for target: %u\n", power_of_2_divider, desired_frequency);
+        //  The low 8 bits of the divider go in bits 15:8 of control 1, the upper 2 bits in bits 7:6
 
-        uint32_t high_divider = (power_of_2_divider & 0x300) >> 2; //  Will always be zero if div always <= 15
-        uint32_t low_divider = (power_of_2_divider & 0x0ff);
+        uint32_t high_divider = (divider & 0x300) >> 2;
+        uint32_t low_divider = (divider & 0x0ff);
 
         uint32_t control_reg_1_formatted_divider = (low_divider << 8) + high_divider;
 
@@ -937,16 +1536,72 @@ namespace EmmcImpl
     //  Data Transfer - Read/Write methods
     //
 
-    BlockIOResultCodes SDCardController::DataCommand(bool write, uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_transfer)
+    BlockIOResultCodes SDCardController::Transfer(bool write, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number)
+    {
+        //  Segments the ADMA2 engine can use directly go straight to the data command, as does everything on a host
+        //      without ADMA2.  Anything else is staged through the bounce buffer so it still moves by DMA.
+
+        if (!adma2_supported_ || SegmentsAreDMAAligned(segments, number_of_segments, 512))
+        {
+            return DataCommand(write, segments, number_of_segments, block_number);
+        }
+
+        return BouncedTransfer(write, segments, number_of_segments, block_number);
+    }
+
+    BlockIOResultCodes SDCardController::BouncedTransfer(bool write, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number)
+    {
+        uint32_t blocks_remaining = TotalBlocksInSegments(segments, number_of_segments);
+
+        uint32_t current_segment = 0;
+        uint32_t offset_into_segment = 0;
+
+        //  One data command per bounce buffer full, the data is gathered from the segments before a write and
+        //      scattered back to them after a read
+
+        while (blocks_remaining > 0)
+        {
+            uint32_t blocks_this_pass = blocks_remaining < SD_CARD_DMA_BOUNCE_BUFFER_BLOCKS ? blocks_remaining : SD_CARD_DMA_BOUNCE_BUFFER_BLOCKS;
+
+            BlockIOSegment bounce_segment = {dma_bounce_buffer_, blocks_this_pass};
+
+            if (write)
+            {
+                CopySegmentsAndBounceBuffer(segments, current_segment, offset_into_segment, dma_bounce_buffer_, blocks_this_pass * 512, 512, true);
+            }
+
+            RETURN_IF_FAILED(DataCommand(write, &bounce_segment, 1, block_number));
+
+            if (!write)
+            {
+                CopySegmentsAndBounceBuffer(segments, current_segment, offset_into_segment, dma_bounce_buffer_, blocks_this_pass * 512, 512, false);
+            }
+
+            block_number += blocks_this_pass;
+            blocks_remaining -= blocks_this_pass;
+        }
+
+        return BlockIOResultCodes::SUCCESS;
+    }
+
+    BlockIOResultCodes SDCardController::DataCommand(bool write, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number)
     {
         if (!is_sdhc_card_)
         {
             block_number *= 512;
         }
 
-        transfer_blocks_ = blocks_to_transfer;
+        //  The transfer covers all the segments, they are filled or drained in order
+
+        transfer_blocks_ = 0;
+
+        for (uint32_t i = 0; i < number_of_segments; i++)
+        {
+            transfer_blocks_ += segments[i].block_count_;
+        }
 
-        buffer_ = buffer;
+        segments_ = segments;
+        number_of_segments_ = number_of_segments;
 
         EMMCCommandTypes command = EMMCCommandTypes::ReadBlock;
 
@@ -963,12 +1618,18 @@ namespace EmmcImpl
             command = EMMCCommandTypes::ReadMultiple;
         }
 
+        //  Use DMA if we can, otherwise the data is moved by TransferData()
+
+        use_dma_for_transfer_ = PrepareDMATransfer(segments, number_of_segments);
+
+        auto start_time = PhysicalTimer::Now();
+
         int retry_count = 0;
         int max_retries = 3;
 
         while (retry_count < max_retries)
         {
-            auto command_result = Command(command, block_number, 5000);
+            auto command_result = IssueDataCommand(command, write, block_number);
 
             if (command_result.Successful())
             {
@@ -977,15 +1638,98 @@ namespace EmmcImpl
 
             LogDebug1("EMMC Data Command Failed with code: %d\n", command_result.ResultCode());
 
+            //  If the DMA transfer failed, reset the data line and fall back to PIO for the retries
+
+            if (use_dma_for_transfer_)
+            {
+                LogWarning("EMMC DMA transfer failed, falling back to PIO\n");
+
+                ResetDataLine();
+                use_dma_for_transfer_ = false;
+            }
+
             if (++retry_count >= max_retries)
             {
+                RecordDataCommand(write, transfer_blocks_, start_time, false);
                 return BlockIOResultCodes::EMMC_DATA_COMMAND_MAX_RETRIES;
             }
+
+            statistics_.RecordRetry();
         }
 
+        //  For DMA reads, drop any lines speculatively loaded into the cache while the transfer was in flight
+
+        if (use_dma_for_transfer_ && !write)
+        {
+            for (uint32_t i = 0; i < number_of_segments; i++)
+            {
+                CleanAndInvalidateDataCache(segments[i].buffer_, segments[i].block_count_ * block_size_);
+            }
+        }
+
+        use_dma_for_transfer_ = false;
+
+        RecordDataCommand(write, transfer_blocks_, start_time, true);
+
         return BlockIOResultCodes::SUCCESS;
     }
 
+    ValueResultWithErrorInfo<BlockIOResultCodes, int32_t, uint32_t> SDCardController::IssueDataCommand(EMMCCommandTypes command_type, bool write, uint32_t block_number)
+    {
+        using Result = ValueResultWithErrorInfo<BlockIOResultCodes, int32_t, uint32_t>;
+
+        EMMCCommand command = GetCommand(command_type);
+
+        if (transfer_blocks_ > 1)
+        {
+            //  Tell the card how many blocks are coming ahead of a long write so it can pre-erase them.  ACMD23 is only
+            //      a hint, so if the card rejects it the write goes ahead anyway.
+
+            if (write && (transfer_blocks_ >= MIN_SD_CARD_PRE_ERASE_BLOCKS))
+            {
+                if (AppCommand(EMMCCommandTypes::SetWriteBlockEraseCount, transfer_blocks_ & ACMD23_MAX_ERASE_COUNT, 2000).Failed())
+                {
+                    LogDebug1("EMMC ACMD23 failed, writing without pre-erase\n");
+                }
+            }
+
+            //  With a pre-defined block count the card ends the transfer itself, so no CMD12 is needed afterwards
+
+            if (auto_cmd23_supported_)
+            {
+                registers_->arg2 = transfer_blocks_;
+                command.auto_command = AC_CMD23;
+            }
+            else if (set_block_count_supported_)
+            {
+                auto set_block_count_result = Command(EMMCCommandTypes::SetBlockCount, transfer_blocks_, 2000);
+
+                if (set_block_count_result.Failed())
+                {
+                    return set_block_count_result;
+                }
+
+                command.auto_command = AC_NONE;
+            }
+        }
+
+        return IssueCommand(command, block_number, 5000);
+    }
+
+    void SDCardController::RecordDataCommand(bool write, uint32_t blocks, minstd::chrono::time_point<minstd::chrono::nanoseconds> start_time, bool succeeded)
+    {
+        uint64_t latency_in_us = minstd::chrono::duration_cast<minstd::chrono::microseconds>(PhysicalTimer::Now() - start_time).count();
+
+        if (write)
+        {
+            statistics_.RecordWrite(blocks, latency_in_us, succeeded);
+        }
+        else
+        {
+            statistics_.RecordRead(blocks, latency_in_us, succeeded);
+        }
+    }
+
     BlockIOResultCodes SDCardController::Seek(uint64_t offset_in_blocks)
     {
         offset_in_blocks_ = offset_in_blocks;
@@ -1002,7 +1746,9 @@ namespace EmmcImpl
     {
         using Result = ValueResult<BlockIOResultCodes, uint32_t>;
 
-        BlockIOResultCodes data_command_result = DataCommand(false, buffer, block_number, blocks_to_read);
+        BlockIOSegment segment = {buffer, blocks_to_read};
+
+        BlockIOResultCodes data_command_result = Transfer(false, &segment, 1, block_number);
 
         if (Failure(data_command_result))
         {
@@ -1016,7 +1762,9 @@ namespace EmmcImpl
     {
         using Result = ValueResult<BlockIOResultCodes, uint32_t>;
 
-        BlockIOResultCodes data_command_result = DataCommand(true, buffer, block_number, blocks_to_write);
+        BlockIOSegment segment = {buffer, blocks_to_write};
+
+        BlockIOResultCodes data_command_result = Transfer(true, &segment, 1, block_number);
 
         if (Failure(data_command_result))
         {
@@ -1025,6 +1773,101 @@ namespace EmmcImpl
 
         return Result::Success(blocks_to_write);
     }
+
+    ValueResult<BlockIOResultCodes, uint32_t> SDCardController::ReadBlocksV(BlockIOPriority priority, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number)
+    {
+        using Result = ValueResult<BlockIOResultCodes, uint32_t>;
+
+        //  The segments are scattered by the ADMA2 descriptor table, or block by block for PIO, so a single command covers them all
+
+        if (number_of_segments == 0)
+        {
+            return Result::Success(0);
+        }
+
+        BlockIOResultCodes data_command_result = Transfer(false, segments, number_of_segments, block_number);
+
+        if (Failure(data_command_result))
+        {
+            return Result::Failure(data_command_result);
+        }
+
+        return Result::Success(TotalBlocksInSegments(segments, number_of_segments));
+    }
+
+    ValueResult<BlockIOResultCodes, uint32_t> SDCardController::WriteBlocksV(BlockIOPriority priority, const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t block_number)
+    {
+        using Result = ValueResult<BlockIOResultCodes, uint32_t>;
+
+        if (number_of_segments == 0)
+        {
+            return Result::Success(0);
+        }
+
+        BlockIOResultCodes data_command_result = Transfer(true, segments, number_of_segments, block_number);
+
+        if (Failure(data_command_result))
+        {
+            return Result::Failure(data_command_result);
+        }
+
+        return Result::Success(TotalBlocksInSegments(segments, number_of_segments));
+    }
+
+    BlockIOResultCodes SDCardController::Discard(uint32_t block_number, uint32_t number_of_blocks)
+    {
+        //  No data moves for an erase
+
+        transfer_blocks_ = 0;
+
+        //  Large ranges are erased in pieces so each erase completes within the busy timeout
+
+        while (number_of_blocks > 0)
+        {
+            uint32_t blocks_to_erase = number_of_blocks > MAX_SD_CARD_ERASE_BLOCKS ? MAX_SD_CARD_ERASE_BLOCKS : number_of_blocks;
+
+            uint32_t first_address = block_number;
+            uint32_t last_address = block_number + blocks_to_erase - 1;
+
+            if (!is_sdhc_card_)
+            {
+                first_address *= 512;
+                last_address *= 512;
+            }
+
+            if (Command(EMMCCommandTypes::EraseWriteBlockStart, first_address, 2000).Failed() ||
+                Command(EMMCCommandTypes::EraseWriteBlockEnd, last_address, 2000).Failed() ||
+                Command(EMMCCommandTypes::Erase, 0, 2000).Failed())
+            {
+                LogDebug1("EMMC erase of blocks %u through %u failed\n", block_number, block_number + blocks_to_erase - 1);
+                return BlockIOResultCodes::EMMC_ERASE_FAILED;
+            }
+
+            block_number += blocks_to_erase;
+            number_of_blocks -= blocks_to_erase;
+        }
+
+        return BlockIOResultCodes::SUCCESS;
+    }
+
+    ValueResult<BlockIOResultCodes, uint32_t> SDCardController::ExecuteRequest(BlockIORequest &request)
+    {
+        using Result = ValueResult<BlockIOResultCodes, uint32_t>;
+
+        //  Requests are only queued on the controller by the IO service task, so they execute on the core which owns the card.
+        //      They go straight to the transfer, which picks single or multiple block commands and DMA or PIO.
+
+        BlockIOSegment segment = {request.Buffer(), request.BlockCount()};
+
+        BlockIOResultCodes data_command_result = Transfer(request.Direction() == BlockIODirection::WRITE, &segment, 1, request.BlockNumber());
+
+        if (Failure(data_command_result))
+        {
+            return Result::Failure(data_command_result);
+        }
+
+        return Result::Success(request.BlockCount());
+    }
 }
 
 //
@@ -0,0 +1,64 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "devices/ram_disk.h"
+
+#include <string.h>
+
+BlockIOResultCodes RamDiskBlockIODevice::Seek(uint64_t offset_in_blocks)
+{
+    if (offset_in_blocks > size_in_blocks_)
+    {
+        return BlockIOResultCodes::RAM_DISK_BLOCK_OUT_OF_RANGE;
+    }
+
+    offset_in_blocks_ = offset_in_blocks;
+
+    return BlockIOResultCodes::SUCCESS;
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> RamDiskBlockIODevice::ReadFromBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_read)
+{
+    using Result = ValueResult<BlockIOResultCodes, uint32_t>;
+
+    if (!IsRangeValid(block_number, blocks_to_read))
+    {
+        return Result::Failure(BlockIOResultCodes::RAM_DISK_BLOCK_OUT_OF_RANGE);
+    }
+
+    memcpy(buffer, BlockAddress(block_number), static_cast<size_t>(blocks_to_read) * BLOCK_SIZE_IN_BYTES);
+
+    return Result::Success(blocks_to_read);
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> RamDiskBlockIODevice::ReadFromCurrentOffset(uint8_t *buffer, uint32_t blocks_to_read)
+{
+    return ReadFromBlock(buffer, static_cast<uint32_t>(offset_in_blocks_), blocks_to_read);
+}
+
+ValueResult<BlockIOResultCodes, uint32_t> RamDiskBlockIODevice::WriteBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_write)
+{
+    using Result = ValueResult<BlockIOResultCodes, uint32_t>;
+
+    if (!IsRangeValid(block_number, blocks_to_write))
+    {
+        return Result::Failure(BlockIOResultCodes::RAM_DISK_BLOCK_OUT_OF_RANGE);
+    }
+
+    memcpy(BlockAddress(block_number), buffer, static_cast<size_t>(blocks_to_write) * BLOCK_SIZE_IN_BYTES);
+
+    return Result::Success(blocks_to_write);
+}
+
+BlockIOResultCodes RamDiskBlockIODevice::Discard(uint32_t block_number, uint32_t number_of_blocks)
+{
+    if (!IsRangeValid(block_number, number_of_blocks))
+    {
+        return BlockIOResultCodes::RAM_DISK_BLOCK_OUT_OF_RANGE;
+    }
+
+    memset(BlockAddress(block_number), 0, static_cast<size_t>(number_of_blocks) * BLOCK_SIZE_IN_BYTES);
+
+    return BlockIOResultCodes::SUCCESS;
+}
@@ -0,0 +1,50 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "devices/ram_disk.h"
+
+#include "heaps.h"
+
+#include "devices/log.h"
+#include "platform/memory_manager.h"
+
+ReferenceResult<BlockIOResultCodes, RamDiskBlockIODevice> CreateRamDisk(const char *name, uint64_t size_in_bytes)
+{
+    using Result = ReferenceResult<BlockIOResultCodes, RamDiskBlockIODevice>;
+
+    uint32_t size_in_blocks = static_cast<uint32_t>(size_in_bytes / RamDiskBlockIODevice::BLOCK_SIZE_IN_BYTES);
+
+    if (size_in_blocks == 0)
+    {
+        return Result::Failure(BlockIOResultCodes::RAM_DISK_UNABLE_TO_ALLOCATE_MEMORY);
+    }
+
+    //  Take whole pages from the memory manager for the disk storage
+
+    uint64_t storage_size_in_bytes = static_cast<uint64_t>(size_in_blocks) * RamDiskBlockIODevice::BLOCK_SIZE_IN_BYTES;
+
+    MemoryPagePointer storage = GetMemoryManager().GetFreeBlock(storage_size_in_bytes);
+
+    if (static_cast<uint64_t>(storage) == 0)
+    {
+        LogError("Unable to allocate %u blocks for RAM disk: %s\n", size_in_blocks, name);
+        return Result::Failure(BlockIOResultCodes::RAM_DISK_UNABLE_TO_ALLOCATE_MEMORY);
+    }
+
+    //  Create the device and register it with the OS so it can be located by name
+
+    auto ram_disk_entity = make_static_unique<RamDiskBlockIODevice>(true, name, name, static_cast<uint8_t *>(storage), size_in_blocks);
+
+    RamDiskBlockIODevice &ram_disk = *ram_disk_entity;
+
+    if (!Successful(GetOSEntityRegistry().AddEntity(ram_disk_entity)))
+    {
+        LogError("Unable to register RAM disk: %s\n", name);
+
+        GetMemoryManager().ReleaseBlock(storage, storage_size_in_bytes);
+        return Result::Failure(BlockIOResultCodes::FAILURE);
+    }
+
+    return Result::Success(ram_disk);
+}
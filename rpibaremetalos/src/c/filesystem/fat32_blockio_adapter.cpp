@@ -6,6 +6,12 @@
 
 #include "filesystem/filesystem_errors.h"
 
+#include <string.h>
+
+#include <algorithm>
+
+#include "heaps.h"
+
 namespace filesystems::fat32
 {
     //
@@ -52,17 +58,101 @@ namespace filesystems::fat32
         char filesystem_type_[8];                            //  BS_FilSysType
     } PACKED FAT32BiosParameterBlock;
 
+    //
+    //  FAT32 FSInfo sector
+    //
+
+    typedef struct FAT32FSInfoSector
+    {
+        uint32_t lead_signature_;      //  FSI_LeadSig
+        uint8_t reserved1_[480];       //  FSI_Reserved1
+        uint32_t structure_signature_; //  FSI_StrucSig
+        uint32_t free_count_;          //  FSI_Free_Count
+        uint32_t next_free_;           //  FSI_Nxt_Free
+        uint8_t reserved2_[12];        //  FSI_Reserved2
+        uint32_t trail_signature_;     //  FSI_TrailSig
+    } PACKED FAT32FSInfoSector;
+
+    static_assert(sizeof(FAT32FSInfoSector) == 512);
+
+    constexpr uint32_t FAT32_FSINFO_LEAD_SIGNATURE = 0x41615252;
+    constexpr uint32_t FAT32_FSINFO_STRUCTURE_SIGNATURE = 0x61417272;
+    constexpr uint32_t FAT32_FSINFO_TRAIL_SIGNATURE = 0xAA550000;
+    constexpr uint32_t FAT32_FSINFO_UNKNOWN = 0xFFFFFFFF;
+
+    constexpr uint16_t FAT32_NO_FSINFO_SECTOR = 0xFFFF;
+
+    //  BPB_extFlags - when mirroring is disabled only the active FAT is in use
+
+    constexpr uint16_t FAT32_FAT_MIRRORING_DISABLED = 0x0080;
+    constexpr uint16_t FAT32_ACTIVE_FAT_MASK = 0x000F;
+
+    static bool IsValidFSInfoSector(const FAT32FSInfoSector &fsinfo)
+    {
+        return (fsinfo.lead_signature_ == FAT32_FSINFO_LEAD_SIGNATURE) &&
+               (fsinfo.structure_signature_ == FAT32_FSINFO_STRUCTURE_SIGNATURE) &&
+               (fsinfo.trail_signature_ == FAT32_FSINFO_TRAIL_SIGNATURE);
+    }
+
+    //  Number of FAT sectors read with each request while building the free cluster bitmap
+
+    constexpr uint32_t FAT32_FREE_CLUSTER_BITMAP_SECTORS_PER_READ = 32;
+
+    //
+    //  Layout used when formatting a new filesystem
+    //
+
+    constexpr uint32_t FAT32_FORMAT_BYTES_PER_SECTOR = 512;
+    constexpr uint16_t FAT32_FORMAT_RESERVED_SECTORS = 32;
+    constexpr uint8_t FAT32_FORMAT_NUMBER_OF_FATS = 2;
+    constexpr uint16_t FAT32_FORMAT_FSINFO_SECTOR = 1;
+    constexpr uint16_t FAT32_FORMAT_BACKUP_BOOT_SECTOR = 6;
+    constexpr uint32_t FAT32_FORMAT_ROOT_DIRECTORY_CLUSTER = 2;
+    constexpr uint32_t FAT32_FORMAT_MINIMUM_CLUSTERS = 65525; //  Volumes with fewer clusters are FAT12 or FAT16 by definition
+    constexpr uint8_t FAT32_FORMAT_MEDIA_DESCRIPTOR = 0xF8;
+    constexpr uint8_t FAT32_FORMAT_VOLUME_ID_ATTRIBUTE = 0x08;
+    constexpr size_t FAT32_VOLUME_LABEL_LENGTH = 11;
+
+    constexpr uint32_t FAT32_BOOT_SECTOR_SIGNATURE_OFFSET = 510;
+
+    //  Cluster size follows the table in the Microsoft FAT specification for 512 byte sectors
+
+    static uint8_t SectorsPerClusterForVolume(uint32_t number_of_sectors)
+    {
+        if (number_of_sectors <= 532480)
+        {
+            return 1;
+        }
+        else if (number_of_sectors <= 16777216)
+        {
+            return 8;
+        }
+        else if (number_of_sectors <= 33554432)
+        {
+            return 16;
+        }
+        else if (number_of_sectors <= 67108864)
+        {
+            return 32;
+        }
+
+        return 64;
+    }
+
     //
     //  FAT32 Block IO Adapter follows
     //
 
-    ValueResult<FilesystemResultCodes, FAT32BlockIOAdapter> FAT32BlockIOAdapter::Mount(BlockIODevice &io_device, uint32_t first_lba_sector)
+    ValueResult<FilesystemResultCodes, FAT32BlockIOAdapter> FAT32BlockIOAdapter::Mount(BlockIODevice &io_device,
+                                                                                       uint32_t first_lba_sector,
+                                                                                       bool discard_freed_clusters,
+                                                                                       uint32_t fat_cache_size_in_sectors)
     {
         using Result = ValueResult<FilesystemResultCodes, FAT32BlockIOAdapter>;
 
         LogDebug1("In FAT32BlockIOAdapter\n");
 
-        uint8_t first_lba_buffer[io_device.BlockSize()];
+        alignas(BLOCK_IO_BUFFER_ALIGNMENT) uint8_t first_lba_buffer[io_device.BlockSize()];
 
         if (io_device.ReadFromBlock(first_lba_buffer, first_lba_sector, 1).Failed())
         {
@@ -79,9 +169,38 @@ namespace filesystems::fat32
         uint32_t fat_lba = first_lba_sector + bpb.reserved_logical_sectors_;
         uint32_t data_lba = fat_lba + (bpb.number_of_fats_ * bpb.logical_sectors_per_fat32_);
 
+        //  FAT updates are normally mirrored to every copy of the FAT, unless the volume says only one copy is active
+
+        uint32_t number_of_fats = bpb.number_of_fats_;
+
+        if (((bpb.flags_ & FAT32_FAT_MIRRORING_DISABLED) != 0) && ((bpb.flags_ & FAT32_ACTIVE_FAT_MASK) < bpb.number_of_fats_))
+        {
+            fat_lba += (bpb.flags_ & FAT32_ACTIVE_FAT_MASK) * bpb.logical_sectors_per_fat32_;
+            number_of_fats = 1;
+        }
+
+        //  The highest usable cluster is limited by both the size of the FAT and the size of the data region
+
+        uint32_t total_sectors = bpb.total_logical_sectors32_ != 0 ? bpb.total_logical_sectors32_ : bpb.total_logical_sectors_fat16_;
+        uint32_t maximum_cluster_number = (bpb.logical_sectors_per_fat32_ * (io_device.BlockSize() / sizeof(uint32_t))) - 1;
+
+        if ((bpb.logical_sectors_per_cluster_ != 0) && (total_sectors > (data_lba - first_lba_sector)))
+        {
+            maximum_cluster_number = minstd::min(maximum_cluster_number, ((total_sectors - (data_lba - first_lba_sector)) / bpb.logical_sectors_per_cluster_) + 1);
+        }
+
         LogDebug1("First LBA, FAT LBA, Data LBA, Logical Sectors per FAT32, Logical Sectors per Cluster: %u, %u, %u, %u, %u\n", first_lba_sector, fat_lba, data_lba, bpb.logical_sectors_per_fat32_, bpb.logical_sectors_per_cluster_);
         LogDebug1("Root Directory Cluster: %u\n", bpb.root_directory_cluster_);
 
+        //  The FSInfo sector is optional
+
+        uint32_t fsinfo_lba = 0;
+
+        if ((bpb.location_of_filesystem_information_sector_ != 0) && (bpb.location_of_filesystem_information_sector_ != FAT32_NO_FSINFO_SECTOR))
+        {
+            fsinfo_lba = first_lba_sector + bpb.location_of_filesystem_information_sector_;
+        }
+
         //  Return success
 
         return Result::Success(FAT32BlockIOAdapter(io_device,
@@ -89,9 +208,169 @@ namespace filesystems::fat32
                                                    bpb.logical_sectors_per_cluster_,
                                                    bpb.bytes_per_logical_sector_,
                                                    bpb.logical_sectors_per_fat32_,
+                                                   number_of_fats,
                                                    first_lba_sector,
                                                    fat_lba,
-                                                   data_lba));
+                                                   data_lba,
+                                                   maximum_cluster_number,
+                                                   discard_freed_clusters,
+                                                   fat_cache_size_in_sectors,
+                                                   fsinfo_lba));
+    }
+
+    FilesystemResultCodes FAT32BlockIOAdapter::Format(BlockIODevice &io_device,
+                                                      uint32_t first_lba_sector,
+                                                      uint32_t number_of_sectors,
+                                                      const char *volume_label)
+    {
+        LogEntryAndExit("Formatting %u sectors starting at sector: %u\n", number_of_sectors, first_lba_sector);
+
+        if (io_device.BlockSize() != FAT32_FORMAT_BYTES_PER_SECTOR)
+        {
+            return FilesystemResultCodes::FAT32_UNABLE_TO_FORMAT_DEVICE;
+        }
+
+        //  Size the FAT to cover every cluster the volume could hold if the FATs took no space, this overestimates the FAT
+        //      by a few sectors at most but insures every data cluster has an entry.
+
+        const uint32_t sectors_per_cluster = SectorsPerClusterForVolume(number_of_sectors);
+        const uint32_t entries_per_sector = FAT32_FORMAT_BYTES_PER_SECTOR / sizeof(uint32_t);
+
+        if (number_of_sectors <= FAT32_FORMAT_RESERVED_SECTORS)
+        {
+            return FilesystemResultCodes::FAT32_VOLUME_TOO_SMALL_TO_FORMAT;
+        }
+
+        const uint32_t sectors_per_fat = ((((number_of_sectors - FAT32_FORMAT_RESERVED_SECTORS) / sectors_per_cluster) + 2) + entries_per_sector - 1) / entries_per_sector;
+        const uint32_t system_sectors = FAT32_FORMAT_RESERVED_SECTORS + (FAT32_FORMAT_NUMBER_OF_FATS * sectors_per_fat);
+
+        if ((number_of_sectors <= system_sectors) ||
+            (((number_of_sectors - system_sectors) / sectors_per_cluster) < FAT32_FORMAT_MINIMUM_CLUSTERS))
+        {
+            return FilesystemResultCodes::FAT32_VOLUME_TOO_SMALL_TO_FORMAT;
+        }
+
+        const uint32_t number_of_clusters = (number_of_sectors - system_sectors) / sectors_per_cluster;
+
+        const uint32_t fat_lba = first_lba_sector + FAT32_FORMAT_RESERVED_SECTORS;
+        const uint32_t data_lba = fat_lba + (FAT32_FORMAT_NUMBER_OF_FATS * sectors_per_fat);
+
+        //  The volume label is space padded in the boot sector and the root directory
+
+        char padded_label[FAT32_VOLUME_LABEL_LENGTH];
+
+        memset(padded_label, ' ', FAT32_VOLUME_LABEL_LENGTH);
+        memcpy(padded_label, volume_label, minstd::min(strlen(volume_label), FAT32_VOLUME_LABEL_LENGTH));
+
+        //  The volume serial number just has to differ between volumes, so hash the label and the geometry
+
+        uint32_t volume_serial_number = number_of_sectors ^ first_lba_sector;
+
+        for (size_t i = 0; i < FAT32_VOLUME_LABEL_LENGTH; i++)
+        {
+            volume_serial_number = (volume_serial_number * 31) + (uint8_t)padded_label[i];
+        }
+
+        alignas(BLOCK_IO_BUFFER_ALIGNMENT) uint8_t sector_buffer[FAT32_FORMAT_BYTES_PER_SECTOR];
+
+        //  Boot sector, also written to the backup boot sector location
+
+        memset(sector_buffer, 0, sizeof(sector_buffer));
+
+        FAT32BiosParameterBlock &bpb = *((FAT32BiosParameterBlock *)sector_buffer);
+
+        bpb.jmp_[0] = (char)0xEB;
+        bpb.jmp_[1] = (char)0x58;
+        bpb.jmp_[2] = (char)0x90;
+        memcpy(bpb.oem_name_, "RPIBMOS ", sizeof(bpb.oem_name_));
+        bpb.bytes_per_logical_sector_ = FAT32_FORMAT_BYTES_PER_SECTOR;
+        bpb.logical_sectors_per_cluster_ = sectors_per_cluster;
+        bpb.reserved_logical_sectors_ = FAT32_FORMAT_RESERVED_SECTORS;
+        bpb.number_of_fats_ = FAT32_FORMAT_NUMBER_OF_FATS;
+        bpb.media_descriptor_ = FAT32_FORMAT_MEDIA_DESCRIPTOR;
+        bpb.physical_sectors_per_track_ = 32;
+        bpb.number_of_heads_ = 64;
+        bpb.hidden_sectors_ = first_lba_sector;
+        bpb.total_logical_sectors32_ = number_of_sectors;
+        bpb.logical_sectors_per_fat32_ = sectors_per_fat;
+        bpb.root_directory_cluster_ = FAT32_FORMAT_ROOT_DIRECTORY_CLUSTER;
+        bpb.location_of_filesystem_information_sector_ = FAT32_FORMAT_FSINFO_SECTOR;
+        bpb.location_of_backup_sectors_ = FAT32_FORMAT_BACKUP_BOOT_SECTOR;
+        bpb.physical_drive_number_ = 0x80;
+        bpb.extended_boot_signature_ = 0x29;
+        bpb.volume_serial_number_ = volume_serial_number;
+        memcpy(bpb.volume_label_, padded_label, sizeof(bpb.volume_label_));
+        memcpy(bpb.filesystem_type_, "FAT32   ", sizeof(bpb.filesystem_type_));
+
+        sector_buffer[FAT32_BOOT_SECTOR_SIGNATURE_OFFSET] = 0x55;
+        sector_buffer[FAT32_BOOT_SECTOR_SIGNATURE_OFFSET + 1] = 0xAA;
+
+        if (io_device.WriteBlock(sector_buffer, first_lba_sector, 1).Failed() ||
+            io_device.WriteBlock(sector_buffer, first_lba_sector + FAT32_FORMAT_BACKUP_BOOT_SECTOR, 1).Failed())
+        {
+            return FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR;
+        }
+
+        //  FSInfo sector, the root directory holds the only allocated cluster
+
+        memset(sector_buffer, 0, sizeof(sector_buffer));
+
+        FAT32FSInfoSector &fsinfo = *((FAT32FSInfoSector *)sector_buffer);
+
+        fsinfo.lead_signature_ = FAT32_FSINFO_LEAD_SIGNATURE;
+        fsinfo.structure_signature_ = FAT32_FSINFO_STRUCTURE_SIGNATURE;
+        fsinfo.free_count_ = number_of_clusters - 1;
+        fsinfo.next_free_ = FAT32_FORMAT_ROOT_DIRECTORY_CLUSTER + 1;
+        fsinfo.trail_signature_ = FAT32_FSINFO_TRAIL_SIGNATURE;
+
+        if (io_device.WriteBlock(sector_buffer, first_lba_sector + FAT32_FORMAT_FSINFO_SECTOR, 1).Failed())
+        {
+            return FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR;
+        }
+
+        //  Both FATs are empty apart from the reserved entries and the end of chain for the root directory
+
+        for (uint32_t fat = 0; fat < FAT32_FORMAT_NUMBER_OF_FATS; fat++)
+        {
+            for (uint32_t sector = 0; sector < sectors_per_fat; sector++)
+            {
+                memset(sector_buffer, 0, sizeof(sector_buffer));
+
+                if (sector == 0)
+                {
+                    uint32_t *fat_entries = (uint32_t *)sector_buffer;
+
+                    fat_entries[0] = static_cast<uint32_t>(FAT32MediaDescriptor);
+                    fat_entries[1] = static_cast<uint32_t>(FAT32EntryAllocatedAndEndOfFile);
+                    fat_entries[FAT32_FORMAT_ROOT_DIRECTORY_CLUSTER] = static_cast<uint32_t>(FAT32EntryAllocatedAndEndOfFile);
+                }
+
+                if (io_device.WriteBlock(sector_buffer, fat_lba + (fat * sectors_per_fat) + sector, 1).Failed())
+                {
+                    return FilesystemResultCodes::FAT32_UNABLE_TO_WRITE_FAT_TABLE_SECTOR;
+                }
+            }
+        }
+
+        //  Root directory, the first entry is the volume label
+
+        for (uint32_t sector = 0; sector < sectors_per_cluster; sector++)
+        {
+            memset(sector_buffer, 0, sizeof(sector_buffer));
+
+            if (sector == 0)
+            {
+                memcpy(sector_buffer, padded_label, FAT32_VOLUME_LABEL_LENGTH);
+                sector_buffer[FAT32_VOLUME_LABEL_LENGTH] = FAT32_FORMAT_VOLUME_ID_ATTRIBUTE;
+            }
+
+            if (io_device.WriteBlock(sector_buffer, data_lba + sector, 1).Failed())
+            {
+                return FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR;
+            }
+        }
+
+        return FilesystemResultCodes::SUCCESS;
     }
 
     ValueResult<FilesystemResultCodes, FAT32ClusterIndex> FAT32BlockIOAdapter::NextClusterInChain(FAT32ClusterIndex cluster) const
@@ -107,24 +386,15 @@ namespace filesystems::fat32
             return Result::Failure(FilesystemResultCodes::FAT32_CLUSTER_OUT_OF_RANGE);
         }
 
-        //  Calculate the sector LBA from the FAT table base address.
-
-        uint32_t sector = static_cast<uint32_t>(fat_lba_) + (static_cast<uint32_t>(cluster) / fat32_entries_per_block_);
-        uint32_t offset = static_cast<uint32_t>(cluster) % fat32_entries_per_block_;
+        //  The FAT cache reads the sector holding the entry from the device if it is not already resident
 
-        uint32_t current_fat[(io_device_->BlockSize() / sizeof(uint32_t)) + 2];
+        auto entry = fat_cache_.ReadEntry(static_cast<uint32_t>(cluster));
 
-        //  FAT entries are only one sector at a time - they are not clustered.
-
-        if (io_device_->ReadFromBlock((uint8_t *)current_fat, sector, 1).Failed())
-        {
-            LogDebug1("Unable to load FAT32 sector: %u\n", sector);
-            return Result::Failure(FilesystemResultCodes::FAT32_UNABLE_TO_READ_FAT_TABLE_SECTOR);
-        }
+        ReturnOnFailure(entry);
 
         //  Finished with success
 
-        return Result::Success(FAT32ClusterIndex(current_fat[offset]));
+        return Result::Success(FAT32ClusterIndex(*entry));
     }
 
     ValueResult<FilesystemResultCodes, FAT32ClusterIndex> FAT32BlockIOAdapter::PreviousClusterInChain(FAT32ClusterIndex first_cluster,
@@ -176,6 +446,8 @@ namespace filesystems::fat32
 
     FilesystemResultCodes FAT32BlockIOAdapter::UpdateFATTableEntry(FAT32ClusterIndex cluster, FAT32ClusterIndex new_value)
     {
+        using Result = FilesystemResultCodes;
+
         LogEntryAndExit("Updating FAT Table entry: %d with new value: %d\n", static_cast<uint32_t>(cluster), static_cast<uint32_t>(new_value));
 
         //  Insure we stay in the bounds of the FAT table.  We do have to be able to write a zero (FAT32EntryFree) to the FAT table though.
@@ -185,32 +457,150 @@ namespace filesystems::fat32
             return FilesystemResultCodes::FAT32_CLUSTER_OUT_OF_RANGE;
         }
 
-        // Calculate the sector LBA from the FAT table base address
+        //  Outside of a transaction, single entry updates are written through so the FAT on the device is current when we return
 
-        uint32_t sector = static_cast<uint32_t>(fat_lba_) + (static_cast<uint32_t>(cluster) / fat32_entries_per_block_);
-        uint32_t start_off = static_cast<uint32_t>(cluster) % fat32_entries_per_block_;
+        ReturnOnCallFailure(fat_cache_.WriteEntry(static_cast<uint32_t>(cluster), static_cast<uint32_t>(new_value), fat_transaction_depth_ == 0));
+
+        UpdateFreeClusterBitmap(cluster, new_value);
+
+        //  Finished with success
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+
+    ValueResult<FilesystemResultCodes, FAT32Extent> FAT32BlockIOAdapter::AllocateExtent(FAT32ClusterIndex last_cluster, uint32_t clusters_wanted)
+    {
+        using Result = ValueResult<FilesystemResultCodes, FAT32Extent>;
 
-        uint32_t current_fat[(io_device_->BlockSize() / sizeof(uint32_t)) + 2];
+        LogEntryAndExit("Allocating extent of %u clusters after cluster: %u\n", clusters_wanted, static_cast<uint32_t>(last_cluster));
 
-        //  FAT entries are only one sector at a time - they are not clustered.
+        const bool extending_chain = (last_cluster != FAT32EntryFree);
 
-        if (io_device_->ReadFromBlock((uint8_t *)current_fat, sector, 1).Failed())
+        if ((clusters_wanted == 0) || (extending_chain && IsClusterOutOfRange(last_cluster)))
         {
-            LogDebug1("Unable to load FAT32 sector: %u\n", sector);
-            return FilesystemResultCodes::FAT32_UNABLE_TO_READ_FAT_TABLE_SECTOR;
+            return Result::Failure(FilesystemResultCodes::FAT32_CLUSTER_OUT_OF_RANGE);
         }
 
-        current_fat[start_off] = static_cast<uint32_t>(new_value);
+        //  Look for free space directly after the end of the chain first so the file stays contiguous, if the volume is full
+        //      from there on, fall back to the allocation hint.
+
+        FAT32ClusterIndex search_start = FAT32EntryFree;
 
-        if (io_device_->WriteBlock((uint8_t *)current_fat, sector, 1).Failed())
+        if (extending_chain && (static_cast<uint32_t>(last_cluster) + 1 <= static_cast<uint32_t>(MaximumClusterNumber())))
         {
-            LogDebug1("Unable to write FAT32 sector: %u\n", sector);
-            return FilesystemResultCodes::FAT32_UNABLE_TO_WRITE_FAT_TABLE_SECTOR;
+            search_start = last_cluster + 1;
         }
 
-        //  Finished with success
+        FAT32ClusterIndex first_cluster = FAT32EntryFree;
 
-        return FilesystemResultCodes::SUCCESS;
+        if (search_start != FAT32EntryFree)
+        {
+            auto free_cluster = FindNextEmptyCluster(search_start);
+
+            if (free_cluster.Successful())
+            {
+                first_cluster = *free_cluster;
+            }
+            else if (free_cluster.ResultCode() != FilesystemResultCodes::FAT32_DEVICE_FULL)
+            {
+                return Result::Failure(free_cluster.ResultCode());
+            }
+        }
+
+        if (first_cluster == FAT32EntryFree)
+        {
+            auto free_cluster = FindNextEmptyCluster();
+
+            ReturnOnFailure(free_cluster);
+
+            first_cluster = *free_cluster;
+        }
+
+        auto run_length = FreeRunLength(first_cluster, clusters_wanted);
+
+        ReturnOnFailure(run_length);
+
+        uint32_t number_of_clusters = *run_length;
+
+        //  With the bitmap loaded, runs can be measured without any IO, so look a little further for a run long enough to hold
+        //      the whole request before settling for the first one found.
+
+        if (free_cluster_bitmap_.Initialized())
+        {
+            uint32_t candidate = static_cast<uint32_t>(first_cluster) + number_of_clusters;
+
+            for (uint32_t runs_examined = 1; (runs_examined < EXTENT_SEARCH_LIMIT) && (number_of_clusters < clusters_wanted); runs_examined++)
+            {
+                candidate = free_cluster_bitmap_.FindFree(candidate, static_cast<uint32_t>(MaximumClusterNumber()) + 1);
+
+                if (candidate == FAT32FreeClusterBitmap::NO_FREE_CLUSTER)
+                {
+                    break;
+                }
+
+                uint32_t candidate_length = free_cluster_bitmap_.FreeRunLength(candidate, static_cast<uint32_t>(MaximumClusterNumber()) + 1, clusters_wanted);
+
+                if (candidate_length > number_of_clusters)
+                {
+                    first_cluster = FAT32ClusterIndex(candidate);
+                    number_of_clusters = candidate_length;
+                }
+
+                candidate += candidate_length;
+            }
+        }
+
+        //  Chain the run together and terminate it, then link it onto the end of the existing chain.  The entries are updated
+        //      in a single transaction, so each FAT sector spanned by the run is written once.
+
+        BeginFATTransaction();
+
+        FilesystemResultCodes link_result = FilesystemResultCodes::SUCCESS;
+        uint32_t clusters_linked = 0;
+
+        while ((clusters_linked < number_of_clusters) && Successful(link_result))
+        {
+            FAT32ClusterIndex cluster = first_cluster + clusters_linked;
+            FAT32ClusterIndex next_value = (clusters_linked + 1 < number_of_clusters) ? cluster + 1 : FAT32EntryAllocatedAndEndOfFile;
+
+            link_result = UpdateFATTableEntry(cluster, next_value);
+
+            if (Successful(link_result))
+            {
+                clusters_linked++;
+            }
+        }
+
+        if (extending_chain && Successful(link_result))
+        {
+            link_result = UpdateFATTableEntry(last_cluster, first_cluster);
+        }
+
+        //  If the run could not be linked in, free the part of it already chained before the transaction is committed, so
+        //      the failure does not leak clusters.  The end of the existing chain is only changed by the last update.
+
+        if (Failed(link_result))
+        {
+            for (uint32_t i = 0; i < clusters_linked; i++)
+            {
+                if (Failed(UpdateFATTableEntry(first_cluster + i, FAT32EntryFree)))
+                {
+                    LogError("Unable to free cluster %u of a partially allocated extent\n", static_cast<uint32_t>(first_cluster + i));
+                }
+            }
+
+            CommitFATTransaction();
+
+            return Result::Failure(link_result);
+        }
+
+        ReturnOnCallFailure(CommitFATTransaction());
+
+        //  Move the allocation hint past the run so the next allocation does not start by skipping over it
+
+        last_empty_cluster_found_ = minstd::max(last_empty_cluster_found_, first_cluster + (number_of_clusters - 1));
+
+        return Result::Success(FAT32Extent{first_cluster, number_of_clusters});
     }
 
     ValueResult<FilesystemResultCodes, FAT32ClusterIndex> FAT32BlockIOAdapter::FindNextEmptyCluster(FAT32ClusterIndex starting_cluster) const
@@ -221,7 +611,9 @@ namespace filesystems::fat32
 
         //  If the starting cluster is zero, set it to the highest empty cluter we have found thus far or the root directory cluster which should be the first
 
-        if (starting_cluster == 0)
+        const bool search_from_hint = (starting_cluster == 0);
+
+        if (search_from_hint)
         {
             starting_cluster = last_empty_cluster_found_ > root_directory_cluster_ ? last_empty_cluster_found_ : root_directory_cluster_;
         }
@@ -233,36 +625,52 @@ namespace filesystems::fat32
             return Result::Failure(FilesystemResultCodes::FAT32_CLUSTER_OUT_OF_RANGE);
         }
 
-        //  From starting cluster, move forward FAT Entry by FAT entry until we find an empty one
-        //      Read the FAT table for the current cluster and start searching.
+        //  With the free cluster bitmap loaded, the search is done in memory.  The bitmap takes an exclusive end, the
+        //      maximum cluster number is itself a valid cluster.
 
-        uint32_t current_cluster = static_cast<uint32_t>(starting_cluster);
+        if (free_cluster_bitmap_.Initialized())
+        {
+            uint32_t free_cluster = free_cluster_bitmap_.FindFree(static_cast<uint32_t>(starting_cluster), static_cast<uint32_t>(MaximumClusterNumber()) + 1);
 
-        uint32_t current_fat[(io_device_->BlockSize() / sizeof(uint32_t)) + 2];
+            //  The allocation hint is only a hint, so a search from it wraps around to the start of the volume
 
-        ReturnOnCallFailure(ReadFATBlock(FAT32ClusterIndex(current_cluster), current_fat));
+            if ((free_cluster == FAT32FreeClusterBitmap::NO_FREE_CLUSTER) && search_from_hint)
+            {
+                free_cluster = free_cluster_bitmap_.FindFree(2, static_cast<uint32_t>(starting_cluster));
+            }
 
-        while (true)
-        {
-            if (current_cluster >= (uint32_t)MaximumClusterNumber())
+            if (free_cluster == FAT32FreeClusterBitmap::NO_FREE_CLUSTER)
             {
                 return Result::Failure(FilesystemResultCodes::FAT32_DEVICE_FULL);
             }
 
-            if (current_fat[current_cluster % fat32_entries_per_block_] == FAT32EntryFree)
+            const_cast<FAT32BlockIOAdapter *>(this)->last_empty_cluster_found_ = FAT32ClusterIndex(free_cluster);
+
+            return Result::Success(FAT32ClusterIndex(free_cluster));
+        }
+
+        //  From starting cluster, move forward FAT Entry by FAT entry until we find an empty one.
+        //      The FAT cache only goes to the device when the search crosses into a sector which is not resident.
+
+        uint32_t current_cluster = static_cast<uint32_t>(starting_cluster);
+
+        while (true)
+        {
+            if (current_cluster > (uint32_t)MaximumClusterNumber())
             {
-                break;
+                return Result::Failure(FilesystemResultCodes::FAT32_DEVICE_FULL);
             }
 
-            current_cluster++;
+            auto entry = fat_cache_.ReadEntry(current_cluster);
 
-            //  If we have advanced to the next cluster, then read it and continue on.
+            ReturnOnFailure(entry);
 
-            if (current_cluster % fat32_entries_per_block_ == 0)
+            if (*entry == FAT32EntryFree)
             {
-                LogDebug1("Advancing to FAT Table: %d\n", current_cluster / fat32_entries_per_block_);
-                ReturnOnCallFailure(ReadFATBlock(FAT32ClusterIndex(current_cluster), current_fat));
+                break;
             }
+
+            current_cluster++;
         }
 
         //  We will fake it here as this new cluster is likely to be used and will update the last used cluster
@@ -280,43 +688,339 @@ namespace filesystems::fat32
 
         //  Do not try to read past the end of the FAT table
 
-        if (IsClusterOutOfRange(first_cluster))
+        if (IsClusterOutOfRange(first_cluster) || (first_cluster >= FAT32EntryDefective))
         {
             return FilesystemResultCodes::FAT32_CLUSTER_OUT_OF_RANGE;
         }
 
-        //  Walk the cluster chain and release each cluster by writing a zero into the FAT Table entry
+        //  Release the chain a FAT sector at a time.  Each visit to a sector frees every entry of the chain it holds, following
+        //      the chain until it leaves the sector, so the sector is read and written once rather than once per cluster.
+        //      The free cluster bitmap and FSInfo counts are updated as each sector is released, and freed clusters are
+        //      gathered into physically contiguous runs.  Dirty FAT sectors are written back when the transaction commits,
+        //      consecutive sectors in a single request per FAT copy, and the runs are only discarded once that succeeds.
 
-        FAT32ClusterIndex current_cluster = first_cluster;
+        uint32_t released_clusters[fat_cache_.EntriesPerSector()];
+        uint32_t number_released = 0;
 
-        do
+        uint32_t current_cluster = static_cast<uint32_t>(first_cluster);
+
+        uint32_t run_start = current_cluster;
+        uint32_t run_length = 0;
+
+        BeginFATTransaction();
+
+        while (true)
         {
-            auto next_cluster = NextClusterInChain(current_cluster);
+            //  On failure, still write back the entries released so far.  If that fails too, the release never reached
+            //      the device and that is the failure to report.
 
-            ReturnOnFailure(next_cluster);
+            auto next_cluster = fat_cache_.ReleaseChainInSector(current_cluster, static_cast<uint32_t>(MaximumClusterNumber()), released_clusters, number_released);
+
+            if (next_cluster.Failed())
+            {
+                ReturnOnCallFailure(CommitFATTransaction());
+
+                return next_cluster.ResultCode();
+            }
+
+            for (uint32_t i = 0; i < number_released; i++)
+            {
+                UpdateFreeClusterBitmap(FAT32ClusterIndex(released_clusters[i]), FAT32EntryFree);
+
+                if ((run_length > 0) && (released_clusters[i] == run_start + run_length))
+                {
+                    run_length++;
+                }
+                else
+                {
+                    DiscardClusters(FAT32ClusterIndex(run_start), run_length);
+
+                    run_start = released_clusters[i];
+                    run_length = 1;
+                }
+            }
+
+            if (FAT32ClusterIndex(*next_cluster) >= FAT32EntryEOFThreshold)
+            {
+                break;
+            }
+
+            //  A link to a reserved, defective or nonexistent cluster means the chain is damaged
+
+            if (IsClusterOutOfRange(FAT32ClusterIndex(*next_cluster)) || (FAT32ClusterIndex(*next_cluster) == FAT32EntryDefective))
+            {
+                DiscardClusters(FAT32ClusterIndex(run_start), run_length);
+
+                ReturnOnCallFailure(CommitFATTransaction());
 
-            ReturnOnCallFailure(UpdateFATTableEntry(current_cluster, FAT32ClusterIndex(0)));
+                return FilesystemResultCodes::FAT32_CLUSTER_OUT_OF_RANGE;
+            }
+
+            current_cluster = *next_cluster;
+        }
+
+        DiscardClusters(FAT32ClusterIndex(run_start), run_length);
+
+        return CommitFATTransaction();
+    }
+
+    void FAT32BlockIOAdapter::BeginFATTransaction()
+    {
+        fat_transaction_depth_++;
+    }
+
+    FilesystemResultCodes FAT32BlockIOAdapter::CommitFATTransaction()
+    {
+        if ((fat_transaction_depth_ == 0) || (--fat_transaction_depth_ > 0))
+        {
+            return FilesystemResultCodes::SUCCESS;
+        }
+
+        FilesystemResultCodes result = fat_cache_.Flush();
+
+        //  Freed clusters are only discarded once the FAT entries freeing them have been written, otherwise a failure or
+        //      power loss could leave a chain pointing at discarded clusters
+
+        if (Failed(result))
+        {
+            number_of_pending_discards_ = 0;
+            return result;
+        }
+
+        IssuePendingDiscards();
+
+        return result;
+    }
+
+    FilesystemResultCodes FAT32BlockIOAdapter::LoadFreeClusterBitmap()
+    {
+        using Result = FilesystemResultCodes;
+
+        LogEntryAndExit("Loading free cluster bitmap for %u clusters\n", static_cast<uint32_t>(maximum_cluster_number_));
+
+        ReturnOnCallFailure(free_cluster_bitmap_.Initialize());
+
+        //  Read the FAT in runs of sectors straight from the device, going through the FAT cache would only evict
+        //      the sectors the filesystem is actually working with.
+
+        const uint32_t sectors_per_read = minstd::min(sectors_per_fat_, FAT32_FREE_CLUSTER_BITMAP_SECTORS_PER_READ);
+        const size_t buffer_size = static_cast<size_t>(sectors_per_read) * io_device_->BlockSize();
+
+        uint32_t *fat_entries = static_cast<uint32_t *>(__os_filesystem_cache_heap_resource.allocate(buffer_size, alignof(uint32_t)));
+
+        if (fat_entries == nullptr)
+        {
+            free_cluster_bitmap_.Release();
+            return FilesystemResultCodes::FAT32_UNABLE_TO_ALLOCATE_FREE_CLUSTER_BITMAP;
+        }
+
+        FilesystemResultCodes result = FilesystemResultCodes::SUCCESS;
+
+        uint32_t cluster = 0;
+
+        for (uint32_t sector = 0; (sector < sectors_per_fat_) && (cluster <= static_cast<uint32_t>(maximum_cluster_number_)); sector += sectors_per_read)
+        {
+            uint32_t sectors_to_read = minstd::min(sectors_per_read, sectors_per_fat_ - sector);
+
+            if (io_device_->ReadFromBlockWithPriority(BlockIOPriority::METADATA, (uint8_t *)fat_entries, static_cast<uint32_t>(fat_lba_) + sector, sectors_to_read).Failed())
+            {
+                LogDebug1("Unable to load FAT32 sectors starting at: %u\n", static_cast<uint32_t>(fat_lba_) + sector);
+                result = FilesystemResultCodes::FAT32_UNABLE_TO_READ_FAT_TABLE_SECTOR;
+                break;
+            }
+
+            for (uint32_t i = 0; (i < sectors_to_read * fat32_entries_per_block_) && (cluster <= static_cast<uint32_t>(maximum_cluster_number_)); i++, cluster++)
+            {
+                if ((cluster >= 2) && (fat_entries[i] == FAT32EntryFree))
+                {
+                    free_cluster_bitmap_.MarkFree(cluster);
+                }
+            }
+        }
 
-            current_cluster = next_cluster;
-        } while (current_cluster < FAT32EntryEOFThreshold);
+        __os_filesystem_cache_heap_resource.deallocate(fat_entries, buffer_size, alignof(uint32_t));
+
+        if (Failed(result))
+        {
+            free_cluster_bitmap_.Release();
+            return result;
+        }
+
+        //  The FAT is the authority on the free cluster count, if FSInfo disagrees it is rewritten on the next flush.
+        //      The next free hint is taken as is, it only decides where the next search starts.
+
+        if (static_cast<uint32_t>(fsinfo_lba_) != 0)
+        {
+            alignas(BLOCK_IO_BUFFER_ALIGNMENT) uint8_t sector_buffer[io_device_->BlockSize()];
+
+            if (io_device_->ReadFromBlockWithPriority(BlockIOPriority::METADATA, sector_buffer, static_cast<uint32_t>(fsinfo_lba_), 1).Failed())
+            {
+                free_cluster_bitmap_.Release();
+                return FilesystemResultCodes::FAT32_DEVICE_READ_ERROR;
+            }
+
+            FAT32FSInfoSector &fsinfo = *((FAT32FSInfoSector *)sector_buffer);
+
+            if (IsValidFSInfoSector(fsinfo))
+            {
+                if (fsinfo.free_count_ != free_cluster_bitmap_.FreeClusters())
+                {
+                    LogDebug1("FSInfo free count %u does not match the FAT free count %u\n", fsinfo.free_count_, free_cluster_bitmap_.FreeClusters());
+                    fsinfo_dirty_ = true;
+                }
+
+                if ((fsinfo.next_free_ != FAT32_FSINFO_UNKNOWN) && !IsClusterOutOfRange(FAT32ClusterIndex(fsinfo.next_free_)))
+                {
+                    last_empty_cluster_found_ = FAT32ClusterIndex(fsinfo.next_free_);
+                }
+            }
+        }
+
+        LogDebug1("Free clusters: %u\n", free_cluster_bitmap_.FreeClusters());
 
         return FilesystemResultCodes::SUCCESS;
     }
 
-    FilesystemResultCodes FAT32BlockIOAdapter::ReadFATBlock(FAT32ClusterIndex cluster, uint32_t *buffer) const
+    FilesystemResultCodes FAT32BlockIOAdapter::Flush()
+    {
+        using Result = FilesystemResultCodes;
+
+        ReturnOnCallFailure(fat_cache_.Flush());
+
+        return WriteFSInfo();
+    }
+
+    void FAT32BlockIOAdapter::UpdateFreeClusterBitmap(FAT32ClusterIndex cluster, FAT32ClusterIndex new_value)
+    {
+        if (!free_cluster_bitmap_.Initialized())
+        {
+            return;
+        }
+
+        if (new_value == FAT32EntryFree)
+        {
+            free_cluster_bitmap_.MarkFree(static_cast<uint32_t>(cluster));
+        }
+        else
+        {
+            free_cluster_bitmap_.MarkAllocated(static_cast<uint32_t>(cluster));
+        }
+
+        fsinfo_dirty_ = true;
+    }
+
+    ValueResult<FilesystemResultCodes, uint32_t> FAT32BlockIOAdapter::FreeRunLength(FAT32ClusterIndex first_cluster, uint32_t maximum_length) const
     {
-        //  Calculate the sector LBA from the FAT table base address.
+        using Result = ValueResult<FilesystemResultCodes, uint32_t>;
+
+        if (free_cluster_bitmap_.Initialized())
+        {
+            return Result::Success(free_cluster_bitmap_.FreeRunLength(static_cast<uint32_t>(first_cluster), static_cast<uint32_t>(MaximumClusterNumber()) + 1, maximum_length));
+        }
 
-        uint32_t sector = static_cast<uint32_t>(fat_lba_) + (static_cast<uint32_t>(cluster) / fat32_entries_per_block_);
+        //  Without the bitmap, walk the FAT entries through the cache
 
-        //  FAT entries are only one sector at a time - they are not clustered.
+        uint32_t length = 1;
+        uint32_t cluster = static_cast<uint32_t>(first_cluster) + 1;
 
-        if (io_device_->ReadFromBlock((uint8_t *)buffer, sector, 1).Failed())
+        while ((length < maximum_length) && (cluster <= static_cast<uint32_t>(MaximumClusterNumber())))
         {
-            LogDebug1("Unable to load FAT32 sector: %u\n", sector);
-            return FilesystemResultCodes::FAT32_UNABLE_TO_READ_FAT_TABLE_SECTOR;
+            auto entry = fat_cache_.ReadEntry(cluster);
+
+            ReturnOnFailure(entry);
+
+            if (*entry != static_cast<uint32_t>(FAT32EntryFree))
+            {
+                break;
+            }
+
+            length++;
+            cluster++;
         }
 
+        return Result::Success(length);
+    }
+
+    FilesystemResultCodes FAT32BlockIOAdapter::WriteFSInfo()
+    {
+        if (!fsinfo_dirty_ || (static_cast<uint32_t>(fsinfo_lba_) == 0) || !free_cluster_bitmap_.Initialized())
+        {
+            return FilesystemResultCodes::SUCCESS;
+        }
+
+        alignas(BLOCK_IO_BUFFER_ALIGNMENT) uint8_t sector_buffer[io_device_->BlockSize()];
+
+        if (io_device_->ReadFromBlockWithPriority(BlockIOPriority::METADATA, sector_buffer, static_cast<uint32_t>(fsinfo_lba_), 1).Failed())
+        {
+            return FilesystemResultCodes::FAT32_DEVICE_READ_ERROR;
+        }
+
+        FAT32FSInfoSector &fsinfo = *((FAT32FSInfoSector *)sector_buffer);
+
+        //  Do not overwrite a sector which does not actually hold FSInfo
+
+        if (IsValidFSInfoSector(fsinfo))
+        {
+            fsinfo.free_count_ = free_cluster_bitmap_.FreeClusters();
+            fsinfo.next_free_ = static_cast<uint32_t>(last_empty_cluster_found_);
+
+            if (io_device_->WriteBlockWithPriority(BlockIOPriority::METADATA, sector_buffer, static_cast<uint32_t>(fsinfo_lba_), 1).Failed())
+            {
+                return FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR;
+            }
+        }
+
+        fsinfo_dirty_ = false;
+
         return FilesystemResultCodes::SUCCESS;
     }
+
+    void FAT32BlockIOAdapter::DiscardClusters(FAT32ClusterIndex first_cluster, uint32_t number_of_clusters)
+    {
+        if (!discard_freed_clusters_ || (number_of_clusters == 0))
+        {
+            return;
+        }
+
+        //  Discard is only a hint to the device, so runs which do not fit in the queue are simply not discarded
+
+        if (number_of_pending_discards_ == MAX_FAT32_PENDING_DISCARD_RUNS)
+        {
+            LogDebug1("Discard queue full, not discarding %u clusters starting at cluster: %u\n", number_of_clusters, static_cast<uint32_t>(first_cluster));
+            return;
+        }
+
+        pending_discards_[number_of_pending_discards_++] = FAT32Extent{first_cluster, number_of_clusters};
+    }
+
+    void FAT32BlockIOAdapter::IssuePendingDiscards()
+    {
+        if (number_of_pending_discards_ == 0)
+        {
+            return;
+        }
+
+        //  The FAT sectors may still be held in a write-back cache in front of the media
+
+        if (Failed(io_device_->Flush()))
+        {
+            LogDebug1("Unable to flush device, dropping %u pending discards\n", number_of_pending_discards_);
+            number_of_pending_discards_ = 0;
+            return;
+        }
+
+        //  A failed discard is not an error, the clusters are free either way
+
+        for (uint32_t i = 0; i < number_of_pending_discards_; i++)
+        {
+            const FAT32Extent &run = pending_discards_[i];
+
+            if (Failed(io_device_->Discard(FATClusterToSector(run.first_cluster_), run.number_of_clusters_ * logical_sectors_per_cluster_)))
+            {
+                LogDebug1("Unable to discard %u clusters starting at cluster: %u\n", run.number_of_clusters_, static_cast<uint32_t>(run.first_cluster_));
+            }
+        }
+
+        number_of_pending_discards_ = 0;
+    }
 } // namespace filesystems::fat32
@@ -525,11 +525,11 @@ namespace filesystems::fat32
 
     FilesystemResultCodes FAT32Directory::SetDirectoryEntryFirstCluster(FAT32BlockIOAdapter &block_io_adapter, const FAT32DirectoryEntryAddress &address, FAT32ClusterIndex first_cluster)
     {
-        uint8_t block_buffer[block_io_adapter.BytesPerCluster()];
+        alignas(BLOCK_IO_BUFFER_ALIGNMENT) uint8_t block_buffer[block_io_adapter.BytesPerCluster()];
 
         //  Read the directory block
 
-        auto read_block_result = block_io_adapter.ReadCluster(address.Cluster(), block_buffer);
+        auto read_block_result = block_io_adapter.ReadCluster(address.Cluster(), block_buffer, BlockIOPriority::METADATA);
 
         if (read_block_result != BlockIOResultCodes::SUCCESS)
         {
@@ -540,7 +540,7 @@ namespace filesystems::fat32
 
         entry.SetFirstCluster(first_cluster);
 
-        auto write_block_result = block_io_adapter.WriteCluster(address.Cluster(), block_buffer);
+        auto write_block_result = block_io_adapter.WriteCluster(address.Cluster(), block_buffer, BlockIOPriority::METADATA);
 
         if (write_block_result != BlockIOResultCodes::SUCCESS)
         {
@@ -552,11 +552,11 @@ namespace filesystems::fat32
 
     FilesystemResultCodes FAT32Directory::UpdateDirectoryEntrySize(FAT32BlockIOAdapter &block_io_adapter, const FAT32DirectoryEntryAddress &address, uint32_t new_size)
     {
-        uint8_t block_buffer[block_io_adapter.BytesPerCluster()];
+        alignas(BLOCK_IO_BUFFER_ALIGNMENT) uint8_t block_buffer[block_io_adapter.BytesPerCluster()];
 
         //  Read the directory block
 
-        auto read_block_result = block_io_adapter.ReadCluster(address.Cluster(), block_buffer);
+        auto read_block_result = block_io_adapter.ReadCluster(address.Cluster(), block_buffer, BlockIOPriority::METADATA);
 
         if (read_block_result != BlockIOResultCodes::SUCCESS)
         {
@@ -567,7 +567,38 @@ namespace filesystems::fat32
 
         entry.SetSize(new_size);
 
-        auto write_block_result = block_io_adapter.WriteCluster(address.Cluster(), block_buffer);
+        auto write_block_result = block_io_adapter.WriteCluster(address.Cluster(), block_buffer, BlockIOPriority::METADATA);
+
+        if (write_block_result != BlockIOResultCodes::SUCCESS)
+        {
+            return FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR;
+        }
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+
+    FilesystemResultCodes FAT32Directory::UpdateDirectoryEntry(FAT32BlockIOAdapter &block_io_adapter,
+                                                               const FAT32DirectoryEntryAddress &address,
+                                                               FAT32ClusterIndex first_cluster,
+                                                               uint32_t new_size)
+    {
+        alignas(BLOCK_IO_BUFFER_ALIGNMENT) uint8_t block_buffer[block_io_adapter.BytesPerCluster()];
+
+        //  Read the directory block
+
+        auto read_block_result = block_io_adapter.ReadCluster(address.Cluster(), block_buffer, BlockIOPriority::METADATA);
+
+        if (read_block_result != BlockIOResultCodes::SUCCESS)
+        {
+            return FilesystemResultCodes::FAT32_DEVICE_READ_ERROR;
+        }
+
+        FAT32DirectoryClusterEntry &entry = ((FAT32DirectoryClusterEntry *)block_buffer)[address.Index()];
+
+        entry.SetFirstCluster(first_cluster);
+        entry.SetSize(new_size);
+
+        auto write_block_result = block_io_adapter.WriteCluster(address.Cluster(), block_buffer, BlockIOPriority::METADATA);
 
         if (write_block_result != BlockIOResultCodes::SUCCESS)
         {
@@ -607,7 +638,8 @@ namespace filesystems::fat32
             return FilesystemResultCodes::FILE_NOT_FOUND;
         }
 
-        //  Insure the file is not open
+        //  Insure the file is not open.  An open file may be holding back its size and first cluster until it is flushed,
+        //      the entry on disk may not point at its chain yet and the file would write its entry back into a freed slot.
 
         minstd::fixed_string<MAX_FILESYSTEM_PATH_LENGTH> absolute_path(path_);
 
@@ -642,15 +674,18 @@ namespace filesystems::fat32
 
         //  Remove the file cluster entry
 
-        directory_cluster.RemoveEntry(GetOpaqueData(*file_entry).directory_entry_address_);
+        ReturnOnCallFailure(directory_cluster.RemoveEntry(GetOpaqueData(*file_entry).directory_entry_address_));
 
-        //  Release the clusters for the file
+        //  Release the clusters for the file, an empty file has none
 
-        block_io_adapter.ReleaseChain(cluster_entry->FirstCluster(block_io_adapter.RootDirectoryCluster()));
+        FAT32ClusterIndex first_cluster = cluster_entry->FirstCluster(block_io_adapter.RootDirectoryCluster());
 
-        //  Finished with Success
+        if (first_cluster == FAT32EntryFree)
+        {
+            return FilesystemResultCodes::SUCCESS;
+        }
 
-        return FilesystemResultCodes::SUCCESS;
+        return block_io_adapter.ReleaseChain(first_cluster);
     }
 
     FilesystemResultCodes FAT32Directory::RenameEntry(const minstd::string &name, const minstd::string &new_name, FilesystemDirectoryEntryType entry_type)
@@ -389,11 +389,11 @@ namespace filesystems::fat32
 
         //  Create a buffer for a cluster read
 
-        uint8_t buffer[block_io_adapter_.BytesPerCluster()];
+        alignas(BLOCK_IO_BUFFER_ALIGNMENT) uint8_t buffer[block_io_adapter_.BytesPerCluster()];
 
         //  Read the directory cluster
 
-        if (block_io_adapter_.ReadCluster(address.cluster_, buffer) != BlockIOResultCodes::SUCCESS)
+        if (block_io_adapter_.ReadCluster(address.cluster_, buffer, BlockIOPriority::METADATA) != BlockIOResultCodes::SUCCESS)
         {
             return Result::Failure(FilesystemResultCodes::FAT32_DEVICE_READ_ERROR);
         }
@@ -409,14 +409,14 @@ namespace filesystems::fat32
 
         //  Create a buffer for a cluster read
 
-        uint8_t buffer[block_io_adapter_.BytesPerCluster()];
+        alignas(BLOCK_IO_BUFFER_ALIGNMENT) uint8_t buffer[block_io_adapter_.BytesPerCluster()];
         FAT32DirectoryClusterTable cluster_table(buffer);
 
         FAT32DirectoryEntryAddress current_entry_address(address);
 
         //  Read the directory cluster
 
-        if (block_io_adapter_.ReadCluster(current_entry_address.cluster_, buffer) != BlockIOResultCodes::SUCCESS)
+        if (block_io_adapter_.ReadCluster(current_entry_address.cluster_, buffer, BlockIOPriority::METADATA) != BlockIOResultCodes::SUCCESS)
         {
             return FilesystemResultCodes::FAT32_DEVICE_READ_ERROR;
         }
@@ -439,7 +439,7 @@ namespace filesystems::fat32
                 //  We are at the start of the cluster, so we need to move to the previous cluster.
                 //      Flush any changes to the current cluster before moving.
 
-                if (block_io_adapter_.WriteCluster(current_entry_address.cluster_, buffer) != BlockIOResultCodes::SUCCESS)
+                if (block_io_adapter_.WriteCluster(current_entry_address.cluster_, buffer, BlockIOPriority::METADATA) != BlockIOResultCodes::SUCCESS)
                 {
                     return FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR;
                 }
@@ -453,7 +453,7 @@ namespace filesystems::fat32
                 current_entry_address.cluster_ = previous_cluster;
                 current_entry_address.index_ = entries_per_cluster_ - 1;
 
-                if (block_io_adapter_.ReadCluster(current_entry_address.cluster_, buffer) != BlockIOResultCodes::SUCCESS)
+                if (block_io_adapter_.ReadCluster(current_entry_address.cluster_, buffer, BlockIOPriority::METADATA) != BlockIOResultCodes::SUCCESS)
                 {
                     return FilesystemResultCodes::FAT32_DEVICE_READ_ERROR;
                 }
@@ -484,7 +484,7 @@ namespace filesystems::fat32
 
         if (buffer_dirty)
         {
-            if (block_io_adapter_.WriteCluster(current_entry_address.cluster_, buffer) != BlockIOResultCodes::SUCCESS)
+            if (block_io_adapter_.WriteCluster(current_entry_address.cluster_, buffer, BlockIOPriority::METADATA) != BlockIOResultCodes::SUCCESS)
             {
                 return FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR;
             }
@@ -632,11 +632,11 @@ namespace filesystems::fat32
 
         //  Create a buffer for a cluster read
 
-        uint8_t buffer[block_io_adapter_.BytesPerCluster()];
+        alignas(BLOCK_IO_BUFFER_ALIGNMENT) uint8_t buffer[block_io_adapter_.BytesPerCluster()];
 
         //  Read the directory cluster, update the entries and write the cluster back to the device
 
-        if (block_io_adapter_.ReadCluster(empty_entry_address.cluster_, buffer) != BlockIOResultCodes::SUCCESS)
+        if (block_io_adapter_.ReadCluster(empty_entry_address.cluster_, buffer, BlockIOPriority::METADATA) != BlockIOResultCodes::SUCCESS)
         {
             return Result::Failure(FilesystemResultCodes::FAT32_DEVICE_READ_ERROR);
         }
@@ -658,7 +658,7 @@ namespace filesystems::fat32
 
             if (current_entry_index >= entries_per_cluster_)
             {
-                if (block_io_adapter_.WriteCluster(current_cluster_index, buffer) != BlockIOResultCodes::SUCCESS)
+                if (block_io_adapter_.WriteCluster(current_cluster_index, buffer, BlockIOPriority::METADATA) != BlockIOResultCodes::SUCCESS)
                 {
                     return Result::Failure(FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR);
                 }
@@ -676,7 +676,7 @@ namespace filesystems::fat32
 
                 current_cluster_index = *next_cluster_index;
 
-                if (block_io_adapter_.ReadCluster(current_cluster_index, buffer) != BlockIOResultCodes::SUCCESS)
+                if (block_io_adapter_.ReadCluster(current_cluster_index, buffer, BlockIOPriority::METADATA) != BlockIOResultCodes::SUCCESS)
                 {
                     return Result::Failure(FilesystemResultCodes::FAT32_DEVICE_READ_ERROR);
                 }
@@ -696,7 +696,7 @@ namespace filesystems::fat32
 
         if (current_entry_index >= entries_per_cluster_)
         {
-            if (block_io_adapter_.WriteCluster(current_cluster_index, buffer) != BlockIOResultCodes::SUCCESS)
+            if (block_io_adapter_.WriteCluster(current_cluster_index, buffer, BlockIOPriority::METADATA) != BlockIOResultCodes::SUCCESS)
             {
                 return Result::Failure(FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR);
             }
@@ -714,7 +714,7 @@ namespace filesystems::fat32
 
             current_cluster_index = *next_cluster_index;
 
-            if (block_io_adapter_.ReadCluster(current_cluster_index, buffer) != BlockIOResultCodes::SUCCESS)
+            if (block_io_adapter_.ReadCluster(current_cluster_index, buffer, BlockIOPriority::METADATA) != BlockIOResultCodes::SUCCESS)
             {
                 return Result::Failure(FilesystemResultCodes::FAT32_DEVICE_READ_ERROR);
             }
@@ -732,7 +732,7 @@ namespace filesystems::fat32
 
         //  Write the cluster
 
-        if (block_io_adapter_.WriteCluster(current_cluster_index, buffer) != BlockIOResultCodes::SUCCESS)
+        if (block_io_adapter_.WriteCluster(current_cluster_index, buffer, BlockIOPriority::METADATA) != BlockIOResultCodes::SUCCESS)
         {
             return Result::Failure(FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR);
         }
@@ -763,11 +763,11 @@ namespace filesystems::fat32
 
         //  Zero out the cluster
 
-        uint8_t block_buffer[block_io_adapter_.BytesPerCluster()];
+        alignas(BLOCK_IO_BUFFER_ALIGNMENT) uint8_t block_buffer[block_io_adapter_.BytesPerCluster()];
 
         memset(block_buffer, 0, block_io_adapter_.BytesPerCluster());
 
-        BlockIOResultCodes write_block_result = block_io_adapter_.WriteCluster(*next_empty_cluster, block_buffer);
+        BlockIOResultCodes write_block_result = block_io_adapter_.WriteCluster(*next_empty_cluster, block_buffer, BlockIOPriority::METADATA);
 
         if (write_block_result != BlockIOResultCodes::SUCCESS)
         {
@@ -793,22 +793,32 @@ namespace filesystems::fat32
             current_entry = *next_entry;
         } while (true);
 
-        FilesystemResultCodes update_result = block_io_adapter_.UpdateFATTableEntry(current_entry, *next_empty_cluster);
+        //  Terminate the new cluster and then link it onto the chain.  Both entries are updated in one FAT transaction, so a
+        //      FAT sector holding both is written once.
 
-        ReturnOnFailure(update_result);
-
-        update_result = block_io_adapter_.UpdateFATTableEntry(*next_empty_cluster, FAT32EntryAllocatedAndEndOfFile);
+        block_io_adapter_.BeginFATTransaction();
 
-        //  If the update of the next FAT Table entry failed, then we need to back out the previous update
+        FilesystemResultCodes update_result = block_io_adapter_.UpdateFATTableEntry(*next_empty_cluster, FAT32EntryAllocatedAndEndOfFile);
 
-        if (update_result != FilesystemResultCodes::SUCCESS)
+        if (update_result == FilesystemResultCodes::SUCCESS)
         {
-            LogError("Failed to update FAT Table entry for new cluster, backing out previous update.  Cluster Indices: %u, %u\n", current_entry, *next_empty_cluster);
+            update_result = block_io_adapter_.UpdateFATTableEntry(current_entry, *next_empty_cluster);
+
+            //  If the link to the new cluster failed, then we need to release the new cluster again
+
+            if (update_result != FilesystemResultCodes::SUCCESS)
+            {
+                LogError("Failed to link new cluster into FAT Table chain, backing out new cluster.  Cluster Indices: %u, %u\n", current_entry, *next_empty_cluster);
 
-            block_io_adapter_.UpdateFATTableEntry(current_entry, FAT32EntryAllocatedAndEndOfFile);
-            return update_result;
+                block_io_adapter_.UpdateFATTableEntry(*next_empty_cluster, FAT32EntryFree);
+            }
         }
 
+        FilesystemResultCodes commit_result = block_io_adapter_.CommitFATTransaction();
+
+        ReturnOnFailure(update_result);
+        ReturnOnFailure(commit_result);
+
         //  Finished with Success
 
         return FilesystemResultCodes::SUCCESS;
@@ -819,7 +829,7 @@ namespace filesystems::fat32
     {
         //  Allocate a buffer for the cluster on the stack.
 
-        uint8_t block_buffer[block_io_adapter_.BytesPerCluster()];
+        alignas(BLOCK_IO_BUFFER_ALIGNMENT) uint8_t block_buffer[block_io_adapter_.BytesPerCluster()];
 
         //  Zero out the entire buffer
 
@@ -864,7 +874,7 @@ namespace filesystems::fat32
 
         //  Write the cluster to the device
 
-        BlockIOResultCodes write_block_result = block_io_adapter_.WriteCluster(cluster_index, block_buffer);
+        BlockIOResultCodes write_block_result = block_io_adapter_.WriteCluster(cluster_index, block_buffer, BlockIOPriority::METADATA);
 
         if (write_block_result != BlockIOResultCodes::SUCCESS)
         {
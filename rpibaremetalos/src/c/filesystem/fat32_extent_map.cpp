@@ -0,0 +1,233 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "filesystem/fat32_extent_map.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "heaps.h"
+
+namespace filesystems::fat32
+{
+    FAT32ExtentMap::~FAT32ExtentMap()
+    {
+        Release();
+    }
+
+    void FAT32ExtentMap::Reset(FAT32ClusterIndex first_cluster)
+    {
+        LockGuard lock(map_lock_);
+
+        first_cluster_ = first_cluster;
+        number_of_extents_ = 0;
+        generation_++;
+    }
+
+    ValueResult<FilesystemResultCodes, FAT32Extent> FAT32ExtentMap::ExtentAt(const FAT32BlockIOAdapter &block_io_adapter,
+                                                                             uint32_t cluster_in_file,
+                                                                             uint32_t clusters_wanted)
+    {
+        using Result = ValueResult<FilesystemResultCodes, FAT32Extent>;
+
+        LockGuard lock(map_lock_);
+
+        //  Walk the chain further if the run wanted has not been mapped yet
+
+        uint32_t last_cluster_wanted = cluster_in_file + minstd::max(clusters_wanted, (uint32_t)1) - 1;
+
+        if (last_cluster_wanted >= ClustersMapped())
+        {
+            ReturnOnCallFailure(MapThrough(block_io_adapter, last_cluster_wanted));
+
+            if (cluster_in_file >= ClustersMapped())
+            {
+                return Result::Success(FAT32Extent{FAT32EntryAllocatedAndEndOfFile, 0});
+            }
+        }
+
+        //  Binary search for the last extent starting at or before the position
+
+        uint32_t low = 0;
+        uint32_t high = number_of_extents_ - 1;
+
+        while (low < high)
+        {
+            uint32_t middle = (low + high + 1) / 2;
+
+            if (extents_[middle].first_cluster_in_file_ <= cluster_in_file)
+            {
+                low = middle;
+            }
+            else
+            {
+                high = middle - 1;
+            }
+        }
+
+        const MappedExtent &extent = extents_[low];
+        uint32_t offset_into_extent = cluster_in_file - extent.first_cluster_in_file_;
+
+        return Result::Success(FAT32Extent{FAT32ClusterIndex(extent.first_cluster_ + offset_into_extent), extent.number_of_clusters_ - offset_into_extent});
+    }
+
+    ValueResult<FilesystemResultCodes, FAT32ClusterIndex> FAT32ExtentMap::ClusterAt(const FAT32BlockIOAdapter &block_io_adapter, uint32_t cluster_in_file)
+    {
+        using Result = ValueResult<FilesystemResultCodes, FAT32ClusterIndex>;
+
+        auto extent = ExtentAt(block_io_adapter, cluster_in_file);
+
+        ReturnOnFailure(extent);
+
+        return Result::Success(extent->first_cluster_);
+    }
+
+    FilesystemResultCodes FAT32ExtentMap::MapThrough(const FAT32BlockIOAdapter &block_io_adapter, uint32_t cluster_in_file)
+    {
+        using Result = FilesystemResultCodes;
+
+        while (ClustersMapped() <= cluster_in_file)
+        {
+            //  An empty file has no chain to map
+
+            if (first_cluster_ == FAT32EntryFree)
+            {
+                return FilesystemResultCodes::SUCCESS;
+            }
+
+            if (number_of_extents_ == 0)
+            {
+                ReturnOnCallFailure(AddCluster(static_cast<uint32_t>(first_cluster_)));
+                continue;
+            }
+
+            //  Resume the walk from the last cluster mapped, a batch of clusters at a time.  The FAT cache keeps this from
+            //      costing a device read per cluster, but a miss still goes to the device so the lock is dropped for the walk.
+
+            const MappedExtent &last_extent = extents_[number_of_extents_ - 1];
+
+            FAT32ClusterIndex walk_from = FAT32ClusterIndex(last_extent.first_cluster_ + last_extent.number_of_clusters_ - 1);
+
+            const uint32_t generation = generation_;
+            const uint32_t clusters_mapped = ClustersMapped();
+            const uint32_t clusters_to_walk = minstd::min(cluster_in_file + 1 - clusters_mapped, WALK_BATCH_SIZE);
+
+            uint32_t clusters_walked[WALK_BATCH_SIZE];
+            uint32_t number_of_clusters_walked = 0;
+            bool end_of_chain = false;
+
+            FilesystemResultCodes walk_result = FilesystemResultCodes::SUCCESS;
+
+            map_lock_.Unlock();
+
+            while (number_of_clusters_walked < clusters_to_walk)
+            {
+                auto next_cluster = block_io_adapter.NextClusterInChain(walk_from);
+
+                if (next_cluster.Failed())
+                {
+                    walk_result = next_cluster.ResultCode();
+                    break;
+                }
+
+                if (*next_cluster >= FAT32EntryEOFThreshold)
+                {
+                    end_of_chain = true;
+                    break;
+                }
+
+                walk_from = *next_cluster;
+                clusters_walked[number_of_clusters_walked++] = static_cast<uint32_t>(walk_from);
+            }
+
+            map_lock_.Lock();
+
+            ReturnOnFailure(walk_result);
+
+            //  If the map was reset or extended by another task while the lock was dropped, the batch may not follow on
+            //      from the end of the map any more, so it is thrown away and the walk resumes from the new end.
+
+            if ((generation != generation_) || (clusters_mapped != ClustersMapped()))
+            {
+                continue;
+            }
+
+            for (uint32_t i = 0; i < number_of_clusters_walked; i++)
+            {
+                ReturnOnCallFailure(AddCluster(clusters_walked[i]));
+            }
+
+            if (end_of_chain)
+            {
+                break;
+            }
+        }
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+
+    FilesystemResultCodes FAT32ExtentMap::AddCluster(uint32_t cluster)
+    {
+        //  A cluster physically following the last extent just lengthens it
+
+        if (number_of_extents_ > 0)
+        {
+            MappedExtent &last_extent = extents_[number_of_extents_ - 1];
+
+            if (cluster == last_extent.first_cluster_ + last_extent.number_of_clusters_)
+            {
+                last_extent.number_of_clusters_++;
+                return FilesystemResultCodes::SUCCESS;
+            }
+        }
+
+        //  Otherwise start a new extent, growing the extent array if it is full
+
+        if (number_of_extents_ == capacity_)
+        {
+            uint32_t new_capacity = capacity_ == 0 ? INITIAL_CAPACITY : capacity_ * 2;
+
+            MappedExtent *new_extents = static_cast<MappedExtent *>(__os_dynamic_heap_resource.allocate(sizeof(MappedExtent) * new_capacity, alignof(MappedExtent)));
+
+            if (new_extents == nullptr)
+            {
+                return FilesystemResultCodes::FAT32_UNABLE_TO_ALLOCATE_EXTENT_MAP;
+            }
+
+            if (extents_ != nullptr)
+            {
+                memcpy(new_extents, extents_, sizeof(MappedExtent) * number_of_extents_);
+                __os_dynamic_heap_resource.deallocate(extents_, sizeof(MappedExtent) * capacity_, alignof(MappedExtent));
+            }
+
+            extents_ = new_extents;
+            capacity_ = new_capacity;
+        }
+
+        uint32_t first_cluster_in_file = ClustersMapped();
+
+        extents_[number_of_extents_].first_cluster_in_file_ = first_cluster_in_file;
+        extents_[number_of_extents_].first_cluster_ = cluster;
+        extents_[number_of_extents_].number_of_clusters_ = 1;
+
+        number_of_extents_++;
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+
+    void FAT32ExtentMap::Release()
+    {
+        if (extents_ == nullptr)
+        {
+            return;
+        }
+
+        __os_dynamic_heap_resource.deallocate(extents_, sizeof(MappedExtent) * capacity_, alignof(MappedExtent));
+
+        extents_ = nullptr;
+        number_of_extents_ = 0;
+        capacity_ = 0;
+    }
+} // namespace filesystems::fat32
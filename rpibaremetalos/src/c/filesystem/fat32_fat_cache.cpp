@@ -0,0 +1,591 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "filesystem/fat32_fat_cache.h"
+
+#include <algorithm>
+
+#include "heaps.h"
+
+#include "devices/log.h"
+
+#include "task/system_calls.h"
+
+namespace filesystems::fat32
+{
+    //  FAT entries 0 and 1 are reserved, a chain never links to them
+
+    constexpr uint32_t FIRST_DATA_CLUSTER = 2;
+
+    static uint32_t ReleaseEntriesInSector(uint32_t *sector,
+                                           uint32_t first_cluster_in_sector,
+                                           uint32_t entries_per_sector,
+                                           uint32_t cluster,
+                                           uint32_t maximum_cluster_number,
+                                           uint32_t *released_clusters,
+                                           uint32_t &number_released)
+    {
+        //  Each entry is zeroed as it is visited, so a chain which loops back on itself ends at a free entry
+
+        while (true)
+        {
+            uint32_t next_cluster = sector[cluster - first_cluster_in_sector];
+
+            sector[cluster - first_cluster_in_sector] = 0;
+            released_clusters[number_released++] = cluster;
+
+            if ((next_cluster < FIRST_DATA_CLUSTER) ||
+                (next_cluster > maximum_cluster_number) ||
+                ((next_cluster - first_cluster_in_sector) >= entries_per_sector))
+            {
+                return next_cluster;
+            }
+
+            cluster = next_cluster;
+        }
+    }
+
+    FAT32FATCache::FAT32FATCache(BlockIODevice &io_device,
+                                 uint32_t fat_lba,
+                                 uint32_t sectors_per_fat,
+                                 uint32_t number_of_fats,
+                                 uint32_t cache_size_in_sectors)
+        : io_device_(&io_device),
+          fat_lba_(fat_lba),
+          sectors_per_fat_(sectors_per_fat),
+          number_of_fats_(number_of_fats),
+          entries_per_sector_(io_device.BlockSize() / sizeof(uint32_t)),
+          cache_size_in_sectors_(minstd::min(cache_size_in_sectors, sectors_per_fat))
+    {
+    }
+
+    FAT32FATCache::FAT32FATCache(const FAT32FATCache &cache_to_copy)
+        : io_device_(cache_to_copy.io_device_),
+          fat_lba_(cache_to_copy.fat_lba_),
+          sectors_per_fat_(cache_to_copy.sectors_per_fat_),
+          number_of_fats_(cache_to_copy.number_of_fats_),
+          entries_per_sector_(cache_to_copy.entries_per_sector_),
+          cache_size_in_sectors_(cache_to_copy.cache_size_in_sectors_)
+    {
+    }
+
+    FAT32FATCache::~FAT32FATCache()
+    {
+        if (entries_ == nullptr)
+        {
+            return;
+        }
+
+        if (Failed(Flush()))
+        {
+            LogError("Unable to write back dirty FAT sectors, %u sectors lost\n", dirty_sectors_);
+        }
+
+        __os_filesystem_cache_heap_resource.deallocate(sector_data_, static_cast<size_t>(cache_size_in_sectors_) * io_device_->BlockSize(), BLOCK_IO_BUFFER_ALIGNMENT);
+        __os_filesystem_cache_heap_resource.deallocate(entries_, sizeof(CacheEntry) * cache_size_in_sectors_, alignof(CacheEntry));
+    }
+
+    FilesystemResultCodes FAT32FATCache::AllocateBuffers()
+    {
+        if ((entries_ != nullptr) || (cache_size_in_sectors_ == 0))
+        {
+            return FilesystemResultCodes::SUCCESS;
+        }
+
+        CacheEntry *entries = static_cast<CacheEntry *>(__os_filesystem_cache_heap_resource.allocate(sizeof(CacheEntry) * cache_size_in_sectors_, alignof(CacheEntry)));
+        uint32_t *sector_data = static_cast<uint32_t *>(__os_filesystem_cache_heap_resource.allocate(static_cast<size_t>(cache_size_in_sectors_) * io_device_->BlockSize(), BLOCK_IO_BUFFER_ALIGNMENT));
+
+        //  Both buffers or neither, the rest of the cache takes a null entries_ to mean nothing is allocated
+
+        if ((entries == nullptr) || (sector_data == nullptr))
+        {
+            LogError("Unable to allocate FAT cache of %u sectors\n", cache_size_in_sectors_);
+
+            if (entries != nullptr)
+            {
+                __os_filesystem_cache_heap_resource.deallocate(entries, sizeof(CacheEntry) * cache_size_in_sectors_, alignof(CacheEntry));
+            }
+
+            if (sector_data != nullptr)
+            {
+                __os_filesystem_cache_heap_resource.deallocate(sector_data, static_cast<size_t>(cache_size_in_sectors_) * io_device_->BlockSize(), BLOCK_IO_BUFFER_ALIGNMENT);
+            }
+
+            return FilesystemResultCodes::FAT32_UNABLE_TO_ALLOCATE_FAT_CACHE;
+        }
+
+        for (uint32_t i = 0; i < cache_size_in_sectors_; i++)
+        {
+            entries[i].fat_sector_ = 0;
+            entries[i].last_used_ = 0;
+            entries[i].valid_ = false;
+            entries[i].dirty_ = false;
+            entries[i].writeback_pending_ = false;
+            entries[i].load_pending_ = false;
+        }
+
+        entries_ = entries;
+        sector_data_ = sector_data;
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+
+    ValueResult<FilesystemResultCodes, uint32_t> FAT32FATCache::ReadEntry(uint32_t cluster)
+    {
+        using Result = ValueResult<FilesystemResultCodes, uint32_t>;
+
+        uint32_t fat_sector = cluster / entries_per_sector_;
+        uint32_t offset = cluster % entries_per_sector_;
+
+        //  Without a cache, read the sector every time
+
+        if (cache_size_in_sectors_ == 0)
+        {
+            uint32_t current_fat[entries_per_sector_];
+
+            if (io_device_->ReadFromBlockWithPriority(BlockIOPriority::METADATA, (uint8_t *)current_fat, fat_lba_ + fat_sector, 1).Failed())
+            {
+                LogDebug1("Unable to load FAT32 sector: %u\n", fat_lba_ + fat_sector);
+                return Result::Failure(FilesystemResultCodes::FAT32_UNABLE_TO_READ_FAT_TABLE_SECTOR);
+            }
+
+            return Result::Success(current_fat[offset]);
+        }
+
+        LockGuard lock(cache_lock_);
+
+        auto index = LoadSector(fat_sector);
+
+        ReturnOnFailure(index);
+
+        return Result::Success(SectorData(*index)[offset]);
+    }
+
+    FilesystemResultCodes FAT32FATCache::WriteEntry(uint32_t cluster, uint32_t value, bool write_through)
+    {
+        using Result = FilesystemResultCodes;
+
+        uint32_t fat_sector = cluster / entries_per_sector_;
+        uint32_t offset = cluster % entries_per_sector_;
+
+        //  Without a cache, read-modify-write the sector on the device
+
+        if (cache_size_in_sectors_ == 0)
+        {
+            uint32_t current_fat[entries_per_sector_];
+
+            if (io_device_->ReadFromBlockWithPriority(BlockIOPriority::METADATA, (uint8_t *)current_fat, fat_lba_ + fat_sector, 1).Failed())
+            {
+                LogDebug1("Unable to load FAT32 sector: %u\n", fat_lba_ + fat_sector);
+                return FilesystemResultCodes::FAT32_UNABLE_TO_READ_FAT_TABLE_SECTOR;
+            }
+
+            current_fat[offset] = value;
+
+            BlockIOSegment segment = {(uint8_t *)current_fat, 1};
+
+            return WriteToAllFATs(&segment, 1, fat_sector);
+        }
+
+        LockGuard lock(cache_lock_);
+
+        auto index = LoadSector(fat_sector);
+
+        ReturnOnFailure(index);
+
+        //  Writing through a sector while a flush is writing it could put the older copy on the device last, so wait
+
+        while (write_through && entries_[*index].writeback_pending_)
+        {
+            cache_lock_.Unlock();
+            sc_Yield();
+            cache_lock_.Lock();
+
+            index = LoadSector(fat_sector);
+
+            ReturnOnFailure(index);
+        }
+
+        SectorData(*index)[offset] = value;
+
+        if (!entries_[*index].dirty_)
+        {
+            entries_[*index].dirty_ = true;
+            dirty_sectors_++;
+        }
+
+        if (write_through)
+        {
+            return WriteBack(*index);
+        }
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+
+    ValueResult<FilesystemResultCodes, uint32_t> FAT32FATCache::ReleaseChainInSector(uint32_t first_cluster,
+                                                                                      uint32_t maximum_cluster_number,
+                                                                                      uint32_t *released_clusters,
+                                                                                      uint32_t &number_released)
+    {
+        using Result = ValueResult<FilesystemResultCodes, uint32_t>;
+
+        uint32_t fat_sector = first_cluster / entries_per_sector_;
+        uint32_t first_cluster_in_sector = fat_sector * entries_per_sector_;
+
+        number_released = 0;
+
+        //  Without a cache, read the sector, free the entries and write it back
+
+        if (cache_size_in_sectors_ == 0)
+        {
+            uint32_t current_fat[entries_per_sector_];
+
+            if (io_device_->ReadFromBlockWithPriority(BlockIOPriority::METADATA, (uint8_t *)current_fat, fat_lba_ + fat_sector, 1).Failed())
+            {
+                LogDebug1("Unable to load FAT32 sector: %u\n", fat_lba_ + fat_sector);
+                return Result::Failure(FilesystemResultCodes::FAT32_UNABLE_TO_READ_FAT_TABLE_SECTOR);
+            }
+
+            uint32_t next_cluster = ReleaseEntriesInSector(current_fat, first_cluster_in_sector, entries_per_sector_, first_cluster, maximum_cluster_number, released_clusters, number_released);
+
+            BlockIOSegment segment = {(uint8_t *)current_fat, 1};
+
+            ReturnOnCallFailure(WriteToAllFATs(&segment, 1, fat_sector));
+
+            return Result::Success(next_cluster);
+        }
+
+        LockGuard lock(cache_lock_);
+
+        auto index = LoadSector(fat_sector);
+
+        ReturnOnFailure(index);
+
+        uint32_t next_cluster = ReleaseEntriesInSector(SectorData(*index), first_cluster_in_sector, entries_per_sector_, first_cluster, maximum_cluster_number, released_clusters, number_released);
+
+        if (!entries_[*index].dirty_)
+        {
+            entries_[*index].dirty_ = true;
+            dirty_sectors_++;
+        }
+
+        return Result::Success(next_cluster);
+    }
+
+    FilesystemResultCodes FAT32FATCache::Flush()
+    {
+        if (entries_ == nullptr)
+        {
+            return FilesystemResultCodes::SUCCESS;
+        }
+
+        LockGuard lock(cache_lock_);
+
+        //  Let a flush or eviction write-back already in progress finish first, so every sector dirty when this flush was
+        //      called is on the device once it returns
+
+        while (flush_in_progress_ || WriteBackPending())
+        {
+            cache_lock_.Unlock();
+            sc_Yield();
+            cache_lock_.Lock();
+        }
+
+        if (dirty_sectors_ == 0)
+        {
+            return FilesystemResultCodes::SUCCESS;
+        }
+
+        //  Gather the dirty sectors and put them in FAT order, the cache is small so an insertion sort will do
+
+        uint32_t dirty[dirty_sectors_];
+        uint32_t number_dirty = 0;
+
+        for (uint32_t i = 0; i < cache_size_in_sectors_; i++)
+        {
+            if (!entries_[i].dirty_)
+            {
+                continue;
+            }
+
+            uint32_t position = number_dirty++;
+
+            while ((position > 0) && (entries_[dirty[position - 1]].fat_sector_ > entries_[i].fat_sector_))
+            {
+                dirty[position] = dirty[position - 1];
+                position--;
+            }
+
+            dirty[position] = i;
+        }
+
+        //  The lock is dropped for the writes.  The sectors are marked clean first, so one updated while its write is
+        //      outstanding stays dirty, and flagged so they are not evicted while their data is being written.
+
+        flush_in_progress_ = true;
+
+        for (uint32_t i = 0; i < number_dirty; i++)
+        {
+            entries_[dirty[i]].writeback_pending_ = true;
+            entries_[dirty[i]].dirty_ = false;
+        }
+
+        dirty_sectors_ -= number_dirty;
+
+        //  Write each run of consecutive FAT sectors with one vectored request per FAT copy.  Sectors in a run which
+        //      cannot be written are dirtied again.
+
+        FilesystemResultCodes result = FilesystemResultCodes::SUCCESS;
+
+        BlockIOSegment segments[number_dirty];
+
+        uint32_t run_start = 0;
+
+        while (run_start < number_dirty)
+        {
+            uint32_t run_length = 1;
+
+            while ((run_start + run_length < number_dirty) &&
+                   (entries_[dirty[run_start + run_length]].fat_sector_ == entries_[dirty[run_start]].fat_sector_ + run_length))
+            {
+                run_length++;
+            }
+
+            for (uint32_t i = 0; i < run_length; i++)
+            {
+                segments[i].buffer_ = (uint8_t *)SectorData(dirty[run_start + i]);
+                segments[i].block_count_ = 1;
+            }
+
+            cache_lock_.Unlock();
+
+            FilesystemResultCodes write_result = WriteToAllFATs(segments, run_length, entries_[dirty[run_start]].fat_sector_);
+
+            cache_lock_.Lock();
+
+            for (uint32_t i = 0; i < run_length; i++)
+            {
+                CacheEntry &entry = entries_[dirty[run_start + i]];
+
+                entry.writeback_pending_ = false;
+
+                if (Failed(write_result) && entry.valid_ && !entry.dirty_)
+                {
+                    entry.dirty_ = true;
+                    dirty_sectors_++;
+                }
+            }
+
+            if (Successful(write_result))
+            {
+                sectors_written_back_ += run_length;
+            }
+            else
+            {
+                result = FilesystemResultCodes::FAT32_UNABLE_TO_WRITE_FAT_TABLE_SECTOR;
+            }
+
+            run_start += run_length;
+        }
+
+        flush_in_progress_ = false;
+
+        return result;
+    }
+
+    void FAT32FATCache::Invalidate()
+    {
+        if (entries_ == nullptr)
+        {
+            return;
+        }
+
+        LockGuard lock(cache_lock_);
+
+        for (uint32_t i = 0; i < cache_size_in_sectors_; i++)
+        {
+            entries_[i].valid_ = false;
+            entries_[i].dirty_ = false;
+        }
+
+        most_recent_entry_ = INVALID_ENTRY;
+        dirty_sectors_ = 0;
+    }
+
+    ValueResult<FilesystemResultCodes, uint32_t> FAT32FATCache::LoadSector(uint32_t fat_sector)
+    {
+        using Result = ValueResult<FilesystemResultCodes, uint32_t>;
+
+        ReturnOnCallFailure(AllocateBuffers());
+
+        //  Chain walks and free cluster scans tend to stay in the same sector, so check the last sector used first
+
+        if ((most_recent_entry_ != INVALID_ENTRY) && entries_[most_recent_entry_].valid_ && (entries_[most_recent_entry_].fat_sector_ == fat_sector))
+        {
+            entries_[most_recent_entry_].last_used_ = ++use_counter_;
+            hits_++;
+
+            return Result::Success(most_recent_entry_);
+        }
+
+        //  Search the cache, remembering the best candidate for eviction on the way.  An empty entry is always preferred,
+        //      otherwise the least recently used.  Sectors being written or read cannot be evicted.  The lock is dropped to
+        //      wait for another task, or to write back a dirty victim, and the search starts over afterwards as the cache
+        //      may have changed in the meantime.
+
+        while (true)
+        {
+            uint32_t victim = INVALID_ENTRY;
+            bool wait = false;
+
+            for (uint32_t i = 0; i < cache_size_in_sectors_; i++)
+            {
+                if (entries_[i].valid_ && (entries_[i].fat_sector_ == fat_sector))
+                {
+                    entries_[i].last_used_ = ++use_counter_;
+                    most_recent_entry_ = i;
+                    hits_++;
+
+                    return Result::Success(i);
+                }
+
+                //  Another task is already reading the sector in
+
+                if (entries_[i].load_pending_ && (entries_[i].fat_sector_ == fat_sector))
+                {
+                    wait = true;
+                    break;
+                }
+
+                if (entries_[i].writeback_pending_ || entries_[i].load_pending_)
+                {
+                    continue;
+                }
+
+                if ((victim == INVALID_ENTRY) || (entries_[victim].valid_ && (!entries_[i].valid_ || (entries_[i].last_used_ < entries_[victim].last_used_))))
+                {
+                    victim = i;
+                }
+            }
+
+            if (wait || (victim == INVALID_ENTRY))
+            {
+                cache_lock_.Unlock();
+                sc_Yield();
+                cache_lock_.Lock();
+                continue;
+            }
+
+            //  Write back the sector being evicted, if that fails the sector stays in the cache and we give up
+
+            if (entries_[victim].valid_ && entries_[victim].dirty_)
+            {
+                ReturnOnCallFailure(WriteBack(victim));
+                continue;
+            }
+
+            //  Claim the entry for the sector and read it in without the lock, tasks after the same sector wait for it
+
+            misses_++;
+
+            entries_[victim].valid_ = false;
+            entries_[victim].dirty_ = false;
+            entries_[victim].fat_sector_ = fat_sector;
+            entries_[victim].load_pending_ = true;
+
+            cache_lock_.Unlock();
+
+            bool read_failed = io_device_->ReadFromBlockWithPriority(BlockIOPriority::METADATA, (uint8_t *)SectorData(victim), fat_lba_ + fat_sector, 1).Failed();
+
+            cache_lock_.Lock();
+
+            entries_[victim].load_pending_ = false;
+
+            if (read_failed)
+            {
+                LogDebug1("Unable to load FAT32 sector: %u\n", fat_lba_ + fat_sector);
+                return Result::Failure(FilesystemResultCodes::FAT32_UNABLE_TO_READ_FAT_TABLE_SECTOR);
+            }
+
+            entries_[victim].last_used_ = ++use_counter_;
+            entries_[victim].valid_ = true;
+
+            most_recent_entry_ = victim;
+
+            return Result::Success(victim);
+        }
+    }
+
+    FilesystemResultCodes FAT32FATCache::WriteBack(uint32_t index)
+    {
+        //  Called with the lock held.  As in Flush(), the sector is marked clean before the lock is dropped for the write, so
+        //      an update made in the meantime leaves it dirty, and flagged so it is not evicted while it is being written.
+
+        CacheEntry &entry = entries_[index];
+
+        entry.writeback_pending_ = true;
+        entry.dirty_ = false;
+        dirty_sectors_--;
+
+        BlockIOSegment segment = {(uint8_t *)SectorData(index), 1};
+
+        cache_lock_.Unlock();
+
+        FilesystemResultCodes write_result = WriteToAllFATs(&segment, 1, entry.fat_sector_);
+
+        cache_lock_.Lock();
+
+        entry.writeback_pending_ = false;
+
+        if (Failed(write_result))
+        {
+            if (entry.valid_ && !entry.dirty_)
+            {
+                entry.dirty_ = true;
+                dirty_sectors_++;
+            }
+
+            return write_result;
+        }
+
+        sectors_written_back_++;
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+
+    bool FAT32FATCache::WriteBackPending() const
+    {
+        for (uint32_t i = 0; i < cache_size_in_sectors_; i++)
+        {
+            if (entries_[i].writeback_pending_)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    FilesystemResultCodes FAT32FATCache::WriteToAllFATs(const BlockIOSegment *segments, uint32_t number_of_segments, uint32_t first_fat_sector)
+    {
+        //  The copies of the FAT follow one another on the volume.  Runs of sectors go out as vectored writes, all at the
+        //      METADATA priority.
+
+        for (uint32_t fat = 0; fat < number_of_fats_; fat++)
+        {
+            uint32_t sector = fat_lba_ + (fat * sectors_per_fat_) + first_fat_sector;
+
+            auto write_result = number_of_segments == 1 ? io_device_->WriteBlockWithPriority(BlockIOPriority::METADATA, segments[0].buffer_, sector, segments[0].block_count_)
+                                                        : io_device_->WriteBlocksV(BlockIOPriority::METADATA, segments, number_of_segments, sector);
+
+            if (write_result.Failed())
+            {
+                LogDebug1("Unable to write FAT32 sector: %u\n", sector);
+                return FilesystemResultCodes::FAT32_UNABLE_TO_WRITE_FAT_TABLE_SECTOR;
+            }
+        }
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+} // namespace filesystems::fat32
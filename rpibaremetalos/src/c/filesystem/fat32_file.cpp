@@ -3,14 +3,33 @@
 // license that can be found in the LICENSE file.
 
 #include <stdint.h>
+#include <string.h>
+
+#include "heaps.h"
 
 #include "filesystem/file_map.h"
 
 #include "filesystem/fat32_file.h"
+#include "filesystem/fat32_file_mapping.h"
 #include "filesystem/fat32_filesystem.h"
 
 namespace filesystems::fat32
 {
+    FAT32File::~FAT32File()
+    {
+        //  Close() normally flushes, this catches files destroyed without being closed
+
+        if (directory_entry_dirty_ && Failed(Flush()))
+        {
+            LogError("Unable to update the directory entry for file: %s\n", path_.c_str());
+        }
+
+        if (read_ahead_buffer_ != nullptr)
+        {
+            __os_dynamic_heap_resource.deallocate(read_ahead_buffer_, read_ahead_buffer_size_, BLOCK_IO_BUFFER_ALIGNMENT);
+        }
+    }
+
     FilesystemResultCodes FAT32File::SeekEnd()
     {
         return Seek(directory_entry_.Size());
@@ -37,6 +56,10 @@ namespace filesystems::fat32
 
         FAT32BlockIOAdapter &block_io_adapter = filesystem.BlockIOAdapter();
 
+        //  A seek ends any sequential run, so shrink the read-ahead window back down
+
+        read_ahead_window_ = 1;
+
         //  If the current cluster is zero, then we have an empty file and are already at the end
 
         if (current_cluster_ == 0)
@@ -44,49 +67,91 @@ namespace filesystems::fat32
             return Result::SUCCESS;
         }
 
-        //  If position is zero, then we are at the start of the file now
+        //  Set position to the smaller of the position or the file size
+
+        position = minstd::min(position, directory_entry_.Size());
+
+        //  Find the cluster holding the position with the extent map.  A position on a cluster boundary is left at the end
+        //      of the cluster before it, as a write there may have to extend the chain first.
 
-        if (position == 0)
+        uint32_t bytes_per_cluster = block_io_adapter.BytesPerCluster();
+
+        uint32_t cluster_in_file = position / bytes_per_cluster;
+        uint32_t offset_into_cluster = position % bytes_per_cluster;
+
+        if ((offset_into_cluster == 0) && (cluster_in_file > 0))
         {
-            current_cluster_ = first_cluster_;
-            byte_offset_into_cluster_ = 0;
-            byte_offset_into_file_ = 0;
+            cluster_in_file--;
+            offset_into_cluster = bytes_per_cluster;
+        }
 
-            return Result::SUCCESS;
+        auto cluster = extent_map_.ClusterAt(block_io_adapter, cluster_in_file);
+
+        ReturnOnFailure(cluster);
+
+        //  The chain should never be shorter than the file
+
+        if (*cluster >= FAT32EntryEOFThreshold)
+        {
+            LogDebug1("File chain ends before cluster %u of the file\n", cluster_in_file);
+            return FilesystemResultCodes::FAT32_CLUSTER_NOT_PRESENT_IN_CHAIN;
         }
 
-        //  Set position to the smaller of the position or the file size
+        current_cluster_ = *cluster;
+        byte_offset_into_cluster_ = offset_into_cluster;
+        byte_offset_into_file_ = position;
 
-        position = minstd::min(position, directory_entry_.Size());
+        return FilesystemResultCodes::SUCCESS;
+    }
 
-        //  Read from the current cluster and offset and append to the buffer until the buffer is full.
+    FilesystemResultCodes FAT32File::Read(minstd::buffer<uint8_t> &buffer)
+    {
+        using Result = FilesystemResultCodes;
 
-        uint32_t bytes_in_block = block_io_adapter.BytesPerCluster();
+        LogEntryAndExit("Entering\n");
+
+        //  Get the filesystem entity
+
+        auto get_filesystem_result = GetOSEntityRegistry().GetEntityById(filesystem_uuid_);
 
-        while (true)
+        if (!get_filesystem_result.Successful())
         {
-            //  We will either seek to position or the end of the current block
+            return FilesystemResultCodes::FILESYSTEM_DOES_NOT_EXIST;
+        }
 
-            uint32_t bytes_to_read = minstd::min(bytes_in_block - byte_offset_into_cluster_, position - byte_offset_into_file_);
+        //  Get the block io adapter from the filesystem
 
-            byte_offset_into_file_ += bytes_to_read;
-            byte_offset_into_cluster_ += bytes_to_read;
+        FAT32Filesystem &filesystem = get_filesystem_result;
 
-            //  Break if we reached the end of the file
+        FAT32BlockIOAdapter &block_io_adapter = filesystem.BlockIOAdapter();
 
-            if (byte_offset_into_file_ >= position)
-            {
-                break;
-            }
+        uint32_t bytes_in_block = block_io_adapter.BytesPerCluster();
+
+        //  If the current cluster is zero, then we have an empty file and there is nothing to read
+
+        if (current_cluster_ == 0)
+        {
+            return Result::SUCCESS;
+        }
+
+        //  The read is sequential if it picks up where the last read left off
+
+        bool sequential = (byte_offset_into_file_ == next_sequential_read_offset_);
 
-            //  Move to the next block
+        //  Read from the current cluster and offset and append to the buffer until the buffer is full or we reach the end of the file.
+
+        while ((buffer.space_remaining() > 0) && (byte_offset_into_file_ < directory_entry_.Size()))
+        {
+            //  If we have read all the bytes in the block, then move to the next block
 
             if (byte_offset_into_cluster_ >= bytes_in_block)
             {
-                auto next_file_cluster = block_io_adapter.NextClusterInChain(current_cluster_);
+                auto next_file_cluster = NextClusterInFile(block_io_adapter);
 
                 ReturnOnFailure(next_file_cluster);
 
+                //  We are done if we have hit the last block.
+
                 if (*next_file_cluster >= FAT32EntryEOFThreshold)
                 {
                     break;
@@ -95,94 +160,259 @@ namespace filesystems::fat32
                 current_cluster_ = *next_file_cluster;
                 byte_offset_into_cluster_ = 0;
             }
+
+            uint32_t bytes_left_in_file = directory_entry_.Size() - byte_offset_into_file_;
+
+            //  When the read is cluster aligned and the buffer can take whole clusters, read them in contiguous runs.
+            //      Clusters already prefetched are cheaper to copy than to read again, so they take the path below.
+
+            if ((byte_offset_into_cluster_ == 0) &&
+                (buffer.space_remaining() >= bytes_in_block) &&
+                (bytes_left_in_file >= bytes_in_block) &&
+                (PrefetchedCluster(current_cluster_, bytes_in_block) == nullptr))
+            {
+                uint32_t bytes_read = 0;
+
+                ReturnOnCallFailure(ReadClustersIntoBuffer(block_io_adapter, buffer, bytes_left_in_file, bytes_read));
+
+                byte_offset_into_file_ += bytes_read;
+                byte_offset_into_cluster_ = bytes_in_block;
+
+                sequential = true;
+
+                continue;
+            }
+
+            //  Otherwise the head or tail of the read is bounced through the read-ahead buffer
+
+            auto cluster_data = ReadCurrentCluster(block_io_adapter, sequential);
+
+            ReturnOnFailure(cluster_data);
+
+            //  Every cluster after the first in this read follows on from the one before
+
+            sequential = true;
+
+            //  Read the minimum of the number of bytes not yet read from the cluster or the number of bytes remaining in the file.
+
+            uint32_t bytes_to_read = minstd::min(bytes_in_block - byte_offset_into_cluster_, bytes_left_in_file);
+
+            //  Append to the buffer, though the number of bytes appended may be less than the bytes to read if we run out of space in the buffer
+
+            uint32_t bytes_appended = buffer.append(*cluster_data + byte_offset_into_cluster_, bytes_to_read);
+
+            byte_offset_into_file_ += bytes_appended;
+            byte_offset_into_cluster_ += bytes_appended;
         }
 
+        next_sequential_read_offset_ = byte_offset_into_file_;
+
         return FilesystemResultCodes::SUCCESS;
     }
 
-    FilesystemResultCodes FAT32File::Read(minstd::buffer<uint8_t> &buffer)
+    FilesystemResultCodes FAT32File::ReadClustersIntoBuffer(FAT32BlockIOAdapter &block_io_adapter,
+                                                            minstd::buffer<uint8_t> &buffer,
+                                                            uint32_t bytes_left_in_file,
+                                                            uint32_t &bytes_read)
     {
         using Result = FilesystemResultCodes;
 
-        LogEntryAndExit("Entering\n");
+        uint32_t bytes_per_cluster = block_io_adapter.BytesPerCluster();
 
-        //  Get the filesystem entity
+        bytes_read = 0;
 
-        auto get_filesystem_result = GetOSEntityRegistry().GetEntityById(filesystem_uuid_);
+        //  The runs are staged through the read-ahead buffer, minstd::buffer can only grow by copying into it so the device
+        //      cannot fill the free space at its end in place.  Whatever was prefetched is overwritten.
 
-        if (!get_filesystem_result.Successful())
+        uint8_t *staging_buffer = ClusterBuffer(bytes_per_cluster);
+
+        if (staging_buffer == nullptr)
         {
-            return FilesystemResultCodes::FILESYSTEM_DOES_NOT_EXIST;
+            return FilesystemResultCodes::FAT32_UNABLE_TO_ALLOCATE_CLUSTER_BUFFER;
         }
 
-        //  Get the block io adapter from the filesystem
+        read_ahead_cluster_count_ = 0;
 
-        FAT32Filesystem &filesystem = get_filesystem_result;
+        const uint32_t staging_clusters = read_ahead_buffer_size_ / bytes_per_cluster;
 
-        FAT32BlockIOAdapter &block_io_adapter = filesystem.BlockIOAdapter();
+        //  Whole clusters only, the caller bounces any partial cluster at the end of the read
 
-        //  Create a read buffer
+        uint32_t clusters_wanted = minstd::min((uint32_t)buffer.space_remaining(), bytes_left_in_file) / bytes_per_cluster;
 
-        uint8_t block_buffer[block_io_adapter.BytesPerCluster()];
-        uint32_t bytes_in_block = block_io_adapter.BytesPerCluster();
+        //  Read each run of physically contiguous clusters with a single device read, as much of it as fits in the staging
+        //      buffer.  The current cluster is left on the last cluster read.
 
-        //  If the current cluster is zero, then we have an empty file and there is nothing to read
+        while (clusters_wanted > 0)
+        {
+            auto extent = extent_map_.ExtentAt(block_io_adapter, (byte_offset_into_file_ + bytes_read) / bytes_per_cluster, clusters_wanted);
 
-        if (current_cluster_ == 0)
+            ReturnOnFailure(extent);
+
+            //  The chain should never be shorter than the file
+
+            if ((extent->number_of_clusters_ == 0) || ((bytes_read == 0) && (extent->first_cluster_ != current_cluster_)))
+            {
+                return FilesystemResultCodes::FAT32_CLUSTER_NOT_PRESENT_IN_CHAIN;
+            }
+
+            uint32_t run_length = minstd::min(minstd::min(extent->number_of_clusters_, clusters_wanted), staging_clusters);
+            uint32_t run_bytes = run_length * bytes_per_cluster;
+
+            if (block_io_adapter.ReadClusters(extent->first_cluster_, run_length, staging_buffer) != BlockIOResultCodes::SUCCESS)
+            {
+                return FilesystemResultCodes::FAT32_DEVICE_READ_ERROR;
+            }
+
+            buffer.append(staging_buffer, run_bytes);
+
+            current_cluster_ = FAT32ClusterIndex(static_cast<uint32_t>(extent->first_cluster_) + run_length - 1);
+
+            bytes_read += run_bytes;
+            clusters_wanted -= run_length;
+        }
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+
+    const uint8_t *FAT32File::PrefetchedCluster(FAT32ClusterIndex cluster, uint32_t bytes_per_cluster) const
+    {
+        for (uint32_t i = 0; i < read_ahead_cluster_count_; i++)
         {
-            return Result::SUCCESS;
+            if (read_ahead_clusters_[i] == static_cast<uint32_t>(cluster))
+            {
+                return read_ahead_buffer_ + (i * bytes_per_cluster);
+            }
+        }
+
+        return nullptr;
+    }
+
+    uint8_t *FAT32File::ClusterBuffer(uint32_t bytes_per_cluster)
+    {
+        //  The read-ahead buffer doubles as the bounce buffer for partial cluster reads and writes, so it always holds at
+        //      least one cluster.  Returns nullptr if the buffer cannot be allocated, the next call tries again.
+
+        if (read_ahead_buffer_ == nullptr)
+        {
+            uint32_t maximum_window = minstd::min((uint32_t)MAX_FAT32_READ_AHEAD_CLUSTERS, (uint32_t)(MAX_FAT32_READ_AHEAD_BYTES / bytes_per_cluster));
+            uint32_t buffer_size = minstd::max(maximum_window, (uint32_t)1) * bytes_per_cluster;
+
+            read_ahead_buffer_ = static_cast<uint8_t *>(__os_dynamic_heap_resource.allocate(buffer_size, BLOCK_IO_BUFFER_ALIGNMENT));
+            read_ahead_buffer_size_ = read_ahead_buffer_ != nullptr ? buffer_size : 0;
+        }
+
+        return read_ahead_buffer_;
+    }
+
+    ValueResult<FilesystemResultCodes, const uint8_t *> FAT32File::ReadCurrentCluster(FAT32BlockIOAdapter &block_io_adapter,
+                                                                                    bool sequential)
+    {
+        using Result = ValueResult<FilesystemResultCodes, const uint8_t *>;
+
+        uint32_t bytes_per_cluster = block_io_adapter.BytesPerCluster();
+
+        //  If the cluster was prefetched, return it from the read-ahead buffer
+
+        const uint8_t *prefetched = PrefetchedCluster(current_cluster_, bytes_per_cluster);
+
+        if (prefetched != nullptr)
+        {
+            return Result::Success(prefetched);
+        }
+
+        uint8_t *cluster_buffer = ClusterBuffer(bytes_per_cluster);
+
+        if (cluster_buffer == nullptr)
+        {
+            return Result::Failure(FilesystemResultCodes::FAT32_UNABLE_TO_ALLOCATE_CLUSTER_BUFFER);
         }
 
-        //  Read from the current cluster and offset and append to the buffer until the buffer is full.
+        uint32_t maximum_window = minstd::min((uint32_t)MAX_FAT32_READ_AHEAD_CLUSTERS, (uint32_t)(MAX_FAT32_READ_AHEAD_BYTES / bytes_per_cluster));
+
+        //  For random access, or if the clusters are too large to prefetch, just read the current cluster
 
-        while (buffer.space_remaining() > 0)
+        if (!sequential || (maximum_window < 2))
         {
-            auto read_block_result = block_io_adapter.ReadCluster(current_cluster_, block_buffer);
+            read_ahead_window_ = 1;
+            read_ahead_cluster_count_ = 0;
 
-            if (read_block_result != BlockIOResultCodes::SUCCESS)
+            if (block_io_adapter.ReadCluster(current_cluster_, cluster_buffer) != BlockIOResultCodes::SUCCESS)
             {
-                return FilesystemResultCodes::FAT32_DEVICE_READ_ERROR;
+                return Result::Failure(FilesystemResultCodes::FAT32_DEVICE_READ_ERROR);
             }
 
-            //  Read the minimum of the number of bytes not yet read from the cluster or the number of bytes remaining in the file.
+            //  Keep the cluster, the next small read probably falls in it too
 
-            uint32_t bytes_to_read = minstd::min(bytes_in_block - byte_offset_into_cluster_, directory_entry_.Size() - byte_offset_into_file_);
+            read_ahead_clusters_[0] = static_cast<uint32_t>(current_cluster_);
+            read_ahead_cluster_count_ = 1;
 
-            //  Append to the buffer, though the number of bytes appended may be less than the bytes to read if we run out of space in the buffer
+            return Result::Success(cluster_buffer);
+        }
 
-            uint32_t bytes_appended = buffer.append(block_buffer + byte_offset_into_cluster_, bytes_to_read);
+        //  Sequential reader has consumed the window, so grow the window and prefetch the following clusters
 
-            byte_offset_into_file_ += bytes_appended;
-            byte_offset_into_cluster_ += bytes_appended;
+        read_ahead_window_ = minstd::min(read_ahead_window_ * 2, maximum_window);
+
+        //  Do not prefetch beyond the end of the file
+
+        uint32_t start_of_current_cluster = byte_offset_into_file_ - byte_offset_into_cluster_;
+        uint32_t clusters_left_in_file = (directory_entry_.Size() - start_of_current_cluster + bytes_per_cluster - 1) / bytes_per_cluster;
+        uint32_t clusters_to_prefetch = minstd::max(minstd::min(read_ahead_window_, clusters_left_in_file), (uint32_t)1);
 
-            //  Break if we have read the whole file
+        //  Look up the clusters in the window with the extent map, then read each run of physically contiguous clusters
+        //      with a single device read.  The window holds the cluster the caller is waiting for and the caller waits for
+        //      the whole window, so it is read as INTERACTIVE rather than queued behind background write-back.
 
-            if (byte_offset_into_file_ >= directory_entry_.Size())
+        read_ahead_cluster_count_ = 0;
+
+        uint32_t cluster_in_file = start_of_current_cluster / bytes_per_cluster;
+        uint32_t cluster_count = 0;
+
+        while (cluster_count < clusters_to_prefetch)
+        {
+            auto extent = extent_map_.ExtentAt(block_io_adapter, cluster_in_file + cluster_count, clusters_to_prefetch - cluster_count);
+
+            ReturnOnFailure(extent);
+
+            if (extent->number_of_clusters_ == 0)
             {
                 break;
             }
 
-            //  If we have read all the bytes in the block, then move to the next block
+            uint32_t run_length = minstd::min(extent->number_of_clusters_, clusters_to_prefetch - cluster_count);
 
-            if (byte_offset_into_cluster_ >= bytes_in_block)
+            if (block_io_adapter.ReadClusters(extent->first_cluster_, run_length, cluster_buffer + (cluster_count * bytes_per_cluster)) != BlockIOResultCodes::SUCCESS)
             {
-                auto next_file_cluster = block_io_adapter.NextClusterInChain(current_cluster_);
-
-                ReturnOnFailure(next_file_cluster);
+                return Result::Failure(FilesystemResultCodes::FAT32_DEVICE_READ_ERROR);
+            }
 
-                //  We are done if we have hit the last block.
+            for (uint32_t i = 0; i < run_length; i++)
+            {
+                read_ahead_clusters_[cluster_count++] = static_cast<uint32_t>(extent->first_cluster_) + i;
+            }
+        }
 
-                if (*next_file_cluster >= FAT32EntryEOFThreshold)
-                {
-                    break;
-                }
+        //  The current cluster is always in the chain, so the window should never come up empty
 
-                current_cluster_ = *next_file_cluster;
-                byte_offset_into_cluster_ = 0;
-            }
+        if ((cluster_count == 0) || (read_ahead_clusters_[0] != static_cast<uint32_t>(current_cluster_)))
+        {
+            return Result::Failure(FilesystemResultCodes::FAT32_CLUSTER_NOT_PRESENT_IN_CHAIN);
         }
 
-        return FilesystemResultCodes::SUCCESS;
+        read_ahead_cluster_count_ = cluster_count;
+
+        return Result::Success(cluster_buffer);
+    }
+
+    ValueResult<FilesystemResultCodes, FAT32ClusterIndex> FAT32File::NextClusterInFile(FAT32BlockIOAdapter &block_io_adapter)
+    {
+        //  The cluster following the current one is at the next cluster position in the file, the extent map usually has it
+        //      without reading the FAT
+
+        uint32_t bytes_per_cluster = block_io_adapter.BytesPerCluster();
+        uint32_t current_cluster_in_file = (byte_offset_into_file_ - byte_offset_into_cluster_) / bytes_per_cluster;
+
+        return extent_map_.ClusterAt(block_io_adapter, current_cluster_in_file + 1);
     }
 
     FilesystemResultCodes FAT32File::Write(const minstd::buffer<uint8_t> &buffer)
@@ -204,128 +434,190 @@ namespace filesystems::fat32
 
         FAT32BlockIOAdapter &block_io_adapter = filesystem.BlockIOAdapter();
 
-        //  If the current cluster is zero, then we have an empty file so we have to allocate a cluster now
+        //  Prefetched clusters may be overwritten, so drop them
+
+        read_ahead_cluster_count_ = 0;
+
+        //  Clusters are allocated in physically contiguous extents sized to the data still to be written, this tracks how many
+        //      clusters of the current extent lie beyond the current cluster.
+
+        const uint32_t bytes_per_cluster = block_io_adapter.BytesPerCluster();
+
+        uint32_t clusters_left_in_extent = 0;
+
+        //  If the current cluster is zero, then we have an empty file so we have to allocate the first extent now
 
         if (current_cluster_ == 0)
         {
-            auto new_cluster_index = block_io_adapter.FindNextEmptyCluster();
+            uint32_t clusters_wanted = minstd::max((uint32_t)((buffer.size() + bytes_per_cluster - 1) / bytes_per_cluster), (uint32_t)1);
 
-            ReturnOnFailure(new_cluster_index);
+            auto first_extent = block_io_adapter.AllocateExtent(FAT32EntryFree, clusters_wanted);
 
-            if (block_io_adapter.UpdateFATTableEntry(*new_cluster_index, FAT32EntryAllocatedAndEndOfFile) != FilesystemResultCodes::SUCCESS)
-            {
-                return FilesystemResultCodes::FAT32_UNABLE_TO_WRITE_FAT_TABLE_SECTOR;
-            }
+            ReturnOnFailure(first_extent);
 
-            //  Update the directory entry with the initial cluster
+            //  Move to the new cluster, the directory entry picks up the initial cluster when the file is flushed
 
-            ReturnOnCallFailure(FAT32Directory::SetDirectoryEntryFirstCluster(block_io_adapter, directory_entry_address_, *new_cluster_index));
+            first_cluster_ = first_extent->first_cluster_;
+            directory_entry_dirty_ = true;
+            current_cluster_ = first_extent->first_cluster_;
 
-            //  Move to the new cluster
+            extent_map_.Reset(first_cluster_);
 
-            first_cluster_ = *new_cluster_index;
-            current_cluster_ = *new_cluster_index;
+            clusters_left_in_extent = first_extent->number_of_clusters_ - 1;
         }
 
-        //  Allocate a buffer for the cluster on the stack.
-
-        uint8_t block_buffer[block_io_adapter.BytesPerCluster()];
-
         //  Start tracking the offset into the write buffer
 
         uint32_t offset_into_buffer = 0;
 
         while (offset_into_buffer < buffer.size())
         {
-            //  If we have data already written into this cluster, then read it so we can append.
+            //  Once the current cluster is full, we need to move forward to the next cluster in the file -or- allocate
+            //      more clusters if we are at the end of the chain.  Clusters in an extent we allocated are contiguous, so
+            //      there is no need to go to the FAT for them.
 
-            if (byte_offset_into_cluster_ > 0)
+            if (byte_offset_into_cluster_ >= bytes_per_cluster)
             {
-                BlockIOResultCodes read_block_result = block_io_adapter.ReadCluster(current_cluster_, block_buffer);
-
-                if (read_block_result != BlockIOResultCodes::SUCCESS)
+                if (clusters_left_in_extent > 0)
                 {
-                    return FilesystemResultCodes::FAT32_DEVICE_READ_ERROR;
+                    current_cluster_ = current_cluster_ + 1;
+                    byte_offset_into_cluster_ = 0;
+                    clusters_left_in_extent--;
                 }
-            }
+                else
+                {
+                    //  The chain may continue past the end of the file if clusters were preallocated
 
-            //  Append from the buffer to the cluster, then write the cluster.
+                    auto next_cluster = NextClusterInFile(block_io_adapter);
 
-            uint32_t bytes_left_in_cluster = block_io_adapter.BytesPerCluster() - byte_offset_into_cluster_;
-            uint32_t bytes_to_copy = minstd::min(bytes_left_in_cluster, (uint32_t)buffer.size() - offset_into_buffer);
+                    ReturnOnFailure(next_cluster);
 
-            memcpy(block_buffer + byte_offset_into_cluster_, (char *)buffer.data() + offset_into_buffer, bytes_to_copy);
+                    byte_offset_into_cluster_ = 0;
 
-            BlockIOResultCodes write_block_result = block_io_adapter.WriteCluster(current_cluster_, block_buffer);
+                    if (*next_cluster < FAT32EntryEOFThreshold)
+                    {
+                        current_cluster_ = *next_cluster;
+                    }
+                    else
+                    {
+                        //  OK, we have filled the existing file storage so allocate an extent for the rest of the buffer,
+                        //      linked onto the end of the chain.
 
-            if (write_block_result != BlockIOResultCodes::SUCCESS)
-            {
-                LogDebug1("Writing cluster failed with code: %d\n", write_block_result);
-                return FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR;
-            }
+                        uint32_t bytes_left_to_write = buffer.size() - offset_into_buffer;
 
-            //  Move forward in the cluster
+                        auto next_extent = block_io_adapter.AllocateExtent(current_cluster_, (bytes_left_to_write + bytes_per_cluster - 1) / bytes_per_cluster);
 
-            byte_offset_into_file_ += bytes_to_copy;
-            byte_offset_into_cluster_ += bytes_to_copy;
+                        ReturnOnFailure(next_extent);
 
-            //  Move forward in the append buffer.  Break now if the buffer has been fully written.
+                        //  Move to the first cluster of the new extent
 
-            offset_into_buffer += bytes_to_copy;
+                        current_cluster_ = next_extent->first_cluster_;
+                        clusters_left_in_extent = next_extent->number_of_clusters_ - 1;
+                    }
+                }
+            }
 
-            if (offset_into_buffer >= buffer.size())
+            uint32_t bytes_left_to_write = buffer.size() - offset_into_buffer;
+
+            //  Whole clusters are written straight from the caller's buffer, a physically contiguous run with a single device write
+
+            if ((byte_offset_into_cluster_ == 0) && (bytes_left_to_write >= bytes_per_cluster))
             {
-                break;
+                uint32_t whole_clusters = bytes_left_to_write / bytes_per_cluster;
+                uint32_t run_length = 1;
+
+                if (clusters_left_in_extent > 0)
+                {
+                    run_length = minstd::min(whole_clusters, clusters_left_in_extent + 1);
+                }
+                else
+                {
+                    auto extent = extent_map_.ExtentAt(block_io_adapter, byte_offset_into_file_ / bytes_per_cluster, whole_clusters);
+
+                    ReturnOnFailure(extent);
+
+                    if ((extent->number_of_clusters_ > 0) && (extent->first_cluster_ == current_cluster_))
+                    {
+                        run_length = minstd::min(whole_clusters, extent->number_of_clusters_);
+                    }
+                }
+
+                uint32_t run_bytes = run_length * bytes_per_cluster;
+
+                BlockIOResultCodes write_run_result = block_io_adapter.WriteClusters(current_cluster_, run_length, (uint8_t *)buffer.data() + offset_into_buffer);
+
+                if (write_run_result != BlockIOResultCodes::SUCCESS)
+                {
+                    LogDebug1("Writing clusters failed with code: %d\n", write_run_result);
+                    return FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR;
+                }
+
+                //  Leave the current cluster on the last cluster written
+
+                current_cluster_ = FAT32ClusterIndex(static_cast<uint32_t>(current_cluster_) + run_length - 1);
+                clusters_left_in_extent -= minstd::min(run_length - 1, clusters_left_in_extent);
+
+                byte_offset_into_file_ += run_bytes;
+                byte_offset_into_cluster_ = bytes_per_cluster;
+
+                offset_into_buffer += run_bytes;
+
+                continue;
             }
 
-            //  There is still data to be written to the device, which means we need to move forward to the next
-            //      cluster in the file -or- get a new cluster if we are at the end of the file.
+            //  A partial cluster is assembled in the bounce buffer.  The cluster only has to be read first if it holds file
+            //      data on either side of the bytes being written.
+
+            uint8_t *block_buffer = ClusterBuffer(bytes_per_cluster);
 
-            if (byte_offset_into_file_ < directory_entry_.Size())
+            if (block_buffer == nullptr)
             {
-                auto next_cluster = block_io_adapter.NextClusterInChain(current_cluster_);
+                return FilesystemResultCodes::FAT32_UNABLE_TO_ALLOCATE_CLUSTER_BUFFER;
+            }
 
-                ReturnOnFailure(next_cluster);
+            uint32_t bytes_left_in_cluster = bytes_per_cluster - byte_offset_into_cluster_;
+            uint32_t bytes_to_copy = minstd::min(bytes_left_in_cluster, bytes_left_to_write);
 
-                current_cluster_ = *next_cluster;
-                byte_offset_into_cluster_ = 0;
+            uint32_t start_of_current_cluster = byte_offset_into_file_ - byte_offset_into_cluster_;
+            uint32_t file_bytes_in_cluster = minstd::min(directory_entry_.Size() - minstd::min(start_of_current_cluster, directory_entry_.Size()), bytes_per_cluster);
 
-                continue;
+            if ((byte_offset_into_cluster_ > 0) || (bytes_to_copy < file_bytes_in_cluster))
+            {
+                BlockIOResultCodes read_block_result = block_io_adapter.ReadCluster(current_cluster_, block_buffer);
+
+                if (read_block_result != BlockIOResultCodes::SUCCESS)
+                {
+                    return FilesystemResultCodes::FAT32_DEVICE_READ_ERROR;
+                }
             }
 
-            //  OK, we have filled the existing file storage so we need a new cluster to continue.
-            //
-            //  Get the next empty cluster, then link the previous final cluster to the next cluster and then mark the new
-            //      cluster as the last cluster in the file.
+            //  Copy from the buffer to the cluster, then write the cluster.
 
-            auto next_empty_cluster = block_io_adapter.FindNextEmptyCluster(current_cluster_ + 1);
+            memcpy(block_buffer + byte_offset_into_cluster_, (char *)buffer.data() + offset_into_buffer, bytes_to_copy);
+
+            BlockIOResultCodes write_block_result = block_io_adapter.WriteCluster(current_cluster_, block_buffer);
 
-            ReturnOnFailure(next_empty_cluster);
+            if (write_block_result != BlockIOResultCodes::SUCCESS)
+            {
+                LogDebug1("Writing cluster failed with code: %d\n", write_block_result);
+                return FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR;
+            }
 
-            ReturnOnCallFailure(block_io_adapter.UpdateFATTableEntry(current_cluster_, *next_empty_cluster));
-            ReturnOnCallFailure(block_io_adapter.UpdateFATTableEntry(*next_empty_cluster, FAT32EntryAllocatedAndEndOfFile));
+            //  Move forward in the cluster and in the write buffer
 
-            //  Move to the next cluster and reset the offset into the cluster to zero.
+            byte_offset_into_file_ += bytes_to_copy;
+            byte_offset_into_cluster_ += bytes_to_copy;
 
-            current_cluster_ = *next_empty_cluster;
-            byte_offset_into_cluster_ = 0;
+            offset_into_buffer += bytes_to_copy;
         }
 
-        //  Finally, update the directory entry.
-        //      We need to update the directory entry saved with the file and also the entry on the disk.
+        //  Finally, update the size in the directory entry saved with the file.  The entry on the disk is updated when the
+        //      file is flushed.
 
         if (byte_offset_into_file_ > directory_entry_.Size())
         {
             directory_entry_.UpdateSize(byte_offset_into_file_);
-
-            auto update_directory_entry_result = FAT32Directory::UpdateDirectoryEntrySize(block_io_adapter, directory_entry_address_, byte_offset_into_file_);
-
-            if (update_directory_entry_result != FilesystemResultCodes::SUCCESS)
-            {
-                LogDebug1("Failed to update directory entry after append\n");
-
-                return update_directory_entry_result;
-            }
+            directory_entry_dirty_ = true;
         }
 
         //  Finished with success
@@ -349,12 +641,501 @@ namespace filesystems::fat32
         return Write(buffer);
     }
 
+    FilesystemResultCodes FAT32File::ReadAt(uint32_t offset, minstd::buffer<uint8_t> &buffer)
+    {
+        LogEntryAndExit("Reading at offset %u\n", offset);
+
+        //  Get the filesystem entity
+
+        auto get_filesystem_result = GetOSEntityRegistry().GetEntityById(filesystem_uuid_);
+
+        if (!get_filesystem_result.Successful())
+        {
+            return FilesystemResultCodes::FILESYSTEM_DOES_NOT_EXIST;
+        }
+
+        FAT32Filesystem &filesystem = get_filesystem_result;
+
+        FAT32BlockIOAdapter &block_io_adapter = filesystem.BlockIOAdapter();
+
+        const uint32_t bytes_per_cluster = block_io_adapter.BytesPerCluster();
+        const uint32_t file_size = directory_entry_.Size();
+
+        //  Reading at or past the end of the file is not an error, there is just nothing to read
+
+        if (offset >= file_size)
+        {
+            return FilesystemResultCodes::SUCCESS;
+        }
+
+        //  Only the extent map is shared with other callers, so clusters are staged through a buffer allocated for this
+        //      call rather than the read-ahead buffer.  It is sized like the read-ahead buffer, so a physically contiguous run
+        //      of clusters still takes a single device read.
+
+        uint32_t bytes_to_read = minstd::min((uint32_t)buffer.space_remaining(), file_size - offset);
+
+        const uint32_t staging_clusters = minstd::max(minstd::min((uint32_t)MAX_FAT32_READ_AHEAD_CLUSTERS, (uint32_t)(MAX_FAT32_READ_AHEAD_BYTES / bytes_per_cluster)), (uint32_t)1);
+        const uint32_t staging_buffer_size = staging_clusters * bytes_per_cluster;
+
+        uint8_t *staging_buffer = nullptr;
+
+        FilesystemResultCodes result = FilesystemResultCodes::SUCCESS;
+
+        while (bytes_to_read > 0)
+        {
+            uint32_t offset_into_cluster = offset % bytes_per_cluster;
+            uint32_t clusters_wanted = (offset_into_cluster + bytes_to_read + bytes_per_cluster - 1) / bytes_per_cluster;
+
+            auto extent = extent_map_.ExtentAt(block_io_adapter, offset / bytes_per_cluster, clusters_wanted);
+
+            if (extent.Failed())
+            {
+                result = extent.ResultCode();
+                break;
+            }
+
+            //  The chain should never be shorter than the file
+
+            if (extent->number_of_clusters_ == 0)
+            {
+                result = FilesystemResultCodes::FAT32_CLUSTER_NOT_PRESENT_IN_CHAIN;
+                break;
+            }
+
+            if (staging_buffer == nullptr)
+            {
+                staging_buffer = static_cast<uint8_t *>(__os_dynamic_heap_resource.allocate(staging_buffer_size, BLOCK_IO_BUFFER_ALIGNMENT));
+
+                if (staging_buffer == nullptr)
+                {
+                    result = FilesystemResultCodes::FAT32_UNABLE_TO_ALLOCATE_CLUSTER_BUFFER;
+                    break;
+                }
+            }
+
+            //  Read as much of the physically contiguous run as the staging buffer holds with a single device read, a
+            //      partial cluster at either end of the read is just trimmed off when it is appended.
+
+            uint32_t run_length = minstd::min(minstd::min(extent->number_of_clusters_, clusters_wanted), staging_clusters);
+
+            if (block_io_adapter.ReadClusters(extent->first_cluster_, run_length, staging_buffer) != BlockIOResultCodes::SUCCESS)
+            {
+                result = FilesystemResultCodes::FAT32_DEVICE_READ_ERROR;
+                break;
+            }
+
+            uint32_t bytes_from_run = minstd::min((run_length * bytes_per_cluster) - offset_into_cluster, bytes_to_read);
+
+            buffer.append(staging_buffer + offset_into_cluster, bytes_from_run);
+
+            offset += bytes_from_run;
+            bytes_to_read -= bytes_from_run;
+        }
+
+        if (staging_buffer != nullptr)
+        {
+            __os_dynamic_heap_resource.deallocate(staging_buffer, staging_buffer_size, BLOCK_IO_BUFFER_ALIGNMENT);
+        }
+
+        return result;
+    }
+
+    FilesystemResultCodes FAT32File::WriteAt(uint32_t offset, const minstd::buffer<uint8_t> &buffer)
+    {
+        LogEntryAndExit("Writing at offset %u\n", offset);
+
+        //  Get the filesystem entity
+
+        auto get_filesystem_result = GetOSEntityRegistry().GetEntityById(filesystem_uuid_);
+
+        if (!get_filesystem_result.Successful())
+        {
+            return FilesystemResultCodes::FILESYSTEM_DOES_NOT_EXIST;
+        }
+
+        FAT32Filesystem &filesystem = get_filesystem_result;
+
+        FAT32BlockIOAdapter &block_io_adapter = filesystem.BlockIOAdapter();
+
+        const uint32_t file_size = directory_entry_.Size();
+
+        //  FAT32 files cannot have holes, so a write has to start within the file or right at its end
+
+        if (offset > file_size)
+        {
+            return FilesystemResultCodes::POSITION_PAST_END_OF_FILE;
+        }
+
+        if (buffer.size() <= (file_size - offset))
+        {
+            return WriteWithinFile(block_io_adapter, offset, buffer.data(), buffer.size());
+        }
+
+        return WriteBeyondEndOfFile(block_io_adapter, offset, buffer.data(), buffer.size());
+    }
+
+    FilesystemResultCodes FAT32File::WriteBeyondEndOfFile(FAT32BlockIOAdapter &block_io_adapter, uint32_t offset, const uint8_t *data, uint32_t length)
+    {
+        using Result = FilesystemResultCodes;
+
+        const uint32_t bytes_per_cluster = block_io_adapter.BytesPerCluster();
+        const uint32_t new_size = offset + length;
+
+        //  Make sure the chain covers the new end of the file, then write the data as if it were already in the file.  The
+        //      size only grows once the data is on the device, so a failed write does not expose stale cluster contents.
+
+        ReturnOnCallFailure(ExtendChain(block_io_adapter, (new_size + bytes_per_cluster - 1) / bytes_per_cluster));
+
+        ReturnOnCallFailure(WriteWithinFile(block_io_adapter, offset, data, length));
+
+        directory_entry_.UpdateSize(new_size);
+        directory_entry_dirty_ = true;
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+
+    FilesystemResultCodes FAT32File::WriteWithinFile(FAT32BlockIOAdapter &block_io_adapter, uint32_t offset, const uint8_t *data, uint32_t length)
+    {
+        const uint32_t bytes_per_cluster = block_io_adapter.BytesPerCluster();
+        const uint32_t file_size = directory_entry_.Size();
+
+        //  Prefetched clusters may be overwritten, so drop them
+
+        read_ahead_cluster_count_ = 0;
+
+        uint32_t offset_into_buffer = 0;
+
+        uint8_t *bounce_buffer = nullptr;
+
+        FilesystemResultCodes result = FilesystemResultCodes::SUCCESS;
+
+        while (offset_into_buffer < length)
+        {
+            uint32_t bytes_left_to_write = length - offset_into_buffer;
+            uint32_t offset_into_cluster = offset % bytes_per_cluster;
+            uint32_t clusters_wanted = (offset_into_cluster + bytes_left_to_write + bytes_per_cluster - 1) / bytes_per_cluster;
+
+            auto extent = extent_map_.ExtentAt(block_io_adapter, offset / bytes_per_cluster, clusters_wanted);
+
+            if (extent.Failed())
+            {
+                result = extent.ResultCode();
+                break;
+            }
+
+            if (extent->number_of_clusters_ == 0)
+            {
+                result = FilesystemResultCodes::FAT32_CLUSTER_NOT_PRESENT_IN_CHAIN;
+                break;
+            }
+
+            //  Whole clusters are written straight from the caller's buffer, a physically contiguous run with a single device write
+
+            if ((offset_into_cluster == 0) && (bytes_left_to_write >= bytes_per_cluster))
+            {
+                uint32_t run_length = minstd::min(extent->number_of_clusters_, bytes_left_to_write / bytes_per_cluster);
+                uint32_t run_bytes = run_length * bytes_per_cluster;
+
+                if (block_io_adapter.WriteClusters(extent->first_cluster_, run_length, (uint8_t *)data + offset_into_buffer) != BlockIOResultCodes::SUCCESS)
+                {
+                    result = FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR;
+                    break;
+                }
+
+                offset += run_bytes;
+                offset_into_buffer += run_bytes;
+
+                continue;
+            }
+
+            //  A partial cluster is assembled in the bounce buffer.  The cluster only has to be read first if it holds file
+            //      data on either side of the bytes being written.
+
+            if (bounce_buffer == nullptr)
+            {
+                bounce_buffer = static_cast<uint8_t *>(__os_dynamic_heap_resource.allocate(bytes_per_cluster, BLOCK_IO_BUFFER_ALIGNMENT));
+
+                if (bounce_buffer == nullptr)
+                {
+                    result = FilesystemResultCodes::FAT32_UNABLE_TO_ALLOCATE_CLUSTER_BUFFER;
+                    break;
+                }
+            }
+
+            uint32_t start_of_cluster = offset - offset_into_cluster;
+            uint32_t bytes_to_copy = minstd::min(bytes_per_cluster - offset_into_cluster, bytes_left_to_write);
+            uint32_t file_bytes_in_cluster = minstd::min(file_size - minstd::min(start_of_cluster, file_size), bytes_per_cluster);
+
+            if ((offset_into_cluster > 0) || (bytes_to_copy < file_bytes_in_cluster))
+            {
+                if (block_io_adapter.ReadCluster(extent->first_cluster_, bounce_buffer) != BlockIOResultCodes::SUCCESS)
+                {
+                    result = FilesystemResultCodes::FAT32_DEVICE_READ_ERROR;
+                    break;
+                }
+            }
+
+            memcpy(bounce_buffer + offset_into_cluster, data + offset_into_buffer, bytes_to_copy);
+
+            if (block_io_adapter.WriteCluster(extent->first_cluster_, bounce_buffer) != BlockIOResultCodes::SUCCESS)
+            {
+                result = FilesystemResultCodes::FAT32_DEVICE_WRITE_ERROR;
+                break;
+            }
+
+            offset += bytes_to_copy;
+            offset_into_buffer += bytes_to_copy;
+        }
+
+        if (bounce_buffer != nullptr)
+        {
+            __os_dynamic_heap_resource.deallocate(bounce_buffer, bytes_per_cluster, BLOCK_IO_BUFFER_ALIGNMENT);
+        }
+
+        return result;
+    }
+
+    FilesystemResultCodes FAT32File::Preallocate(uint32_t bytes)
+    {
+        LogEntryAndExit("Preallocating %u bytes\n", bytes);
+
+        //  Get the filesystem entity
+
+        auto get_filesystem_result = GetOSEntityRegistry().GetEntityById(filesystem_uuid_);
+
+        if (!get_filesystem_result.Successful())
+        {
+            return FilesystemResultCodes::FILESYSTEM_DOES_NOT_EXIST;
+        }
+
+        FAT32Filesystem &filesystem = get_filesystem_result;
+
+        FAT32BlockIOAdapter &block_io_adapter = filesystem.BlockIOAdapter();
+
+        const uint32_t bytes_per_cluster = block_io_adapter.BytesPerCluster();
+
+        //  The clusters stay in the chain beyond the end of the file, Write() moves into them as the file grows
+
+        return ExtendChain(block_io_adapter, (static_cast<uint64_t>(bytes) + bytes_per_cluster - 1) / bytes_per_cluster);
+    }
+
+    FilesystemResultCodes FAT32File::ExtendChain(FAT32BlockIOAdapter &block_io_adapter, uint32_t clusters_needed)
+    {
+        using Result = FilesystemResultCodes;
+
+        if (clusters_needed == 0)
+        {
+            return FilesystemResultCodes::SUCCESS;
+        }
+
+        //  The extent map tells whether the chain is already long enough and, if not, where it ends
+
+        FAT32ClusterIndex last_cluster = FAT32EntryFree;
+        uint32_t clusters_in_chain = 0;
+
+        if (first_cluster_ != FAT32EntryFree)
+        {
+            auto extent = extent_map_.ExtentAt(block_io_adapter, clusters_needed - 1);
+
+            ReturnOnFailure(extent);
+
+            if (extent->number_of_clusters_ > 0)
+            {
+                return FilesystemResultCodes::SUCCESS;
+            }
+
+            clusters_in_chain = extent_map_.ClustersMapped();
+
+            auto chain_end = extent_map_.ClusterAt(block_io_adapter, clusters_in_chain - 1);
+
+            ReturnOnFailure(chain_end);
+
+            last_cluster = *chain_end;
+        }
+
+        //  Extend the chain with as few extents as free space allows
+
+        while (clusters_in_chain < clusters_needed)
+        {
+            auto extent = block_io_adapter.AllocateExtent(last_cluster, clusters_needed - clusters_in_chain);
+
+            ReturnOnFailure(extent);
+
+            //  An empty file gets its first cluster here, it is recorded in the directory entry when the file is flushed.
+            //      The file position stays at zero, now at the start of the new first cluster.
+
+            if (last_cluster == FAT32EntryFree)
+            {
+                first_cluster_ = extent->first_cluster_;
+                directory_entry_dirty_ = true;
+                current_cluster_ = extent->first_cluster_;
+
+                extent_map_.Reset(first_cluster_);
+            }
+
+            last_cluster = extent->first_cluster_ + (extent->number_of_clusters_ - 1);
+            clusters_in_chain += extent->number_of_clusters_;
+        }
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+
+    PointerResult<FilesystemResultCodes, FileMapping> FAT32File::Map(uint32_t offset, uint32_t length, FileModes mode)
+    {
+        using Result = PointerResult<FilesystemResultCodes, FileMapping>;
+
+        LogEntryAndExit("Mapping %u bytes at offset %u\n", length, offset);
+
+        //  Get the filesystem entity
+
+        auto get_filesystem_result = GetOSEntityRegistry().GetEntityById(filesystem_uuid_);
+
+        if (!get_filesystem_result.Successful())
+        {
+            return Result::Failure(FilesystemResultCodes::FILESYSTEM_DOES_NOT_EXIST);
+        }
+
+        FAT32Filesystem &filesystem = get_filesystem_result;
+
+        //  The range has to lie within the file, a mapping never changes the size of the file
+
+        if ((length == 0) || (offset > directory_entry_.Size()) || (length > (directory_entry_.Size() - offset)))
+        {
+            return Result::Failure(FilesystemResultCodes::MAPPING_OUT_OF_RANGE);
+        }
+
+        //  Cluster sizes are powers of two, so taking the larger of a page and a cluster gives pages which hold whole clusters
+
+        uint32_t page_size = minstd::max((uint32_t)FileMapping::PAGE_SIZE, filesystem.BlockIOAdapter().BytesPerCluster());
+
+        minstd::unique_ptr<FileMapping> mapping(static_cast<FileMapping *>(make_dynamic_unique<FAT32FileMapping>(file_uuid_, offset, length, mode, page_size).release()), __os_dynamic_heap_resource);
+
+        return Result::Success(minstd::move(mapping));
+    }
+
+    FilesystemResultCodes FAT32File::ReadPage(uint32_t page_offset, uint8_t *page, uint32_t page_size)
+    {
+        using Result = FilesystemResultCodes;
+
+        //  Get the filesystem entity
+
+        auto get_filesystem_result = GetOSEntityRegistry().GetEntityById(filesystem_uuid_);
+
+        if (!get_filesystem_result.Successful())
+        {
+            return FilesystemResultCodes::FILESYSTEM_DOES_NOT_EXIST;
+        }
+
+        FAT32Filesystem &filesystem = get_filesystem_result;
+
+        FAT32BlockIOAdapter &block_io_adapter = filesystem.BlockIOAdapter();
+
+        const uint32_t bytes_per_cluster = block_io_adapter.BytesPerCluster();
+        const uint32_t first_cluster_in_page = page_offset / bytes_per_cluster;
+        const uint32_t clusters_in_page = page_size / bytes_per_cluster;
+
+        //  Read each run of contiguous clusters in the page with a single device read straight into the page
+
+        uint32_t clusters_read = 0;
+
+        while (clusters_read < clusters_in_page)
+        {
+            auto extent = extent_map_.ExtentAt(block_io_adapter, first_cluster_in_page + clusters_read, clusters_in_page - clusters_read);
+
+            ReturnOnFailure(extent);
+
+            if (extent->number_of_clusters_ == 0)
+            {
+                break;
+            }
+
+            uint32_t run_length = minstd::min(extent->number_of_clusters_, clusters_in_page - clusters_read);
+
+            if (block_io_adapter.ReadClusters(extent->first_cluster_, run_length, page + (clusters_read * bytes_per_cluster)) != BlockIOResultCodes::SUCCESS)
+            {
+                return FilesystemResultCodes::FAT32_DEVICE_READ_ERROR;
+            }
+
+            clusters_read += run_length;
+        }
+
+        memset(page + (clusters_read * bytes_per_cluster), 0, (clusters_in_page - clusters_read) * bytes_per_cluster);
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+
+    FilesystemResultCodes FAT32File::WritePageRange(uint32_t offset, const uint8_t *data, uint32_t length)
+    {
+        //  Get the filesystem entity
+
+        auto get_filesystem_result = GetOSEntityRegistry().GetEntityById(filesystem_uuid_);
+
+        if (!get_filesystem_result.Successful())
+        {
+            return FilesystemResultCodes::FILESYSTEM_DOES_NOT_EXIST;
+        }
+
+        FAT32Filesystem &filesystem = get_filesystem_result;
+
+        //  A mapping never changes the size of the file
+
+        if ((offset > directory_entry_.Size()) || (length > (directory_entry_.Size() - offset)))
+        {
+            return FilesystemResultCodes::MAPPING_OUT_OF_RANGE;
+        }
+
+        return WriteWithinFile(filesystem.BlockIOAdapter(), offset, data, length);
+    }
+
+    FilesystemResultCodes FAT32File::Flush()
+    {
+        LogEntryAndExit("Entering with file name: %s\n", Filename()->c_str());
+
+        if (!directory_entry_dirty_)
+        {
+            return FilesystemResultCodes::SUCCESS;
+        }
+
+        //  Get the filesystem entity
+
+        auto get_filesystem_result = GetOSEntityRegistry().GetEntityById(filesystem_uuid_);
+
+        if (!get_filesystem_result.Successful())
+        {
+            return FilesystemResultCodes::FILESYSTEM_DOES_NOT_EXIST;
+        }
+
+        FAT32Filesystem &filesystem = get_filesystem_result;
+
+        //  Write the first cluster and size to the directory entry on the disk with a single cluster read and write
+
+        auto update_directory_entry_result = FAT32Directory::UpdateDirectoryEntry(filesystem.BlockIOAdapter(), directory_entry_address_, first_cluster_, directory_entry_.Size());
+
+        if (update_directory_entry_result != FilesystemResultCodes::SUCCESS)
+        {
+            LogDebug1("Failed to update directory entry when flushing file\n");
+
+            return update_directory_entry_result;
+        }
+
+        directory_entry_dirty_ = false;
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+
     FilesystemResultCodes FAT32File::Close()
     {
         LogEntryAndExit("Entering with file name: %s\n", Filename()->c_str());
 
-        //  Remove the file from the file map
+        //  Write back the directory entry before the file goes away.  The file is removed from the file map even if that
+        //      fails, as there is no way to retry once the caller has closed the file.
+
+        FilesystemResultCodes flush_result = Flush();
+
+        //  Remove the file from the file map, this destroys the file
+
+        FilesystemResultCodes remove_result = GetFileMap().RemoveFile(*this);
 
-        return GetFileMap().RemoveFile(*this);
+        return Failed(flush_result) ? flush_result : remove_result;
     }
 } // namespace filesystems::fat32
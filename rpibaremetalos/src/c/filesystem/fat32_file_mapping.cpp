@@ -0,0 +1,250 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "filesystem/fat32_file_mapping.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "heaps.h"
+
+#include "filesystem/file_map.h"
+
+#include "filesystem/fat32_file.h"
+
+namespace filesystems::fat32
+{
+    FAT32FileMapping::FAT32FileMapping(const UUID &file_uuid,
+                                       uint32_t offset,
+                                       uint32_t length,
+                                       FileModes mode,
+                                       uint32_t page_size)
+        : file_uuid_(file_uuid),
+          offset_(offset),
+          length_(length),
+          mode_(mode),
+          page_size_(page_size),
+          first_page_offset_(offset - (offset % page_size)),
+          number_of_pages_((((offset % page_size) + length) + page_size - 1) / page_size)
+    {
+        //  If the page table cannot be allocated, every access to the mapping fails
+
+        pages_ = static_cast<Page *>(__os_dynamic_heap_resource.allocate(number_of_pages_ * sizeof(Page), alignof(Page)));
+
+        if (pages_ != nullptr)
+        {
+            memset(pages_, 0, number_of_pages_ * sizeof(Page));
+        }
+    }
+
+    FAT32FileMapping::~FAT32FileMapping()
+    {
+        //  Unmap() normally writes back dirty pages, this catches mappings destroyed without being unmapped
+
+        if (!unmapped_ && Failed(Unmap()))
+        {
+            LogError("Unable to write back dirty pages of mapping\n");
+        }
+    }
+
+    uint32_t FAT32FileMapping::PagesPresent() const noexcept
+    {
+        if (pages_ == nullptr)
+        {
+            return 0;
+        }
+
+        uint32_t pages_present = 0;
+
+        for (uint32_t i = 0; i < number_of_pages_; i++)
+        {
+            if (pages_[i].data_ != nullptr)
+            {
+                pages_present++;
+            }
+        }
+
+        return pages_present;
+    }
+
+    ValueResult<FilesystemResultCodes, const uint8_t *> FAT32FileMapping::Access(uint32_t offset, uint32_t length)
+    {
+        using Result = ValueResult<FilesystemResultCodes, const uint8_t *>;
+
+        auto page_data = FaultIn(offset, length, false);
+
+        ReturnOnFailure(page_data);
+
+        return Result::Success(*page_data);
+    }
+
+    ValueResult<FilesystemResultCodes, uint8_t *> FAT32FileMapping::AccessForWrite(uint32_t offset, uint32_t length)
+    {
+        using Result = ValueResult<FilesystemResultCodes, uint8_t *>;
+
+        if (!HasFileMode(mode_, FileModes::WRITE))
+        {
+            return Result::Failure(FilesystemResultCodes::MAPPING_NOT_OPENED_FOR_WRITE);
+        }
+
+        return FaultIn(offset, length, true);
+    }
+
+    ValueResult<FilesystemResultCodes, uint8_t *> FAT32FileMapping::FaultIn(uint32_t offset, uint32_t length, bool for_write)
+    {
+        using Result = ValueResult<FilesystemResultCodes, uint8_t *>;
+
+        if (unmapped_)
+        {
+            return Result::Failure(FilesystemResultCodes::FILE_IS_CLOSED);
+        }
+
+        if (pages_ == nullptr)
+        {
+            return Result::Failure(FilesystemResultCodes::MAPPING_UNABLE_TO_ALLOCATE_PAGE);
+        }
+
+        if ((length == 0) || (offset > length_) || (length > (length_ - offset)))
+        {
+            return Result::Failure(FilesystemResultCodes::MAPPING_OUT_OF_RANGE);
+        }
+
+        //  Offsets into the mapping are relative to the offset requested, which need not be on a page boundary
+
+        uint32_t offset_into_pages = (offset_ - first_page_offset_) + offset;
+
+        uint32_t page_number = offset_into_pages / page_size_;
+        uint32_t offset_into_page = offset_into_pages % page_size_;
+
+        if (length > (page_size_ - offset_into_page))
+        {
+            return Result::Failure(FilesystemResultCodes::MAPPING_RANGE_SPANS_PAGES);
+        }
+
+        Page &page = pages_[page_number];
+
+        //  Allocate and read in the page the first time it is touched.  Pages about to be written are read as well, as
+        //      the caller may only change part of them.
+
+        if (page.data_ == nullptr)
+        {
+            auto file = GetFileMap().GetFileByUUID(file_uuid_);
+
+            ReturnOnFailure(file);
+
+            FAT32File &fat32_file = file;
+
+            uint8_t *data = static_cast<uint8_t *>(__os_dynamic_heap_resource.allocate(page_size_, BLOCK_IO_BUFFER_ALIGNMENT));
+
+            if (data == nullptr)
+            {
+                return Result::Failure(FilesystemResultCodes::MAPPING_UNABLE_TO_ALLOCATE_PAGE);
+            }
+
+            FilesystemResultCodes read_result = fat32_file.ReadPage(first_page_offset_ + (page_number * page_size_), data, page_size_);
+
+            if (Failed(read_result))
+            {
+                __os_dynamic_heap_resource.deallocate(data, page_size_, BLOCK_IO_BUFFER_ALIGNMENT);
+                return Result::Failure(read_result);
+            }
+
+            page.data_ = data;
+        }
+
+        //  Grow the dirty span of the page to cover the range
+
+        if (for_write)
+        {
+            if (page.dirty_start_ == page.dirty_end_)
+            {
+                page.dirty_start_ = offset_into_page;
+                page.dirty_end_ = offset_into_page + length;
+            }
+            else
+            {
+                page.dirty_start_ = minstd::min(page.dirty_start_, offset_into_page);
+                page.dirty_end_ = minstd::max(page.dirty_end_, offset_into_page + length);
+            }
+        }
+
+        return Result::Success(page.data_ + offset_into_page);
+    }
+
+    FilesystemResultCodes FAT32FileMapping::Flush()
+    {
+        using Result = FilesystemResultCodes;
+
+        if (unmapped_)
+        {
+            return FilesystemResultCodes::FILE_IS_CLOSED;
+        }
+
+        if (pages_ == nullptr)
+        {
+            return FilesystemResultCodes::SUCCESS;
+        }
+
+        for (uint32_t page_number = 0; page_number < number_of_pages_; page_number++)
+        {
+            Page &page = pages_[page_number];
+
+            if (page.dirty_start_ == page.dirty_end_)
+            {
+                continue;
+            }
+
+            auto file = GetFileMap().GetFileByUUID(file_uuid_);
+
+            ReturnOnFailure(file);
+
+            FAT32File &fat32_file = file;
+
+            ReturnOnCallFailure(fat32_file.WritePageRange(first_page_offset_ + (page_number * page_size_) + page.dirty_start_,
+                                                          page.data_ + page.dirty_start_,
+                                                          page.dirty_end_ - page.dirty_start_));
+
+            page.dirty_start_ = 0;
+            page.dirty_end_ = 0;
+        }
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+
+    FilesystemResultCodes FAT32FileMapping::Unmap()
+    {
+        if (unmapped_)
+        {
+            return FilesystemResultCodes::FILE_IS_CLOSED;
+        }
+
+        //  The memory is released even if the write back fails, there is no way to retry once the caller has unmapped
+
+        FilesystemResultCodes flush_result = Flush();
+
+        Release();
+
+        return flush_result;
+    }
+
+    void FAT32FileMapping::Release()
+    {
+        if (pages_ != nullptr)
+        {
+            for (uint32_t i = 0; i < number_of_pages_; i++)
+            {
+                if (pages_[i].data_ != nullptr)
+                {
+                    __os_dynamic_heap_resource.deallocate(pages_[i].data_, page_size_, BLOCK_IO_BUFFER_ALIGNMENT);
+                }
+            }
+
+            __os_dynamic_heap_resource.deallocate(pages_, number_of_pages_ * sizeof(Page), alignof(Page));
+        }
+
+        pages_ = nullptr;
+        unmapped_ = true;
+    }
+} // namespace filesystems::fat32
@@ -18,7 +18,10 @@ namespace filesystems::fat32
                                                                                  const char *alias,
                                                                                  bool boot,
                                                                                  BlockIODevice &io_device,
-                                                                                 const MassStoragePartition &partition)
+                                                                                 const MassStoragePartition &partition,
+                                                                                 bool discard_freed_clusters,
+                                                                                 uint32_t fat_cache_size_in_sectors,
+                                                                                 bool free_cluster_bitmap)
     {
         using Result = PointerResult<FilesystemResultCodes, FAT32Filesystem>;
 
@@ -34,7 +37,7 @@ namespace filesystems::fat32
 
         //  Mount the block IO adapter
 
-        auto adapter = FAT32BlockIOAdapter::Mount(io_device, ((FAT32PartitionOpaqueData *)(partition.GetOpaqueDataBlock()))->first_sector_);
+        auto adapter = FAT32BlockIOAdapter::Mount(io_device, ((FAT32PartitionOpaqueData *)(partition.GetOpaqueDataBlock()))->first_sector_, discard_freed_clusters, fat_cache_size_in_sectors);
 
         ReturnOnFailure(adapter);
 
@@ -51,9 +54,52 @@ namespace filesystems::fat32
             new_filesystem = make_dynamic_unique<FAT32Filesystem>(permanent, name, alias, boot, *adapter, partition.Name());
         }
 
+        //  Allocate the FAT cache and build the free cluster bitmap in the adapter owned by the filesystem, copies of the
+        //      adapter do not carry them
+
+        ReturnOnCallFailure(new_filesystem->BlockIOAdapter().AllocateFATCache());
+
+        if (free_cluster_bitmap)
+        {
+            ReturnOnCallFailure(new_filesystem->BlockIOAdapter().LoadFreeClusterBitmap());
+        }
+
         return Result::Success(minstd::move(new_filesystem));
     }
 
+    FAT32Filesystem::~FAT32Filesystem()
+    {
+        //  Write back anything still held in memory, including the FSInfo free cluster count
+
+        if (Failed(block_io_adapter_.Flush()))
+        {
+            LogError("Unable to flush FAT32 filesystem: %s\n", Name().c_str());
+        }
+    }
+
+    FilesystemResultCodes FAT32Filesystem::Format(BlockIODevice &io_device,
+                                                  uint32_t number_of_blocks,
+                                                  const char *volume_label)
+    {
+        LogEntryAndExit("Entering\n");
+
+        if (number_of_blocks <= FAT32_FORMAT_PARTITION_FIRST_SECTOR)
+        {
+            return FilesystemResultCodes::FAT32_VOLUME_TOO_SMALL_TO_FORMAT;
+        }
+
+        const uint32_t partition_sectors = number_of_blocks - FAT32_FORMAT_PARTITION_FIRST_SECTOR;
+
+        FilesystemResultCodes result = WriteMasterBootRecord(io_device, FAT32_FORMAT_PARTITION_FIRST_SECTOR, partition_sectors);
+
+        if (Failed(result))
+        {
+            return result;
+        }
+
+        return FAT32BlockIOAdapter::Format(io_device, FAT32_FORMAT_PARTITION_FIRST_SECTOR, partition_sectors, volume_label);
+    }
+
     PointerResult<FilesystemResultCodes, FilesystemDirectory> FAT32Filesystem::GetRootDirectory()
     {
         using Result = PointerResult<FilesystemResultCodes, FilesystemDirectory>;
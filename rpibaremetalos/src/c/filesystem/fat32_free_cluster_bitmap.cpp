@@ -0,0 +1,227 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "filesystem/fat32_free_cluster_bitmap.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "heaps.h"
+
+namespace filesystems::fat32
+{
+    FAT32FreeClusterBitmap::FAT32FreeClusterBitmap(uint32_t maximum_cluster_number)
+        : number_of_clusters_(maximum_cluster_number + 1),
+          number_of_words_((number_of_clusters_ + BITS_PER_WORD - 1) / BITS_PER_WORD),
+          number_of_summary_words_((number_of_words_ + BITS_PER_WORD - 1) / BITS_PER_WORD)
+    {
+    }
+
+    FAT32FreeClusterBitmap::FAT32FreeClusterBitmap(const FAT32FreeClusterBitmap &bitmap_to_copy)
+        : number_of_clusters_(bitmap_to_copy.number_of_clusters_),
+          number_of_words_(bitmap_to_copy.number_of_words_),
+          number_of_summary_words_(bitmap_to_copy.number_of_summary_words_)
+    {
+    }
+
+    FAT32FreeClusterBitmap::~FAT32FreeClusterBitmap()
+    {
+        Release();
+    }
+
+    FilesystemResultCodes FAT32FreeClusterBitmap::Initialize()
+    {
+        Release();
+
+        LockGuard lock(bitmap_lock_);
+
+        uint64_t *clusters = static_cast<uint64_t *>(__os_filesystem_cache_heap_resource.allocate(sizeof(uint64_t) * number_of_words_, alignof(uint64_t)));
+        uint64_t *summary = static_cast<uint64_t *>(__os_filesystem_cache_heap_resource.allocate(sizeof(uint64_t) * number_of_summary_words_, alignof(uint64_t)));
+
+        //  Both buffers or neither, the rest of the bitmap takes a null clusters_ to mean it is not initialized
+
+        if ((clusters == nullptr) || (summary == nullptr))
+        {
+            if (clusters != nullptr)
+            {
+                __os_filesystem_cache_heap_resource.deallocate(clusters, sizeof(uint64_t) * number_of_words_, alignof(uint64_t));
+            }
+
+            if (summary != nullptr)
+            {
+                __os_filesystem_cache_heap_resource.deallocate(summary, sizeof(uint64_t) * number_of_summary_words_, alignof(uint64_t));
+            }
+
+            return FilesystemResultCodes::FAT32_UNABLE_TO_ALLOCATE_FREE_CLUSTER_BITMAP;
+        }
+
+        memset(clusters, 0, sizeof(uint64_t) * number_of_words_);
+        memset(summary, 0, sizeof(uint64_t) * number_of_summary_words_);
+
+        clusters_ = clusters;
+        summary_ = summary;
+        free_clusters_ = 0;
+
+        return FilesystemResultCodes::SUCCESS;
+    }
+
+    void FAT32FreeClusterBitmap::MarkFree(uint32_t cluster)
+    {
+        if (clusters_ == nullptr)
+        {
+            return;
+        }
+
+        LockGuard lock(bitmap_lock_);
+
+        uint32_t word = cluster / BITS_PER_WORD;
+        uint64_t bit = 1ULL << (cluster % BITS_PER_WORD);
+
+        if ((clusters_[word] & bit) != 0)
+        {
+            return;
+        }
+
+        clusters_[word] |= bit;
+        summary_[word / BITS_PER_WORD] |= 1ULL << (word % BITS_PER_WORD);
+
+        free_clusters_++;
+    }
+
+    void FAT32FreeClusterBitmap::MarkAllocated(uint32_t cluster)
+    {
+        if (clusters_ == nullptr)
+        {
+            return;
+        }
+
+        LockGuard lock(bitmap_lock_);
+
+        uint32_t word = cluster / BITS_PER_WORD;
+        uint64_t bit = 1ULL << (cluster % BITS_PER_WORD);
+
+        if ((clusters_[word] & bit) == 0)
+        {
+            return;
+        }
+
+        clusters_[word] &= ~bit;
+
+        //  The summary bit only tracks words with at least one free cluster
+
+        if (clusters_[word] == 0)
+        {
+            summary_[word / BITS_PER_WORD] &= ~(1ULL << (word % BITS_PER_WORD));
+        }
+
+        free_clusters_--;
+    }
+
+    uint32_t FAT32FreeClusterBitmap::FindFree(uint32_t first_cluster, uint32_t end_cluster) const
+    {
+        end_cluster = minstd::min(end_cluster, number_of_clusters_);
+
+        if ((clusters_ == nullptr) || (first_cluster >= end_cluster))
+        {
+            return NO_FREE_CLUSTER;
+        }
+
+        LockGuard lock(bitmap_lock_);
+
+        //  Check the rest of the word holding the first cluster
+
+        uint32_t word = first_cluster / BITS_PER_WORD;
+        uint64_t free_bits = clusters_[word] & (~0ULL << (first_cluster % BITS_PER_WORD));
+
+        if (free_bits == 0)
+        {
+            //  Use the summary to skip over words with no free clusters
+
+            word++;
+
+            if (word >= number_of_words_)
+            {
+                return NO_FREE_CLUSTER;
+            }
+
+            uint32_t summary_word = word / BITS_PER_WORD;
+            uint64_t summary_bits = summary_[summary_word] & (~0ULL << (word % BITS_PER_WORD));
+
+            while (summary_bits == 0)
+            {
+                summary_word++;
+
+                if ((summary_word >= number_of_summary_words_) || ((summary_word * BITS_PER_WORD * BITS_PER_WORD) >= end_cluster))
+                {
+                    return NO_FREE_CLUSTER;
+                }
+
+                summary_bits = summary_[summary_word];
+            }
+
+            word = (summary_word * BITS_PER_WORD) + __builtin_ctzll(summary_bits);
+            free_bits = clusters_[word];
+        }
+
+        uint32_t cluster = (word * BITS_PER_WORD) + __builtin_ctzll(free_bits);
+
+        return cluster < end_cluster ? cluster : NO_FREE_CLUSTER;
+    }
+
+    uint32_t FAT32FreeClusterBitmap::FreeRunLength(uint32_t first_cluster, uint32_t end_cluster, uint32_t maximum_length) const
+    {
+        end_cluster = minstd::min(end_cluster, number_of_clusters_);
+
+        if ((clusters_ == nullptr) || (first_cluster >= end_cluster))
+        {
+            return 0;
+        }
+
+        maximum_length = minstd::min(maximum_length, end_cluster - first_cluster);
+
+        LockGuard lock(bitmap_lock_);
+
+        //  Count the free bits a word at a time, the run ends at the first clear bit
+
+        uint32_t length = 0;
+        uint32_t cluster = first_cluster;
+
+        while (length < maximum_length)
+        {
+            uint32_t bit = cluster % BITS_PER_WORD;
+            uint64_t allocated_bits = ~(clusters_[cluster / BITS_PER_WORD] >> bit);
+            uint32_t free_in_word = allocated_bits == 0 ? BITS_PER_WORD : __builtin_ctzll(allocated_bits);
+
+            free_in_word = minstd::min(free_in_word, BITS_PER_WORD - bit);
+
+            length += free_in_word;
+            cluster += free_in_word;
+
+            if (free_in_word < (BITS_PER_WORD - bit))
+            {
+                break;
+            }
+        }
+
+        return minstd::min(length, maximum_length);
+    }
+
+    void FAT32FreeClusterBitmap::Release()
+    {
+        if (clusters_ == nullptr)
+        {
+            return;
+        }
+
+        LockGuard lock(bitmap_lock_);
+
+        __os_filesystem_cache_heap_resource.deallocate(clusters_, sizeof(uint64_t) * number_of_words_, alignof(uint64_t));
+        __os_filesystem_cache_heap_resource.deallocate(summary_, sizeof(uint64_t) * number_of_summary_words_, alignof(uint64_t));
+
+        clusters_ = nullptr;
+        summary_ = nullptr;
+        free_clusters_ = 0;
+    }
+} // namespace filesystems::fat32
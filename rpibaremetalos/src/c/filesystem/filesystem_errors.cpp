@@ -7,7 +7,7 @@
 namespace filesystems
 {
 
-    static_assert((uint32_t)FilesystemResultCodes::__END_OF_FILESYSTEM_RESULT_CODES__ == 40);
+    static_assert((uint32_t)FilesystemResultCodes::__END_OF_FILESYSTEM_RESULT_CODES__ == 46);
 
     const char *ErrorMessage(FilesystemResultCodes code)
     {
@@ -31,6 +31,9 @@ namespace filesystems
         case FilesystemResultCodes::UNRECOGNIZED_FILESYSTEM_TYPE:
             return "Unrecognized Filesystem Type";
 
+        case FilesystemResultCodes::UNABLE_TO_WRITE_MASTER_BOOT_RECORD:
+            return "Unable to write Master Boot Record";
+
         case FilesystemResultCodes::FILESYSTEM_DOES_NOT_EXIST:
             return "Filesystem Does Not Exist";
 
@@ -85,6 +88,21 @@ namespace filesystems
         case FilesystemResultCodes::FILE_IS_CLOSED:
             return "File is closed";
 
+        case FilesystemResultCodes::MAPPING_OUT_OF_RANGE:
+            return "Mapping out of range";
+
+        case FilesystemResultCodes::MAPPING_NOT_OPENED_FOR_WRITE:
+            return "Mapping not opened for Write";
+
+        case FilesystemResultCodes::MAPPING_RANGE_SPANS_PAGES:
+            return "Mapping range spans pages";
+
+        case FilesystemResultCodes::MAPPING_UNABLE_TO_ALLOCATE_PAGE:
+            return "Unable to allocate mapping page";
+
+        case FilesystemResultCodes::POSITION_PAST_END_OF_FILE:
+            return "Position past end of file";
+
         case FilesystemResultCodes::FAT32_NOT_A_FAT32_FILESYSTEM:
             return "FAT32: Not a FAT32 filesystem";
 
@@ -133,6 +151,24 @@ namespace filesystems
         case FilesystemResultCodes::FAT32_CLUSTER_NOT_PRESENT_IN_CHAIN:
             return "FAT32: Cluster not present in chain";
 
+        case FilesystemResultCodes::FAT32_UNABLE_TO_FORMAT_DEVICE:
+            return "FAT32: Unable to format device";
+
+        case FilesystemResultCodes::FAT32_VOLUME_TOO_SMALL_TO_FORMAT:
+            return "FAT32: Volume too small to format";
+
+        case FilesystemResultCodes::FAT32_UNABLE_TO_ALLOCATE_FAT_CACHE:
+            return "FAT32: Unable to allocate FAT cache";
+
+        case FilesystemResultCodes::FAT32_UNABLE_TO_ALLOCATE_CLUSTER_BUFFER:
+            return "FAT32: Unable to allocate cluster buffer";
+
+        case FilesystemResultCodes::FAT32_UNABLE_TO_ALLOCATE_FREE_CLUSTER_BITMAP:
+            return "FAT32: Unable to allocate free cluster bitmap";
+
+        case FilesystemResultCodes::FAT32_UNABLE_TO_ALLOCATE_EXTENT_MAP:
+            return "FAT32: Unable to allocate extent map";
+
         default:
             return "Missing message";
         }
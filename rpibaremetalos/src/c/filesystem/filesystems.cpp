@@ -6,6 +6,12 @@
 #include "filesystem/fat32_filesystem.h"
 
 #include "devices/emmc.h"
+#include "devices/block_io_service.h"
+#include "devices/cached_block_io.h"
+#include "devices/ram_disk.h"
+
+#include "heaps.h"
+#include "task/tasks.h"
 
 #include "devices/log.h"
 
@@ -32,6 +38,37 @@ namespace filesystems
             return SimpleSuccessOrFailure::FAILURE;
         }
 
+        //  The SD card controller cannot be driven from more than one core at a time, so all IO to the card
+        //      is handed to a service task pinned to a single core.  Tasks on any core queue requests for it.
+
+        auto sd_card_service_entity = make_static_unique<BlockIOServiceDevice>(true, "SD CARD SERVICE", "SD CARD SERVICE", sd_card);
+
+        BlockIOServiceDevice &sd_card_service = *sd_card_service_entity;
+
+        GetOSEntityRegistry().AddEntity(sd_card_service_entity);
+
+        if (task::GetTaskManager().ForkKernelTask(static_new<BlockIOServiceTask>(sd_card_service),
+                                                  task::TaskDefinition{"SD Card IO Service", 1, DEFAULT_TASK_STACK_SIZE_IN_BYTES, ((uint32_t)0x01 << DEFAULT_BLOCK_IO_SERVICE_CORE)})
+                .Failed())
+        {
+            LogError("Unable to start the SD Card IO service task, tasks submitting IO will drive the card themselves\n");
+        }
+
+        //  Place a write-back cache in front of the SD card, all filesystem IO goes through the cache.
+        //      The cache is registered with the OS so it can be located by name, and a background task
+        //      periodically writes dirty blocks back to the card.
+
+        auto sd_card_cache_entity = make_static_unique<CachedBlockIODevice>(true, "SD CARD CACHE", "SD CARD CACHE", sd_card_service, __os_filesystem_cache_heap_resource);
+
+        CachedBlockIODevice &sd_card_cache = *sd_card_cache_entity;
+
+        GetOSEntityRegistry().AddEntity(sd_card_cache_entity);
+
+        if (task::GetTaskManager().ForkKernelTask(static_new<CachedBlockIOFlushTask>(sd_card_cache), "SD Card Cache Flush").Failed())
+        {
+            LogError("Unable to start the SD Card cache flush task, dirty blocks will only be written on eviction or explicit flush\n");
+        }
+
         //  Get the partitions on the SD card
 
         alignas(MassStoragePartition) uint8_t partition_buffer[sizeof(MassStoragePartition) * MAX_PARTITIONS_ON_MASS_STORAGE_DEVICE + alignof(MassStoragePartition) * MAX_PARTITIONS_ON_MASS_STORAGE_DEVICE];
@@ -40,7 +77,7 @@ namespace filesystems
 
         MassStoragePartitions partitions(partition_allocator);
 
-        FilesystemResultCodes get_partitions_result = GetPartitions(sd_card, partitions);
+        FilesystemResultCodes get_partitions_result = GetPartitions(sd_card_cache, partitions);
 
         if (get_partitions_result != FilesystemResultCodes::SUCCESS)
         {
@@ -52,7 +89,7 @@ namespace filesystems
 
         for (auto itr = partitions.begin(); itr != partitions.end(); itr++)
         {
-            auto current_filesystem = fat32::FAT32Filesystem::Mount(true, itr->Name().c_str(), itr->Alias().c_str(), itr->IsBoot(), sd_card, *itr);
+            auto current_filesystem = fat32::FAT32Filesystem::Mount(true, itr->Name().c_str(), itr->Alias().c_str(), itr->IsBoot(), sd_card_cache, *itr);
 
             if (!current_filesystem.Successful())
             {
@@ -68,6 +105,53 @@ namespace filesystems
         return SimpleSuccessOrFailure::SUCCESS;
     }
 
+    SimpleSuccessOrFailure MountRamDiskFilesystem(const char *name, uint64_t size_in_bytes)
+    {
+        //  Create the RAM disk, it needs no cache in front of it
+
+        auto ram_disk = CreateRamDisk(name, size_in_bytes);
+
+        if (ram_disk.Failed())
+        {
+            LogError("Unable to create RAM disk: %s\n", name);
+            return SimpleSuccessOrFailure::FAILURE;
+        }
+
+        //  The RAM disk starts out empty, so format it with a single FAT32 partition labelled with the disk name
+
+        if (Failed(fat32::FAT32Filesystem::Format(*ram_disk, ram_disk->SizeInBlocks(), name)))
+        {
+            LogError("Unable to format RAM disk: %s\n", name);
+            return SimpleSuccessOrFailure::FAILURE;
+        }
+
+        alignas(MassStoragePartition) uint8_t partition_buffer[sizeof(MassStoragePartition) * MAX_PARTITIONS_ON_MASS_STORAGE_DEVICE + alignof(MassStoragePartition) * MAX_PARTITIONS_ON_MASS_STORAGE_DEVICE];
+        minstd::pmr::monotonic_buffer_resource partition_resource(partition_buffer, sizeof(partition_buffer), nullptr);
+        minstd::pmr::polymorphic_allocator<MassStoragePartition> partition_allocator(&partition_resource);
+
+        MassStoragePartitions partitions(partition_allocator);
+
+        if ((GetPartitions(*ram_disk, partitions) != FilesystemResultCodes::SUCCESS) || (partitions.size() != 1))
+        {
+            LogError("Unable to load RAM disk partition: %s\n", name);
+            return SimpleSuccessOrFailure::FAILURE;
+        }
+
+        //  The scratch filesystem is never the boot filesystem
+
+        auto ram_disk_filesystem = fat32::FAT32Filesystem::Mount(true, name, name, false, *ram_disk, *partitions.begin());
+
+        if (ram_disk_filesystem.Failed())
+        {
+            LogError("Unable to Mount RAM disk: %s\n", name);
+            return SimpleSuccessOrFailure::FAILURE;
+        }
+
+        GetOSEntityRegistry().AddEntity(*ram_disk_filesystem);
+
+        return SimpleSuccessOrFailure::SUCCESS;
+    }
+
     ReferenceResult<FilesystemResultCodes, Filesystem> GetBootFilesystem()
     {
         using Result = ReferenceResult<FilesystemResultCodes, Filesystem>;
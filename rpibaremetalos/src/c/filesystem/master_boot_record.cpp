@@ -11,6 +11,8 @@
 
 #include "devices/log.h"
 
+#include <string.h>
+
 namespace filesystems
 {
     constexpr uint32_t MBR_NUMBER_OF_PARTITION_ENTRIES = 4;
@@ -50,7 +52,7 @@ namespace filesystems
     {
         using Result = FilesystemResultCodes;
 
-        uint8_t mbr_buffer[io_device.BlockSize()];
+        alignas(BLOCK_IO_BUFFER_ALIGNMENT) uint8_t mbr_buffer[io_device.BlockSize()];
         const MasterBootRecord &mbr = *((MasterBootRecord *)mbr_buffer);
 
         //  Read the master boot record - it will be on sector zero
@@ -128,4 +130,38 @@ namespace filesystems
 
         return FilesystemResultCodes::SUCCESS;
     }
+
+    FilesystemResultCodes WriteMasterBootRecord(BlockIODevice &io_device, uint32_t first_sector, uint32_t number_of_sectors)
+    {
+        if (io_device.BlockSize() != sizeof(MasterBootRecord))
+        {
+            return FilesystemResultCodes::UNABLE_TO_WRITE_MASTER_BOOT_RECORD;
+        }
+
+        uint8_t mbr_buffer[sizeof(MasterBootRecord)];
+        MasterBootRecord &mbr = *((MasterBootRecord *)mbr_buffer);
+
+        memset(mbr_buffer, 0, sizeof(mbr_buffer));
+
+        //  CHS addressing is not used, so fill the CHS fields with the 'use LBA' markers
+
+        PartitionEntry &partition = mbr.partitions_[0];
+
+        partition.status_ = MBR_ACTIVE_PARTITION_STATUS;
+        partition.first_sector_ = {0xFE, 0x3F, 0x03, 0xFF};
+        partition.type_ = MBR_PARTITION_FILESYSTEM_FAT32_TYPE;
+        partition.last_sector_ = {0xFE, 0x3F, 0x03, 0xFF};
+        partition.first_logical_block_addressing_sector_ = first_sector;
+        partition.num_sectors_ = number_of_sectors;
+
+        mbr.boot_signature_ = MBR_BOOT_SIGNATURE;
+
+        if (io_device.WriteBlock(mbr_buffer, 0, 1).Failed())
+        {
+            LogError("Unable to write MBR to Block IO Device: %s\n", io_device.Name().c_str());
+            return FilesystemResultCodes::UNABLE_TO_WRITE_MASTER_BOOT_RECORD;
+        }
+
+        return FilesystemResultCodes::SUCCESS;
+    }
 } // namespace filesystems
@@ -28,6 +28,8 @@ const char *ToString(Interrupts interrupt)
         return "SYSTEM_TIMER_2";
     case Interrupts::SYSTEM_TIMER_3:
         return "SYSTEM_TIMER_3";
+    case Interrupts::EMMC:
+        return "EMMC";
     default:
         return "NO_SUCH_INTERRUPT";
     }
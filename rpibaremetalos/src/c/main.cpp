@@ -72,6 +72,13 @@ extern "C" void kernel_main()
 
     filesystems::MountSDCardFilesystems();
 
+    //  Mount the scratch filesystem on a RAM disk
+
+    if (DEFAULT_RAM_DISK_SIZE_IN_BYTES > 0)
+    {
+        filesystems::MountRamDiskFilesystem(DEFAULT_RAM_DISK_NAME, DEFAULT_RAM_DISK_SIZE_IN_BYTES);
+    }
+
     printf("Starting recurring interrupt\n");
 
     EnableIRQs();
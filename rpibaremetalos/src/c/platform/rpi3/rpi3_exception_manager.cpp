@@ -61,7 +61,20 @@ void BCM2837ExceptionManager::HandleInterrupt()
     }
     else if ((interrupt_source & BCM2837ARMLocalInterruptSources::GPU_INTERRUPT) != BCM2837ARMLocalInterruptSources::NONE)
     {
-        interrupt = AsInterrupt(static_cast<BCM2837Interrupts>(GetRegister(BCM2837ARMCInterruptRequestRegisters::REQUEST_PENDING_1)));
+        //  The system timers are reported in pending register 1, the EMMC controller in pending register 2.
+        //      The EMMC interrupt is level triggered, so if a timer is also pending the EMMC interrupt will simply fire again.
+
+        uint32_t pending_1 = GetRegister(BCM2837ARMCInterruptRequestRegisters::REQUEST_PENDING_1);
+
+        if ((pending_1 == 0) &&
+            (GetRegister(BCM2837ARMCInterruptRequestRegisters::REQUEST_PENDING_2) & static_cast<uint32_t>(BCM2837Interrupts::EMMC)))
+        {
+            interrupt = Interrupts::EMMC;
+        }
+        else
+        {
+            interrupt = AsInterrupt(static_cast<BCM2837Interrupts>(pending_1));
+        }
     }
 
     //  If we do not have an interrupt type, then return now.
@@ -30,6 +30,10 @@ extern "C"
     void UnlockSpinLock(void *spinlock)
     {
     }
+
+    void sc_Yield()
+    {
+    }
 }
 
 //  To initialize SW RNGs
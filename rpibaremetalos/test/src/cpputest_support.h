@@ -27,6 +27,11 @@ inline SimpleString StringFrom(filesystems::FilesystemResultCodes value)
     return StringFrom(static_cast<uint32_t>(value));
 }
 
+inline SimpleString StringFrom(BlockIOResultCodes value)
+{
+    return StringFrom(static_cast<uint32_t>(value));
+}
+
 template <typename T, typename U>
 void CHECK_SUCCESSFUL_AND_EQUAL(T expected, U actual)
 {
@@ -0,0 +1,242 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "../cpputest_support.h"
+
+#include <string.h>
+
+#include "heaps.h"
+
+#include "open_test_block_io_device.h"
+
+namespace
+{
+    using block_io::test::test_device;
+
+    constexpr uint32_t BLOCK_SIZE = ut_utility::InMemoryFileBlockIODevice::BLOCK_SIZE_IN_BYTES;
+
+    void CheckMatchesDevice(const BlockIORequest &request)
+    {
+        uint8_t expected[BLOCK_SIZE * 8];
+
+        CHECK(request.BlockCount() <= 8);
+        CHECK(test_device->ReadFromBlock(expected, request.BlockNumber(), request.BlockCount()).Successful());
+        CHECK_EQUAL(0, memcmp(expected, request.Buffer(), request.BlockCount() * BLOCK_SIZE));
+    }
+
+    //  Records the order requests complete in
+
+    const BlockIORequest *completion_order[4];
+    uint32_t completions = 0;
+
+    void RecordCompletion(BlockIORequest &request, void *)
+    {
+        completion_order[completions++] = &request;
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+    TEST_GROUP (BlockIOElevatorTest)
+    {
+        void setup()
+        {
+            block_io::test::OpenTestBlockIODevice();
+        }
+
+        void teardown()
+        {
+            block_io::test::CloseTestBlockIODevice();
+        }
+    };
+#pragma GCC diagnostic pop
+
+    TEST(BlockIOElevatorTest, OutOfOrderContiguousReadsMergeTest)
+    {
+        uint8_t buffer0[BLOCK_SIZE * 2];
+        uint8_t buffer1[BLOCK_SIZE * 2];
+        uint8_t buffer2[BLOCK_SIZE * 2];
+        uint8_t buffer3[BLOCK_SIZE * 2];
+
+        //  Submitted out of order, the elevator should sort and merge these into a single read
+
+        BlockIORequest request2(BlockIODirection::READ, buffer2, 104, 2);
+        BlockIORequest request0(BlockIODirection::READ, buffer0, 100, 2);
+        BlockIORequest request3(BlockIODirection::READ, buffer3, 106, 2);
+        BlockIORequest request1(BlockIODirection::READ, buffer1, 102, 2);
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request2));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request0));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request3));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request1));
+
+        CHECK_EQUAL(4, test_device->ProcessRequests());
+        CHECK_EQUAL(1, test_device->ReadCommandsIssued());
+
+        BlockIORequest *requests[] = {&request0, &request1, &request2, &request3};
+
+        for (auto request : requests)
+        {
+            CHECK(request->IsComplete());
+            CHECK_EQUAL(BlockIOResultCodes::SUCCESS, request->ResultCode());
+            CHECK_EQUAL(2, request->BlocksTransferred());
+
+            CheckMatchesDevice(*request);
+        }
+    }
+
+    TEST(BlockIOElevatorTest, ContiguousBuffersMergeWithoutBounceTest)
+    {
+        uint8_t buffer[BLOCK_SIZE * 4];
+
+        BlockIORequest request0(BlockIODirection::READ, buffer, 200, 1);
+        BlockIORequest request1(BlockIODirection::READ, buffer + BLOCK_SIZE, 201, 3);
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request0));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request1));
+
+        CHECK_EQUAL(2, test_device->ProcessRequests());
+        CHECK_EQUAL(1, test_device->ReadCommandsIssued());
+
+        CheckMatchesDevice(request0);
+        CheckMatchesDevice(request1);
+    }
+
+    TEST(BlockIOElevatorTest, NearlyContiguousReadsMergeTest)
+    {
+        uint8_t buffer0[BLOCK_SIZE];
+        uint8_t buffer1[BLOCK_SIZE];
+        uint8_t buffer2[BLOCK_SIZE];
+
+        //  Gaps within the limit are merged, a gap beyond the limit starts a new transfer
+
+        BlockIORequest request0(BlockIODirection::READ, buffer0, 300, 1);
+        BlockIORequest request1(BlockIODirection::READ, buffer1, 301 + MAX_BLOCK_IO_MERGE_READ_GAP_IN_BLOCKS, 1);
+        BlockIORequest request2(BlockIODirection::READ, buffer2, 302 + (2 * MAX_BLOCK_IO_MERGE_READ_GAP_IN_BLOCKS) + 1, 1);
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request0));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request1));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request2));
+
+        CHECK_EQUAL(3, test_device->ProcessRequests());
+        CHECK_EQUAL(2, test_device->ReadCommandsIssued());
+
+        CheckMatchesDevice(request0);
+        CheckMatchesDevice(request1);
+        CheckMatchesDevice(request2);
+    }
+
+    TEST(BlockIOElevatorTest, ContiguousWritesMergeTest)
+    {
+        uint8_t buffer0[BLOCK_SIZE * 2];
+        uint8_t buffer1[BLOCK_SIZE];
+        uint8_t buffer2[BLOCK_SIZE];
+
+        memset(buffer0, 0xA5, sizeof(buffer0));
+        memset(buffer1, 0x5A, sizeof(buffer1));
+        memset(buffer2, 0x3C, sizeof(buffer2));
+
+        BlockIORequest request1(BlockIODirection::WRITE, buffer1, 402, 1);
+        BlockIORequest request0(BlockIODirection::WRITE, buffer0, 400, 2);
+        BlockIORequest request2(BlockIODirection::WRITE, buffer2, 404, 1); //  Not contiguous, writes never merge across a gap
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request1));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request0));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request2));
+
+        CHECK_EQUAL(3, test_device->ProcessRequests());
+        CHECK_EQUAL(2, test_device->WriteCommandsIssued());
+
+        CheckMatchesDevice(request0);
+        CheckMatchesDevice(request1);
+        CheckMatchesDevice(request2);
+    }
+
+    TEST(BlockIOElevatorTest, WriteOrderingPreservedTest)
+    {
+        uint8_t read_before[BLOCK_SIZE];
+        uint8_t write_buffer[BLOCK_SIZE];
+        uint8_t read_after[BLOCK_SIZE];
+
+        CHECK(test_device->ReadFromBlock(read_before, 500, 1).Successful());
+
+        memset(write_buffer, 0xEE, sizeof(write_buffer));
+        memset(read_after, 0, sizeof(read_after));
+
+        //  A read, a write and a read of the same block must be executed in submission order
+
+        uint8_t original[BLOCK_SIZE];
+        memcpy(original, read_before, sizeof(original));
+        memset(read_before, 0, sizeof(read_before));
+
+        BlockIORequest request0(BlockIODirection::READ, read_before, 500, 1);
+        BlockIORequest request1(BlockIODirection::WRITE, write_buffer, 500, 1);
+        BlockIORequest request2(BlockIODirection::READ, read_after, 500, 1);
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request0));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request1));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request2));
+
+        CHECK_EQUAL(3, test_device->ProcessRequests());
+
+        CHECK_EQUAL(0, memcmp(original, read_before, BLOCK_SIZE));
+        CHECK_EQUAL(0, memcmp(write_buffer, read_after, BLOCK_SIZE));
+    }
+
+    TEST(BlockIOElevatorTest, PriorityClassesKeptApartTest)
+    {
+        uint8_t buffer0[BLOCK_SIZE * 2];
+        uint8_t buffer1[BLOCK_SIZE * 2];
+        uint8_t buffer2[BLOCK_SIZE * 2];
+
+        completions = 0;
+
+        //  The background read sits lowest on the device but goes last, and the contiguous reads of different classes are
+        //      not merged
+
+        BlockIORequest background_request(BlockIODirection::READ, buffer0, 700, 2, RecordCompletion, nullptr, BlockIOPriority::BACKGROUND);
+        BlockIORequest interactive_request(BlockIODirection::READ, buffer1, 704, 2, RecordCompletion, nullptr, BlockIOPriority::INTERACTIVE);
+        BlockIORequest metadata_request(BlockIODirection::READ, buffer2, 702, 2, RecordCompletion, nullptr, BlockIOPriority::METADATA);
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(background_request));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(interactive_request));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(metadata_request));
+
+        CHECK_EQUAL(3, test_device->ProcessRequests());
+        CHECK_EQUAL(3, test_device->ReadCommandsIssued());
+
+        CHECK_EQUAL(3, completions);
+        CHECK(completion_order[0] == &metadata_request);
+        CHECK(completion_order[1] == &interactive_request);
+        CHECK(completion_order[2] == &background_request);
+
+        CheckMatchesDevice(background_request);
+        CheckMatchesDevice(interactive_request);
+        CheckMatchesDevice(metadata_request);
+    }
+
+    TEST(BlockIOElevatorTest, MergedReadFailureSplitsTest)
+    {
+        uint8_t buffer0[BLOCK_SIZE];
+        uint8_t buffer1[BLOCK_SIZE];
+
+        BlockIORequest request0(BlockIODirection::READ, buffer0, 600, 1);
+        BlockIORequest request1(BlockIODirection::READ, buffer1, 601, 1);
+
+        //  The merged read fails, the requests are then retried individually and succeed
+
+        test_device->SimulateReadError(0);
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request0));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request1));
+
+        CHECK_EQUAL(2, test_device->ProcessRequests());
+        CHECK_EQUAL(3, test_device->ReadCommandsIssued());
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, request0.ResultCode());
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, request1.ResultCode());
+
+        CheckMatchesDevice(request0);
+        CheckMatchesDevice(request1);
+    }
+}
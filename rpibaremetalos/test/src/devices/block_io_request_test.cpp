@@ -0,0 +1,207 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "../cpputest_support.h"
+
+#include <string.h>
+
+#include "heaps.h"
+
+#include "open_test_block_io_device.h"
+
+namespace
+{
+    using block_io::test::test_device;
+
+    constexpr uint32_t BLOCK_SIZE = ut_utility::InMemoryFileBlockIODevice::BLOCK_SIZE_IN_BYTES;
+
+    typedef struct CallbackCounter
+    {
+        uint32_t callbacks_ = 0;
+        uint32_t last_block_number_ = 0;
+    } CallbackCounter;
+
+    void CountingCallback(BlockIORequest &request, void *context)
+    {
+        CallbackCounter *counter = static_cast<CallbackCounter *>(context);
+
+        counter->callbacks_++;
+        counter->last_block_number_ = request.BlockNumber();
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+    TEST_GROUP (BlockIORequestTest)
+    {
+        void setup()
+        {
+            block_io::test::OpenTestBlockIODevice();
+        }
+
+        void teardown()
+        {
+            block_io::test::CloseTestBlockIODevice();
+        }
+    };
+#pragma GCC diagnostic pop
+
+    TEST(BlockIORequestTest, SubmitAndProcessReadsTest)
+    {
+        constexpr uint32_t NUM_REQUESTS = 4;
+
+        uint8_t expected[BLOCK_SIZE * 2];
+        uint8_t buffers[NUM_REQUESTS][BLOCK_SIZE * 2];
+
+        BlockIORequest request0(BlockIODirection::READ, buffers[0], 0, 2);
+        BlockIORequest request1(BlockIODirection::READ, buffers[1], 32, 2);
+        BlockIORequest request2(BlockIODirection::READ, buffers[2], 64, 1);
+        BlockIORequest request3(BlockIODirection::READ, buffers[3], 2048, 2);
+
+        BlockIORequest *requests[NUM_REQUESTS] = {&request0, &request1, &request2, &request3};
+
+        for (auto request : requests)
+        {
+            CHECK(request->State() == BlockIORequestState::IDLE);
+            CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(*request));
+            CHECK(request->State() == BlockIORequestState::QUEUED);
+        }
+
+        CHECK_EQUAL(NUM_REQUESTS, test_device->QueuedRequests());
+
+        //  Resubmitting a queued request must fail
+
+        CHECK_EQUAL(BlockIOResultCodes::REQUEST_ALREADY_QUEUED, test_device->SubmitRequest(request0));
+
+        CHECK_EQUAL(NUM_REQUESTS, test_device->ProcessRequests());
+        CHECK_EQUAL(0, test_device->QueuedRequests());
+
+        //  Each request must be complete and the data must match a synchronous read
+
+        for (uint32_t i = 0; i < NUM_REQUESTS; i++)
+        {
+            CHECK(requests[i]->IsComplete());
+            CHECK_EQUAL(BlockIOResultCodes::SUCCESS, requests[i]->ResultCode());
+            CHECK_EQUAL(requests[i]->BlockCount(), requests[i]->BlocksTransferred());
+
+            CHECK(test_device->ReadFromBlock(expected, requests[i]->BlockNumber(), requests[i]->BlockCount()).Successful());
+            CHECK_EQUAL(0, memcmp(expected, buffers[i], requests[i]->BlockCount() * BLOCK_SIZE));
+        }
+    }
+
+    TEST(BlockIORequestTest, WriteThenReadWithWaitTest)
+    {
+        uint8_t write_buffer[BLOCK_SIZE * 3];
+        uint8_t read_buffer[BLOCK_SIZE * 3];
+
+        for (uint32_t i = 0; i < sizeof(write_buffer); i++)
+        {
+            write_buffer[i] = (uint8_t)(i * 7);
+        }
+
+        memset(read_buffer, 0, sizeof(read_buffer));
+
+        BlockIORequest write_request(BlockIODirection::WRITE, write_buffer, 4000, 3);
+        BlockIORequest read_request(BlockIODirection::READ, read_buffer, 4000, 3);
+
+        //  Requests execute in order, so the read must see the data written
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(write_request));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(read_request));
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->WaitForRequest(read_request));
+
+        CHECK(write_request.IsComplete());
+        CHECK_EQUAL(3, write_request.BlocksTransferred());
+        CHECK_EQUAL(0, memcmp(write_buffer, read_buffer, sizeof(write_buffer)));
+
+        //  Waiting on a completed request returns immediately with its result
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->WaitForRequest(write_request));
+    }
+
+    TEST(BlockIORequestTest, CompletionCallbackTest)
+    {
+        CallbackCounter counter;
+
+        uint8_t buffer1[BLOCK_SIZE];
+        uint8_t buffer2[BLOCK_SIZE];
+
+        BlockIORequest request1(BlockIODirection::READ, buffer1, 10, 1, CountingCallback, &counter);
+        BlockIORequest request2(BlockIODirection::READ, buffer2, 20, 1, CountingCallback, &counter);
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request1));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request2));
+
+        CHECK_EQUAL(0, counter.callbacks_);
+
+        test_device->ProcessRequests();
+
+        CHECK_EQUAL(2, counter.callbacks_);
+        CHECK_EQUAL(20, counter.last_block_number_);
+
+        //  A completed request can be submitted again
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request1));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->WaitForRequest(request1));
+
+        CHECK_EQUAL(3, counter.callbacks_);
+        CHECK_EQUAL(10, counter.last_block_number_);
+    }
+
+    TEST(BlockIORequestTest, QueueFullNegativeTest)
+    {
+        uint8_t buffer[BLOCK_SIZE];
+
+        minstd::unique_ptr<BlockIORequest> requests[MAX_QUEUED_BLOCK_IO_REQUESTS + 1];
+
+        for (uint32_t i = 0; i <= MAX_QUEUED_BLOCK_IO_REQUESTS; i++)
+        {
+            requests[i] = make_dynamic_unique<BlockIORequest>(BlockIODirection::READ, buffer, i, 1);
+        }
+
+        for (uint32_t i = 0; i < MAX_QUEUED_BLOCK_IO_REQUESTS; i++)
+        {
+            CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(*requests[i]));
+        }
+
+        CHECK_EQUAL(BlockIOResultCodes::REQUEST_QUEUE_FULL, test_device->SubmitRequest(*requests[MAX_QUEUED_BLOCK_IO_REQUESTS]));
+        CHECK(requests[MAX_QUEUED_BLOCK_IO_REQUESTS]->State() == BlockIORequestState::IDLE);
+
+        CHECK_EQUAL(MAX_QUEUED_BLOCK_IO_REQUESTS, test_device->ProcessRequests());
+
+        //  Once the queue has drained, the request can be submitted
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(*requests[MAX_QUEUED_BLOCK_IO_REQUESTS]));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->WaitForRequest(*requests[MAX_QUEUED_BLOCK_IO_REQUESTS]));
+    }
+
+    TEST(BlockIORequestTest, ReadErrorNegativeTest)
+    {
+        uint8_t buffer1[BLOCK_SIZE];
+        uint8_t buffer2[BLOCK_SIZE];
+
+        BlockIORequest request1(BlockIODirection::READ, buffer1, 10, 1);
+        BlockIORequest request2(BlockIODirection::READ, buffer2, 20, 1);
+
+        test_device->SimulateReadError(1);
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request1));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request2));
+
+        CHECK_EQUAL(2, test_device->ProcessRequests());
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->WaitForRequest(request1));
+        CHECK_EQUAL(BlockIOResultCodes::EMMC_READ_FAILED, test_device->WaitForRequest(request2));
+        CHECK_EQUAL(0, request2.BlocksTransferred());
+    }
+
+    TEST(BlockIORequestTest, WaitOnIdleRequestNegativeTest)
+    {
+        uint8_t buffer[BLOCK_SIZE];
+
+        BlockIORequest request(BlockIODirection::READ, buffer, 10, 1);
+
+        CHECK_EQUAL(BlockIOResultCodes::FAILURE, test_device->WaitForRequest(request));
+    }
+}
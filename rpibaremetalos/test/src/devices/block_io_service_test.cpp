@@ -0,0 +1,312 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "../cpputest_support.h"
+
+#include <string.h>
+
+#include "heaps.h"
+
+#include "devices/block_io_service.h"
+
+#include "open_test_block_io_device.h"
+
+namespace
+{
+    using block_io::test::test_device;
+
+    constexpr uint32_t BLOCK_SIZE = ut_utility::InMemoryFileBlockIODevice::BLOCK_SIZE_IN_BYTES;
+
+    //  Stands in for the service task running on another core, it drains the queue whenever a submitter waits
+
+    BlockIOServiceDevice *attached_service = nullptr;
+    uint32_t wait_calls = 0;
+
+    void DrainFromWorker()
+    {
+        wait_calls++;
+        attached_service->ProcessQueue();
+    }
+
+    //  Stands in for a second task queueing a read while the first is waiting, so both are on the queue when the worker drains it
+
+    uint8_t second_read_buffer[BLOCK_SIZE];
+    bool second_read_submitted = false;
+    BlockIOResultCodes second_read_result = BlockIOResultCodes::FAILURE;
+
+    void SubmitSecondReadThenDrain()
+    {
+        wait_calls++;
+
+        if (!second_read_submitted)
+        {
+            second_read_submitted = true;
+            second_read_result = attached_service->ReadFromBlock(second_read_buffer, 301, 1).ResultCode();
+            return;
+        }
+
+        attached_service->ProcessQueue();
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+    TEST_GROUP (BlockIOServiceTest)
+    {
+        void setup()
+        {
+            block_io::test::OpenTestBlockIODevice();
+
+            attached_service = nullptr;
+            wait_calls = 0;
+            second_read_submitted = false;
+            second_read_result = BlockIOResultCodes::FAILURE;
+        }
+
+        void teardown()
+        {
+            block_io::test::CloseTestBlockIODevice();
+        }
+    };
+#pragma GCC diagnostic pop
+
+    TEST(BlockIOServiceTest, QueueOrderAndFullTest)
+    {
+        BlockIOServiceQueue queue;
+        BlockIOServiceRequest requests[BlockIOServiceQueue::QUEUE_DEPTH + 1];
+        BlockIOServiceRequest *popped_request;
+
+        CHECK_FALSE(queue.Pop(popped_request));
+
+        //  Go around the ring twice so the sequence numbers wrap onto the second lap
+
+        for (uint32_t lap = 0; lap < 2; lap++)
+        {
+            for (uint32_t i = 0; i < BlockIOServiceQueue::QUEUE_DEPTH; i++)
+            {
+                CHECK(queue.Push(&requests[i]));
+            }
+
+            CHECK_FALSE(queue.Push(&requests[BlockIOServiceQueue::QUEUE_DEPTH]));
+
+            for (uint32_t i = 0; i < BlockIOServiceQueue::QUEUE_DEPTH; i++)
+            {
+                CHECK(queue.Pop(popped_request));
+                CHECK(popped_request == &requests[i]);
+            }
+
+            CHECK_FALSE(queue.Pop(popped_request));
+        }
+    }
+
+    TEST(BlockIOServiceTest, PriorityOrderTest)
+    {
+        BlockIOPriorityServiceQueue queue;
+        BlockIOServiceRequest background_requests[2];
+        BlockIOServiceRequest interactive_request;
+        BlockIOServiceRequest metadata_request;
+        BlockIOServiceRequest *popped_request;
+
+        background_requests[0].priority_ = BlockIOPriority::BACKGROUND;
+        background_requests[1].priority_ = BlockIOPriority::BACKGROUND;
+        interactive_request.priority_ = BlockIOPriority::INTERACTIVE;
+        metadata_request.priority_ = BlockIOPriority::METADATA;
+
+        CHECK_FALSE(queue.Pop(popped_request));
+
+        //  Queue in the reverse of priority order, the most urgent classes go first and each class stays FIFO
+
+        CHECK(queue.Push(&background_requests[0]));
+        CHECK(queue.Push(&interactive_request));
+        CHECK(queue.Push(&background_requests[1]));
+        CHECK(queue.Push(&metadata_request));
+
+        CHECK(queue.Pop(popped_request));
+        CHECK(popped_request == &metadata_request);
+        CHECK(queue.Pop(popped_request));
+        CHECK(popped_request == &interactive_request);
+        CHECK(queue.Pop(popped_request));
+        CHECK(popped_request == &background_requests[0]);
+        CHECK(queue.Pop(popped_request));
+        CHECK(popped_request == &background_requests[1]);
+
+        CHECK_FALSE(queue.Pop(popped_request));
+    }
+
+    TEST(BlockIOServiceTest, PriorityAgingTest)
+    {
+        constexpr uint32_t NUMBER_OF_METADATA_REQUESTS = BLOCK_IO_PRIORITY_AGING_LIMIT * 2;
+
+        BlockIOPriorityServiceQueue queue;
+        BlockIOServiceRequest background_request;
+        BlockIOServiceRequest metadata_requests[NUMBER_OF_METADATA_REQUESTS];
+        BlockIOServiceRequest *popped_request;
+
+        background_request.priority_ = BlockIOPriority::BACKGROUND;
+
+        CHECK(queue.Push(&background_request));
+
+        for (uint32_t i = 0; i < NUMBER_OF_METADATA_REQUESTS; i++)
+        {
+            metadata_requests[i].priority_ = BlockIOPriority::METADATA;
+            CHECK(queue.Push(&metadata_requests[i]));
+        }
+
+        //  The background request is passed over until it reaches the aging limit, then it goes next
+
+        for (uint32_t i = 0; i < BLOCK_IO_PRIORITY_AGING_LIMIT; i++)
+        {
+            CHECK(queue.Pop(popped_request));
+            CHECK(popped_request == &metadata_requests[i]);
+        }
+
+        CHECK(queue.Pop(popped_request));
+        CHECK(popped_request == &background_request);
+
+        for (uint32_t i = BLOCK_IO_PRIORITY_AGING_LIMIT; i < NUMBER_OF_METADATA_REQUESTS; i++)
+        {
+            CHECK(queue.Pop(popped_request));
+            CHECK(popped_request == &metadata_requests[i]);
+        }
+
+        CHECK_FALSE(queue.Pop(popped_request));
+    }
+
+    TEST(BlockIOServiceTest, ReadWriteWithoutWorkerTest)
+    {
+        BlockIOServiceDevice service(false, "SERVICE_TEST", "SERVICE_TEST", *test_device);
+
+        CHECK_EQUAL(BLOCK_SIZE, service.BlockSize());
+        CHECK_FALSE(service.WorkerAttached());
+
+        uint8_t write_buffer[BLOCK_SIZE * 2];
+        uint8_t read_buffer[BLOCK_SIZE * 2];
+
+        memset(write_buffer, 0x3C, sizeof(write_buffer));
+
+        //  With no worker attached the submitting task drains the queue itself
+
+        CHECK_SUCCESSFUL_AND_EQUAL(2, service.WriteBlock(write_buffer, 500, 2));
+        CHECK_SUCCESSFUL_AND_EQUAL(2, service.ReadFromBlock(read_buffer, 500, 2));
+
+        CHECK_EQUAL(0, memcmp(write_buffer, read_buffer, sizeof(write_buffer)));
+
+        CHECK_EQUAL(2, service.RequestsServiced());
+        CHECK_EQUAL(1, test_device->WriteCommandsIssued());
+        CHECK_EQUAL(1, test_device->ReadCommandsIssued());
+
+        //  Reads and writes reach the device through its request queue
+
+        CHECK_EQUAL(2, test_device->Statistics().RequestsQueued());
+        CHECK_EQUAL(0, test_device->QueuedRequests());
+
+        //  The service device tracks its own offset
+
+        memset(read_buffer, 0, sizeof(read_buffer));
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, service.Seek(501));
+        CHECK_SUCCESSFUL_AND_EQUAL(1, service.ReadFromCurrentOffset(read_buffer, 1));
+        CHECK_EQUAL(0, memcmp(write_buffer, read_buffer, BLOCK_SIZE));
+    }
+
+    TEST(BlockIOServiceTest, VectoredDiscardAndFlushTest)
+    {
+        BlockIOServiceDevice service(false, "SERVICE_TEST", "SERVICE_TEST", *test_device);
+
+        uint8_t expected[BLOCK_SIZE * 3];
+        uint8_t buffer0[BLOCK_SIZE];
+        uint8_t buffer1[BLOCK_SIZE * 2];
+
+        CHECK(test_device->ReadFromBlock(expected, 100, 3).Successful());
+
+        BlockIOSegment segments[] = {{buffer0, 1}, {buffer1, 2}};
+
+        CHECK_SUCCESSFUL_AND_EQUAL(3, service.ReadBlocksV(BlockIOPriority::METADATA, segments, 2, 100));
+
+        CHECK_EQUAL(0, memcmp(expected, buffer0, sizeof(buffer0)));
+        CHECK_EQUAL(0, memcmp(expected + BLOCK_SIZE, buffer1, sizeof(buffer1)));
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, service.Discard(1000, 8));
+        CHECK_EQUAL(1, test_device->DiscardCommandsIssued());
+        CHECK_EQUAL(8, test_device->BlocksDiscarded());
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, service.Flush());
+
+        CHECK_EQUAL(3, service.RequestsServiced());
+    }
+
+    TEST(BlockIOServiceTest, FailedReadTest)
+    {
+        BlockIOServiceDevice service(false, "SERVICE_TEST", "SERVICE_TEST", *test_device);
+
+        uint8_t buffer[BLOCK_SIZE];
+
+        test_device->SimulateReadError();
+
+        CHECK_FAILED_WITH_CODE(BlockIOResultCodes::EMMC_READ_FAILED, service.ReadFromBlock(buffer, 10, 1));
+    }
+
+    TEST(BlockIOServiceTest, AttachedWorkerTest)
+    {
+        BlockIOServiceDevice service(false, "SERVICE_TEST", "SERVICE_TEST", *test_device);
+
+        attached_service = &service;
+
+        service.AttachWorker(DrainFromWorker);
+
+        CHECK(service.WorkerAttached());
+
+        //  Submitting tasks only wait, the attached worker executes the requests
+
+        uint8_t expected[BLOCK_SIZE];
+        uint8_t buffer[BLOCK_SIZE];
+
+        CHECK(test_device->ReadFromBlock(expected, 200, 1).Successful());
+
+        CHECK_SUCCESSFUL_AND_EQUAL(1, service.ReadFromBlock(buffer, 200, 1));
+        CHECK_EQUAL(0, memcmp(expected, buffer, sizeof(buffer)));
+
+        CHECK(wait_calls > 0);
+        CHECK_EQUAL(1, service.RequestsServiced());
+
+        service.DetachWorker();
+
+        CHECK_FALSE(service.WorkerAttached());
+
+        wait_calls = 0;
+
+        CHECK_SUCCESSFUL_AND_EQUAL(1, service.ReadFromBlock(buffer, 201, 1));
+        CHECK_EQUAL(0, wait_calls);
+    }
+
+    TEST(BlockIOServiceTest, QueuedReadsMergeTest)
+    {
+        BlockIOServiceDevice service(false, "SERVICE_TEST", "SERVICE_TEST", *test_device);
+
+        attached_service = &service;
+
+        service.AttachWorker(SubmitSecondReadThenDrain);
+
+        uint8_t expected[BLOCK_SIZE * 2];
+        uint8_t buffer[BLOCK_SIZE];
+
+        CHECK(test_device->ReadFromBlock(expected, 300, 2).Successful());
+
+        uint32_t reads_before = test_device->ReadCommandsIssued();
+
+        //  Both reads are on the queue when it is drained, the elevator merges them into one command
+
+        CHECK_SUCCESSFUL_AND_EQUAL(1, service.ReadFromBlock(buffer, 300, 1));
+
+        CHECK(second_read_submitted);
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, second_read_result);
+
+        CHECK_EQUAL(0, memcmp(expected, buffer, BLOCK_SIZE));
+        CHECK_EQUAL(0, memcmp(expected + BLOCK_SIZE, second_read_buffer, BLOCK_SIZE));
+
+        CHECK_EQUAL(2, service.RequestsServiced());
+        CHECK_EQUAL(1, test_device->ReadCommandsIssued() - reads_before);
+
+        service.DetachWorker();
+    }
+}
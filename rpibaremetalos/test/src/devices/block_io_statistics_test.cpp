@@ -0,0 +1,125 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "../cpputest_support.h"
+
+#include "heaps.h"
+
+#include "devices/block_io.h"
+
+#include "../utility/in_memory_blockio_device.h"
+
+namespace
+{
+    TEST_GROUP (BlockIOStatisticsTest)
+    {
+    };
+
+    TEST(BlockIOStatisticsTest, HistogramBucketsTest)
+    {
+        CHECK_EQUAL(0, BlockIOLatencyHistogram::BucketForLatency(0));
+        CHECK_EQUAL(1, BlockIOLatencyHistogram::BucketForLatency(1));
+        CHECK_EQUAL(2, BlockIOLatencyHistogram::BucketForLatency(2));
+        CHECK_EQUAL(2, BlockIOLatencyHistogram::BucketForLatency(3));
+        CHECK_EQUAL(3, BlockIOLatencyHistogram::BucketForLatency(4));
+        CHECK_EQUAL(11, BlockIOLatencyHistogram::BucketForLatency(1024));
+        CHECK_EQUAL(BlockIOLatencyHistogram::NUMBER_OF_BUCKETS - 1, BlockIOLatencyHistogram::BucketForLatency(0xFFFFFFFFFFFFFFFF));
+
+        CHECK_EQUAL(0, BlockIOLatencyHistogram::BucketLowerBoundInMicroseconds(0));
+        CHECK_EQUAL(1, BlockIOLatencyHistogram::BucketLowerBoundInMicroseconds(1));
+        CHECK_EQUAL(1024, BlockIOLatencyHistogram::BucketLowerBoundInMicroseconds(11));
+
+        //  Each latency lands in the bucket whose lower bound is at or below it
+
+        for (uint64_t latency = 1; latency < 100000; latency += 37)
+        {
+            uint32_t bucket = BlockIOLatencyHistogram::BucketForLatency(latency);
+
+            CHECK(BlockIOLatencyHistogram::BucketLowerBoundInMicroseconds(bucket) <= latency);
+            CHECK(latency < BlockIOLatencyHistogram::BucketLowerBoundInMicroseconds(bucket + 1));
+        }
+    }
+
+    TEST(BlockIOStatisticsTest, CountersAndLatencyTest)
+    {
+        BlockIOStatistics statistics;
+
+        statistics.RecordRead(1, 100, true);
+        statistics.RecordRead(8, 300, true);
+        statistics.RecordRead(8, 5000, false);
+        statistics.RecordWrite(4, 700, true);
+        statistics.RecordRetry();
+
+        CHECK_EQUAL(3, statistics.Reads());
+        CHECK_EQUAL(9, statistics.BlocksRead());
+        CHECK_EQUAL(1, statistics.Writes());
+        CHECK_EQUAL(4, statistics.BlocksWritten());
+        CHECK_EQUAL(1, statistics.Retries());
+        CHECK_EQUAL(1, statistics.Errors());
+
+        const BlockIOLatencyHistogram &single_read = statistics.Latency(BlockIOCommandClass::SINGLE_BLOCK_READ);
+        const BlockIOLatencyHistogram &multiple_read = statistics.Latency(BlockIOCommandClass::MULTIPLE_BLOCK_READ);
+
+        CHECK_EQUAL(1, single_read.Count());
+        CHECK_EQUAL(2, multiple_read.Count());
+        CHECK_EQUAL(2650, multiple_read.AverageLatencyInMicroseconds());
+        CHECK_EQUAL(5000, multiple_read.MaximumLatencyInMicroseconds());
+        CHECK_EQUAL(1, statistics.Latency(BlockIOCommandClass::MULTIPLE_BLOCK_WRITE).Count());
+        CHECK_EQUAL(0, statistics.Latency(BlockIOCommandClass::SINGLE_BLOCK_WRITE).Count());
+
+        statistics.Reset();
+
+        CHECK_EQUAL(0, statistics.Reads());
+        CHECK_EQUAL(0, multiple_read.Count());
+    }
+
+    TEST(BlockIOStatisticsTest, CompletionTest)
+    {
+        BlockIOStatistics statistics;
+
+        statistics.RecordCompletion(0, false);
+        statistics.RecordCompletion(40, true);
+        statistics.RecordCompletion(1200, false);
+
+        CHECK_EQUAL(1, statistics.InterruptCompletions());
+        CHECK_EQUAL(2, statistics.PolledCompletions());
+        CHECK_EQUAL(3, statistics.CompletionWait().Count());
+        CHECK_EQUAL(1200, statistics.CompletionWait().MaximumLatencyInMicroseconds());
+
+        statistics.Reset();
+
+        CHECK_EQUAL(0, statistics.InterruptCompletions());
+        CHECK_EQUAL(0, statistics.PolledCompletions());
+        CHECK_EQUAL(0, statistics.CompletionWait().Count());
+    }
+
+    TEST(BlockIOStatisticsTest, QueueDepthTest)
+    {
+        CHECK_EQUAL(0, __os_dynamic_heap_core.bytes_in_use());
+
+        {
+            ut_utility::InMemoryFileBlockIODevice test_device("IN_MEMORY_TEST_DEVICE");
+
+            CHECK(test_device.Open("./test/data/test_fat32.img"));
+
+            uint8_t buffer[ut_utility::InMemoryFileBlockIODevice::BLOCK_SIZE_IN_BYTES * 3];
+
+            BlockIORequest request0(BlockIODirection::READ, buffer, 10, 1);
+            BlockIORequest request1(BlockIODirection::READ, buffer + 512, 20, 1);
+            BlockIORequest request2(BlockIODirection::READ, buffer + 1024, 30, 1);
+
+            CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device.SubmitRequest(request0));
+            CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device.SubmitRequest(request1));
+            CHECK_EQUAL(2, test_device.ProcessRequests());
+
+            CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device.SubmitRequest(request2));
+            CHECK_EQUAL(1, test_device.ProcessRequests());
+
+            CHECK_EQUAL(3, test_device.Statistics().RequestsQueued());
+            CHECK_EQUAL(2, test_device.Statistics().MaximumQueueDepth());
+        }
+
+        CHECK_EQUAL(0, __os_dynamic_heap_core.bytes_in_use());
+    }
+}
@@ -0,0 +1,117 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "../cpputest_support.h"
+
+#include <string.h>
+
+#include "heaps.h"
+
+#include "open_test_block_io_device.h"
+
+namespace
+{
+    using block_io::test::test_device;
+
+    constexpr uint32_t BLOCK_SIZE = ut_utility::InMemoryFileBlockIODevice::BLOCK_SIZE_IN_BYTES;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+    TEST_GROUP (BlockIOVectoredTest)
+    {
+        void setup()
+        {
+            block_io::test::OpenTestBlockIODevice();
+        }
+
+        void teardown()
+        {
+            block_io::test::CloseTestBlockIODevice();
+        }
+    };
+#pragma GCC diagnostic pop
+
+    TEST(BlockIOVectoredTest, ScatterReadTest)
+    {
+        uint8_t expected[BLOCK_SIZE * 6];
+        uint8_t buffer0[BLOCK_SIZE * 1];
+        uint8_t buffer1[BLOCK_SIZE * 3];
+        uint8_t buffer2[BLOCK_SIZE * 2];
+
+        CHECK(test_device->ReadFromBlock(expected, 100, 6).Successful());
+
+        BlockIOSegment segments[] = {{buffer0, 1}, {buffer1, 3}, {buffer2, 2}};
+
+        auto read_result = test_device->ReadBlocksV(BlockIOPriority::INTERACTIVE, segments, 3, 100);
+
+        CHECK(read_result.Successful());
+        CHECK_EQUAL(6, *read_result);
+        CHECK_EQUAL(2, test_device->ReadCommandsIssued());
+
+        CHECK_EQUAL(0, memcmp(expected, buffer0, sizeof(buffer0)));
+        CHECK_EQUAL(0, memcmp(expected + BLOCK_SIZE, buffer1, sizeof(buffer1)));
+        CHECK_EQUAL(0, memcmp(expected + (4 * BLOCK_SIZE), buffer2, sizeof(buffer2)));
+    }
+
+    TEST(BlockIOVectoredTest, GatherWriteTest)
+    {
+        uint8_t buffer0[BLOCK_SIZE * 2];
+        uint8_t buffer1[BLOCK_SIZE * 1];
+        uint8_t readback[BLOCK_SIZE * 3];
+
+        memset(buffer0, 0xA5, sizeof(buffer0));
+        memset(buffer1, 0x5A, sizeof(buffer1));
+
+        BlockIOSegment segments[] = {{buffer0, 2}, {buffer1, 1}};
+
+        auto write_result = test_device->WriteBlocksV(BlockIOPriority::INTERACTIVE, segments, 2, 200);
+
+        CHECK(write_result.Successful());
+        CHECK_EQUAL(3, *write_result);
+        CHECK_EQUAL(1, test_device->WriteCommandsIssued());
+
+        CHECK(test_device->ReadFromBlock(readback, 200, 3).Successful());
+
+        CHECK_EQUAL(0, memcmp(buffer0, readback, sizeof(buffer0)));
+        CHECK_EQUAL(0, memcmp(buffer1, readback + sizeof(buffer0), sizeof(buffer1)));
+    }
+
+    TEST(BlockIOVectoredTest, FailedVectoredReadTest)
+    {
+        uint8_t buffer0[BLOCK_SIZE];
+        uint8_t buffer1[BLOCK_SIZE];
+
+        BlockIOSegment segments[] = {{buffer0, 1}, {buffer1, 1}};
+
+        test_device->SimulateReadError();
+
+        auto read_result = test_device->ReadBlocksV(BlockIOPriority::INTERACTIVE, segments, 2, 300);
+
+        CHECK(read_result.Failed());
+        CHECK_EQUAL(BlockIOResultCodes::EMMC_READ_FAILED, read_result.ResultCode());
+    }
+
+    TEST(BlockIOVectoredTest, QueuedRequestsWithScatteredBuffersTest)
+    {
+        uint8_t expected[BLOCK_SIZE * 4];
+        uint8_t buffer0[BLOCK_SIZE * 2];
+        uint8_t buffer1[BLOCK_SIZE * 2];
+
+        CHECK(test_device->ReadFromBlock(expected, 400, 4).Successful());
+
+        //  Requests for adjacent blocks with separate buffers are merged into one vectored read
+
+        BlockIORequest request0(BlockIODirection::READ, buffer0, 400, 2);
+        BlockIORequest request1(BlockIODirection::READ, buffer1, 402, 2);
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request1));
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, test_device->SubmitRequest(request0));
+
+        CHECK_EQUAL(2, test_device->ProcessRequests());
+        CHECK_EQUAL(2, test_device->ReadCommandsIssued());
+
+        CHECK_EQUAL(0, memcmp(expected, buffer0, sizeof(buffer0)));
+        CHECK_EQUAL(0, memcmp(expected + sizeof(buffer0), buffer1, sizeof(buffer1)));
+    }
+}
@@ -0,0 +1,331 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "../cpputest_support.h"
+
+#include <string.h>
+
+#include "heaps.h"
+
+#include "devices/cached_block_io.h"
+
+#include "../utility/in_memory_blockio_device.h"
+
+namespace
+{
+    minstd::unique_ptr<ut_utility::InMemoryFileBlockIODevice> test_device;
+    minstd::unique_ptr<CachedBlockIODevice> cached_device;
+
+    constexpr uint32_t BLOCK_SIZE = ut_utility::InMemoryFileBlockIODevice::BLOCK_SIZE_IN_BYTES;
+    constexpr uint32_t CACHE_SIZE_IN_BLOCKS = 8;
+
+    void FillPattern(uint8_t *buffer, uint32_t blocks, uint8_t seed)
+    {
+        for (uint32_t i = 0; i < blocks * BLOCK_SIZE; i++)
+        {
+            buffer[i] = (uint8_t)(seed + i);
+        }
+    }
+
+    void CheckDeviceMatches(const uint8_t *expected, uint32_t block_number, uint32_t block_count)
+    {
+        uint8_t device_contents[BLOCK_SIZE * 8];
+
+        CHECK(block_count <= 8);
+        CHECK(test_device->ReadFromBlock(device_contents, block_number, block_count).Successful());
+        CHECK_EQUAL(0, memcmp(expected, device_contents, block_count * BLOCK_SIZE));
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+    TEST_GROUP (CachedBlockIOTest)
+    {
+        void setup()
+        {
+            CHECK_EQUAL(0, __os_dynamic_heap_core.bytes_in_use());
+
+            test_device = make_dynamic_unique<ut_utility::InMemoryFileBlockIODevice>("IN_MEMORY_TEST_DEVICE");
+
+            CHECK(test_device->Open("./test/data/test_fat32.img"));
+
+            cached_device = make_dynamic_unique<CachedBlockIODevice>(false, "CACHED_TEST_DEVICE", "CACHED_TEST_DEVICE", *test_device, __os_dynamic_heap_resource, CACHE_SIZE_IN_BLOCKS);
+        }
+
+        void teardown()
+        {
+            cached_device = minstd::unique_ptr<CachedBlockIODevice>();
+            test_device = minstd::unique_ptr<ut_utility::InMemoryFileBlockIODevice>();
+
+            CHECK_EQUAL(0, __os_dynamic_heap_core.bytes_in_use());
+        }
+    };
+#pragma GCC diagnostic pop
+
+    TEST(CachedBlockIOTest, RepeatedReadsAreServedFromCacheTest)
+    {
+        uint8_t buffer[BLOCK_SIZE * 4];
+
+        CHECK_SUCCESSFUL_AND_EQUAL(4, cached_device->ReadFromBlock(buffer, 100, 4));
+        CHECK_EQUAL(1, test_device->ReadCommandsIssued());
+        CHECK_EQUAL(4, cached_device->CacheMisses());
+        CheckDeviceMatches(buffer, 100, 4);
+
+        memset(buffer, 0, sizeof(buffer));
+
+        CHECK_SUCCESSFUL_AND_EQUAL(4, cached_device->ReadFromBlock(buffer, 100, 4));
+        CHECK_EQUAL(2, test_device->ReadCommandsIssued()); //  The second command is the CheckDeviceMatches() read
+        CHECK_EQUAL(4, cached_device->CacheHits());
+        CheckDeviceMatches(buffer, 100, 4);
+    }
+
+    TEST(CachedBlockIOTest, CacheStatisticsThroughBaseClassTest)
+    {
+        uint8_t buffer[BLOCK_SIZE * 2];
+
+        BlockIODevice &cache = *cached_device;
+        BlockIODevice &device = *test_device;
+
+        CHECK(device.CacheStatistics() == nullptr);
+        CHECK(device.UnderlyingDevice() == nullptr);
+        CHECK(cache.UnderlyingDevice() == &device);
+
+        CHECK_SUCCESSFUL_AND_EQUAL(2, cached_device->ReadFromBlock(buffer, 100, 2));
+        CHECK(cached_device->WriteBlock(buffer, 200, 1).Successful());
+
+        const BlockIOCacheStatistics *statistics = cache.CacheStatistics();
+
+        CHECK(statistics != nullptr);
+        CHECK_EQUAL(CACHE_SIZE_IN_BLOCKS, statistics->CacheSizeInBlocks());
+        CHECK_EQUAL(1, statistics->DirtyBlocks());
+        CHECK_EQUAL(2, statistics->Misses());
+        CHECK_EQUAL(0, statistics->Hits());
+    }
+
+    TEST(CachedBlockIOTest, PartialHitReadsOnlyMissingRunsTest)
+    {
+        uint8_t buffer[BLOCK_SIZE * 4];
+
+        CHECK_SUCCESSFUL_AND_EQUAL(2, cached_device->ReadFromBlock(buffer, 101, 2));
+        CHECK_EQUAL(1, test_device->ReadCommandsIssued());
+
+        //  Blocks 101 and 102 are cached, so only 100 and 103 should be read from the device
+
+        CHECK_SUCCESSFUL_AND_EQUAL(4, cached_device->ReadFromBlock(buffer, 100, 4));
+        CHECK_EQUAL(3, test_device->ReadCommandsIssued());
+        CHECK_EQUAL(2, cached_device->CacheHits());
+        CHECK_EQUAL(4, cached_device->CacheMisses());
+
+        CheckDeviceMatches(buffer, 100, 4);
+    }
+
+    TEST(CachedBlockIOTest, WritesAreDeferredUntilFlushTest)
+    {
+        uint8_t original[BLOCK_SIZE * 3];
+        uint8_t pattern[BLOCK_SIZE * 3];
+        uint8_t buffer[BLOCK_SIZE * 3];
+
+        CHECK(test_device->ReadFromBlock(original, 200, 3).Successful());
+
+        FillPattern(pattern, 3, 0x5A);
+
+        CHECK_SUCCESSFUL_AND_EQUAL(3, cached_device->WriteBlock(pattern, 200, 3));
+        CHECK_EQUAL(0, test_device->WriteCommandsIssued());
+        CHECK_EQUAL(3, cached_device->DirtyBlocks());
+
+        //  The cache returns the new data, the device still holds the old data
+
+        CHECK_SUCCESSFUL_AND_EQUAL(3, cached_device->ReadFromBlock(buffer, 200, 3));
+        CHECK_EQUAL(0, memcmp(pattern, buffer, sizeof(pattern)));
+        CheckDeviceMatches(original, 200, 3);
+
+        //  Flushing coalesces the three contiguous blocks into a single write
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, cached_device->Flush());
+        CHECK_EQUAL(1, test_device->WriteCommandsIssued());
+        CHECK_EQUAL(0, cached_device->DirtyBlocks());
+        CHECK_EQUAL(3, cached_device->BlocksWrittenBack());
+        CheckDeviceMatches(pattern, 200, 3);
+    }
+
+    TEST(CachedBlockIOTest, FlushWritesSortedRunsTest)
+    {
+        uint8_t pattern[BLOCK_SIZE];
+
+        //  Blocks written out of order, 300-302 form one run and 310 another
+
+        FillPattern(pattern, 1, 0x10);
+        CHECK(cached_device->WriteBlock(pattern, 302, 1).Successful());
+        CHECK(cached_device->WriteBlock(pattern, 310, 1).Successful());
+        CHECK(cached_device->WriteBlock(pattern, 300, 1).Successful());
+        CHECK(cached_device->WriteBlock(pattern, 301, 1).Successful());
+
+        CHECK_EQUAL(4, cached_device->DirtyBlocks());
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, cached_device->Flush());
+        CHECK_EQUAL(2, test_device->WriteCommandsIssued());
+
+        CheckDeviceMatches(pattern, 300, 1);
+        CheckDeviceMatches(pattern, 301, 1);
+        CheckDeviceMatches(pattern, 302, 1);
+        CheckDeviceMatches(pattern, 310, 1);
+    }
+
+    TEST(CachedBlockIOTest, EvictionWritesBackDirtyBlocksTest)
+    {
+        uint8_t pattern[BLOCK_SIZE];
+        uint8_t buffer[BLOCK_SIZE * 4];
+
+        FillPattern(pattern, 1, 0xA5);
+
+        CHECK(cached_device->WriteBlock(pattern, 400, 1).Successful());
+        CHECK_EQUAL(0, test_device->WriteCommandsIssued());
+
+        //  Read enough other blocks to push the dirty block out of the cache
+
+        CHECK(cached_device->ReadFromBlock(buffer, 500, 4).Successful());
+        CHECK_EQUAL(0, test_device->WriteCommandsIssued());
+        CHECK(cached_device->ReadFromBlock(buffer, 510, 4).Successful());
+
+        CHECK_EQUAL(1, test_device->WriteCommandsIssued());
+        CHECK_EQUAL(0, cached_device->DirtyBlocks());
+        CheckDeviceMatches(pattern, 400, 1);
+    }
+
+    TEST(CachedBlockIOTest, LargeWritesPassThroughTest)
+    {
+        uint8_t buffer[BLOCK_SIZE * 6];
+        uint8_t pattern[BLOCK_SIZE * 6];
+
+        CHECK(cached_device->ReadFromBlock(buffer, 600, 2).Successful());
+
+        //  A dirty copy of a block in the range must not be written back over the new data
+
+        FillPattern(pattern, 1, 0x77);
+
+        CHECK(cached_device->WriteBlock(pattern, 603, 1).Successful());
+        CHECK_EQUAL(1, cached_device->DirtyBlocks());
+
+        FillPattern(pattern, 6, 0x33);
+
+        CHECK_SUCCESSFUL_AND_EQUAL(6, cached_device->WriteBlock(pattern, 600, 6));
+        CHECK_EQUAL(1, test_device->WriteCommandsIssued());
+        CHECK_EQUAL(0, cached_device->DirtyBlocks());
+        CheckDeviceMatches(pattern, 600, 6);
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, cached_device->Flush());
+        CHECK_EQUAL(1, test_device->WriteCommandsIssued());
+        CheckDeviceMatches(pattern, 600, 6);
+
+        //  The previously cached blocks were dropped, so they are read again and reflect the write
+
+        uint32_t read_commands = test_device->ReadCommandsIssued();
+
+        CHECK(cached_device->ReadFromBlock(buffer, 600, 2).Successful());
+        CHECK_EQUAL(read_commands + 1, test_device->ReadCommandsIssued());
+        CHECK_EQUAL(0, memcmp(pattern, buffer, BLOCK_SIZE * 2));
+    }
+
+    TEST(CachedBlockIOTest, DiscardDropsCachedBlocksTest)
+    {
+        uint8_t pattern[BLOCK_SIZE * 4];
+
+        FillPattern(pattern, 4, 0x33);
+
+        CHECK_SUCCESSFUL_AND_EQUAL(4, cached_device->WriteBlock(pattern, 300, 4));
+        CHECK_EQUAL(4, cached_device->DirtyBlocks());
+
+        //  Discarding the middle two blocks drops them without a write back and passes the discard to the device
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, cached_device->Discard(301, 2));
+        CHECK_EQUAL(2, cached_device->DirtyBlocks());
+        CHECK_EQUAL(1, test_device->DiscardCommandsIssued());
+        CHECK_EQUAL(2, test_device->BlocksDiscarded());
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, cached_device->Flush());
+        CHECK_EQUAL(2, test_device->WriteCommandsIssued());
+        CHECK_EQUAL(2, cached_device->BlocksWrittenBack());
+    }
+
+    TEST(CachedBlockIOTest, FailedFlushLeavesBlocksDirtyTest)
+    {
+        uint8_t pattern[BLOCK_SIZE * 2];
+
+        FillPattern(pattern, 2, 0x77);
+
+        CHECK(cached_device->WriteBlock(pattern, 700, 2).Successful());
+
+        test_device->SimulateWriteError();
+
+        CHECK_EQUAL(BlockIOResultCodes::EMMC_DATA_COMMAND_MAX_RETRIES, cached_device->Flush());
+        CHECK_EQUAL(2, cached_device->DirtyBlocks());
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, cached_device->Flush());
+        CHECK_EQUAL(0, cached_device->DirtyBlocks());
+        CheckDeviceMatches(pattern, 700, 2);
+    }
+
+    TEST(CachedBlockIOTest, FailedEvictionFailsOnlyTriggeringWriteTest)
+    {
+        uint8_t pattern[BLOCK_SIZE * CACHE_SIZE_IN_BLOCKS];
+        uint8_t new_blocks[BLOCK_SIZE * 2];
+
+        FillPattern(pattern, CACHE_SIZE_IN_BLOCKS, 0x3C);
+        FillPattern(new_blocks, 2, 0xC3);
+
+        //  Fill the cache with dirty blocks, block 1000 is the least recently used
+
+        CHECK(cached_device->WriteBlock(pattern, 1000, CACHE_SIZE_IN_BLOCKS / 2).Successful());
+        CHECK(cached_device->WriteBlock(pattern + (BLOCK_SIZE * (CACHE_SIZE_IN_BLOCKS / 2)), 1000 + (CACHE_SIZE_IN_BLOCKS / 2), CACHE_SIZE_IN_BLOCKS / 2).Successful());
+        CHECK_EQUAL(CACHE_SIZE_IN_BLOCKS, cached_device->DirtyBlocks());
+
+        test_device->SimulateWriteError();
+
+        auto failed_write = cached_device->WriteBlock(new_blocks, 1100, 1);
+
+        CHECK(failed_write.Failed());
+        CHECK_EQUAL(BlockIOResultCodes::EMMC_DATA_COMMAND_MAX_RETRIES, failed_write.ResultCode());
+        CHECK_EQUAL(CACHE_SIZE_IN_BLOCKS, cached_device->DirtyBlocks());
+
+        //  The block which could not be written back is moved out of the way, the next write evicts block 1001 instead
+
+        CHECK(cached_device->WriteBlock(new_blocks + BLOCK_SIZE, 1101, 1).Successful());
+        CHECK_EQUAL(CACHE_SIZE_IN_BLOCKS, cached_device->DirtyBlocks());
+        CheckDeviceMatches(pattern + BLOCK_SIZE, 1001, 1);
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, cached_device->Flush());
+        CHECK_EQUAL(0, cached_device->DirtyBlocks());
+        CheckDeviceMatches(pattern, 1000, 1);
+        CheckDeviceMatches(new_blocks + BLOCK_SIZE, 1101, 1);
+    }
+
+    TEST(CachedBlockIOTest, FailedReadIsReturnedTest)
+    {
+        uint8_t buffer[BLOCK_SIZE * 2];
+
+        test_device->SimulateReadError();
+
+        CHECK_FAILED_WITH_CODE(BlockIOResultCodes::EMMC_READ_FAILED, cached_device->ReadFromBlock(buffer, 800, 2));
+        CHECK_EQUAL(0, cached_device->CacheMisses());
+
+        //  Nothing was cached, so the retry goes to the device
+
+        CHECK(cached_device->ReadFromBlock(buffer, 800, 2).Successful());
+        CHECK_EQUAL(2, test_device->ReadCommandsIssued());
+    }
+
+    TEST(CachedBlockIOTest, DestructionFlushesDirtyBlocksTest)
+    {
+        uint8_t pattern[BLOCK_SIZE];
+
+        FillPattern(pattern, 1, 0x42);
+
+        CHECK(cached_device->WriteBlock(pattern, 900, 1).Successful());
+        CHECK_EQUAL(0, test_device->WriteCommandsIssued());
+
+        cached_device = minstd::unique_ptr<CachedBlockIODevice>();
+
+        CHECK_EQUAL(1, test_device->WriteCommandsIssued());
+        CheckDeviceMatches(pattern, 900, 1);
+    }
+}
@@ -0,0 +1,30 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "../cpputest_support.h"
+
+#include "open_test_block_io_device.h"
+
+namespace block_io::test
+{
+    minstd::unique_ptr<ut_utility::InMemoryFileBlockIODevice> test_device;
+
+    void OpenTestBlockIODevice()
+    {
+        //  Every test starts with nothing allocated, so leaks show up in CloseTestBlockIODevice()
+
+        CHECK_EQUAL(0, __os_dynamic_heap_core.bytes_in_use());
+
+        test_device = make_dynamic_unique<ut_utility::InMemoryFileBlockIODevice>("IN_MEMORY_TEST_DEVICE");
+
+        CHECK(test_device->Open("./test/data/test_fat32.img"));
+    }
+
+    void CloseTestBlockIODevice()
+    {
+        test_device = minstd::unique_ptr<ut_utility::InMemoryFileBlockIODevice>();
+
+        CHECK_EQUAL(0, __os_dynamic_heap_core.bytes_in_use());
+    }
+}
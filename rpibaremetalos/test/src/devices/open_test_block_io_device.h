@@ -0,0 +1,18 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#pragma once
+
+#include "heaps.h"
+
+#include "../utility/in_memory_blockio_device.h"
+
+namespace block_io::test
+{
+    extern minstd::unique_ptr<ut_utility::InMemoryFileBlockIODevice> test_device;
+
+    void OpenTestBlockIODevice();
+
+    void CloseTestBlockIODevice();
+}
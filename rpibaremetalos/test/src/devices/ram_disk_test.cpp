@@ -0,0 +1,92 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "../cpputest_support.h"
+
+#include <string.h>
+
+#include "devices/ram_disk.h"
+
+namespace
+{
+    constexpr uint32_t BLOCK_SIZE = RamDiskBlockIODevice::BLOCK_SIZE_IN_BYTES;
+    constexpr uint32_t RAM_DISK_SIZE_IN_BLOCKS = 64;
+
+    uint8_t ram_disk_storage[RAM_DISK_SIZE_IN_BLOCKS * BLOCK_SIZE];
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+    TEST_GROUP (RamDiskTest)
+    {
+        void setup()
+        {
+            memset(ram_disk_storage, 0xEE, sizeof(ram_disk_storage));
+        }
+    };
+#pragma GCC diagnostic pop
+
+    TEST(RamDiskTest, ReadWriteRoundTripTest)
+    {
+        RamDiskBlockIODevice ram_disk(false, "RAM_DISK_TEST", "RAM_DISK_TEST", ram_disk_storage, RAM_DISK_SIZE_IN_BLOCKS);
+
+        CHECK_EQUAL(BLOCK_SIZE, ram_disk.BlockSize());
+        CHECK_EQUAL(RAM_DISK_SIZE_IN_BLOCKS, ram_disk.SizeInBlocks());
+
+        uint8_t write_buffer[BLOCK_SIZE * 3];
+        uint8_t read_buffer[BLOCK_SIZE * 3];
+
+        for (uint32_t i = 0; i < sizeof(write_buffer); i++)
+        {
+            write_buffer[i] = (uint8_t)(i % 251);
+        }
+
+        CHECK_SUCCESSFUL_AND_EQUAL(3, ram_disk.WriteBlock(write_buffer, 10, 3));
+        CHECK_SUCCESSFUL_AND_EQUAL(3, ram_disk.ReadFromBlock(read_buffer, 10, 3));
+        CHECK_EQUAL(0, memcmp(write_buffer, read_buffer, sizeof(write_buffer)));
+
+        //  Reading from the current offset should return the same blocks
+
+        memset(read_buffer, 0, sizeof(read_buffer));
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, ram_disk.Seek(11));
+        CHECK_SUCCESSFUL_AND_EQUAL(2, ram_disk.ReadFromCurrentOffset(read_buffer, 2));
+        CHECK_EQUAL(0, memcmp(write_buffer + BLOCK_SIZE, read_buffer, BLOCK_SIZE * 2));
+    }
+
+    TEST(RamDiskTest, OutOfRangeTest)
+    {
+        RamDiskBlockIODevice ram_disk(false, "RAM_DISK_TEST", "RAM_DISK_TEST", ram_disk_storage, RAM_DISK_SIZE_IN_BLOCKS);
+
+        uint8_t buffer[BLOCK_SIZE * 2];
+
+        //  The last block is accessible, a range running past it is not
+
+        CHECK_SUCCESSFUL_AND_EQUAL(1, ram_disk.ReadFromBlock(buffer, RAM_DISK_SIZE_IN_BLOCKS - 1, 1));
+
+        CHECK_FAILED_WITH_CODE(BlockIOResultCodes::RAM_DISK_BLOCK_OUT_OF_RANGE, ram_disk.ReadFromBlock(buffer, RAM_DISK_SIZE_IN_BLOCKS - 1, 2));
+        CHECK_FAILED_WITH_CODE(BlockIOResultCodes::RAM_DISK_BLOCK_OUT_OF_RANGE, ram_disk.WriteBlock(buffer, RAM_DISK_SIZE_IN_BLOCKS, 1));
+        CHECK_FAILED_WITH_CODE(BlockIOResultCodes::RAM_DISK_BLOCK_OUT_OF_RANGE, ram_disk.WriteBlock(buffer, 0xFFFFFFFF, 2));
+
+        CHECK_EQUAL(BlockIOResultCodes::RAM_DISK_BLOCK_OUT_OF_RANGE, ram_disk.Seek(RAM_DISK_SIZE_IN_BLOCKS + 1));
+        CHECK_EQUAL(BlockIOResultCodes::RAM_DISK_BLOCK_OUT_OF_RANGE, ram_disk.Discard(RAM_DISK_SIZE_IN_BLOCKS - 2, 3));
+    }
+
+    TEST(RamDiskTest, DiscardZeroFillsTest)
+    {
+        RamDiskBlockIODevice ram_disk(false, "RAM_DISK_TEST", "RAM_DISK_TEST", ram_disk_storage, RAM_DISK_SIZE_IN_BLOCKS);
+
+        uint8_t buffer[BLOCK_SIZE * 4];
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, ram_disk.Discard(20, 2));
+
+        CHECK_SUCCESSFUL_AND_EQUAL(4, ram_disk.ReadFromBlock(buffer, 19, 4));
+
+        //  Only the discarded blocks are cleared
+
+        for (uint32_t i = 0; i < sizeof(buffer); i++)
+        {
+            CHECK_EQUAL(((i >= BLOCK_SIZE) && (i < BLOCK_SIZE * 3)) ? 0x00 : 0xEE, buffer[i]);
+        }
+    }
+}
@@ -278,6 +278,70 @@ namespace
         CHECK(Successful(test_fat32->BlockIOAdapter().ReleaseChain(FAT32ClusterIndex(2))));
     }
 
+    TEST(FAT32BlockIOAdapterTest, ReleaseChainDiscardTest)
+    {
+        //  Create the filesystem
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0]);
+
+        CHECK(test_fat32.Successful());
+        CHECK(test_fat32->BlockIOAdapter().DiscardFreedClusters());
+
+        //  Build a chain with two runs of contiguous clusters
+
+        test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(6000), FAT32ClusterIndex(6001));
+        test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(6001), FAT32ClusterIndex(6002));
+        test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(6002), FAT32ClusterIndex(6010));
+        test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(6010), FAT32ClusterIndex(FAT32EntryAllocatedAndEndOfFile));
+
+        CHECK(Successful(test_fat32->BlockIOAdapter().ReleaseChain(FAT32ClusterIndex(6000))));
+
+        //  Each run is discarded with a single request
+
+        CHECK_EQUAL(2, test_device->DiscardCommandsIssued());
+        CHECK_EQUAL(4 * test_fat32->BlockIOAdapter().LogicalSectorsPerCluster(), test_device->BlocksDiscarded());
+
+        CHECK_SUCCESSFUL_AND_EQUAL(FAT32EntryFree, test_fat32->BlockIOAdapter().NextClusterInChain(FAT32ClusterIndex(6010)));
+    }
+
+    TEST(FAT32BlockIOAdapterTest, ReleaseChainFailedFATWriteSkipsDiscardTest)
+    {
+        //  Create the filesystem
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0]);
+
+        CHECK(test_fat32.Successful());
+        CHECK(test_fat32->BlockIOAdapter().DiscardFreedClusters());
+
+        test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(6000), FAT32ClusterIndex(6001));
+        test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(6001), FAT32ClusterIndex(FAT32EntryAllocatedAndEndOfFile));
+
+        //  The freed clusters must not be discarded if the FAT entries freeing them never reach the device
+
+        test_device->SimulateWriteError();
+
+        CHECK(Failed(test_fat32->BlockIOAdapter().ReleaseChain(FAT32ClusterIndex(6000))));
+
+        CHECK_EQUAL(0, test_device->DiscardCommandsIssued());
+    }
+
+    TEST(FAT32BlockIOAdapterTest, ReleaseChainDiscardDisabledTest)
+    {
+        //  Create the filesystem with discard turned off
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0], false);
+
+        CHECK(test_fat32.Successful());
+        CHECK_FALSE(test_fat32->BlockIOAdapter().DiscardFreedClusters());
+
+        test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(6000), FAT32ClusterIndex(6001));
+        test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(6001), FAT32ClusterIndex(FAT32EntryAllocatedAndEndOfFile));
+
+        CHECK(Successful(test_fat32->BlockIOAdapter().ReleaseChain(FAT32ClusterIndex(6000))));
+
+        CHECK_EQUAL(0, test_device->DiscardCommandsIssued());
+    }
+
     TEST(FAT32BlockIOAdapterTest, ReleaseChainIndexOutOfRangeNegativeTest)
     {
         //  Create the filesystem
@@ -294,4 +358,494 @@ namespace
 
         CHECK_FAILED_WITH_CODE(FilesystemResultCodes::FAT32_CLUSTER_OUT_OF_RANGE, test_fat32->BlockIOAdapter().ReleaseChain(FAT32ClusterIndex(0)));
     }
+
+    TEST(FAT32BlockIOAdapterTest, FATCacheChainWalkTest)
+    {
+        //  Build a long chain of consecutive clusters with the cache disabled
+
+        auto uncached_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0], DEFAULT_FAT32_DISCARD_FREED_CLUSTERS, 0);
+
+        CHECK(uncached_fat32.Successful());
+        CHECK_EQUAL(0, uncached_fat32->BlockIOAdapter().FATCache().CacheSizeInSectors());
+
+        for (uint32_t cluster = 6000; cluster < 6999; cluster++)
+        {
+            CHECK(Successful(uncached_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(cluster), FAT32ClusterIndex(cluster + 1))));
+        }
+
+        CHECK(Successful(uncached_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(6999), FAT32EntryAllocatedAndEndOfFile)));
+
+        //  Walk the chain on a cached mount, each FAT sector spanned by the chain should be read only once
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0]);
+
+        CHECK(test_fat32.Successful());
+
+        const uint32_t entries_per_sector = test_fat32->BlockIOAdapter().FATEntriesPerBlock();
+        const uint32_t sectors_spanned = (6999 / entries_per_sector) - (6000 / entries_per_sector) + 1;
+
+        uint32_t reads_before_walk = test_device->ReadCommandsIssued();
+
+        FAT32ClusterIndex current_cluster(6000);
+        uint32_t chain_length = 1;
+
+        while (true)
+        {
+            auto next_cluster = test_fat32->BlockIOAdapter().NextClusterInChain(current_cluster);
+
+            CHECK(next_cluster.Successful());
+
+            if (*next_cluster >= FAT32EntryEOFThreshold)
+            {
+                break;
+            }
+
+            CHECK_EQUAL((uint32_t)current_cluster + 1, (uint32_t)*next_cluster);
+
+            current_cluster = *next_cluster;
+            chain_length++;
+        }
+
+        CHECK_EQUAL(1000, chain_length);
+        CHECK_EQUAL(sectors_spanned, test_device->ReadCommandsIssued() - reads_before_walk);
+        CHECK_EQUAL(sectors_spanned, test_fat32->BlockIOAdapter().FATCache().Misses());
+        CHECK_EQUAL(1000 - sectors_spanned, test_fat32->BlockIOAdapter().FATCache().Hits());
+    }
+
+    TEST(FAT32BlockIOAdapterTest, FATCacheWriteThroughTest)
+    {
+        //  Create the filesystem
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0]);
+
+        CHECK(test_fat32.Successful());
+
+        //  Single FAT entry updates go straight to the device, once for each copy of the FAT
+
+        uint32_t writes_before_update = test_device->WriteCommandsIssued();
+
+        CHECK(Successful(test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(6000), FAT32ClusterIndex(6001))));
+
+        CHECK_EQUAL(2, test_fat32->BlockIOAdapter().NumberOfFATs());
+        CHECK_EQUAL(writes_before_update + test_fat32->BlockIOAdapter().NumberOfFATs(), test_device->WriteCommandsIssued());
+        CHECK_EQUAL(0, test_fat32->BlockIOAdapter().FATCache().DirtySectors());
+
+        //  A mount without the cache sees the update on the device
+
+        auto uncached_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0], DEFAULT_FAT32_DISCARD_FREED_CLUSTERS, 0);
+
+        CHECK(uncached_fat32.Successful());
+
+        CHECK_SUCCESSFUL_AND_EQUAL(6001U, uncached_fat32->BlockIOAdapter().NextClusterInChain(FAT32ClusterIndex(6000)));
+    }
+
+    TEST(FAT32BlockIOAdapterTest, FATCacheReleaseChainWriteBackTest)
+    {
+        //  Create the filesystem
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0]);
+
+        CHECK(test_fat32.Successful());
+
+        //  Build a chain which crosses several FAT sectors
+
+        for (uint32_t cluster = 6000; cluster < 6299; cluster++)
+        {
+            CHECK(Successful(test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(cluster), FAT32ClusterIndex(cluster + 1))));
+        }
+
+        CHECK(Successful(test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(6299), FAT32EntryAllocatedAndEndOfFile)));
+
+        //  Releasing the chain writes each FAT sector holding part of the chain exactly once.  The sectors are consecutive, so
+        //      they go out as one request per FAT copy.
+
+        const uint32_t entries_per_sector = test_fat32->BlockIOAdapter().FATEntriesPerBlock();
+        const uint32_t sectors_spanned = (6299 / entries_per_sector) - (6000 / entries_per_sector) + 1;
+
+        uint32_t writes_before_release = test_device->WriteCommandsIssued();
+        uint64_t sectors_written_before_release = test_fat32->BlockIOAdapter().FATCache().SectorsWrittenBack();
+
+        CHECK(Successful(test_fat32->BlockIOAdapter().ReleaseChain(FAT32ClusterIndex(6000))));
+
+        CHECK_EQUAL(test_fat32->BlockIOAdapter().NumberOfFATs(), test_device->WriteCommandsIssued() - writes_before_release);
+        CHECK_EQUAL(sectors_spanned, test_fat32->BlockIOAdapter().FATCache().SectorsWrittenBack() - sectors_written_before_release);
+        CHECK_EQUAL(0, test_fat32->BlockIOAdapter().FATCache().DirtySectors());
+
+        //  The released entries are free on the device
+
+        auto uncached_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0], DEFAULT_FAT32_DISCARD_FREED_CLUSTERS, 0);
+
+        CHECK(uncached_fat32.Successful());
+
+        CHECK_SUCCESSFUL_AND_EQUAL(FAT32EntryFree, uncached_fat32->BlockIOAdapter().NextClusterInChain(FAT32ClusterIndex(6000)));
+        CHECK_SUCCESSFUL_AND_EQUAL(FAT32EntryFree, uncached_fat32->BlockIOAdapter().NextClusterInChain(FAT32ClusterIndex(6150)));
+        CHECK_SUCCESSFUL_AND_EQUAL(FAT32EntryFree, uncached_fat32->BlockIOAdapter().NextClusterInChain(FAT32ClusterIndex(6299)));
+    }
+
+    TEST(FAT32BlockIOAdapterTest, ReleaseChainUncachedTest)
+    {
+        //  Create the filesystem with the FAT cache turned off
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0], DEFAULT_FAT32_DISCARD_FREED_CLUSTERS, 0);
+
+        CHECK(test_fat32.Successful());
+        CHECK(test_fat32->BlockIOAdapter().FreeClusterBitmap().Initialized());
+
+        const uint32_t free_clusters = test_fat32->BlockIOAdapter().FreeClusterBitmap().FreeClusters();
+
+        //  Build a chain which crosses several FAT sectors
+
+        for (uint32_t cluster = 6000; cluster < 6299; cluster++)
+        {
+            CHECK(Successful(test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(cluster), FAT32ClusterIndex(cluster + 1))));
+        }
+
+        CHECK(Successful(test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(6299), FAT32EntryAllocatedAndEndOfFile)));
+
+        CHECK_EQUAL(free_clusters - 300, test_fat32->BlockIOAdapter().FreeClusterBitmap().FreeClusters());
+
+        //  Even without the cache, each FAT sector holding part of the chain is read once and written once to each FAT copy
+
+        const uint32_t entries_per_sector = test_fat32->BlockIOAdapter().FATEntriesPerBlock();
+        const uint32_t sectors_spanned = (6299 / entries_per_sector) - (6000 / entries_per_sector) + 1;
+
+        uint32_t reads_before_release = test_device->ReadCommandsIssued();
+        uint32_t writes_before_release = test_device->WriteCommandsIssued();
+
+        CHECK(Successful(test_fat32->BlockIOAdapter().ReleaseChain(FAT32ClusterIndex(6000))));
+
+        CHECK_EQUAL(sectors_spanned, test_device->ReadCommandsIssued() - reads_before_release);
+        CHECK_EQUAL(sectors_spanned * test_fat32->BlockIOAdapter().NumberOfFATs(), test_device->WriteCommandsIssued() - writes_before_release);
+
+        //  The bitmap is updated in the same pass
+
+        CHECK_EQUAL(free_clusters, test_fat32->BlockIOAdapter().FreeClusterBitmap().FreeClusters());
+
+        CHECK_SUCCESSFUL_AND_EQUAL(FAT32EntryFree, test_fat32->BlockIOAdapter().NextClusterInChain(FAT32ClusterIndex(6000)));
+        CHECK_SUCCESSFUL_AND_EQUAL(FAT32EntryFree, test_fat32->BlockIOAdapter().NextClusterInChain(FAT32ClusterIndex(6299)));
+    }
+
+    TEST(FAT32BlockIOAdapterTest, ReleaseChainDamagedChainNegativeTest)
+    {
+        //  Create the filesystem
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0]);
+
+        CHECK(test_fat32.Successful());
+
+        //  A chain running into a free cluster is released up to the bad link
+
+        CHECK(Successful(test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(6000), FAT32ClusterIndex(6001))));
+
+        CHECK_FAILED_WITH_CODE(FilesystemResultCodes::FAT32_CLUSTER_OUT_OF_RANGE, test_fat32->BlockIOAdapter().ReleaseChain(FAT32ClusterIndex(6000)));
+
+        CHECK_SUCCESSFUL_AND_EQUAL(FAT32EntryFree, test_fat32->BlockIOAdapter().NextClusterInChain(FAT32ClusterIndex(6000)));
+        CHECK_SUCCESSFUL_AND_EQUAL(FAT32EntryFree, test_fat32->BlockIOAdapter().NextClusterInChain(FAT32ClusterIndex(6001)));
+        CHECK_EQUAL(0, test_fat32->BlockIOAdapter().FATCache().DirtySectors());
+    }
+
+    TEST(FAT32BlockIOAdapterTest, FATCacheDisabledTest)
+    {
+        //  Create the filesystem with the FAT cache turned off
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0], DEFAULT_FAT32_DISCARD_FREED_CLUSTERS, 0);
+
+        CHECK(test_fat32.Successful());
+
+        //  Every FAT access goes to the device
+
+        uint32_t reads_before = test_device->ReadCommandsIssued();
+
+        CHECK(test_fat32->BlockIOAdapter().NextClusterInChain(FAT32ClusterIndex(2)).Successful());
+        CHECK(test_fat32->BlockIOAdapter().NextClusterInChain(FAT32ClusterIndex(2)).Successful());
+
+        CHECK_EQUAL(reads_before + 2, test_device->ReadCommandsIssued());
+        CHECK_EQUAL(0, test_fat32->BlockIOAdapter().FATCache().Hits());
+        CHECK_EQUAL(0, test_fat32->BlockIOAdapter().FATCache().Misses());
+    }
+
+    TEST(FAT32BlockIOAdapterTest, FreeClusterBitmapTest)
+    {
+        //  Create the filesystem, the free cluster bitmap is loaded at mount
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0]);
+
+        CHECK(test_fat32.Successful());
+        CHECK(test_fat32->BlockIOAdapter().FreeClusterBitmap().Initialized());
+
+        const uint32_t free_clusters = test_fat32->BlockIOAdapter().FreeClusterBitmap().FreeClusters();
+
+        CHECK(free_clusters > 0);
+
+        //  Finding a free cluster does not touch the device
+
+        uint32_t reads_before_search = test_device->ReadCommandsIssued();
+
+        CHECK_SUCCESSFUL_AND_EQUAL(33U, test_fat32->BlockIOAdapter().FindNextEmptyCluster(FAT32ClusterIndex(2)));
+
+        CHECK_EQUAL(reads_before_search, test_device->ReadCommandsIssued());
+
+        //  Allocating and freeing clusters keeps the bitmap current
+
+        CHECK(Successful(test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(33), FAT32ClusterIndex(34))));
+        CHECK(Successful(test_fat32->BlockIOAdapter().UpdateFATTableEntry(FAT32ClusterIndex(34), FAT32EntryAllocatedAndEndOfFile)));
+
+        CHECK_EQUAL(free_clusters - 2, test_fat32->BlockIOAdapter().FreeClusterBitmap().FreeClusters());
+        CHECK_SUCCESSFUL_AND_EQUAL(35U, test_fat32->BlockIOAdapter().FindNextEmptyCluster(FAT32ClusterIndex(2)));
+
+        CHECK(Successful(test_fat32->BlockIOAdapter().ReleaseChain(FAT32ClusterIndex(33))));
+
+        CHECK_EQUAL(free_clusters, test_fat32->BlockIOAdapter().FreeClusterBitmap().FreeClusters());
+        CHECK_SUCCESSFUL_AND_EQUAL(33U, test_fat32->BlockIOAdapter().FindNextEmptyCluster(FAT32ClusterIndex(2)));
+    }
+
+    TEST(FAT32BlockIOAdapterTest, FreeClusterBitmapWrapAroundTest)
+    {
+        //  Create the filesystem
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0]);
+
+        CHECK(test_fat32.Successful());
+
+        //  Move the allocation hint to the end of the volume by allocating the last two clusters, the maximum cluster
+        //      number is itself a cluster which can be allocated
+
+        FAT32ClusterIndex max_ci = test_fat32->BlockIOAdapter().MaximumClusterNumber();
+        FAT32ClusterIndex max_ci_minus_1 = FAT32ClusterIndex((uint32_t)max_ci - 1);
+
+        CHECK_SUCCESSFUL_AND_EQUAL(max_ci_minus_1, test_fat32->BlockIOAdapter().FindNextEmptyCluster(max_ci_minus_1));
+        CHECK(Successful(test_fat32->BlockIOAdapter().UpdateFATTableEntry(max_ci_minus_1, FAT32EntryAllocatedAndEndOfFile)));
+
+        CHECK_SUCCESSFUL_AND_EQUAL(max_ci, test_fat32->BlockIOAdapter().FindNextEmptyCluster(max_ci_minus_1));
+        CHECK(Successful(test_fat32->BlockIOAdapter().UpdateFATTableEntry(max_ci, FAT32EntryAllocatedAndEndOfFile)));
+
+        //  A search from the hint wraps around to the first free cluster, an explicit search does not
+
+        CHECK_SUCCESSFUL_AND_EQUAL(33U, test_fat32->BlockIOAdapter().FindNextEmptyCluster());
+        CHECK_FAILED_WITH_CODE(FilesystemResultCodes::FAT32_DEVICE_FULL, test_fat32->BlockIOAdapter().FindNextEmptyCluster(max_ci_minus_1).ResultCode());
+    }
+
+    TEST(FAT32BlockIOAdapterTest, FreeClusterBitmapDisabledTest)
+    {
+        //  Create the filesystem without the free cluster bitmap
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0], DEFAULT_FAT32_DISCARD_FREED_CLUSTERS, DEFAULT_FAT32_FAT_CACHE_SIZE_IN_SECTORS, false);
+
+        CHECK(test_fat32.Successful());
+        CHECK_FALSE(test_fat32->BlockIOAdapter().FreeClusterBitmap().Initialized());
+
+        //  The search falls back to scanning the FAT
+
+        uint32_t reads_before_search = test_device->ReadCommandsIssued();
+
+        CHECK_SUCCESSFUL_AND_EQUAL(33U, test_fat32->BlockIOAdapter().FindNextEmptyCluster(FAT32ClusterIndex(2)));
+
+        CHECK(test_device->ReadCommandsIssued() > reads_before_search);
+    }
+
+    void CheckLastClusterAllocatable(bool free_cluster_bitmap)
+    {
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0], DEFAULT_FAT32_DISCARD_FREED_CLUSTERS, DEFAULT_FAT32_FAT_CACHE_SIZE_IN_SECTORS, free_cluster_bitmap);
+
+        CHECK(test_fat32.Successful());
+
+        FAT32BlockIOAdapter &adapter = test_fat32->BlockIOAdapter();
+
+        //  The maximum cluster number is the last cluster on the volume, not one past it
+
+        FAT32ClusterIndex max_ci = adapter.MaximumClusterNumber();
+        FAT32ClusterIndex max_ci_minus_1 = FAT32ClusterIndex((uint32_t)max_ci - 1);
+
+        CHECK_SUCCESSFUL_AND_EQUAL(max_ci, adapter.FindNextEmptyCluster(max_ci));
+
+        //  A chain ending just before the last cluster is extended into it
+
+        CHECK(Successful(adapter.UpdateFATTableEntry(max_ci_minus_1, FAT32EntryAllocatedAndEndOfFile)));
+
+        auto extent = adapter.AllocateExtent(max_ci_minus_1, 4);
+
+        CHECK(extent.Successful());
+        CHECK_EQUAL((uint32_t)max_ci, (uint32_t)extent->first_cluster_);
+        CHECK_EQUAL(1U, extent->number_of_clusters_);
+    }
+
+    TEST(FAT32BlockIOAdapterTest, LastClusterAllocatableTest)
+    {
+        CheckLastClusterAllocatable(true);
+    }
+
+    TEST(FAT32BlockIOAdapterTest, LastClusterAllocatableWithoutBitmapTest)
+    {
+        CheckLastClusterAllocatable(false);
+    }
+
+    TEST(FAT32BlockIOAdapterTest, AllocateExtentTest)
+    {
+        //  Create the filesystem, the free cluster bitmap is loaded at mount
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0]);
+
+        CHECK(test_fat32.Successful());
+
+        FAT32BlockIOAdapter &adapter = test_fat32->BlockIOAdapter();
+
+        //  Start a chain at cluster 33 and leave a short hole after it
+
+        CHECK(Successful(adapter.UpdateFATTableEntry(FAT32ClusterIndex(33), FAT32EntryAllocatedAndEndOfFile)));
+        CHECK(Successful(adapter.UpdateFATTableEntry(FAT32ClusterIndex(40), FAT32EntryAllocatedAndEndOfFile)));
+
+        const uint32_t free_clusters = adapter.FreeClusterBitmap().FreeClusters();
+
+        //  The hole is too short, so the extent is placed in the first run long enough and the whole run is written to
+        //      each copy of the FAT with a single sector write.
+
+        uint32_t writes_before_allocation = test_device->WriteCommandsIssued();
+
+        auto extent = adapter.AllocateExtent(FAT32ClusterIndex(33), 16);
+
+        CHECK(extent.Successful());
+        CHECK_EQUAL(41, (uint32_t)extent->first_cluster_);
+        CHECK_EQUAL(16, extent->number_of_clusters_);
+
+        CHECK_EQUAL(writes_before_allocation + adapter.NumberOfFATs(), test_device->WriteCommandsIssued());
+        CHECK_EQUAL(free_clusters - 16, adapter.FreeClusterBitmap().FreeClusters());
+
+        CHECK_SUCCESSFUL_AND_EQUAL(41U, adapter.NextClusterInChain(FAT32ClusterIndex(33)));
+
+        for (uint32_t cluster = 41; cluster < 56; cluster++)
+        {
+            CHECK_SUCCESSFUL_AND_EQUAL(cluster + 1, adapter.NextClusterInChain(FAT32ClusterIndex(cluster)));
+        }
+
+        CHECK_SUCCESSFUL_AND_EQUAL(FAT32EntryAllocatedAndEndOfFile, adapter.NextClusterInChain(FAT32ClusterIndex(56)));
+
+        //  Extending the chain again continues directly after the last extent
+
+        auto next_extent = adapter.AllocateExtent(FAT32ClusterIndex(56), 4);
+
+        CHECK(next_extent.Successful());
+        CHECK_EQUAL(57, (uint32_t)next_extent->first_cluster_);
+        CHECK_EQUAL(4, next_extent->number_of_clusters_);
+
+        CHECK_SUCCESSFUL_AND_EQUAL(57U, adapter.NextClusterInChain(FAT32ClusterIndex(56)));
+
+        //  Releasing the chain returns every cluster
+
+        CHECK(Successful(adapter.ReleaseChain(FAT32ClusterIndex(33))));
+
+        CHECK_EQUAL(free_clusters + 1, adapter.FreeClusterBitmap().FreeClusters());
+    }
+
+    TEST(FAT32BlockIOAdapterTest, AllocateExtentWithoutBitmapTest)
+    {
+        //  Create the filesystem without the free cluster bitmap
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0], DEFAULT_FAT32_DISCARD_FREED_CLUSTERS, DEFAULT_FAT32_FAT_CACHE_SIZE_IN_SECTORS, false);
+
+        CHECK(test_fat32.Successful());
+
+        FAT32BlockIOAdapter &adapter = test_fat32->BlockIOAdapter();
+
+        CHECK(Successful(adapter.UpdateFATTableEntry(FAT32ClusterIndex(33), FAT32EntryAllocatedAndEndOfFile)));
+        CHECK(Successful(adapter.UpdateFATTableEntry(FAT32ClusterIndex(40), FAT32EntryAllocatedAndEndOfFile)));
+
+        //  Without the bitmap the first free run is taken, even if it is short
+
+        auto extent = adapter.AllocateExtent(FAT32ClusterIndex(33), 16);
+
+        CHECK(extent.Successful());
+        CHECK_EQUAL(34, (uint32_t)extent->first_cluster_);
+        CHECK_EQUAL(6, extent->number_of_clusters_);
+
+        CHECK_SUCCESSFUL_AND_EQUAL(34U, adapter.NextClusterInChain(FAT32ClusterIndex(33)));
+        CHECK_SUCCESSFUL_AND_EQUAL(FAT32EntryAllocatedAndEndOfFile, adapter.NextClusterInChain(FAT32ClusterIndex(39)));
+
+        //  The remainder goes after the allocated cluster
+
+        auto next_extent = adapter.AllocateExtent(FAT32ClusterIndex(39), 10);
+
+        CHECK(next_extent.Successful());
+        CHECK_EQUAL(41, (uint32_t)next_extent->first_cluster_);
+        CHECK_EQUAL(10, next_extent->number_of_clusters_);
+
+        CHECK_SUCCESSFUL_AND_EQUAL(41U, adapter.NextClusterInChain(FAT32ClusterIndex(39)));
+        CHECK_SUCCESSFUL_AND_EQUAL(FAT32EntryAllocatedAndEndOfFile, adapter.NextClusterInChain(FAT32ClusterIndex(50)));
+
+        //  A zero length extent is rejected
+
+        CHECK_FAILED_WITH_CODE(FilesystemResultCodes::FAT32_CLUSTER_OUT_OF_RANGE, adapter.AllocateExtent(FAT32ClusterIndex(50), 0));
+    }
+
+    TEST(FAT32BlockIOAdapterTest, AllocateExtentLinkFailureNegativeTest)
+    {
+        //  Create the filesystem without the FAT cache, so each FAT entry update reads its sector from the device
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0], DEFAULT_FAT32_DISCARD_FREED_CLUSTERS, 0);
+
+        CHECK(test_fat32.Successful());
+
+        FAT32BlockIOAdapter &adapter = test_fat32->BlockIOAdapter();
+
+        CHECK(Successful(adapter.UpdateFATTableEntry(FAT32ClusterIndex(33), FAT32EntryAllocatedAndEndOfFile)));
+
+        const uint32_t free_clusters = adapter.FreeClusterBitmap().FreeClusters();
+
+        //  Fail the third entry of the run, the two already chained are freed again and the chain is left as it was
+
+        test_device->SimulateReadError(2);
+
+        CHECK(adapter.AllocateExtent(FAT32ClusterIndex(33), 4).Failed());
+
+        CHECK_EQUAL(free_clusters, adapter.FreeClusterBitmap().FreeClusters());
+        CHECK_SUCCESSFUL_AND_EQUAL(FAT32EntryAllocatedAndEndOfFile, adapter.NextClusterInChain(FAT32ClusterIndex(33)));
+        CHECK_SUCCESSFUL_AND_EQUAL(34U, adapter.FindNextEmptyCluster(FAT32ClusterIndex(34)));
+        CHECK_SUCCESSFUL_AND_EQUAL(35U, adapter.FindNextEmptyCluster(FAT32ClusterIndex(35)));
+    }
+
+    TEST(FAT32BlockIOAdapterTest, FATTransactionTest)
+    {
+        //  Create the filesystem
+
+        auto test_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0]);
+
+        CHECK(test_fat32.Successful());
+
+        FAT32BlockIOAdapter &adapter = test_fat32->BlockIOAdapter();
+
+        //  Updates made inside a transaction stay in the FAT cache, including those made by a nested transaction
+
+        uint32_t writes_before_transaction = test_device->WriteCommandsIssued();
+
+        adapter.BeginFATTransaction();
+
+        for (uint32_t cluster = 6000; cluster < 6299; cluster++)
+        {
+            CHECK(Successful(adapter.UpdateFATTableEntry(FAT32ClusterIndex(cluster), FAT32ClusterIndex(cluster + 1))));
+        }
+
+        adapter.BeginFATTransaction();
+
+        CHECK(Successful(adapter.UpdateFATTableEntry(FAT32ClusterIndex(6299), FAT32EntryAllocatedAndEndOfFile)));
+
+        CHECK(Successful(adapter.CommitFATTransaction()));
+
+        CHECK_EQUAL(writes_before_transaction, test_device->WriteCommandsIssued());
+        CHECK(adapter.FATCache().DirtySectors() > 0);
+
+        //  The outermost commit writes the consecutive dirty sectors with one request per FAT copy
+
+        CHECK(Successful(adapter.CommitFATTransaction()));
+
+        CHECK_EQUAL(writes_before_transaction + adapter.NumberOfFATs(), test_device->WriteCommandsIssued());
+        CHECK_EQUAL(0, adapter.FATCache().DirtySectors());
+
+        //  A mount without the cache sees the chain on the device
+
+        auto uncached_fat32 = FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0], DEFAULT_FAT32_DISCARD_FREED_CLUSTERS, 0);
+
+        CHECK(uncached_fat32.Successful());
+
+        CHECK_SUCCESSFUL_AND_EQUAL(6001U, uncached_fat32->BlockIOAdapter().NextClusterInChain(FAT32ClusterIndex(6000)));
+        CHECK_SUCCESSFUL_AND_EQUAL(FAT32EntryAllocatedAndEndOfFile, uncached_fat32->BlockIOAdapter().NextClusterInChain(FAT32ClusterIndex(6299)));
+    }
 }
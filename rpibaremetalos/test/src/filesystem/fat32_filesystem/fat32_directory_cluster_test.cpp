@@ -117,6 +117,8 @@ namespace
 
     TEST(FAT32DirectoryCluster, GetClusterEntryDeviceErrorNegativeTest)
     {
+        test::RemountTestFAT32Image(test::TestFAT32ImageMount::UNCACHED);
+
         auto get_filesystem_result = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
 
         FAT32DirectoryCluster test_cluster(get_filesystem_result->Id(),
@@ -685,6 +687,8 @@ namespace
 
     TEST(FAT32DirectoryCluster, CreateAndRemoveLongFilenameEntryDeviceErrorNegativeTest)
     {
+        test::RemountTestFAT32Image(test::TestFAT32ImageMount::UNCACHED);
+
         //  It takes 23 reads to create the entry and another 4 to remove it - simulate an error on the first 27 reads while
         //      insuring the entry is created on the 22nd read and removed on the 27th
 
@@ -830,6 +834,8 @@ namespace
 
     TEST(FAT32DirectoryCluster, CreateAndRemoveShortFilenameEntryDeviceErrorNegativeTest1)
     {
+        test::RemountTestFAT32Image(test::TestFAT32ImageMount::UNCACHED);
+
         //  It takes 23 reads to create the entry and another 4 to remove it - simulate an error on the first 27 reads while
         //      insuring the entry is created on the 22nd read and removed on the 27th
 
@@ -933,6 +939,8 @@ namespace
 
     TEST(FAT32DirectoryCluster, CreateAndRemoveShortFilenameEntryDeviceErrorNegativeTest2)
     {
+        test::RemountTestFAT32Image(test::TestFAT32ImageMount::UNCACHED);
+
         //  It takes 23 reads to create the entry and another 4 to remove it - simulate an error on the first 27 reads while
         //      insuring the entry is created on the 22nd read and removed on the 27th
 
@@ -123,6 +123,8 @@ namespace
 
     TEST(FAT32DirectoryTest, GetDirectoryReadErrorNegativeTest)
     {
+        test::RemountTestFAT32Image(test::TestFAT32ImageMount::UNCACHED);
+
         auto get_filesystem_result = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
 
         CHECK(get_filesystem_result.Successful());
@@ -273,6 +275,8 @@ namespace
 
     TEST(FAT32DirectoryTest, VisitDirectoryNegativeTest)
     {
+        test::RemountTestFAT32Image(test::TestFAT32ImageMount::UNCACHED);
+
         auto get_filesystem_result = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
 
         CHECK(get_filesystem_result.Successful());
@@ -451,6 +455,8 @@ namespace
 
     TEST(FAT32DirectoryTest, CreateDirectoryNegativeTest)
     {
+        test::RemountTestFAT32Image(test::TestFAT32ImageMount::UNCACHED);
+
         auto get_filesystem_result = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
 
         CHECK(get_filesystem_result.Successful());
@@ -616,6 +622,8 @@ namespace
 
     TEST(FAT32DirectoryTest, SetDirectoryEntryFirstClusterNegativeTests)
     {
+        test::RemountTestFAT32Image(test::TestFAT32ImageMount::UNCACHED);
+
         auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
 
         CHECK(filesystem.Successful());
@@ -659,6 +667,8 @@ namespace
 
     TEST(FAT32DirectoryTest, UpdateDirectoryEntrySizeNegativeTests)
     {
+        test::RemountTestFAT32Image(test::TestFAT32ImageMount::UNCACHED);
+
         auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
 
         CHECK(filesystem.Successful());
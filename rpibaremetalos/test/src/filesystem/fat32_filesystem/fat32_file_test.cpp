@@ -4,9 +4,12 @@
 
 #include "../../cpputest_support.h"
 
+#include <string.h>
+
 #include "../../utility/in_memory_blockio_device.h"
 
 #include "filesystem/fat32_directory_cluster.h"
+#include "filesystem/fat32_file_mapping.h"
 #include "filesystem/fat32_filesystem.h"
 #include "filesystem/filesystems.h"
 
@@ -82,316 +85,1196 @@ namespace
         CHECK(root_directory->OpenFile(minstd::fixed_string<>("Lorem ipsum dolor sit amet.text"), FileModes::READ).ResultCode() == FilesystemResultCodes::FILE_NOT_FOUND);
     }
 
-    TEST(FAT32File, CheckSecondFile)
-    {
-        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+    TEST(FAT32File, CheckSecondFile)
+    {
+        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+
+        CHECK(filesystem.Successful());
+
+        //  Get the root directory
+
+        auto subdir1 = filesystem->GetDirectory(minstd::fixed_string<>("/subdir1"));
+
+        CHECK(subdir1.Successful());
+
+        //  Open the file
+
+        auto file = subdir1->OpenFile(minstd::fixed_string<>("A diam maecenas sed enim ut sem.Pellentesque"), FileModes::READ);
+
+        CHECK(file.Successful());
+        CHECK(*(file->AbsolutePath()) == minstd::fixed_string<>("/subdir1/A diam maecenas sed enim ut sem.Pellentesque"));
+
+        //  Read the file
+
+        minstd::stack_buffer<uint8_t, 4096> buffer;
+
+        file->Read(buffer);
+
+        //  Compare with equality with the reference file
+
+        ut_utility::FILE_EQUAL("./test/data/A_diam_maecenas_sed_enim_ut sem.Pellentesque", buffer);
+
+        //  Close and Delete the file and check it is gone
+
+        CHECK(Successful(file->Close()));
+
+        CHECK(Successful(subdir1->DeleteFile(minstd::fixed_string<>("A diam maecenas sed enim ut sem.Pellentesque"))));
+
+        CHECK(subdir1->OpenFile(minstd::fixed_string<>("A diam maecenas sed enim ut sem.Pellentesque"), FileModes::READ).ResultCode() == FilesystemResultCodes::FILE_NOT_FOUND);
+    }
+
+    TEST(FAT32File, FileCreationAndAppendSmallBuffers)
+    {
+        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+
+        CHECK(filesystem.Successful());
+
+        //  Get the directory we use for testing file operations
+
+        auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
+
+        CHECK(directory.Successful());
+
+        //  Create a file
+
+        auto new_file = directory->OpenFile(minstd::fixed_string<>("test small buffers file.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+
+        CHECK(new_file.Successful());
+        CHECK(*(new_file->AbsolutePath()) == minstd::fixed_string<>("/file testing/test small buffers file.txt"));
+
+        //  Append to it
+
+        minstd::stack_buffer<uint8_t, 1024> buffer_to_append;
+
+        buffer_to_append.append((uint8_t *)"This is content for the new File\n", 33);
+
+        for (int i = 0; i < 510; i++)
+        {
+            new_file->Append(buffer_to_append);
+        }
+
+        //  Close it
+
+        new_file->Close();
+
+        //  Open the file again - it already exists, then append some more
+
+        auto new_file1 = directory->OpenFile(minstd::fixed_string<>("test small buffers file.txt"), FileModes::READ_WRITE_APPEND);
+
+        CHECK(new_file1.Successful());
+
+        for (int i = 0; i < 512; i++)
+        {
+            new_file1->Append(buffer_to_append);
+        }
+
+        //  Close it
+
+        new_file1->Close();
+
+        //  Open the file again and check the content is correct.
+        //      There should be 1022 entries of the string above.
+
+        auto file_for_check = directory->OpenFile(minstd::fixed_string<>("test small buffers file.txt"), FileModes::READ);
+
+        CHECK(file_for_check.Successful());
+
+        minstd::stack_buffer<uint8_t, 33 * 1500> read_buffer;
+
+        file_for_check->Read(read_buffer);
+
+        CHECK_EQUAL((33 * 1022), read_buffer.size());
+
+        for (int i = 0; i < 1022; i++)
+        {
+            STRNCMP_EQUAL("This is content for the new File\n", (char *)read_buffer.data() + (i * 33), 33);
+        }
+
+        //  Close and Delete the file and check it is gone
+
+        CHECK(Successful(file_for_check->Close()));
+
+        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("test small buffers file.txt"))));
+
+        CHECK(directory->OpenFile(minstd::fixed_string<>("test small buffers file.txt"), FileModes::READ).ResultCode() == FilesystemResultCodes::FILE_NOT_FOUND);
+    }
+
+    void CreateAndAppendLargeBuffers()
+    {
+        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+
+        CHECK(filesystem.Successful());
+
+        //  Get the directory within which we will test file operations
+
+        auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
+
+        CHECK(directory.Successful());
+
+        minstd::stack_buffer<uint8_t, 16384> reference_buffer;
+
+        {
+            //  Create a file.  It will be closed when the File instance goes out of scope.
+
+            auto new_file = directory->OpenFile(minstd::fixed_string<>("test large buffers file.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+
+            CHECK(new_file.Successful());
+
+            //  Read the data file from the test data directory
+
+            ut_utility::ReadFile("./test/data/long_test_file.txt", reference_buffer);
+
+            //  Append the large buffer to the file twice
+
+            new_file->Append(reference_buffer);
+            new_file->Append(reference_buffer);
+        }
+
+        //  Open the file again - it already exists, then append the reference three more times
+
+        auto new_file1 = directory->OpenFile(minstd::fixed_string<>("test large buffers file.txt"), FileModes::READ_WRITE_APPEND);
+
+        CHECK(new_file1.Successful());
+
+        new_file1->Append(reference_buffer);
+        new_file1->Append(reference_buffer);
+        new_file1->Append(reference_buffer);
+
+        uint32_t file1_size = *(new_file1->Size());
+
+        new_file1->Close();
+
+        //  Open the file again and check the content is correct.
+
+        auto file_for_check = directory->OpenFile(minstd::fixed_string<>("test large buffers file.txt"), FileModes::READ);
+
+        CHECK(file_for_check.Successful());
+
+        minstd::stack_buffer<uint8_t, 6 * 16384> read_buffer;
+
+        file_for_check->Read(read_buffer);
+
+        CHECK_EQUAL(file1_size, read_buffer.size());
+
+        for (int i = 0; i < 5; i++)
+        {
+            STRNCMP_EQUAL((char *)reference_buffer.data(), (char *)read_buffer.data() + (i * reference_buffer.size()), reference_buffer.size());
+        }
+
+        //  Close and Delete the file and check it is gone
+
+        CHECK(Successful(file_for_check->Close()));
+
+        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("test large buffers file.txt"))));
+
+        CHECK(directory->OpenFile(minstd::fixed_string<>("test large buffers file.txt"), FileModes::READ).ResultCode() == FilesystemResultCodes::FILE_NOT_FOUND);
+    }
+
+    TEST(FAT32File, FileCreationAndAppendLargeBuffers)
+    {
+        CreateAndAppendLargeBuffers();
+    }
+
+    TEST(FAT32File, FileCreationAndAppendLargeBuffersWithoutBitmap)
+    {
+        //  Clusters are found by scanning the FAT through the FAT cache
+
+        test::RemountTestFAT32Image(test::TestFAT32ImageMount::NO_BITMAP);
+
+        CreateAndAppendLargeBuffers();
+    }
+
+    TEST(FAT32File, DeferredDirectoryEntryUpdateTest)
+    {
+        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+
+        CHECK(filesystem.Successful());
+
+        auto get_test_device_result = GetOSEntityRegistry().GetEntityByName<ut_utility::InMemoryFileBlockIODevice>("IN_MEMORY_TEST_DEVICE");
+
+        CHECK(get_test_device_result.Successful());
+
+        auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
+
+        CHECK(directory.Successful());
+
+        //  Create a file and write the first line, which allocates the first cluster
+
+        auto new_file = directory->OpenFile(minstd::fixed_string<>("deferred update test.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+
+        CHECK(new_file.Successful());
+
+        FAT32File &fat32_file = static_cast<FAT32File &>(*(new_file.Value()));
+
+        minstd::stack_buffer<uint8_t, 64> buffer_to_append;
+
+        buffer_to_append.append((const uint8_t *)"This is content for the new File\n", 33);
+
+        CHECK(Successful(new_file->Append(buffer_to_append)));
+        CHECK(fat32_file.DirectoryEntryDirty());
+
+        //  Small appends within the cluster cost a data cluster read and write each, the directory entry is not touched
+
+        uint32_t reads_before = get_test_device_result->ReadCommandsIssued();
+        uint32_t writes_before = get_test_device_result->WriteCommandsIssued();
+
+        for (int i = 0; i < 10; i++)
+        {
+            CHECK(Successful(new_file->Append(buffer_to_append)));
+        }
+
+        CHECK_EQUAL(reads_before + 10, get_test_device_result->ReadCommandsIssued());
+        CHECK_EQUAL(writes_before + 10, get_test_device_result->WriteCommandsIssued());
+
+        CHECK_SUCCESSFUL_AND_EQUAL(33U * 11, new_file->Size());
+
+        //  Flushing writes the directory entry
+
+        CHECK(Successful(new_file->Flush()));
+        CHECK_FALSE(fat32_file.DirectoryEntryDirty());
+
+        //  Flushing a clean file does nothing
+
+        writes_before = get_test_device_result->WriteCommandsIssued();
+
+        CHECK(Successful(new_file->Flush()));
+
+        CHECK_EQUAL(writes_before, get_test_device_result->WriteCommandsIssued());
+
+        //  More appends, then Close() writes the entry back
+
+        for (int i = 0; i < 5; i++)
+        {
+            CHECK(Successful(new_file->Append(buffer_to_append)));
+        }
+
+        CHECK(Successful(new_file->Close()));
+
+        auto file_for_check = directory->OpenFile(minstd::fixed_string<>("deferred update test.txt"), FileModes::READ);
+
+        CHECK(file_for_check.Successful());
+        CHECK_SUCCESSFUL_AND_EQUAL(33U * 16, file_for_check->Size());
+
+        minstd::stack_buffer<uint8_t, 33 * 32> read_buffer;
+
+        CHECK(Successful(file_for_check->Read(read_buffer)));
+        CHECK_EQUAL(33 * 16, read_buffer.size());
+
+        for (int i = 0; i < 16; i++)
+        {
+            STRNCMP_EQUAL("This is content for the new File\n", (char *)read_buffer.data() + (i * 33), 33);
+        }
+
+        CHECK(Successful(file_for_check->Close()));
+
+        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("deferred update test.txt"))));
+    }
+
+    TEST(FAT32File, PreallocateTest)
+    {
+        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+
+        CHECK(filesystem.Successful());
+
+        FAT32BlockIOAdapter &block_io_adapter = filesystem->BlockIOAdapter();
+
+        //  Get the directory within which we will test file operations
+
+        auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
+
+        CHECK(directory.Successful());
+
+        minstd::stack_buffer<uint8_t, 16384> reference_buffer;
+
+        ut_utility::ReadFile("./test/data/long_test_file.txt", reference_buffer);
+
+        //  Create a file and reserve room for three copies of the reference, the size of the file does not change
+
+        auto new_file = directory->OpenFile(minstd::fixed_string<>("preallocated file.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+
+        CHECK(new_file.Successful());
+
+        auto first_free_before = block_io_adapter.FindNextEmptyCluster(FAT32ClusterIndex(2));
+
+        CHECK(first_free_before.Successful());
+
+        CHECK(Successful(new_file->Preallocate(3 * reference_buffer.size())));
+
+        CHECK_SUCCESSFUL_AND_EQUAL(0U, new_file->Size());
+
+        auto first_free_after = block_io_adapter.FindNextEmptyCluster(FAT32ClusterIndex(2));
+
+        CHECK(first_free_after.Successful());
+        CHECK(*first_free_after != *first_free_before);
+
+        //  Preallocating less than is already reserved does nothing
+
+        CHECK(Successful(new_file->Preallocate(reference_buffer.size())));
+
+        //  Writing into the reserved space does not allocate any more clusters
+
+        CHECK(Successful(new_file->Append(reference_buffer)));
+        CHECK(Successful(new_file->Append(reference_buffer)));
+        CHECK(Successful(new_file->Append(reference_buffer)));
+
+        CHECK_SUCCESSFUL_AND_EQUAL(3 * reference_buffer.size(), new_file->Size());
+        CHECK_SUCCESSFUL_AND_EQUAL(*first_free_after, block_io_adapter.FindNextEmptyCluster(FAT32ClusterIndex(2)));
+
+        //  Writing past the reserved space extends the chain
+
+        CHECK(Successful(new_file->Append(reference_buffer)));
+
+        CHECK(Successful(new_file->Close()));
+
+        //  Open the file again and check the content is correct.
+
+        auto file_for_check = directory->OpenFile(minstd::fixed_string<>("preallocated file.txt"), FileModes::READ);
+
+        CHECK(file_for_check.Successful());
+
+        minstd::stack_buffer<uint8_t, 4 * 16384> read_buffer;
+
+        CHECK(Successful(file_for_check->Read(read_buffer)));
+
+        CHECK_EQUAL(4 * reference_buffer.size(), read_buffer.size());
+
+        for (int i = 0; i < 4; i++)
+        {
+            STRNCMP_EQUAL((char *)reference_buffer.data(), (char *)read_buffer.data() + (i * reference_buffer.size()), reference_buffer.size());
+        }
+
+        //  Deleting the file releases the whole chain
+
+        CHECK(Successful(file_for_check->Close()));
+
+        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("preallocated file.txt"))));
+
+        CHECK_SUCCESSFUL_AND_EQUAL(*first_free_before, block_io_adapter.FindNextEmptyCluster(FAT32ClusterIndex(2)));
+    }
+
+    TEST(FAT32File, ReadFromEmptyFile)
+    {
+        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+
+        CHECK(filesystem.Successful());
+
+        //  Get the directory we use for testing file operations
+
+        auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
+
+        CHECK(directory.Successful());
+
+        //  Create a file
+
+        auto new_file = directory->OpenFile(minstd::fixed_string<>("empty file.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+
+        CHECK(new_file.Successful());
+        CHECK(*(new_file->AbsolutePath()) == minstd::fixed_string<>("/file testing/empty file.txt"));
+
+        //  Try to read from it and insure we get zero bytes
+
+        minstd::stack_buffer<uint8_t, 16384> read_buffer;
+
+        CHECK(Successful(new_file->Read(read_buffer)));
+
+        CHECK_EQUAL(0, read_buffer.size());
+    }
+
+    TEST(FAT32File, Seek)
+    {
+        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+
+        CHECK(filesystem.Successful());
+
+        //  Get the directory we use for testing file operations
+
+        auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
+
+        CHECK(directory.Successful());
+
+        //  Create a file
+
+        auto new_file = directory->OpenFile(minstd::fixed_string<>("empty file.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+
+        CHECK(new_file.Successful());
+        CHECK(*(new_file->AbsolutePath()) == minstd::fixed_string<>("/file testing/empty file.txt"));
+
+        //  Append to it
+
+        minstd::stack_buffer<uint8_t, 1024> buffer_to_append;
+
+        buffer_to_append.append((uint8_t*)"****************************************************************************************************", 100);
+
+        for (int i = 0; i < 500; i++)
+        {
+            new_file->Append(buffer_to_append);
+        }
+
+        //  The file should be 50k bytes long
+
+        CHECK_EQUAL(50000, *(new_file->Size()));
+
+        //  Seek some locations and write single characters
+
+        CHECK(Successful(new_file->Seek(0)));
+
+        buffer_to_append.clear();
+        buffer_to_append.append((const uint8_t*)"0", 1);
+
+        CHECK(Successful(new_file->Write(buffer_to_append)));
+
+        CHECK(Successful(new_file->Seek(67)));
+
+        buffer_to_append.clear();
+        buffer_to_append.append((const uint8_t*)"1", 1);
+
+        CHECK(Successful(new_file->Write(buffer_to_append)));
+
+        //  The next write spans a cluster so one byte will be the last of one cluster and the second will be the first of the next cluster
+
+        CHECK(Successful(new_file->Seek(1023)));
+
+        buffer_to_append.clear();
+        buffer_to_append.append((const uint8_t*)"23", 2);
+
+        CHECK(Successful(new_file->Write(buffer_to_append)));
+
+        CHECK(Successful(new_file->Seek(20000)));
+
+        buffer_to_append.clear();
+        buffer_to_append.append((const uint8_t*)"4", 1);
+
+        CHECK(Successful(new_file->Write(buffer_to_append)));
+
+        CHECK(Successful(new_file->Seek(49999)));
+
+        buffer_to_append.clear();
+        buffer_to_append.append((const uint8_t*)"5", 1);
+
+        CHECK(Successful(new_file->Write(buffer_to_append)));
+
+        //  The file should still be 50k bytes long
+
+        CHECK_EQUAL(50000, *(new_file->Size()));
+
+        //  Read the entire file and check the locations we wrote
+
+        CHECK(Successful(new_file->Seek(0)));
+
+        minstd::stack_buffer<uint8_t, 100000> read_buffer;
+
+        CHECK(Successful(new_file->Read(read_buffer)));
+
+        CHECK_EQUAL(50000, read_buffer.size());
+
+        CHECK_EQUAL('0', ((char *)(read_buffer.data()))[0]);
+        CHECK_EQUAL('1', ((char *)(read_buffer.data()))[67]);
+        CHECK_EQUAL('2', ((char *)(read_buffer.data()))[1023]); //  This is the last byte of the first clusterEnd of the second cluster
+        CHECK_EQUAL('3', ((char *)(read_buffer.data()))[1024]); //  This is the first byte of the third cluster
+        CHECK_EQUAL('4', ((char *)(read_buffer.data()))[20000]);
+        CHECK_EQUAL('5', ((char *)(read_buffer.data()))[49999]);
+    }
+
+    TEST(FAT32File, SequentialReadAheadTest)
+    {
+        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+
+        CHECK(filesystem.Successful());
+
+        auto get_test_device_result = GetOSEntityRegistry().GetEntityByName<ut_utility::InMemoryFileBlockIODevice>("IN_MEMORY_TEST_DEVICE");
+
+        CHECK(get_test_device_result.Successful());
+
+        auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
+
+        CHECK(directory.Successful());
+
+        //  Create a file spanning many clusters
+
+        minstd::stack_buffer<uint8_t, 16384> reference_buffer;
+
+        ut_utility::ReadFile("./test/data/long_test_file.txt", reference_buffer);
+
+        {
+            auto new_file = directory->OpenFile(minstd::fixed_string<>("read ahead test.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+
+            CHECK(new_file.Successful());
+
+            for (int i = 0; i < 5; i++)
+            {
+                new_file->Append(reference_buffer);
+            }
+        }
+
+        uint32_t bytes_per_cluster = filesystem->BlockIOAdapter().BytesPerCluster();
+        uint32_t clusters_in_file = ((5 * reference_buffer.size()) + bytes_per_cluster - 1) / bytes_per_cluster;
+
+        //  Stream the file back in chunks smaller than a cluster, each read carries on from the last so the
+        //      read-ahead window grows and most clusters come from the read-ahead buffer.
+
+        auto file_for_check = directory->OpenFile(minstd::fixed_string<>("read ahead test.txt"), FileModes::READ);
+
+        CHECK(file_for_check.Successful());
+
+        uint32_t reads_before = get_test_device_result->ReadCommandsIssued();
+
+        minstd::stack_buffer<uint8_t, 6 * 16384> read_buffer;
+        minstd::stack_buffer<uint8_t, 1000> chunk_buffer;
+
+        while (true)
+        {
+            chunk_buffer.clear();
+
+            CHECK(Successful(file_for_check->Read(chunk_buffer)));
+
+            if (chunk_buffer.size() == 0)
+            {
+                break;
+            }
+
+            read_buffer.append(chunk_buffer.data(), chunk_buffer.size());
+        }
+
+        uint32_t sequential_reads = get_test_device_result->ReadCommandsIssued() - reads_before;
+
+        CHECK_EQUAL(5 * reference_buffer.size(), read_buffer.size());
+
+        for (int i = 0; i < 5; i++)
+        {
+            STRNCMP_EQUAL((char *)reference_buffer.data(), (char *)read_buffer.data() + (i * reference_buffer.size()), reference_buffer.size());
+        }
+
+        //  Without read-ahead each cluster costs a FAT sector read and a data read, plus a data read for every chunk.
+        //      With read-ahead the chain is walked once and the data comes in a handful of multi-cluster reads.
+
+        CHECK(sequential_reads < clusters_in_file + (clusters_in_file / 2));
+
+        //  After a seek the window shrinks, the data read must still be correct
+
+        CHECK(Successful(file_for_check->Seek(20000)));
+
+        chunk_buffer.clear();
+
+        CHECK(Successful(file_for_check->Read(chunk_buffer)));
+        CHECK_EQUAL(1000, chunk_buffer.size());
+        CHECK_EQUAL(0, memcmp(read_buffer.data() + 20000, chunk_buffer.data(), 1000));
+
+        CHECK(Successful(file_for_check->Close()));
+
+        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("read ahead test.txt"))));
+    }
+
+    TEST(FAT32File, AlignedReadTest)
+    {
+        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+
+        CHECK(filesystem.Successful());
+
+        auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
+
+        CHECK(directory.Successful());
+
+        //  Create a file spanning many clusters
+
+        minstd::stack_buffer<uint8_t, 16384> reference_buffer;
+
+        ut_utility::ReadFile("./test/data/long_test_file.txt", reference_buffer);
+
+        {
+            auto new_file = directory->OpenFile(minstd::fixed_string<>("aligned read test.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+
+            CHECK(new_file.Successful());
+
+            for (int i = 0; i < 5; i++)
+            {
+                CHECK(Successful(new_file->Append(reference_buffer)));
+            }
+        }
+
+        auto file_for_check = directory->OpenFile(minstd::fixed_string<>("aligned read test.txt"), FileModes::READ);
+
+        CHECK(file_for_check.Successful());
+
+        //  The whole file from the start is read straight into the buffer, apart from the partial cluster at the end
+
+        minstd::stack_buffer<uint8_t, 6 * 16384> read_buffer;
+
+        CHECK(Successful(file_for_check->Read(read_buffer)));
+        CHECK_EQUAL(5 * reference_buffer.size(), read_buffer.size());
+
+        for (int i = 0; i < 5; i++)
+        {
+            CHECK_EQUAL(0, memcmp(reference_buffer.data(), read_buffer.data() + (i * reference_buffer.size()), reference_buffer.size()));
+        }
+
+        //  Reads starting part way into a cluster bounce the head and tail and read the clusters in between directly.  The
+        //      chunk size is not a multiple of the cluster size, so each read starts and ends at a different offset.
+
+        const uint32_t bytes_per_cluster = filesystem->BlockIOAdapter().BytesPerCluster();
+
+        uint32_t position = bytes_per_cluster / 2;
+
+        CHECK(Successful(file_for_check->Seek(position)));
+
+        minstd::stack_buffer<uint8_t, 5000> chunk_buffer;
+
+        for (int i = 0; i < 4; i++)
+        {
+            chunk_buffer.clear();
+
+            CHECK(Successful(file_for_check->Read(chunk_buffer)));
+            CHECK_EQUAL(5000, chunk_buffer.size());
+            CHECK_EQUAL(0, memcmp(read_buffer.data() + position, chunk_buffer.data(), 5000));
+
+            position += 5000;
+        }
+
+        //  A read running off the end of the file stops at the end
+
+        CHECK(Successful(file_for_check->Seek(read_buffer.size() - 3000)));
+
+        chunk_buffer.clear();
+
+        CHECK(Successful(file_for_check->Read(chunk_buffer)));
+        CHECK_EQUAL(3000, chunk_buffer.size());
+        CHECK_EQUAL(0, memcmp(read_buffer.data() + read_buffer.size() - 3000, chunk_buffer.data(), 3000));
+
+        CHECK(Successful(file_for_check->Close()));
+
+        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("aligned read test.txt"))));
+    }
+
+    TEST(FAT32File, ClusterOverwriteTest)
+    {
+        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+
+        CHECK(filesystem.Successful());
+
+        auto get_test_device_result = GetOSEntityRegistry().GetEntityByName<ut_utility::InMemoryFileBlockIODevice>("IN_MEMORY_TEST_DEVICE");
+
+        CHECK(get_test_device_result.Successful());
+
+        auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
+
+        CHECK(directory.Successful());
+
+        //  Create a file spanning many clusters
+
+        minstd::stack_buffer<uint8_t, 16384> reference_buffer;
+
+        ut_utility::ReadFile("./test/data/long_test_file.txt", reference_buffer);
+
+        {
+            auto new_file = directory->OpenFile(minstd::fixed_string<>("overwrite test.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+
+            CHECK(new_file.Successful());
+
+            for (int i = 0; i < 5; i++)
+            {
+                CHECK(Successful(new_file->Append(reference_buffer)));
+            }
+        }
+
+        auto file_to_overwrite = directory->OpenFile(minstd::fixed_string<>("overwrite test.txt"), FileModes::READ_WRITE_APPEND);
+
+        CHECK(file_to_overwrite.Successful());
+
+        //  Read the whole file first, so the chain is mapped and the only device requests below are for data
+
+        minstd::stack_buffer<uint8_t, 6 * 16384> expected;
+
+        CHECK(Successful(file_to_overwrite->Read(expected)));
+        CHECK_EQUAL(5 * reference_buffer.size(), expected.size());
+
+        //  Overwriting whole clusters does not read them first
+
+        const uint32_t bytes_per_cluster = filesystem->BlockIOAdapter().BytesPerCluster();
+
+        minstd::stack_buffer<uint8_t, 16384> overwrite_buffer;
+
+        for (uint32_t i = 0; i < 3 * bytes_per_cluster; i++)
+        {
+            overwrite_buffer.push_back('A' + (i % 26));
+        }
+
+        uint32_t reads_before = get_test_device_result->ReadCommandsIssued();
+
+        CHECK(Successful(file_to_overwrite->Seek(2 * bytes_per_cluster)));
+        CHECK(Successful(file_to_overwrite->Write(overwrite_buffer)));
+
+        CHECK_EQUAL(reads_before, get_test_device_result->ReadCommandsIssued());
+
+        memcpy(expected.data() + (2 * bytes_per_cluster), overwrite_buffer.data(), overwrite_buffer.size());
+
+        //  A short write at the start of a cluster still has to preserve the rest of the cluster
+
+        minstd::stack_buffer<uint8_t, 16> short_buffer;
+
+        short_buffer.append((const uint8_t *)"0123456789", 10);
+
+        reads_before = get_test_device_result->ReadCommandsIssued();
+
+        CHECK(Successful(file_to_overwrite->Seek(6 * bytes_per_cluster)));
+        CHECK(Successful(file_to_overwrite->Write(short_buffer)));
+
+        CHECK_EQUAL(reads_before + 1, get_test_device_result->ReadCommandsIssued());
+
+        memcpy(expected.data() + (6 * bytes_per_cluster), short_buffer.data(), short_buffer.size());
+
+        CHECK(Successful(file_to_overwrite->Close()));
+
+        //  The file holds the overwritten data and everything around it is unchanged
+
+        auto file_for_check = directory->OpenFile(minstd::fixed_string<>("overwrite test.txt"), FileModes::READ);
+
+        CHECK(file_for_check.Successful());
+
+        minstd::stack_buffer<uint8_t, 6 * 16384> read_buffer;
+
+        CHECK(Successful(file_for_check->Read(read_buffer)));
+        CHECK_EQUAL(expected.size(), read_buffer.size());
+        CHECK_EQUAL(0, memcmp(expected.data(), read_buffer.data(), expected.size()));
+
+        CHECK(Successful(file_for_check->Close()));
+
+        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("overwrite test.txt"))));
+    }
+
+    TEST(FAT32File, FileMappingTest)
+    {
+        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+
+        CHECK(filesystem.Successful());
+
+        auto get_test_device_result = GetOSEntityRegistry().GetEntityByName<ut_utility::InMemoryFileBlockIODevice>("IN_MEMORY_TEST_DEVICE");
+
+        CHECK(get_test_device_result.Successful());
+
+        auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
+
+        CHECK(directory.Successful());
+
+        //  Create a file spanning many pages
+
+        minstd::stack_buffer<uint8_t, 16384> reference_buffer;
+
+        ut_utility::ReadFile("./test/data/long_test_file.txt", reference_buffer);
+
+        {
+            auto new_file = directory->OpenFile(minstd::fixed_string<>("mapping test.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+
+            CHECK(new_file.Successful());
+
+            for (int i = 0; i < 5; i++)
+            {
+                CHECK(Successful(new_file->Append(reference_buffer)));
+            }
+        }
+
+        auto mapped_file = directory->OpenFile(minstd::fixed_string<>("mapping test.txt"), FileModes::READ_WRITE_APPEND);
+
+        CHECK(mapped_file.Successful());
+
+        //  Read the whole file first, so the chain is mapped and the only device requests below are for pages
+
+        minstd::stack_buffer<uint8_t, 6 * 16384> expected;
+
+        CHECK(Successful(mapped_file->Read(expected)));
+        CHECK_EQUAL(5 * reference_buffer.size(), expected.size());
+
+        //  Ranges outside the file cannot be mapped
 
-        CHECK(filesystem.Successful());
+        CHECK_FAILED_WITH_CODE(FilesystemResultCodes::MAPPING_OUT_OF_RANGE, mapped_file->Map(expected.size() - 10, 20, FileModes::READ).ResultCode());
+        CHECK_FAILED_WITH_CODE(FilesystemResultCodes::MAPPING_OUT_OF_RANGE, mapped_file->Map(0, 0, FileModes::READ).ResultCode());
 
-        //  Get the root directory
+        //  Creating the mapping reads nothing, pages are read as they are accessed
 
-        auto subdir1 = filesystem->GetDirectory(minstd::fixed_string<>("/subdir1"));
+        const uint32_t mapping_offset = 10000;
+        const uint32_t mapping_length = 20000;
 
-        CHECK(subdir1.Successful());
+        uint32_t reads_before = get_test_device_result->ReadCommandsIssued();
 
-        //  Open the file
+        auto mapping = mapped_file->Map(mapping_offset, mapping_length, FileModes::READ_WRITE);
 
-        auto file = subdir1->OpenFile(minstd::fixed_string<>("A diam maecenas sed enim ut sem.Pellentesque"), FileModes::READ);
+        CHECK(mapping.Successful());
+        CHECK_EQUAL(mapping_offset, mapping.Value()->Offset());
+        CHECK_EQUAL(mapping_length, mapping.Value()->Length());
 
-        CHECK(file.Successful());
-        CHECK(*(file->AbsolutePath()) == minstd::fixed_string<>("/subdir1/A diam maecenas sed enim ut sem.Pellentesque"));
+        FAT32FileMapping &fat32_mapping = static_cast<FAT32FileMapping &>(*(mapping.Value()));
 
-        //  Read the file
+        const uint32_t page_size = fat32_mapping.PageSize();
+        const uint32_t offset_into_first_page = mapping_offset % page_size;
 
-        minstd::stack_buffer<uint8_t, 4096> buffer;
+        CHECK_EQUAL(reads_before, get_test_device_result->ReadCommandsIssued());
+        CHECK_EQUAL(0, fat32_mapping.PagesPresent());
 
-        file->Read(buffer);
+        //  Touching a range within a single page reads just that page
 
-        //  Compare with equality with the reference file
+        auto page_data = mapping.Value()->Access(100, 50);
 
-        ut_utility::FILE_EQUAL("./test/data/A_diam_maecenas_sed_enim_ut sem.Pellentesque", buffer);
+        CHECK(page_data.Successful());
+        CHECK_EQUAL(0, memcmp(*page_data, expected.data() + mapping_offset + 100, 50));
+        CHECK_EQUAL(1, fat32_mapping.PagesPresent());
+        CHECK(get_test_device_result->ReadCommandsIssued() > reads_before);
 
-        //  Close and Delete the file and check it is gone
+        //  Touching it again reads nothing
 
-        CHECK(Successful(file->Close()));
+        reads_before = get_test_device_result->ReadCommandsIssued();
 
-        CHECK(Successful(subdir1->DeleteFile(minstd::fixed_string<>("A diam maecenas sed enim ut sem.Pellentesque"))));
+        CHECK(mapping.Value()->Access(120, 10).Successful());
+        CHECK_EQUAL(reads_before, get_test_device_result->ReadCommandsIssued());
 
-        CHECK(subdir1->OpenFile(minstd::fixed_string<>("A diam maecenas sed enim ut sem.Pellentesque"), FileModes::READ).ResultCode() == FilesystemResultCodes::FILE_NOT_FOUND);
-    }
+        //  Pages are not contiguous, so a range straddling a page boundary is refused
 
-    TEST(FAT32File, FileCreationAndAppendSmallBuffers)
-    {
-        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+        const uint32_t write_offset = page_size - offset_into_first_page - 100;
 
-        CHECK(filesystem.Successful());
+        CHECK_FAILED_WITH_CODE(FilesystemResultCodes::MAPPING_RANGE_SPANS_PAGES, mapping.Value()->AccessForWrite(write_offset, 200).ResultCode());
+        CHECK_EQUAL(1, fat32_mapping.PagesPresent());
 
-        //  Get the directory we use for testing file operations
+        //  Writing either side of the boundary brings in the page following the first
 
-        auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
+        auto writable_data = mapping.Value()->AccessForWrite(write_offset, 100);
 
-        CHECK(directory.Successful());
+        CHECK(writable_data.Successful());
 
-        //  Create a file
+        memset(*writable_data, 'Z', 100);
 
-        auto new_file = directory->OpenFile(minstd::fixed_string<>("test small buffers file.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+        writable_data = mapping.Value()->AccessForWrite(write_offset + 100, 100);
 
-        CHECK(new_file.Successful());
-        CHECK(*(new_file->AbsolutePath()) == minstd::fixed_string<>("/file testing/test small buffers file.txt"));
+        CHECK(writable_data.Successful());
+        CHECK_EQUAL(2, fat32_mapping.PagesPresent());
 
-        //  Append to it
+        memset(*writable_data, 'Z', 100);
+        memset(expected.data() + mapping_offset + write_offset, 'Z', 200);
 
-        minstd::stack_buffer<uint8_t, 1024> buffer_to_append;
+        //  Data written through the file to a part of a dirty page the mapping did not write survives the flush
 
-        buffer_to_append.append((uint8_t *)"This is content for the new File\n", 33);
+        minstd::stack_buffer<uint8_t, 64> file_data;
 
-        for (int i = 0; i < 510; i++)
+        for (uint32_t i = 0; i < 64; i++)
         {
-            new_file->Append(buffer_to_append);
+            file_data.push_back('Y');
         }
 
-        //  Close it
+        const uint32_t file_write_offset = mapping_offset + write_offset + 200 + 64;
 
-        new_file->Close();
+        CHECK(Successful(mapped_file->WriteAt(file_write_offset, file_data)));
+        memcpy(expected.data() + file_write_offset, file_data.data(), 64);
 
-        //  Open the file again - it already exists, then append some more
+        //  Access outside the mapping fails
 
-        auto new_file1 = directory->OpenFile(minstd::fixed_string<>("test small buffers file.txt"), FileModes::READ_WRITE_APPEND);
+        CHECK_FAILED_WITH_CODE(FilesystemResultCodes::MAPPING_OUT_OF_RANGE, mapping.Value()->Access(mapping_length - 10, 20).ResultCode());
+        CHECK_FAILED_WITH_CODE(FilesystemResultCodes::MAPPING_OUT_OF_RANGE, mapping.Value()->Access(0, 0).ResultCode());
 
-        CHECK(new_file1.Successful());
+        //  Flushing writes back the dirty pages, a second flush has nothing to write
 
-        for (int i = 0; i < 512; i++)
-        {
-            new_file1->Append(buffer_to_append);
-        }
+        uint32_t writes_before = get_test_device_result->WriteCommandsIssued();
 
-        //  Close it
+        CHECK(Successful(mapping.Value()->Flush()));
+        CHECK(get_test_device_result->WriteCommandsIssued() > writes_before);
 
-        new_file1->Close();
+        writes_before = get_test_device_result->WriteCommandsIssued();
 
-        //  Open the file again and check the content is correct.
-        //      There should be 1022 entries of the string above.
+        CHECK(Successful(mapping.Value()->Flush()));
+        CHECK_EQUAL(writes_before, get_test_device_result->WriteCommandsIssued());
 
-        auto file_for_check = directory->OpenFile(minstd::fixed_string<>("test small buffers file.txt"), FileModes::READ);
+        //  The file sees the changes once they are written back
 
-        CHECK(file_for_check.Successful());
+        minstd::stack_buffer<uint8_t, 256> changed_data;
 
-        minstd::stack_buffer<uint8_t, 33 * 1500> read_buffer;
+        CHECK(Successful(mapped_file->Seek(mapping_offset + write_offset)));
+        CHECK(Successful(mapped_file->Read(changed_data)));
+        CHECK_EQUAL(0, memcmp(changed_data.data(), expected.data() + mapping_offset + write_offset, changed_data.size()));
 
-        file_for_check->Read(read_buffer);
+        CHECK(Successful(mapping.Value()->Unmap()));
+        CHECK_FAILED_WITH_CODE(FilesystemResultCodes::FILE_IS_CLOSED, mapping.Value()->Access(100, 50).ResultCode());
 
-        CHECK_EQUAL((33 * 1022), read_buffer.size());
+        //  A read only mapping cannot be written through
 
-        for (int i = 0; i < 1022; i++)
         {
-            STRNCMP_EQUAL("This is content for the new File\n", (char *)read_buffer.data() + (i * 33), 33);
+            auto read_only_mapping = mapped_file->Map(0, 100, FileModes::READ);
+
+            CHECK(read_only_mapping.Successful());
+            CHECK_FAILED_WITH_CODE(FilesystemResultCodes::MAPPING_NOT_OPENED_FOR_WRITE, read_only_mapping.Value()->AccessForWrite(0, 10).ResultCode());
         }
 
-        //  Close and Delete the file and check it is gone
+        CHECK(Successful(mapped_file->Close()));
 
-        CHECK(Successful(file_for_check->Close()));
+        //  The file holds the data written through the mapping and everything around it is unchanged
 
-        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("test small buffers file.txt"))));
+        auto file_for_check = directory->OpenFile(minstd::fixed_string<>("mapping test.txt"), FileModes::READ);
 
-        CHECK(directory->OpenFile(minstd::fixed_string<>("test small buffers file.txt"), FileModes::READ).ResultCode() == FilesystemResultCodes::FILE_NOT_FOUND);
+        CHECK(file_for_check.Successful());
+
+        minstd::stack_buffer<uint8_t, 6 * 16384> read_buffer;
+
+        CHECK(Successful(file_for_check->Read(read_buffer)));
+        CHECK_EQUAL(expected.size(), read_buffer.size());
+        CHECK_EQUAL(0, memcmp(expected.data(), read_buffer.data(), expected.size()));
+
+        CHECK(Successful(file_for_check->Close()));
+
+        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("mapping test.txt"))));
     }
 
-    TEST(FAT32File, FileCreationAndAppendLargeBuffers)
+    TEST(FAT32File, PositionalReadWriteTest)
     {
         auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
 
         CHECK(filesystem.Successful());
 
-        //  Get the directory within which we will test file operations
-
         auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
 
         CHECK(directory.Successful());
 
+        //  Create a file spanning many clusters
+
         minstd::stack_buffer<uint8_t, 16384> reference_buffer;
 
-        {
-            //  Create a file.  It will be closed when the File instance goes out of scope.
+        ut_utility::ReadFile("./test/data/long_test_file.txt", reference_buffer);
 
-            auto new_file = directory->OpenFile(minstd::fixed_string<>("test large buffers file.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+        minstd::stack_buffer<uint8_t, 6 * 16384> expected;
+
+        {
+            auto new_file = directory->OpenFile(minstd::fixed_string<>("positional test.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
 
             CHECK(new_file.Successful());
 
-            //  Read the data file from the test data directory
+            for (int i = 0; i < 5; i++)
+            {
+                CHECK(Successful(new_file->Append(reference_buffer)));
+                expected.append(reference_buffer.data(), reference_buffer.size());
+            }
+        }
 
-            ut_utility::ReadFile("./test/data/long_test_file.txt", reference_buffer);
+        auto file = directory->OpenFile(minstd::fixed_string<>("positional test.txt"), FileModes::READ_WRITE_APPEND);
 
-            //  Append the large buffer to the file twice
+        CHECK(file.Successful());
 
-            new_file->Append(reference_buffer);
-            new_file->Append(reference_buffer);
+        //  Move the file position a little way into the file
+
+        minstd::stack_buffer<uint8_t, 100> cursor_buffer;
+
+        CHECK(Successful(file->Read(cursor_buffer)));
+        CHECK_EQUAL(0, memcmp(cursor_buffer.data(), expected.data(), cursor_buffer.size()));
+
+        //  Positional reads, unaligned and spanning clusters
+
+        minstd::stack_buffer<uint8_t, 3000> read_at_buffer;
+
+        CHECK(Successful(file->ReadAt(20001, read_at_buffer)));
+        CHECK_EQUAL(3000, read_at_buffer.size());
+        CHECK_EQUAL(0, memcmp(read_at_buffer.data(), expected.data() + 20001, read_at_buffer.size()));
+
+        //  A read running into the end of the file stops there, a read past the end reads nothing
+
+        read_at_buffer.clear();
+
+        CHECK(Successful(file->ReadAt(expected.size() - 700, read_at_buffer)));
+        CHECK_EQUAL(700, read_at_buffer.size());
+        CHECK_EQUAL(0, memcmp(read_at_buffer.data(), expected.data() + expected.size() - 700, read_at_buffer.size()));
+
+        read_at_buffer.clear();
+
+        CHECK(Successful(file->ReadAt(expected.size() + 5, read_at_buffer)));
+        CHECK_EQUAL(0, read_at_buffer.size());
+
+        //  Positional writes within the file overwrite in place and leave the size alone
+
+        minstd::stack_buffer<uint8_t, 1500> write_at_buffer;
+
+        for (uint32_t i = 0; i < 1500; i++)
+        {
+            write_at_buffer.push_back('W');
         }
 
-        //  Open the file again - it already exists, then append the reference three more times
+        CHECK(Successful(file->WriteAt(1000, write_at_buffer)));
+        CHECK_SUCCESSFUL_AND_EQUAL((uint32_t)expected.size(), file->Size());
 
-        auto new_file1 = directory->OpenFile(minstd::fixed_string<>("test large buffers file.txt"), FileModes::READ_WRITE_APPEND);
+        memcpy(expected.data() + 1000, write_at_buffer.data(), write_at_buffer.size());
 
-        CHECK(new_file1.Successful());
+        read_at_buffer.clear();
 
-        new_file1->Append(reference_buffer);
-        new_file1->Append(reference_buffer);
-        new_file1->Append(reference_buffer);
+        CHECK(Successful(file->ReadAt(900, read_at_buffer)));
+        CHECK_EQUAL(0, memcmp(read_at_buffer.data(), expected.data() + 900, read_at_buffer.size()));
 
-        uint32_t file1_size = *(new_file1->Size());
+        //  A positional write running past the end grows the file
 
-        new_file1->Close();
+        minstd::stack_buffer<uint8_t, 100> grow_buffer;
 
-        //  Open the file again and check the content is correct.
+        for (uint32_t i = 0; i < 100; i++)
+        {
+            grow_buffer.push_back('E');
+        }
 
-        auto file_for_check = directory->OpenFile(minstd::fixed_string<>("test large buffers file.txt"), FileModes::READ);
+        uint32_t original_size = expected.size();
 
-        CHECK(file_for_check.Successful());
+        CHECK(Successful(file->WriteAt(original_size - 10, grow_buffer)));
+        CHECK_SUCCESSFUL_AND_EQUAL(original_size + 90, file->Size());
 
-        minstd::stack_buffer<uint8_t, 6 * 16384> read_buffer;
+        memcpy(expected.data() + original_size - 10, grow_buffer.data(), 10);
+        expected.append(grow_buffer.data() + 10, 90);
 
-        file_for_check->Read(read_buffer);
+        //  Growing the file by several clusters extends the chain without going through the file position
 
-        CHECK_EQUAL(file1_size, read_buffer.size());
+        minstd::stack_buffer<uint8_t, 10000> large_grow_buffer;
 
-        for (int i = 0; i < 5; i++)
+        for (uint32_t i = 0; i < 10000; i++)
         {
-            STRNCMP_EQUAL((char *)reference_buffer.data(), (char *)read_buffer.data() + (i * reference_buffer.size()), reference_buffer.size());
+            large_grow_buffer.push_back('G');
         }
 
-        //  Close and Delete the file and check it is gone
+        CHECK(Successful(file->WriteAt(expected.size(), large_grow_buffer)));
+        CHECK_SUCCESSFUL_AND_EQUAL((uint32_t)(expected.size() + large_grow_buffer.size()), file->Size());
 
-        CHECK(Successful(file_for_check->Close()));
+        expected.append(large_grow_buffer.data(), large_grow_buffer.size());
 
-        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("test large buffers file.txt"))));
+        //  Writes cannot leave a hole in the file
 
-        CHECK(directory->OpenFile(minstd::fixed_string<>("test large buffers file.txt"), FileModes::READ).ResultCode() == FilesystemResultCodes::FILE_NOT_FOUND);
-    }
+        CHECK_FAILED_WITH_CODE(FilesystemResultCodes::POSITION_PAST_END_OF_FILE, file->WriteAt(expected.size() + 1, grow_buffer));
 
-    TEST(FAT32File, ReadFromEmptyFile)
-    {
-        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+        //  None of that moved the file position
 
-        CHECK(filesystem.Successful());
+        cursor_buffer.clear();
 
-        //  Get the directory we use for testing file operations
+        CHECK(Successful(file->Read(cursor_buffer)));
+        CHECK_EQUAL(0, memcmp(cursor_buffer.data(), expected.data() + 100, cursor_buffer.size()));
 
-        auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
+        CHECK(Successful(file->Close()));
 
-        CHECK(directory.Successful());
+        //  The file holds everything written through it
 
-        //  Create a file
+        auto file_for_check = directory->OpenFile(minstd::fixed_string<>("positional test.txt"), FileModes::READ);
 
-        auto new_file = directory->OpenFile(minstd::fixed_string<>("empty file.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+        CHECK(file_for_check.Successful());
 
-        CHECK(new_file.Successful());
-        CHECK(*(new_file->AbsolutePath()) == minstd::fixed_string<>("/file testing/empty file.txt"));
+        minstd::stack_buffer<uint8_t, 6 * 16384> read_buffer;
 
-        //  Try to read from it and insure we get zero bytes
+        CHECK(Successful(file_for_check->Read(read_buffer)));
+        CHECK_EQUAL(expected.size(), read_buffer.size());
+        CHECK_EQUAL(0, memcmp(expected.data(), read_buffer.data(), expected.size()));
 
-        minstd::stack_buffer<uint8_t, 16384> read_buffer;
+        CHECK(Successful(file_for_check->Close()));
 
-        CHECK(Successful(new_file->Read(read_buffer)));
+        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("positional test.txt"))));
 
-        CHECK_EQUAL(0, read_buffer.size());
+        //  A positional write into an empty file gives it a chain, and a cursor read still starts at the beginning
+
+        {
+            auto empty_file = directory->OpenFile(minstd::fixed_string<>("positional empty.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+
+            CHECK(empty_file.Successful());
+
+            CHECK(Successful(empty_file->WriteAt(0, grow_buffer)));
+            CHECK_SUCCESSFUL_AND_EQUAL((uint32_t)grow_buffer.size(), empty_file->Size());
+
+            minstd::stack_buffer<uint8_t, 200> empty_file_buffer;
+
+            CHECK(Successful(empty_file->Read(empty_file_buffer)));
+            CHECK_EQUAL(grow_buffer.size(), empty_file_buffer.size());
+            CHECK_EQUAL(0, memcmp(grow_buffer.data(), empty_file_buffer.data(), grow_buffer.size()));
+
+            CHECK(Successful(empty_file->Close()));
+        }
+
+        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("positional empty.txt"))));
     }
 
-    TEST(FAT32File, Seek)
+    TEST(FAT32File, ExtentMapRandomSeekTest)
     {
         auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
 
         CHECK(filesystem.Successful());
 
-        //  Get the directory we use for testing file operations
+        auto get_test_device_result = GetOSEntityRegistry().GetEntityByName<ut_utility::InMemoryFileBlockIODevice>("IN_MEMORY_TEST_DEVICE");
+
+        CHECK(get_test_device_result.Successful());
 
         auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
 
         CHECK(directory.Successful());
 
-        //  Create a file
-
-        auto new_file = directory->OpenFile(minstd::fixed_string<>("empty file.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
-
-        CHECK(new_file.Successful());
-        CHECK(*(new_file->AbsolutePath()) == minstd::fixed_string<>("/file testing/empty file.txt"));
-
-        //  Append to it
+        //  Create a file spanning many clusters
 
-        minstd::stack_buffer<uint8_t, 1024> buffer_to_append;
+        minstd::stack_buffer<uint8_t, 16384> reference_buffer;
 
-        buffer_to_append.append((uint8_t*)"****************************************************************************************************", 100);
+        ut_utility::ReadFile("./test/data/long_test_file.txt", reference_buffer);
 
-        for (int i = 0; i < 500; i++)
         {
-            new_file->Append(buffer_to_append);
-        }
-
-        //  The file should be 50k bytes long
+            auto new_file = directory->OpenFile(minstd::fixed_string<>("extent map test.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
 
-        CHECK_EQUAL(50000, *(new_file->Size()));
+            CHECK(new_file.Successful());
 
-        //  Seek some locations and write single characters
+            for (int i = 0; i < 5; i++)
+            {
+                CHECK(Successful(new_file->Append(reference_buffer)));
+            }
+        }
 
-        CHECK(Successful(new_file->Seek(0)));
+        //  Reading the whole file maps the entire chain
 
-        buffer_to_append.clear();
-        buffer_to_append.append((const uint8_t*)"0", 1);
+        auto file_for_check = directory->OpenFile(minstd::fixed_string<>("extent map test.txt"), FileModes::READ);
 
-        CHECK(Successful(new_file->Write(buffer_to_append)));
+        CHECK(file_for_check.Successful());
 
-        CHECK(Successful(new_file->Seek(67)));
+        minstd::stack_buffer<uint8_t, 6 * 16384> read_buffer;
 
-        buffer_to_append.clear();
-        buffer_to_append.append((const uint8_t*)"1", 1);
+        CHECK(Successful(file_for_check->Read(read_buffer)));
+        CHECK_EQUAL(5 * reference_buffer.size(), read_buffer.size());
 
-        CHECK(Successful(new_file->Write(buffer_to_append)));
+        //  Seek backwards and forwards, each seek is answered by the extent map so the only device read is for the data,
+        //      and not even that if the cluster is still in the read-ahead buffer
 
-        //  The next write spans a cluster so one byte will be the last of one cluster and the second will be the first of the next cluster
+        const uint32_t bytes_per_cluster = filesystem->BlockIOAdapter().BytesPerCluster();
+        const uint32_t clusters_in_file = read_buffer.size() / bytes_per_cluster;
+        const uint32_t cluster_positions[] = {clusters_in_file - 1, 3, clusters_in_file / 2, 0, clusters_in_file - 2, 1};
 
-        CHECK(Successful(new_file->Seek(1023)));
+        minstd::stack_buffer<uint8_t, 100> chunk_buffer;
 
-        buffer_to_append.clear();
-        buffer_to_append.append((const uint8_t*)"23", 2);
+        for (uint32_t cluster_in_file : cluster_positions)
+        {
+            uint32_t position = (cluster_in_file * bytes_per_cluster) + 10;
 
-        CHECK(Successful(new_file->Write(buffer_to_append)));
+            uint32_t reads_before = get_test_device_result->ReadCommandsIssued();
 
-        CHECK(Successful(new_file->Seek(20000)));
+            CHECK(Successful(file_for_check->Seek(position)));
 
-        buffer_to_append.clear();
-        buffer_to_append.append((const uint8_t*)"4", 1);
+            chunk_buffer.clear();
 
-        CHECK(Successful(new_file->Write(buffer_to_append)));
+            CHECK(Successful(file_for_check->Read(chunk_buffer)));
+            CHECK_EQUAL(100, chunk_buffer.size());
+            CHECK_EQUAL(0, memcmp(read_buffer.data() + position, chunk_buffer.data(), 100));
 
-        CHECK(Successful(new_file->Seek(49999)));
+            CHECK(get_test_device_result->ReadCommandsIssued() - reads_before <= 1);
+        }
 
-        buffer_to_append.clear();
-        buffer_to_append.append((const uint8_t*)"5", 1);
+        //  Seeking to the end and appending still extends the file correctly
 
-        CHECK(Successful(new_file->Write(buffer_to_append)));
+        CHECK(Successful(file_for_check->Close()));
 
-        //  The file should still be 50k bytes long
+        auto file_to_extend = directory->OpenFile(minstd::fixed_string<>("extent map test.txt"), FileModes::READ_WRITE_APPEND);
 
-        CHECK_EQUAL(50000, *(new_file->Size()));
+        CHECK(file_to_extend.Successful());
 
-        //  Read the entire file and check the locations we wrote
+        CHECK(Successful(file_to_extend->Append(reference_buffer)));
 
-        CHECK(Successful(new_file->Seek(0)));
+        CHECK(Successful(file_to_extend->Seek(5 * reference_buffer.size())));
 
-        minstd::stack_buffer<uint8_t, 100000> read_buffer;
+        read_buffer.clear();
 
-        CHECK(Successful(new_file->Read(read_buffer)));
+        CHECK(Successful(file_to_extend->Read(read_buffer)));
+        CHECK_EQUAL(reference_buffer.size(), read_buffer.size());
+        CHECK_EQUAL(0, memcmp(reference_buffer.data(), read_buffer.data(), reference_buffer.size()));
 
-        CHECK_EQUAL(50000, read_buffer.size());
+        CHECK(Successful(file_to_extend->Close()));
 
-        CHECK_EQUAL('0', ((char *)(read_buffer.data()))[0]);
-        CHECK_EQUAL('1', ((char *)(read_buffer.data()))[67]);
-        CHECK_EQUAL('2', ((char *)(read_buffer.data()))[1023]); //  This is the last byte of the first clusterEnd of the second cluster
-        CHECK_EQUAL('3', ((char *)(read_buffer.data()))[1024]); //  This is the first byte of the third cluster
-        CHECK_EQUAL('4', ((char *)(read_buffer.data()))[20000]);
-        CHECK_EQUAL('5', ((char *)(read_buffer.data()))[49999]);
+        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("extent map test.txt"))));
     }
 
     TEST(FAT32File, ReadDeviceErrorNegativeTest)
     {
+        test::RemountTestFAT32Image(test::TestFAT32ImageMount::UNCACHED);
+
         for (int i = 0; i <= 4; i++)
         {
             auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
@@ -456,6 +1339,8 @@ namespace
 
     TEST(FAT32File, WriteDeviceErrorAllocatingFirstClusterNegativeTest)
     {
+        test::RemountTestFAT32Image(test::TestFAT32ImageMount::UNCACHED);
+
         for (int i = 0; i <= 3; i++)
         {
             auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
@@ -525,6 +1410,8 @@ namespace
 
     TEST(FAT32File, ReadDeviceErrorBeforeAppendNegativeTest)
     {
+        test::RemountTestFAT32Image(test::TestFAT32ImageMount::UNCACHED);
+
         auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
 
         CHECK(filesystem.Successful());
@@ -668,6 +1555,8 @@ namespace
 
     TEST(FAT32File, DeviceErrorsNegativeTest)
     {
+        test::RemountTestFAT32Image(test::TestFAT32ImageMount::UNCACHED);
+
         auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
 
         CHECK(filesystem.Successful());
@@ -840,4 +1729,55 @@ namespace
 
         CHECK(subdir1->DeleteFile(minstd::fixed_string<>("no_such_file.text")) == FilesystemResultCodes::FILE_NOT_FOUND);
     }
+
+    TEST(FAT32File, DeleteUnflushedFileTest)
+    {
+        auto filesystem = GetOSEntityRegistry().GetEntityByName<FAT32Filesystem>("test_fat32");
+
+        CHECK(filesystem.Successful());
+
+        auto directory = filesystem->GetDirectory(minstd::fixed_string<>("/file testing"));
+
+        CHECK(directory.Successful());
+
+        const uint32_t free_clusters = filesystem->BlockIOAdapter().FreeClusterBitmap().FreeClusters();
+
+        //  Write to a new file without flushing it, its directory entry on disk still has no first cluster
+
+        auto new_file = directory->OpenFile(minstd::fixed_string<>("delete unflushed test.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+
+        CHECK(new_file.Successful());
+
+        minstd::stack_buffer<uint8_t, 1024> buffer_to_append;
+
+        buffer_to_append.append((uint8_t *)"This is content for the new File\n", 33);
+
+        for (int i = 0; i < 64; i++)
+        {
+            CHECK(Successful(new_file->Append(buffer_to_append)));
+        }
+
+        CHECK(filesystem->BlockIOAdapter().FreeClusterBitmap().FreeClusters() < free_clusters);
+
+        //  The file cannot be deleted while it is open
+
+        CHECK(directory->DeleteFile(minstd::fixed_string<>("delete unflushed test.txt")) == FilesystemResultCodes::FILE_ALREADY_OPENED_EXCLUSIVELY);
+
+        //  Once closed, deleting it releases every cluster it was given
+
+        CHECK(Successful(new_file->Close()));
+
+        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("delete unflushed test.txt"))));
+
+        CHECK_EQUAL(free_clusters, filesystem->BlockIOAdapter().FreeClusterBitmap().FreeClusters());
+
+        //  An empty file has no chain to release
+
+        auto empty_file = directory->OpenFile(minstd::fixed_string<>("delete empty test.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+
+        CHECK(empty_file.Successful());
+        CHECK(Successful(empty_file->Close()));
+
+        CHECK(Successful(directory->DeleteFile(minstd::fixed_string<>("delete empty test.txt"))));
+    }
 }
@@ -0,0 +1,162 @@
+// Copyright 2024 Stephan Friedl. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "../../cpputest_support.h"
+
+#include <string.h>
+
+#include <__memory_resource/monotonic_buffer_resource.h>
+#include <__memory_resource/polymorphic_allocator.h>
+
+#include "devices/ram_disk.h"
+
+#include "filesystem/fat32_filesystem.h"
+#include "filesystem/filesystems.h"
+#include "filesystem/master_boot_record.h"
+
+namespace
+{
+    using namespace filesystems;
+    using namespace filesystems::fat32;
+
+    constexpr uint32_t RAM_DISK_SIZE_IN_BLOCKS = 69632; //  34MB, just large enough for the 65525 clusters FAT32 requires
+
+    uint8_t ram_disk_storage[RAM_DISK_SIZE_IN_BLOCKS * RamDiskBlockIODevice::BLOCK_SIZE_IN_BYTES];
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+    TEST_GROUP (FAT32Format)
+    {
+        void setup()
+        {
+            CHECK_EQUAL(0, __os_dynamic_heap_core.bytes_in_use());
+
+            memset(ram_disk_storage, 0xEE, sizeof(ram_disk_storage));
+        }
+
+        void teardown()
+        {
+            CHECK_EQUAL(0, __os_dynamic_heap_core.bytes_in_use());
+        }
+    };
+#pragma GCC diagnostic pop
+
+    TEST(FAT32Format, FormatTooSmallTest)
+    {
+        RamDiskBlockIODevice ram_disk(false, "RAM_DISK_TEST", "RAM_DISK_TEST", ram_disk_storage, 128);
+
+        CHECK_FAILED_WITH_CODE(FilesystemResultCodes::FAT32_VOLUME_TOO_SMALL_TO_FORMAT, FAT32Filesystem::Format(ram_disk, 32, "SCRATCH"));
+        CHECK_FAILED_WITH_CODE(FilesystemResultCodes::FAT32_VOLUME_TOO_SMALL_TO_FORMAT, FAT32Filesystem::Format(ram_disk, 128, "SCRATCH"));
+
+        //  A 16MB volume has room for the FATs but too few clusters to be FAT32
+
+        RamDiskBlockIODevice small_ram_disk(false, "RAM_DISK_TEST", "RAM_DISK_TEST", ram_disk_storage, 32768);
+
+        CHECK_FAILED_WITH_CODE(FilesystemResultCodes::FAT32_VOLUME_TOO_SMALL_TO_FORMAT, FAT32Filesystem::Format(small_ram_disk, small_ram_disk.SizeInBlocks(), "SCRATCH"));
+    }
+
+    TEST(FAT32Format, FormatMountAndUseTest)
+    {
+        RamDiskBlockIODevice ram_disk(false, "RAM_DISK_TEST", "RAM_DISK_TEST", ram_disk_storage, RAM_DISK_SIZE_IN_BLOCKS);
+
+        CHECK(Successful(FAT32Filesystem::Format(ram_disk, ram_disk.SizeInBlocks(), "SCRATCH")));
+
+        //  The formatted disk should hold one FAT32 partition with the volume label
+
+        alignas(MassStoragePartition) uint8_t partition_buffer[sizeof(MassStoragePartition) * MAX_PARTITIONS_ON_MASS_STORAGE_DEVICE + alignof(MassStoragePartition) * MAX_PARTITIONS_ON_MASS_STORAGE_DEVICE];
+        minstd::pmr::monotonic_buffer_resource partition_resource(partition_buffer, sizeof(partition_buffer), nullptr);
+        minstd::pmr::polymorphic_allocator<MassStoragePartition> partition_allocator(&partition_resource);
+
+        MassStoragePartitions partitions(partition_allocator);
+
+        CHECK(GetPartitions(ram_disk, partitions) == FilesystemResultCodes::SUCCESS);
+        CHECK_EQUAL(1, partitions.size());
+        STRCMP_EQUAL("SCRATCH", partitions[0].Name().c_str());
+
+        //  Every cluster in the FAT must be backed by the data region of the disk
+
+        auto adapter = FAT32BlockIOAdapter::Mount(ram_disk, FAT32_FORMAT_PARTITION_FIRST_SECTOR);
+
+        CHECK(adapter.Successful());
+
+        uint8_t cluster_buffer[adapter->BytesPerCluster()];
+
+        CHECK_EQUAL(BlockIOResultCodes::SUCCESS, adapter->ReadCluster(adapter->MaximumClusterNumber(), cluster_buffer));
+        CHECK_EQUAL(BlockIOResultCodes::RAM_DISK_BLOCK_OUT_OF_RANGE, adapter->ReadCluster(adapter->MaximumClusterNumber() + 1, cluster_buffer));
+
+        //  Mount the filesystem, write a file and read it back
+
+        auto filesystem = FAT32Filesystem::Mount(false, "ram_disk_fat32", "SCRATCH", false, ram_disk, partitions[0]);
+
+        CHECK(filesystem.Successful());
+
+        FAT32Filesystem &scratch_filesystem = **filesystem;
+
+        //  Everything but the root directory cluster is free on a new volume
+
+        CHECK(scratch_filesystem.BlockIOAdapter().FreeClusterBitmap().Initialized());
+        CHECK_EQUAL((uint32_t)scratch_filesystem.BlockIOAdapter().MaximumClusterNumber() - 2, scratch_filesystem.BlockIOAdapter().FreeClusterBitmap().FreeClusters());
+
+        CHECK(GetOSEntityRegistry().AddEntity(*filesystem) == OSEntityRegistryResultCodes::SUCCESS);
+
+        {
+            auto root_directory = scratch_filesystem.GetRootDirectory();
+
+            CHECK(root_directory.Successful());
+
+            auto new_file = root_directory->OpenFile(minstd::fixed_string<>("scratch file.txt"), FileModes::CREATE | FileModes::READ_WRITE_APPEND);
+
+            CHECK(new_file.Successful());
+
+            minstd::stack_buffer<uint8_t, 1024> buffer_to_append;
+
+            buffer_to_append.append((uint8_t *)"This is content for the scratch File\n", 37);
+
+            for (int i = 0; i < 100; i++)
+            {
+                CHECK(Successful(new_file->Append(buffer_to_append)));
+            }
+
+            CHECK(Successful(new_file->Close()));
+
+            auto file_for_check = root_directory->OpenFile(minstd::fixed_string<>("scratch file.txt"), FileModes::READ);
+
+            CHECK(file_for_check.Successful());
+
+            minstd::stack_buffer<uint8_t, 37 * 128> read_buffer;
+
+            file_for_check->Read(read_buffer);
+
+            CHECK_EQUAL((37 * 100), read_buffer.size());
+
+            for (int i = 0; i < 100; i++)
+            {
+                STRNCMP_EQUAL("This is content for the scratch File\n", (char *)read_buffer.data() + (i * 37), 37);
+            }
+
+            CHECK(Successful(file_for_check->Close()));
+        }
+
+        CHECK(GetOSEntityRegistry().RemoveEntityById(scratch_filesystem.Id()) == OSEntityRegistryResultCodes::SUCCESS);
+
+        //  Unmounting wrote the free cluster count back to FSInfo, it should match the count from the FAT on a fresh mount
+
+        constexpr uint32_t FSINFO_FREE_COUNT_OFFSET = 488;
+
+        uint8_t fsinfo_sector[RamDiskBlockIODevice::BLOCK_SIZE_IN_BYTES];
+
+        CHECK(ram_disk.ReadFromBlock(fsinfo_sector, FAT32_FORMAT_PARTITION_FIRST_SECTOR + 1, 1).Successful());
+
+        uint32_t fsinfo_free_count;
+
+        memcpy(&fsinfo_free_count, fsinfo_sector + FSINFO_FREE_COUNT_OFFSET, sizeof(fsinfo_free_count));
+
+        auto remounted_filesystem = FAT32Filesystem::Mount(false, "ram_disk_fat32", "SCRATCH", false, ram_disk, partitions[0]);
+
+        CHECK(remounted_filesystem.Successful());
+
+        CHECK(fsinfo_free_count < (uint32_t)(*remounted_filesystem)->BlockIOAdapter().MaximumClusterNumber() - 2);
+        CHECK_EQUAL(fsinfo_free_count, (*remounted_filesystem)->BlockIOAdapter().FreeClusterBitmap().FreeClusters());
+    }
+}
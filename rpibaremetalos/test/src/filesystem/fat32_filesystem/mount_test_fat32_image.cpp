@@ -17,13 +17,14 @@
 namespace filesystems::fat32::test
 {
     bool __test_fat32_device_removed = false;
+    TestFAT32ImageMount __test_fat32_mount = TestFAT32ImageMount::DEFAULT;
 
     void TestFAT32DeviceRemoved()
     {
         __test_fat32_device_removed = true;
     }
 
-    void MountTestFAT32Image()
+    void MountTestFAT32Image(TestFAT32ImageMount mount)
     {
         //  Load the empty 32MB FAT32 image
 
@@ -45,11 +46,15 @@ namespace filesystems::fat32::test
 
         //  Create the filesystem
 
-        auto test_fat32 = ::filesystems::fat32::FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0]);
+        uint32_t fat_cache_size_in_sectors = (mount == TestFAT32ImageMount::UNCACHED) ? 0 : DEFAULT_FAT32_FAT_CACHE_SIZE_IN_SECTORS;
+        bool free_cluster_bitmap = (mount == TestFAT32ImageMount::DEFAULT) && DEFAULT_FAT32_FREE_CLUSTER_BITMAP;
+
+        auto test_fat32 = ::filesystems::fat32::FAT32Filesystem::Mount(false, "test_fat32", "TESTFAT32", false, *test_device, partitions[0], DEFAULT_FAT32_DISCARD_FREED_CLUSTERS, fat_cache_size_in_sectors, free_cluster_bitmap);
 
         CHECK(test_fat32.Successful());
 
         __test_fat32_device_removed = false;
+        __test_fat32_mount = mount;
 
         //  Save the device and filesystem as OS Entities
 
@@ -74,6 +79,12 @@ namespace filesystems::fat32::test
     void ResetTestFAT32Image()
     {
         UnmountTestFAT32Image();
-        MountTestFAT32Image();
+        MountTestFAT32Image(__test_fat32_mount);
+    }
+
+    void RemountTestFAT32Image(TestFAT32ImageMount mount)
+    {
+        UnmountTestFAT32Image();
+        MountTestFAT32Image(mount);
     }
 }
\ No newline at end of file
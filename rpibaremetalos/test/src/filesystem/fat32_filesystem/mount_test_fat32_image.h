@@ -10,9 +10,26 @@ namespace filesystems::fat32::test
 {
     void TestFAT32DeviceRemoved();
 
-    void MountTestFAT32Image();
+    //  The test image is normally mounted with the default FAT cache and free cluster bitmap.  Tests which inject device
+    //      errors by counting requests mount it UNCACHED, without either, so each FAT access goes to the device.  NO_BITMAP
+    //      keeps the FAT cache but allocates clusters by scanning the FAT.
+
+    typedef enum class TestFAT32ImageMount
+    {
+        DEFAULT = 0,
+        UNCACHED,
+        NO_BITMAP
+    } TestFAT32ImageMount;
+
+    void MountTestFAT32Image(TestFAT32ImageMount mount = TestFAT32ImageMount::DEFAULT);
 
     void UnmountTestFAT32Image();
 
+    //  Unmounts the test image and mounts it again the same way it was last mounted
+
     void ResetTestFAT32Image();
+
+    //  Unmounts the test image and mounts it again with different options
+
+    void RemountTestFAT32Image(TestFAT32ImageMount mount);
 }
\ No newline at end of file
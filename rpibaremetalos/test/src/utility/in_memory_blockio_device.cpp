@@ -58,6 +58,8 @@ namespace ut_utility
     {
         using Result = ValueResult<BlockIOResultCodes, uint32_t>;
 
+        read_commands_issued_++;
+
         if(simulate_read_error_)
         {
             if(requests_before_read_error_ == 0)
@@ -83,6 +85,8 @@ namespace ut_utility
     {
         using Result = ValueResult<BlockIOResultCodes, uint32_t>;
 
+        write_commands_issued_++;
+
         if(simulate_write_error_)
         {
             if(requests_before_write_error_ == 0)
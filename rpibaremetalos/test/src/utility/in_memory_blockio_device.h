@@ -37,6 +37,26 @@ namespace ut_utility
             requests_before_write_error_ = requests_before_error;
         }
 
+        uint32_t ReadCommandsIssued() const
+        {
+            return read_commands_issued_;
+        }
+
+        uint32_t WriteCommandsIssued() const
+        {
+            return write_commands_issued_;
+        }
+
+        uint32_t DiscardCommandsIssued() const
+        {
+            return discard_commands_issued_;
+        }
+
+        uint32_t BlocksDiscarded() const
+        {
+            return blocks_discarded_;
+        }
+
         BlockIOResultCodes Seek(uint64_t offset_in_blocks) override
         {
             return BlockIOResultCodes::FAILURE;
@@ -48,6 +68,14 @@ namespace ut_utility
 
         ValueResult<BlockIOResultCodes, uint32_t> WriteBlock(uint8_t *buffer, uint32_t block_number, uint32_t blocks_to_write) override;
 
+        BlockIOResultCodes Discard(uint32_t block_number, uint32_t number_of_blocks) override
+        {
+            discard_commands_issued_++;
+            blocks_discarded_ += number_of_blocks;
+
+            return BlockIOResultCodes::SUCCESS;
+        }
+
     private:
         using Block = uint8_t[512];
 
@@ -61,5 +89,11 @@ namespace ut_utility
 
         bool simulate_write_error_ = false;
         uint32_t requests_before_write_error_ = 0;
+
+        uint32_t read_commands_issued_ = 0;
+        uint32_t write_commands_issued_ = 0;
+
+        uint32_t discard_commands_issued_ = 0;
+        uint32_t blocks_discarded_ = 0;
     };
 }
\ No newline at end of file